@@ -75,7 +75,6 @@ Life = require "life"
 Stack = require "stack"
 keymap = require "keymap"
 Progress = require "progress_bar"
-Hcache = require "header_cache"
 Threader = require "threader"
 
 --
@@ -348,6 +347,14 @@ function Config.key_changed (name, old)
     return
   end
 
+  --
+  -- If the cache-limit has changed update our cache.
+  --
+  if name == "cache.limit" then
+    cache:limit(tonumber(Config:get "cache.limit") or 0)
+    return
+  end
+
   --
   -- If the cache-prefix has changed load the cache
   --
@@ -361,6 +368,14 @@ function Config.key_changed (name, old)
     return
   end
 
+  --
+  -- If the selection moves then fetch the messages around it.
+  --
+  if name == "index.current" then
+    prefetch_messages()
+    return
+  end
+
   --
   -- If index.limit changes then we must flush our message cache.
   --
@@ -470,10 +485,6 @@ do
 
   -- Restore to the previous mode
   function previous_mode ()
-    if Config:get("global.mode") == "index" then
-      -- Write the header cache of this maildir to disk
-      Hcache.save()
-    end
     local prev = mode_stack:pop()
     if prev == nil then
       prev = "maildir"
@@ -572,6 +583,13 @@ function Message:to_ctime ()
 end
 
 
+--
+-- The comparison functions we define below, by sort-method, which are
+-- carried out natively unless they have been redefined.
+--
+local stock_compare = {}
+
+
 --
 -- Sort the specified table of message-objects.
 --
@@ -582,6 +600,10 @@ end
 --
 --   Call the function compare_by_$METHOD to do the comparison.
 --
+-- If `compare_by_$METHOD` is one of ours, and hasn't been redefined, the
+-- same sort is carried out natively, via `Global:sort_messages`, which
+-- is much faster.
+--
 -- If there is no `compare_by_foo` method then we return the table
 -- unsorted.
 --
@@ -607,7 +629,20 @@ function sort_messages (input)
   if method == "threads" then
     local t_start = os.time()
     local res = {}
-    res, threads_indentation = Threader.thread(input)
+
+    --
+    -- Thread natively, unless the threads are to be sorted by a
+    -- comparison-function other than our own.
+    --
+    local sort_method = Config:get("threads.sort")
+    local stock = sort_method == nil or
+                  ((sort_method == "date" or sort_method == "file") and
+                   _G["compare_by_" .. sort_method] == stock_compare[sort_method])
+    if stock then
+      res, threads_indentation, Threader.roots = Global:thread_messages(input, sort_method)
+    else
+      res, threads_indentation = Threader.thread(input)
+    end
     local t_end = os.time()
     Panel:append("Sort method $[WHITE|BOLD]" .. method .. "$[WHITE] took $[WHITE|BOLD]" .. (t_end - t_start) .. "$[WHITE] seconds with " .. "$[WHITE|BOLD]" .. #input .. "$[WHITE] messages")
 
@@ -618,6 +653,20 @@ function sort_messages (input)
     --
     local func = "compare_by_" .. method
 
+    --
+    -- Our own methods are sorted natively, extracting a single key
+    -- from each message rather than calling a comparison function.
+    --
+    if stock_compare[method] and _G[func] == stock_compare[method] then
+      local t_start = os.time()
+      local res = Global:sort_messages(input, method)
+      if res then
+        local t_end = os.time()
+        Panel:append("Sort method $[WHITE|BOLD]" .. method .. "$[WHITE] took $[WHITE|BOLD]" .. (t_end - t_start) .. "$[WHITE] seconds with " .. "$[WHITE|BOLD]" .. #input .. "$[WHITE] messages")
+        return res
+      end
+    end
+
     --
     -- Is the desired sort-method defined?
     --
@@ -737,6 +786,12 @@ function compare_by_subject (a, b)
 end
 
 
+stock_compare.date    = compare_by_date
+stock_compare.file    = compare_by_file
+stock_compare.from    = compare_by_from
+stock_compare.subject = compare_by_subject
+
+
 --
 -- Utility method to change the sorting method, and flush our caches
 --
@@ -845,21 +900,6 @@ function get_messages ()
     return global_msgs
   end
 
-  global_msgs = {}
-
-  --
-  -- Otherwise fetch all the current messages.
-  --
-  local msgs = Global:current_messages()
-
-  --
-  -- How many steps do we expect to update for our progress-bar?
-  --
-  local steps = math.floor(#msgs / Screen:width())
-  if steps == 0 then
-    steps = 1
-  end
-
   --
   -- Now apply any limit which should be present.
   --
@@ -868,101 +908,95 @@ function get_messages ()
   --   All      -> All messages.
   --   New      -> All messages which are unread.
   --   Today    -> Show messages arrived today.
-  --  "pattern" -> All messages matching the given pattern.
+  --   Attach   -> Messages with attachments.
+  --  "pattern" -> All messages with a sender, recipient, or subject
+  --               matching the given pattern.
   --
   local limit = Config.get_with_default("index.limit", "all")
 
-  if limit == "all" then
-    --
-    -- "All"
-    --
-    --  This could be simplified to the following:
-    --     global_msgs = msgs
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
+  --
+  -- The limit is applied natively, unless it is a pattern which
+  -- uses features only Lua understands (e.g. "%b()").
+  --
+  global_msgs = Global:limit_messages(limit)
+
+  if not global_msgs then
+    global_msgs = {}
+
+    local msgs = Global:current_messages()
 
-      table.insert(global_msgs, o)
-    end
-  elseif limit == "new" then
     --
-    -- "New"
+    -- How many steps do we expect to update for our progress-bar?
     --
+    local steps = math.floor(#msgs / Screen:width())
+    if steps == 0 then
+      steps = 1
+    end
+
     for i, o in ipairs(msgs) do
       -- Bump our progress-bar
       if math.fmod(i, steps) then
         Progress:show_percent(i, #msgs)
       end
 
-      -- If the message is new add it.
-      if o:is_new() then
+      --
+      -- Match the same headers as the native filter does.
+      --
+      if string.find(o:header("From"), limit) or
+         string.find(o:header("To"), limit) or
+         string.find(o:header("Subject"), limit) then
         table.insert(global_msgs, o)
       end
     end
+  end
 
-  elseif limit == "attach" then
+  --
+  -- Sort the set, and start fetching the bodies of those around the
+  -- selection, if they're remote.
+  --
+  global_msgs = sort_messages(global_msgs)
+  prefetch_messages()
+  return global_msgs
+end
 
-    --
-    -- Messages with attachments.
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
 
-      -- If there are attachments add the message.
-      if Message.count_attachments(o) > 0 then
-        table.insert(global_msgs, o)
-      end
-    end
+--
+-- Fetch the bodies of the IMAP messages around the selected one in the
+-- background, nearest first, so that they may be opened without waiting
+-- for the server.
+--
+-- `imap.prefetch` is the number of messages to fetch either side of the
+-- selection, or -1 to fetch the whole folder.
+--
+function prefetch_messages ()
+  local count = Config.get_with_default("imap.prefetch", 10)
+  if not global_msgs or #global_msgs == 0 or count == 0 then
+    return
+  end
 
-  elseif limit == "today" then
-    --
-    -- "Today"
-    --
-    local time = os.time()
-    local today = time - (60 * 60 * 24)
+  local folder = Global:current_maildir()
+  if not folder or not folder:is_imap() then
+    return
+  end
 
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
+  if count < 0 then
+    count = #global_msgs
+  end
 
-      -- get the creation-date of the message
-      local ctime = o:to_ctime()
+  -- WARNING: index.current is 0 based!
+  local cur = Config.get_with_default("index.current", 0) + 1
 
-      -- if it was within the past 24 hours then add it
-      if ctime > today then
-        table.insert(global_msgs, o)
-      end
+  local msgs = {}
+  for i = 0, count do
+    if global_msgs[cur + i] then
+      table.insert(msgs, global_msgs[cur + i])
     end
-  else
-    --
-    -- "Pattern"
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      local fmt = o:format()
-      if string.find(fmt, limit) then
-        table.insert(global_msgs, o)
-      end
+    if i > 0 and global_msgs[cur - i] then
+      table.insert(msgs, global_msgs[cur - i])
     end
   end
 
-  --
-  -- Sort and return the set
-  --
-  global_msgs = sort_messages(global_msgs)
-  return global_msgs
+  Global:prefetch_messages(msgs)
 end
 
 
@@ -2014,15 +2048,9 @@ function Maildir.select (desired, change_mode_too)
     local path = object:path()
     if string.ends(path, desired) then
 
-      -- Save the header cache of the previous selected maildir if possible.
-      Hcache.save()
-
       -- Select the maildir, to make it current.
       Global:select_maildir(object)
 
-      -- Load the header cache of the new selected maildir.
-      Hcache.load()
-
       -- And update the current selection.
       Config:set("maildir.current", index - 1)
 
@@ -2049,6 +2077,23 @@ end
 
 
 
+--
+-- This function is invoked when the messages in a local maildir change,
+-- because a message arrived, was removed, or was renamed.
+--
+-- If the maildir is the current one we flush our cached message-list,
+-- so the change becomes visible in the index.
+--
+function Maildir.contents_changed (path)
+  local cur = Global:current_maildir()
+
+  if cur and cur:path() == path then
+    global_msgs = nil
+  end
+end
+
+
+
 --
 -- This function saves the MIME part under the cursor to the named path.
 --
@@ -2081,12 +2126,10 @@ function write_mime_part( path )
   --  If we found the part.
   if found then
 
-     -- Open the file for writing
-     local file = assert(io.open(path, "w"))
-
-     -- save the content there
-     file:write(found['object']:content())
-     file:close()
+     -- Write the decoded content there.
+     if not found['object']:save(path) then
+        return false
+     end
 
      return found
   else
@@ -2295,131 +2338,35 @@ end
 -- This function formats a single message for display in index-mode,
 -- it is called by the `index_view()` function defined next.
 --
+-- The work is carried out by `Message:format_line`, which expands
+-- `index.format` natively, and calls `on_clean_name` if present.
+--
 function Message:format (thread_indent, index)
-  local path = self:path()
-  local time = self:mtime()
-
-  --
-  -- Cache key is conditional on the sort-method,
-  -- the index-format, and the path of the message.
-  --
-  -- That means changing any of them will flush the cached value.
-  --
-  local ckey = path .. "message:" .. Config.get_with_default("index.sort", "index.sort") .. Config.get_with_default("index.format", "index.format") .. time
-
-  -- Do we have this cached?  If so return it
-  if cache:get(ckey) then
-    return (cache:get(ckey))
-  end
-
-  if not thread_indent then
-    thread_indent = ""
-  end
 
   --
-  -- Basics from the message
+  -- Messages stored in IMAP are fetched when their headers are first
+  -- read, so we cache the formatted result of those.
   --
-  local flags     = self:flags()
-  local subject   = self:header "Subject"
-  local sender    = self:header "From"
-  local recipient = self:header "To"
-  local date      = self:header "Date"
-  local id        = self:header "Message-ID"
-
-  --
-  -- Try to parse out sender into "email" + "name".
+  -- The key is conditional on the sort-method, the index-format,
+  -- and the path of the message.
   --
-  local email = string.match(sender, "<(.*)>") or sender
-  local name = string.gsub(sender, "<(.*)>", "")
-  if name:len() < 1 then
-    name = sender
-  end
+  local folder = Global:current_maildir()
+  local ckey = nil
 
-  --
-  -- Again for recipient.
-  --
-  local recipient_email = string.match(recipient, "<(.*)>") or recipient
-  local recipient_name = string.gsub(recipient, "<(.*)>", "")
-  if recipient_name:len() < 1 then
-    recipient_name = recipient_name
-  end
+  if folder and folder:is_imap() then
+    ckey = self:path() .. "message:" .. Config.get_with_default("index.sort", "index.sort") .. Config.get_with_default("index.format", "index.format") .. self:mtime()
 
-  --
-  -- Compatibility updates
-  --
-  local sender_email = email
-  local sender_name  = name
-
-  --
-  -- The user might have a filter-function to cleanup
-  -- the name of the sender.
-  --
-  -- (This is mostly to handle transforming a string
-  -- such as "Steve Kemp (via Twitter)" into "Steve Kemp")
-  --
-  if type(on_clean_name) == "function" then
-    name = on_clean_name(name)
-  end
-
-  --
-  -- Get the message-flags - these flags are informational, and
-  -- unrelated to the flags a message might have.
-  --
-  --   A => Message has attachments.
-  --   S => Message is signed.
-  --
-  local m_flags = ""
-  local parts = mimeparts2table(self)
-  local a_count = 0
-  for i, o in ipairs(parts) do
-    if o['type'] == "text/x-gpg-output" then
-      m_flags = m_flags .. "S"
-    end
-    if o['filename'] ~= nil and o['filename'] ~= "" then
-      a_count = a_count + 1
+    if cache:get(ckey) then
+      return (cache:get(ckey))
     end
   end
-  if a_count > 0 then
-    m_flags = "A" .. m_flags
-  end
-
 
-  --
-  -- The format-string we use for display.
-  --
-  local format = Config.get_with_default("index.format", "[${4|flags}] ${2|message_flags} - ${20|sender} - ${indent}${subject}")
-
-  --
-  -- Format this message for display
-  --
-  local output = (string.interp(format, {
-      flags           = flags,
-      message_flags   = m_flags,
-      sender          = sender,
-      sender_name     = sender_name,
-      sender_email    = sender_email,
-      email           = email,           -- depreciated
-      name            = name,            -- depreciated
-      indent          = thread_indent,
-      subject         = subject,
-      number          = index,
-      date            = date,
-      id              = id,
-      recipient       = recipient,
-      recipient_name  = recipient_name,
-      recipient_email = recipient_email,
-    }))
+  local output = self:format_line(thread_indent or "", index)
 
-  --
-  -- If the message is unread then show it in the "unread" colour
-  --
-  if self:is_new() then
-    output = "$[UNREAD]" .. output
+  if ckey then
+    cache:set(ckey, output)
   end
 
-  -- Update the cache.
-  cache:set(ckey, output)
-
   return output
 end
 
@@ -2434,6 +2381,9 @@ end
 -- using IMAP we can instead elect to only format the visible messages
 -- if the setting `index.fast` is enabled.
 --
+-- NOTE: The display normally uses `index_view_count` and `index_view_rows`
+-- instead, which only format the visible messages.
+--
 function index_view ()
   local result = {}
 
@@ -2502,6 +2452,49 @@ function index_view ()
 end
 
 
+--
+-- The number of lines in `index`-mode.
+--
+-- With `index_view_rows` this allows the display to fetch only the
+-- messages which are visible, rather than formatting the whole folder.
+--
+function index_view_count ()
+  local messages = get_messages()
+
+  if messages == nil then
+    return 0
+  end
+  return #messages
+end
+
+
+--
+-- Return the formatted lines for `count` messages, starting with the
+-- zero-based offset `top`.
+--
+function index_view_rows (top, count)
+  local result = {}
+  local messages = get_messages()
+
+  if messages == nil then
+    return result
+  end
+
+  local last = math.min(top + count, #messages)
+
+  for offset = top + 1, last do
+    local object = messages[offset]
+    table.insert(result, object:format(threads_indentation[object], offset))
+  end
+
+  --
+  -- Update the colours
+  --
+  result = add_colours(result, 'index')
+  return result
+end
+
+
 --
 -- This function shows our keybindings, both globally and for each mode.
 --
@@ -3179,9 +3172,6 @@ function select ()
       end
     end
 
-    -- Populate the header cache for this maildir
-    Hcache.load()
-
     --
     -- Change to the index-mode, so we can see the messages in
     -- the folder.
@@ -3404,6 +3394,56 @@ do
 end
 
 
+--
+-- Called by `Global:search` before the search-index of a maildir is
+-- built for the first time, which may take a while for a large maildir.
+--
+function on_search_index (folder, current, total)
+  info_msg("Indexing " .. folder .. " for search (" .. current .. "/" .. total .. ")")
+  Screen:redraw()
+end
+
+
+--
+-- Search the contents of every local maildir, and show the matching
+-- messages in index-mode, newest first.
+--
+-- Each word entered must be present in a message for it to match, and
+-- a word ending in "*" matches any word with that prefix.  The search
+-- is carried out by `Global:search`, via a per-maildir index.
+--
+function search_messages ()
+
+  local query = Screen:get_line "Search:"
+
+  if query == nil or query == "" then
+    return
+  end
+
+  local found = Global:search(query)
+
+  if #found == 0 then
+    warning_msg("No messages found for $[WHITE|BOLD]" .. query)
+    return
+  end
+
+  local msgs = {}
+  for i, path in ipairs(found) do
+    table.insert(msgs, Message.new(path))
+  end
+
+  --
+  -- Replace the cached message-list with our results; this will be
+  -- flushed, as normal, when a maildir is next selected.
+  --
+  global_msgs = msgs
+  Config:set("index.current", 0)
+  change_mode "index"
+
+  info_msg("Found " .. #msgs .. " message(s) matching " .. query)
+end
+
+
 --
 -- Scroll the current mode down - by manipulating the "current" offset
 -- for the current mode.
@@ -3649,7 +3689,7 @@ end
 function mark_all_read ()
   local msgs = get_messages()
   if msgs and #msgs > 0 then
-    Fun.object_map('mark_read', msgs)
+    Global:apply_flags(msgs, "+S")
   else
     warning_msg "There are no messages"
   end
@@ -3661,7 +3701,7 @@ end
 function mark_all_new ()
   local msgs = get_messages()
   if msgs and #msgs > 0 then
-    Fun.object_map('mark_unread', msgs)
+    Global:apply_flags(msgs, "-S")
   else
     warning_msg "There are no messages"
   end
@@ -3673,7 +3713,11 @@ end
 function delete_all ()
   local msgs = get_messages()
   if msgs and #msgs > 0 then
-    Fun.object_map("delete", msgs)
+    Global:delete_messages(msgs)
+
+    -- Flush the cached message-list, and the selection with it.
+    global_msgs = nil
+    Config:set("index.current", 0)
   else
     warning_msg "There are no messages"
   end
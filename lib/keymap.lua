@@ -67,6 +67,11 @@ keymap['global']['KEY_RIGHT'] = "right()"
 keymap['global']['/'] = 'find(1)'
 keymap['global']['?'] = 'find(-1)'
 
+--
+-- Full-text search of every local maildir.
+--
+keymap['maildir']['S'] = 'search_messages()'
+
 --
 -- Show keybindings: first of all global, then for a given key.
 --
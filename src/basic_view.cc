@@ -17,6 +17,8 @@
  */
 
 
+#include <algorithm>
+
 #include "config.h"
 #include "lua.h"
 #include "basic_view.h"
@@ -31,6 +33,10 @@ CBasicView::CBasicView()
     m_name = "";
     m_function = "";
     m_simple = true;
+
+    m_rows_top        = 0;
+    m_rows_max        = 0;
+    m_rows_generation = 0;
 }
 
 
@@ -87,6 +93,19 @@ void CBasicView::draw()
     if (m_name.empty())
         return;
 
+    /*
+     * If the view supports it only fetch the lines which are visible.
+     */
+    if (draw_visible())
+        return;
+
+    /*
+     * We redraw the whole display, so start from a blank screen; the
+     * view-function might draw upon it directly.
+     */
+    CScreen *screen = CScreen::instance();
+    screen->clear(false);
+
     /*
      * Get the text we're supposed to display, by invoking our
      * lua function.
@@ -132,7 +151,6 @@ void CBasicView::draw()
      * line-wrap, and disable highlighting.  If false we
      * do the opposite.
      */
-    CScreen *screen = CScreen::instance();
     screen->draw_text_lines(txt, cur, max, m_simple);
 
     /**
@@ -142,6 +160,105 @@ void CBasicView::draw()
 }
 
 
+/*
+ * Draw the display by fetching only the visible lines.
+ *
+ * This is possible if the view defines two further functions, named
+ * after the main one:
+ *
+ *   $function_count() - Returns the number of lines in the view.
+ *
+ *   $function_rows(top, count) - Returns a table of the `count` lines
+ *                                starting with the zero-based `top`.
+ *
+ * Returns false if those don't exist, or there is nothing to draw, in
+ * which case the view-function should be used instead.
+ */
+bool CBasicView::draw_visible()
+{
+    CLua *lua = CLua::instance();
+    int max = lua->function2integer(m_function + "_count");
+
+    if (max <= 0)
+        return false;
+
+    CConfig *config = CConfig::instance();
+    config->set(m_name + ".max", max);
+
+    /*
+     * Ensure our highlight isn't outside reasonable bounds.
+     */
+    int cur = config->get_integer(m_name + ".current");
+
+    if (cur >= max)
+    {
+        config->set(m_name + ".current", max - 1, false);
+        cur = max - 1;
+    }
+
+    if (cur < 0)
+    {
+        config->set(m_name + ".current", 0, false);
+        cur = 0;
+    }
+
+    /*
+     * Find the lines which will be visible, and fetch just those.
+     */
+    CScreen *screen = CScreen::instance();
+
+    int top   = 0;
+    int count = 0;
+    screen->visible_lines(cur, max, m_simple, top, count);
+
+    if (top + count > max)
+        count = max - top;
+
+    /*
+     * If nothing has changed since we last fetched lines we only need
+     * to fetch those which have scrolled into view.
+     */
+    std::vector<std::string> txt;
+
+    int end        = top + count;
+    int cached_end = m_rows_top + (int)m_rows.size();
+
+    if ((m_rows_generation == screen->generation()) && (m_rows_max == max) &&
+            (top < cached_end) && (end > m_rows_top))
+    {
+        int from = std::max(top, m_rows_top);
+        int to   = std::min(end, cached_end);
+
+        if (top < from)
+            txt = lua->function2rows(m_function + "_rows", top, from - top);
+
+        txt.insert(txt.end(), m_rows.begin() + (from - m_rows_top), m_rows.begin() + (to - m_rows_top));
+
+        if (to < end)
+        {
+            std::vector<std::string> after = lua->function2rows(m_function + "_rows", to, end - to);
+            txt.insert(txt.end(), after.begin(), after.end());
+        }
+    }
+
+    /*
+     * Otherwise, or if the view returned fewer lines than we asked
+     * for, fetch them all.
+     */
+    if ((int)txt.size() != count)
+        txt = lua->function2rows(m_function + "_rows", top, count);
+
+    m_rows            = txt;
+    m_rows_top        = top;
+    m_rows_max        = max;
+    m_rows_generation = screen->generation();
+
+    screen->draw_text_lines(txt, cur, max, m_simple, top);
+
+    return true;
+}
+
+
 /*
  * Called when things are idle.  NOP.
  */
@@ -36,6 +36,11 @@
  *
  *  3.  The `on_idle` function does nothing.
  *
+ * Views with many lines may instead define `$function_count` and
+ * `$function_rows`, in which case only the visible lines are fetched,
+ * and those which were fetched previously are reused until the screen
+ * reports that the text might have changed.
+ *
  * The "simple" vs "complex" drawing just means that in simple-modes
  * we draw the text, and in complex-modes we draw a highlight over
  * the current line.
@@ -88,6 +93,11 @@ private:
      */
     std::vector<std::string> get_text(std::string function);
 
+    /**
+     * Draw only the visible lines, if the view supports that.
+     */
+    bool draw_visible();
+
     /**
      * The name of this mode.  e.g. "lua", "index", etc.
      */
@@ -102,4 +112,13 @@ private:
      * Does this mode use simple-scrolling?
      */
     bool m_simple;
+
+    /**
+     * The lines fetched by `draw_visible`, the offset of the first, the
+     * total number of lines, and the screen-generation at the time.
+     */
+    std::vector<std::string> m_rows;
+    int m_rows_top;
+    int m_rows_max;
+    uint64_t m_rows_generation;
 };
@@ -18,16 +18,191 @@
 
 
 #include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
 #include <fstream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "cache.h"
 
 
+/**
+ * @file cache.cc
+ *
+ * The on-disk format of the cache is:
+ *
+ *   "LMC1"              - Magic, 4 bytes.
+ *   uint32_t            - The number of hash-buckets, a power of two.
+ *   uint64_t            - The number of records in the file.
+ *   uint64_t            - The number of bytes used by current records.
+ *   uint64_t            - The number of bytes used by replaced records.
+ *   int64_t             - The time the file was last compacted.
+ *
+ * Then an array of uint64_t bucket-heads, each of which is the offset of
+ * the newest record in that bucket, or zero.  Then the records, each of
+ * which is:
+ *
+ *   uint64_t            - The offset of the previous record in the bucket.
+ *   uint32_t            - The length of the key.
+ *   uint32_t            - The length of the value.
+ *   int64_t             - The time the entry was created.
+ *   key, value          - The bytes of each.
+ *
+ * A record only ever points at an earlier one, so new records are appended
+ * to the end of the file, and the bucket-head updated in place.
+ *
+ * Values are stored in host byte-order, as the cache is a local file.
+ */
+
+
+/*
+ * The magic-marker at the start of our cache-file.
+ */
+#define CACHE_MAGIC "LMC1"
+
+/*
+ * The sizes of the file-header, and of the fixed part of a record.
+ */
+#define CACHE_HEADER_SIZE 40
+#define CACHE_RECORD_SIZE 24
+
+/*
+ * The minimum number of hash-buckets we create.
+ */
+#define CACHE_MIN_BUCKETS 1024
+
+/*
+ * Entries expire after five days.
+ */
+#define CACHE_MAX_AGE (60 * 60 * 24 * 5)
+
+/*
+ * The size of the fixed part of an entry in the arena.
+ */
+#define ARENA_RECORD_SIZE 16
+
+/*
+ * The states of a slot in our hash-table.
+ */
+#define SLOT_EMPTY   0
+#define SLOT_USED    1
+#define SLOT_REMOVED 2
+
+/*
+ * The minimum size of our hash-table of slots.
+ */
+#define SLOT_MIN_COUNT 64
+
+
+/*
+ * The header of our cache-file.
+ */
+struct cache_header
+{
+    char     magic[4];
+    uint32_t buckets;
+    uint64_t records;
+    uint64_t live;
+    uint64_t dead;
+    int64_t  compacted;
+};
+
+
+/*
+ * The fixed part of a record.
+ */
+struct cache_record
+{
+    uint64_t next;
+    uint32_t key_len;
+    uint32_t value_len;
+    int64_t  created;
+};
+
+
+/*
+ * The fixed part of an entry in the arena, which is followed by the
+ * key and value.
+ */
+struct arena_record
+{
+    int64_t  created;
+    uint32_t key_len;
+    uint32_t value_len;
+};
+
+
+/*
+ * FNV-1a hash of the given key.
+ */
+static uint64_t cache_hash(const char *key, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+/*
+ * Has an entry created at the given time expired?
+ */
+static bool expired(int64_t created)
+{
+    return (created <= (int64_t)(time(NULL) - CACHE_MAX_AGE));
+}
+
+
+/*
+ * Read the header of the given mapping.
+ */
+static cache_header read_header(const char *map)
+{
+    cache_header h;
+    memcpy(&h, map, sizeof(h));
+    return h;
+}
+
+
+/*
+ * Read the entry at the given offset of the arena.
+ */
+static arena_record read_entry(const std::vector<char> &arena, uint64_t offset)
+{
+    arena_record r;
+    memcpy(&r, arena.data() + offset, sizeof(r));
+    return r;
+}
+
+
 /*
  * Constructor.
  */
-CCache::CCache()
+CCache::CCache(size_t limit)
 {
+    m_map       = NULL;
+    m_map_size  = 0;
+    m_map_inode = 0;
+    m_count     = 0;
+    m_removed   = 0;
+    m_live      = 0;
+    m_dead      = 0;
+    m_limit     = limit;
+    m_hand      = 0;
+    m_hits      = 0;
+    m_misses    = 0;
+    m_evictions = 0;
 }
 
 /*
@@ -44,15 +219,395 @@ CCache::~CCache()
  */
 void CCache::empty()
 {
-    for (auto it = m_cache.begin(); it != m_cache.end(); ++it)
+    clear_entries();
+    unmap();
+}
+
+
+/*
+ * Remove all the entries from the arena.
+ */
+void CCache::clear_entries()
+{
+    std::vector<char>().swap(m_arena);
+    std::vector<CacheSlot>().swap(m_slots);
+
+    m_count   = 0;
+    m_removed = 0;
+    m_live    = 0;
+    m_dead    = 0;
+    m_hand    = 0;
+}
+
+
+/*
+ * Find the slot holding the given key, returning -1 if not found.
+ */
+int64_t CCache::find_slot(const std::string &key, uint64_t hash)
+{
+    if (m_slots.empty())
+        return -1;
+
+    /*
+     * The table is never full, so there's always an empty slot to
+     * end our search.
+     */
+    size_t mask = m_slots.size() - 1;
+
+    for (size_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        const CacheSlot &slot = m_slots[i];
+
+        if (slot.state == SLOT_EMPTY)
+            return -1;
+
+        if ((slot.state == SLOT_USED) && (slot.hash == hash))
+        {
+            arena_record r = read_entry(m_arena, slot.offset);
+
+            if ((r.key_len == key.size()) &&
+                    (memcmp(m_arena.data() + slot.offset + ARENA_RECORD_SIZE, key.data(), key.size()) == 0))
+                return i;
+        }
+    }
+}
+
+
+/*
+ * Add, or replace, an entry in the arena.
+ */
+void CCache::insert(const std::string &key, const std::string &value, int64_t created)
+{
+    uint64_t hash = cache_hash(key.data(), key.size());
+    int64_t existing = find_slot(key, hash);
+
+    if (existing >= 0)
+        remove_slot(existing);
+
+    if ((m_count + m_removed + 1) * 4 > m_slots.size() * 3)
+        resize_slots(m_count + 1);
+
+    /*
+     * Append the entry to the arena.
+     */
+    arena_record r;
+    r.created   = created;
+    r.key_len   = key.size();
+    r.value_len = value.size();
+
+    uint64_t offset = m_arena.size();
+    m_arena.insert(m_arena.end(), (const char *)&r, (const char *)&r + sizeof(r));
+    m_arena.insert(m_arena.end(), key.begin(), key.end());
+    m_arena.insert(m_arena.end(), value.begin(), value.end());
+
+    /*
+     * Find a free slot for it.
+     */
+    size_t mask = m_slots.size() - 1;
+    size_t i    = hash & mask;
+
+    while (m_slots[i].state == SLOT_USED)
+        i = (i + 1) & mask;
+
+    if (m_slots[i].state == SLOT_REMOVED)
+        m_removed -= 1;
+
+    m_slots[i].hash       = hash;
+    m_slots[i].offset     = offset;
+    m_slots[i].state      = SLOT_USED;
+    m_slots[i].referenced = true;
+
+    m_count += 1;
+    m_live  += ARENA_RECORD_SIZE + key.size() + value.size();
+
+    evict();
+}
+
+
+/*
+ * Remove the entry in the given slot.
+ */
+void CCache::remove_slot(size_t slot)
+{
+    arena_record r = read_entry(m_arena, m_slots[slot].offset);
+    size_t size = ARENA_RECORD_SIZE + r.key_len + r.value_len;
+
+    m_slots[slot].state = SLOT_REMOVED;
+
+    m_count   -= 1;
+    m_removed += 1;
+    m_live    -= size;
+    m_dead    += size;
+}
+
+
+/*
+ * Evict entries until we're within our limit.
+ *
+ * The CLOCK hand sweeps the slots, giving each entry which has been used
+ * since the last sweep a second chance, and evicting the first which
+ * hasn't.
+ */
+void CCache::evict()
+{
+    if (m_limit != 0)
+    {
+        while ((m_live > m_limit) && (m_count > 0))
+        {
+            size_t i = m_hand;
+            m_hand   = (m_hand + 1) & (m_slots.size() - 1);
+
+            if (m_slots[i].state != SLOT_USED)
+                continue;
+
+            if (m_slots[i].referenced)
+            {
+                m_slots[i].referenced = false;
+                continue;
+            }
+
+            remove_slot(i);
+            m_evictions += 1;
+        }
+    }
+
+    /*
+     * Don't let removed entries waste more space than live ones.
+     */
+    if ((m_dead > m_live) && (m_dead > 64 * 1024))
+        compact_arena();
+}
+
+
+/*
+ * Resize the slot-table, to hold at least the given number of entries.
+ */
+void CCache::resize_slots(size_t entries)
+{
+    size_t size = SLOT_MIN_COUNT;
+
+    while (size < entries * 2)
+        size *= 2;
+
+    std::vector<CacheSlot> slots(size);
+
+    for (CacheSlot &slot : slots)
+        slot.state = SLOT_EMPTY;
+
+    size_t mask = size - 1;
+
+    for (const CacheSlot &slot : m_slots)
+    {
+        if (slot.state != SLOT_USED)
+            continue;
+
+        size_t i = slot.hash & mask;
+
+        while (slots[i].state == SLOT_USED)
+            i = (i + 1) & mask;
+
+        slots[i] = slot;
+    }
+
+    m_slots.swap(slots);
+    m_removed = 0;
+    m_hand    = 0;
+}
+
+
+/*
+ * Copy the live entries into a new arena, dropping the dead ones.
+ */
+void CCache::compact_arena()
+{
+    std::vector<char> arena;
+    arena.reserve(m_live);
+
+    for (CacheSlot &slot : m_slots)
     {
-        CacheEntry *val = it->second;
+        if (slot.state != SLOT_USED)
+            continue;
 
-        if (val != NULL)
-            delete(val);
+        arena_record r = read_entry(m_arena, slot.offset);
+        const char *start = m_arena.data() + slot.offset;
+
+        uint64_t offset = arena.size();
+        arena.insert(arena.end(), start, start + ARENA_RECORD_SIZE + r.key_len + r.value_len);
+        slot.offset = offset;
     }
 
-    m_cache.clear();
+    m_arena.swap(arena);
+    m_dead = 0;
+}
+
+
+/*
+ * Get the number of bytes of entries we'll hold in RAM.
+ */
+size_t CCache::limit()
+{
+    return (m_limit);
+}
+
+
+/*
+ * Set the number of bytes of entries we'll hold in RAM.
+ */
+void CCache::limit(size_t bytes)
+{
+    m_limit = bytes;
+    evict();
+}
+
+
+/*
+ * The number of lookups which found a value.
+ */
+uint64_t CCache::hits()
+{
+    return (m_hits);
+}
+
+
+/*
+ * The number of lookups which didn't find a value.
+ */
+uint64_t CCache::misses()
+{
+    return (m_misses);
+}
+
+
+/*
+ * The number of entries which have been evicted.
+ */
+uint64_t CCache::evictions()
+{
+    return (m_evictions);
+}
+
+
+/*
+ * The number of entries held in RAM.
+ */
+size_t CCache::count()
+{
+    return (m_count);
+}
+
+
+/*
+ * The number of bytes of entries held in RAM.
+ */
+size_t CCache::bytes()
+{
+    return (m_live);
+}
+
+
+/*
+ * Release the mapped cache-file, if any.
+ */
+void CCache::unmap()
+{
+    if (m_map != NULL)
+        munmap((void *)m_map, m_map_size);
+
+    m_map       = NULL;
+    m_map_size  = 0;
+    m_map_inode = 0;
+    m_map_path.clear();
+}
+
+
+/*
+ * Map the given binary cache-file into memory.
+ */
+bool CCache::map_file(std::string path)
+{
+    unmap();
+
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+    char magic[4];
+
+    if ((fstat(fd, &sb) < 0) || (sb.st_size < CACHE_HEADER_SIZE) ||
+            (pread(fd, magic, 4, 0) != 4) || (memcmp(magic, CACHE_MAGIC, 4) != 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    /*
+     * Ensure the bucket-array fits in the file.
+     */
+    cache_header h = read_header((const char *)map);
+
+    if ((h.buckets == 0) || ((h.buckets & (h.buckets - 1)) != 0) ||
+            (CACHE_HEADER_SIZE + (uint64_t)h.buckets * 8 > (uint64_t)sb.st_size))
+    {
+        munmap(map, sb.st_size);
+        return false;
+    }
+
+    m_map       = (const char *)map;
+    m_map_size  = sb.st_size;
+    m_map_inode = sb.st_ino;
+    m_map_path  = path;
+    return true;
+}
+
+
+/*
+ * Find the newest record for the given key in the mapped file.
+ */
+bool CCache::find(const std::string &key, uint64_t *offset)
+{
+    if (m_map == NULL)
+        return false;
+
+    cache_header h = read_header(m_map);
+    uint64_t bucket = cache_hash(key.data(), key.size()) & (h.buckets - 1);
+
+    uint64_t off;
+    memcpy(&off, m_map + CACHE_HEADER_SIZE + bucket * 8, sizeof(off));
+
+    /*
+     * Each record points to an earlier one, so this terminates even
+     * if the file is corrupt.
+     */
+    uint64_t prev = m_map_size;
+
+    while ((off != 0) && (off < prev) && (off + CACHE_RECORD_SIZE <= m_map_size))
+    {
+        cache_record r;
+        memcpy(&r, m_map + off, sizeof(r));
+
+        if (off + CACHE_RECORD_SIZE + r.key_len + r.value_len > m_map_size)
+            return false;
+
+        if ((r.key_len == key.size()) &&
+                (memcmp(m_map + off + CACHE_RECORD_SIZE, key.data(), key.size()) == 0))
+        {
+            *offset = off;
+            return true;
+        }
+
+        prev = off;
+        off  = r.next;
+    }
+
+    return false;
 }
 
 
@@ -67,12 +622,34 @@ std::string CCache::get(std::string key)
     //
     key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
 
-    CacheEntry *e = m_cache[key];
+    int64_t slot = find_slot(key, cache_hash(key.data(), key.size()));
 
-    if (e != NULL)
-        return (e->value);
-    else
-        return "";
+    if (slot >= 0)
+    {
+        m_slots[slot].referenced = true;
+        m_hits += 1;
+
+        uint64_t offset = m_slots[slot].offset;
+        arena_record r  = read_entry(m_arena, offset);
+        return (std::string(m_arena.data() + offset + ARENA_RECORD_SIZE + r.key_len, r.value_len));
+    }
+
+    uint64_t off;
+
+    if (find(key, &off))
+    {
+        cache_record r;
+        memcpy(&r, m_map + off, sizeof(r));
+
+        if (!expired(r.created))
+        {
+            m_hits += 1;
+            return (std::string(m_map + off + CACHE_RECORD_SIZE + r.key_len, r.value_len));
+        }
+    }
+
+    m_misses += 1;
+    return "";
 }
 
 
@@ -81,21 +658,13 @@ std::string CCache::get(std::string key)
  */
 void CCache::set(std::string key, std::string value)
 {
-    CacheEntry *e = m_cache[key];
-
-    if (e != NULL)
-        delete(e);
-
     //
     // Remove spaces from key-names to avoid issues when
     // saving/loading.
     //
     key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
 
-    e = new CacheEntry();
-    e->value   = value;
-    e->created = time(NULL);
-    m_cache[ key ] = e;
+    insert(key, value, time(NULL));
 }
 
 
@@ -109,6 +678,16 @@ void CCache::load(std::string path)
      */
     empty();
 
+    if (!map_file(path))
+        import_text(path);
+}
+
+
+/*
+ * Import a cache-file in the older text-based format.
+ */
+void CCache::import_text(std::string path)
+{
     /*
      * Open the file.
      */
@@ -132,17 +711,12 @@ void CCache::load(std::string path)
                 std::string k_name  = line.substr(ctime + 1, kname - ctime - 1);
                 std::string k_value = line.substr(kname + 1);
 
-                CacheEntry *e = new CacheEntry();
-
                 try
                 {
-                    e->value   = k_value;
-                    e->created = std::stoi(c_time);
-                    m_cache[ k_name ] = e;
+                    insert(k_name, k_value, std::stoi(c_time));
                 }
                 catch (std::invalid_argument& exception)
                 {
-                    delete(e);
                 }
             }
         }
@@ -152,6 +726,26 @@ void CCache::load(std::string path)
 }
 
 
+/*
+ * Does the mapped file need to be compacted?
+ *
+ * We compact when more than half the file is replaced records, when the
+ * hash-chains have grown long, or every few days to drop expired entries.
+ */
+bool CCache::needs_compaction()
+{
+    cache_header h = read_header(m_map);
+
+    if (h.dead > h.live)
+        return true;
+
+    if ((h.records + m_count) > ((uint64_t)h.buckets * 2))
+        return true;
+
+    return (expired(h.compacted));
+}
+
+
 /*
  * Save the map to disk.
  *
@@ -159,30 +753,262 @@ void CCache::load(std::string path)
  */
 void CCache::save(std::string path)
 {
-    std::fstream fs;
-    fs.open(path,  std::fstream::out);
+    bool ok = false;
+
+    if ((m_map != NULL) && (path == m_map_path) && !needs_compaction())
+        ok = append(path);
+
+    if (!ok)
+        ok = rewrite(path);
 
     /*
-     * Get the current time, and work out five days ago.
+     * Now map the updated file, which contains everything we've set.
      */
-    time_t now = time(NULL);
-    now -= (60 * 60 * 24 * 5);
+    if (ok && map_file(path))
+        clear_entries();
+}
+
+
+/*
+ * Append the entries we've set to the mapped file.
+ */
+bool CCache::append(std::string path)
+{
+    if (m_count == 0)
+        return true;
+
+    int fd = open(path.c_str(), O_RDWR);
+
+    if (fd < 0)
+        return false;
 
     /*
-     * Iterate over our cache-map.
+     * If the file has changed since we mapped it we can't append.
      */
-    for (auto it = m_cache.begin(); it != m_cache.end(); ++it)
+    struct stat sb;
+
+    if ((fstat(fd, &sb) < 0) || ((uint64_t)sb.st_ino != m_map_inode) ||
+            ((size_t)sb.st_size != m_map_size))
+    {
+        close(fd);
+        return false;
+    }
+
+    cache_header h = read_header(m_map);
+    std::unordered_map<uint64_t, uint64_t> heads;
+    std::string buf;
+
+    for (const CacheSlot &slot : m_slots)
     {
-        std::string key = it->first;
-        CacheEntry *val = it->second;
+        if (slot.state != SLOT_USED)
+            continue;
+
+        arena_record entry = read_entry(m_arena, slot.offset);
+        const char *data   = m_arena.data() + slot.offset + ARENA_RECORD_SIZE;
+        std::string key(data, entry.key_len);
+
+        if (key.empty() || expired(entry.created))
+            continue;
 
         /*
-         * If the key and value are non-empty AND the cache-key was
-         * set then the past week then persist it.
+         * If we're replacing a record then it is now dead.
          */
-        if (!key.empty() && (val != NULL) && (val->created > now))
-            fs << val->created << " " << key << " " << val->value << std::endl;
+        uint64_t old;
+
+        if (find(key, &old))
+        {
+            cache_record r;
+            memcpy(&r, m_map + old, sizeof(r));
+
+            uint64_t size = CACHE_RECORD_SIZE + r.key_len + r.value_len;
+            h.dead += size;
+            h.live -= std::min(h.live, size);
+        }
+        else
+        {
+            h.records += 1;
+        }
+
+        uint64_t bucket = cache_hash(key.data(), key.size()) & (h.buckets - 1);
+        auto head = heads.find(bucket);
+
+        cache_record r;
+
+        if (head != heads.end())
+            r.next = head->second;
+        else
+            memcpy(&r.next, m_map + CACHE_HEADER_SIZE + bucket * 8, sizeof(r.next));
+
+        r.key_len   = entry.key_len;
+        r.value_len = entry.value_len;
+        r.created   = entry.created;
+
+        heads[bucket] = m_map_size + buf.size();
+        h.live += CACHE_RECORD_SIZE + entry.key_len + entry.value_len;
+
+        buf.append((const char *)&r, sizeof(r));
+        buf.append(data, entry.key_len + entry.value_len);
     }
 
-    fs.close();
+    /*
+     * Write the records, then the bucket-heads which point to them,
+     * and finally the header.
+     */
+    bool ok = (pwrite(fd, buf.data(), buf.size(), m_map_size) == (ssize_t)buf.size());
+
+    for (auto it = heads.begin(); ok && (it != heads.end()); ++it)
+        ok = (pwrite(fd, &it->second, sizeof(uint64_t), CACHE_HEADER_SIZE + it->first * 8) == sizeof(uint64_t));
+
+    if (ok)
+        ok = (pwrite(fd, &h, sizeof(h), 0) == sizeof(h));
+
+    ok = (close(fd) == 0) && ok;
+    return ok;
+}
+
+
+/*
+ * Write a new cache-file, containing all current entries.
+ */
+bool CCache::rewrite(std::string path)
+{
+    uint64_t count = m_count;
+
+    if (m_map != NULL)
+        count += read_header(m_map).records;
+
+    /*
+     * An empty cache is saved as an empty file.
+     */
+    if (count == 0)
+    {
+        std::fstream fs;
+        fs.open(path,  std::fstream::out);
+        fs.close();
+        return true;
+    }
+
+    cache_header h;
+    memcpy(h.magic, CACHE_MAGIC, 4);
+    h.buckets   = CACHE_MIN_BUCKETS;
+    h.records   = 0;
+    h.live      = 0;
+    h.dead      = 0;
+    h.compacted = time(NULL);
+
+    while (h.buckets < count)
+        h.buckets *= 2;
+
+    std::vector<uint64_t> heads(h.buckets, 0);
+
+    /*
+     * Write to a temporary file, then rename into place, so that a
+     * concurrent reader never sees a partial cache.
+     */
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+
+    if (f == NULL)
+        return false;
+
+    bool ok = (fwrite(&h, sizeof(h), 1, f) == 1) &&
+              (fwrite(heads.data(), sizeof(uint64_t), heads.size(), f) == heads.size());
+
+    uint64_t offset = CACHE_HEADER_SIZE + (uint64_t)h.buckets * 8;
+
+    auto write_record = [&](const char *key, uint32_t key_len,
+                            const char *value, uint32_t value_len, int64_t created)
+    {
+        uint64_t bucket = cache_hash(key, key_len) & (h.buckets - 1);
+
+        cache_record r;
+        r.next      = heads[bucket];
+        r.key_len   = key_len;
+        r.value_len = value_len;
+        r.created   = created;
+
+        ok = ok && (fwrite(&r, sizeof(r), 1, f) == 1) &&
+             (fwrite(key, 1, key_len, f) == key_len) &&
+             (fwrite(value, 1, value_len, f) == value_len);
+
+        uint64_t size = CACHE_RECORD_SIZE + key_len + value_len;
+        heads[bucket] = offset;
+        offset       += size;
+        h.live       += size;
+        h.records    += 1;
+    };
+
+    /*
+     * The entries we've set since the file was mapped.
+     */
+    for (const CacheSlot &slot : m_slots)
+    {
+        if (!ok)
+            break;
+
+        if (slot.state != SLOT_USED)
+            continue;
+
+        arena_record entry = read_entry(m_arena, slot.offset);
+        const char *key    = m_arena.data() + slot.offset + ARENA_RECORD_SIZE;
+
+        if ((entry.key_len == 0) || expired(entry.created))
+            continue;
+
+        write_record(key, entry.key_len, key + entry.key_len, entry.value_len, entry.created);
+    }
+
+    /*
+     * Then the current entries from the mapped file, which are copied
+     * straight from the mapping.  The newest record for each key comes
+     * first in its bucket.
+     */
+    if (m_map != NULL)
+    {
+        cache_header old = read_header(m_map);
+
+        for (uint64_t b = 0; ok && (b < old.buckets); b++)
+        {
+            std::unordered_set<std::string> seen;
+            uint64_t prev = m_map_size;
+            uint64_t off;
+            memcpy(&off, m_map + CACHE_HEADER_SIZE + b * 8, sizeof(off));
+
+            while ((off != 0) && (off < prev) && (off + CACHE_RECORD_SIZE <= m_map_size))
+            {
+                cache_record r;
+                memcpy(&r, m_map + off, sizeof(r));
+
+                if (off + CACHE_RECORD_SIZE + r.key_len + r.value_len > m_map_size)
+                    break;
+
+                const char *key = m_map + off + CACHE_RECORD_SIZE;
+                std::string k(key, r.key_len);
+
+                if (seen.insert(k).second && !expired(r.created) &&
+                        (find_slot(k, cache_hash(key, r.key_len)) < 0))
+                    write_record(key, r.key_len, key + r.key_len, r.value_len, r.created);
+
+                prev = off;
+                off  = r.next;
+            }
+        }
+    }
+
+    /*
+     * Now we know where the records are, rewrite the header and the
+     * bucket-array.
+     */
+    ok = ok && (fseek(f, 0, SEEK_SET) == 0) &&
+         (fwrite(&h, sizeof(h), 1, f) == 1) &&
+         (fwrite(heads.data(), sizeof(uint64_t), heads.size(), f) == heads.size());
+
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok)
+        ok = (rename(tmp.c_str(), path.c_str()) == 0);
+    else
+        unlink(tmp.c_str());
+
+    return ok;
 }
@@ -20,26 +20,29 @@
 #pragma once
 
 
+#include <stdint.h>
 #include <string>
-#include <unordered_map>
+#include <time.h>
+#include <vector>
 
 
 /**
- * A cached entry.
  *
- * This structure contains a cache-value, along with the time that
- * it was inserted into the cache.
- */
-class CacheEntry
-{
-public:
-    std::string value;
-    time_t      created;
-};
-
-/**
+ * A simple cache, which may be persisted to disk.
+ *
+ * The on-disk form is a hash-table of records which is mapped into memory
+ * by `load`, so there is nothing to parse at startup.  Values set since
+ * then are held in RAM, and `save` appends them to the file rather than
+ * rewriting it.  Once enough of the file is made up of replaced records
+ * it is compacted.
  *
- * A simple in-RAM cache.
+ * Files in the older text-based format are imported by `load`, and are
+ * replaced by the binary format when next saved.
+ *
+ * The entries held in RAM live in a single contiguous arena, found via an
+ * open-addressed table of slots.  If a limit is set, via `limit`, then
+ * entries are evicted with the CLOCK algorithm to keep the arena within
+ * that many bytes.
  *
  */
 class CCache
@@ -48,9 +51,10 @@ class CCache
 public:
 
     /**
-     * Constructor
+     * Constructor.  If `limit` is non-zero it is the number of bytes
+     * of entries we'll hold in RAM.
      */
-    CCache();
+    CCache(size_t limit = 0);
 
     /**
      * Destructor
@@ -85,11 +89,183 @@ public:
      */
     void set(std::string key, std::string value);
 
+    /**
+     * Get the number of bytes of entries we'll hold in RAM, zero meaning
+     * there is no limit.
+     */
+    size_t limit();
+
+    /**
+     * Set the number of bytes of entries we'll hold in RAM, evicting
+     * entries if required.
+     */
+    void limit(size_t bytes);
+
+    /**
+     * The number of lookups which found a value.
+     */
+    uint64_t hits();
+
+    /**
+     * The number of lookups which didn't find a value.
+     */
+    uint64_t misses();
+
+    /**
+     * The number of entries which have been evicted.
+     */
+    uint64_t evictions();
+
+    /**
+     * The number of entries held in RAM.
+     */
+    size_t count();
+
+    /**
+     * The number of bytes of entries held in RAM.
+     */
+    size_t bytes();
+
 private:
 
     /**
-     * The actual map which stores our cached data.
+     * A slot in our hash-table, which refers to an entry in the arena.
+     */
+    struct CacheSlot
+    {
+        uint64_t hash;
+        uint64_t offset;
+        uint8_t  state;
+        bool     referenced;
+    };
+
+    /**
+     * Find the slot holding the given key, returning -1 if not found.
+     */
+    int64_t find_slot(const std::string &key, uint64_t hash);
+
+    /**
+     * Add, or replace, an entry in the arena.
+     */
+    void insert(const std::string &key, const std::string &value, int64_t created);
+
+    /**
+     * Remove the entry in the given slot.
+     */
+    void remove_slot(size_t slot);
+
+    /**
+     * Evict entries until we're within our limit.
+     */
+    void evict();
+
+    /**
+     * Resize the slot-table, to hold at least the given number of entries.
+     */
+    void resize_slots(size_t entries);
+
+    /**
+     * Copy the live entries into a new arena, dropping the dead ones.
+     */
+    void compact_arena();
+
+    /**
+     * Remove all the entries from the arena.
+     */
+    void clear_entries();
+
+    /**
+     * Map the given binary cache-file into memory.
+     */
+    bool map_file(std::string path);
+
+    /**
+     * Release the mapped cache-file, if any.
+     */
+    void unmap();
+
+    /**
+     * Import a cache-file in the older text-based format.
+     */
+    void import_text(std::string path);
+
+    /**
+     * Find the newest record for the given key in the mapped file.
+     *
+     * On success the offset of the record is stored in `offset`.
+     */
+    bool find(const std::string &key, uint64_t *offset);
+
+    /**
+     * Does the mapped file need to be compacted?
+     */
+    bool needs_compaction();
+
+    /**
+     * Append the entries we've set to the mapped file.
+     */
+    bool append(std::string path);
+
+    /**
+     * Write a new cache-file, containing all current entries.
+     */
+    bool rewrite(std::string path);
+
+private:
+
+    /**
+     * The entries which have been set since the file was mapped.
+     */
+    std::vector<char> m_arena;
+
+    /**
+     * The hash-table of slots which refer to our entries.
+     */
+    std::vector<CacheSlot> m_slots;
+
+    /**
+     * The number of live entries, and the slots which were freed.
+     */
+    size_t m_count;
+    size_t m_removed;
+
+    /**
+     * The bytes in the arena used by live, and by removed, entries.
+     */
+    size_t m_live;
+    size_t m_dead;
+
+    /**
+     * The number of bytes of entries we'll hold, or zero.
+     */
+    size_t m_limit;
+
+    /**
+     * The position of the CLOCK hand, within `m_slots`.
+     */
+    size_t m_hand;
+
+    /**
+     * Statistics.
+     */
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_evictions;
+
+    /**
+     * The mapped cache-file, if any.
+     */
+    const char *m_map;
+
+    /**
+     * The size of the mapping.
+     */
+    size_t m_map_size;
+
+    /**
+     * The path, and inode, of the mapped file.
      */
-    std::unordered_map <std::string, CacheEntry * >m_cache;
+    std::string m_map_path;
+    uint64_t m_map_inode;
 
 };
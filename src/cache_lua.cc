@@ -32,6 +32,10 @@
  *   local c = Cache.new( "/path/to/cache" ) <br/>
  *   c:set( "foo", "bar") <br/>
  *   print( c:get( "foo" ) ) <br/>
+ * <br/>
+ *   -- Create a cache which holds at most 1Mb of values. <br/>
+ *   local l = Cache.new( 1024 * 1024 ) <br/>
+ *   print( l:stats()["evictions"] ) <br/>
  *</code>
  *
  */
@@ -107,7 +111,13 @@ std::shared_ptr<CCache> l_CheckCCache(lua_State * l, int n)
 int l_CCache_constructor(lua_State * l)
 {
     CLuaLog("l_CCache_constructor");
-    push_ccache(l, std::shared_ptr<CCache>(new CCache()));
+
+    size_t limit = 0;
+
+    if (lua_isnumber(l, 1))
+        limit = lua_tointeger(l, 1);
+
+    push_ccache(l, std::shared_ptr<CCache>(new CCache(limit)));
     return 1;
 }
 
@@ -153,6 +163,23 @@ int l_CCache_get(lua_State * l)
 }
 
 
+/**
+ * Implementation of Cache:limit()
+ */
+int l_CCache_limit(lua_State * l)
+{
+    CLuaLog("l_CCache_limit");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+
+    if (lua_isnumber(l, 2))
+        foo->limit(lua_tointeger(l, 2));
+
+    lua_pushinteger(l, foo->limit());
+    return 1;
+}
+
+
 /**
  * Implementation of Cache:load()
  */
@@ -199,6 +226,39 @@ int l_CCache_set(lua_State * l)
 }
 
 
+/**
+ * Implementation of Cache:stats()
+ */
+int l_CCache_stats(lua_State * l)
+{
+    CLuaLog("l_CCache_stats");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+
+    lua_newtable(l);
+
+    lua_pushinteger(l, foo->hits());
+    lua_setfield(l, -2, "hits");
+
+    lua_pushinteger(l, foo->misses());
+    lua_setfield(l, -2, "misses");
+
+    lua_pushinteger(l, foo->evictions());
+    lua_setfield(l, -2, "evictions");
+
+    lua_pushinteger(l, foo->count());
+    lua_setfield(l, -2, "entries");
+
+    lua_pushinteger(l, foo->bytes());
+    lua_setfield(l, -2, "bytes");
+
+    lua_pushinteger(l, foo->limit());
+    lua_setfield(l, -2, "limit");
+
+    return 1;
+}
+
+
 /**
  * Destructor
  */
@@ -234,10 +294,12 @@ void InitCache(lua_State * l)
     {
         {"empty", l_CCache_empty},
         {"get", l_CCache_get},
+        {"limit", l_CCache_limit},
         {"load", l_CCache_load},
         {"new", l_CCache_constructor},
         {"save", l_CCache_save},
         {"set", l_CCache_set},
+        {"stats", l_CCache_stats},
         {"__gc", l_CCache_destructor},
         {NULL, NULL}
     };
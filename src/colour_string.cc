@@ -17,276 +17,245 @@
  */
 
 
-#include <algorithm>
-#include <assert.h>
 #include <malloc.h>
-#include <pcrecpp.h>
+#include <string.h>
+#include <wchar.h>
 
 #include "colour_string.h"
 #include "util.h"
 
 
 /*
- * Parse a string into an array of "string + colour" pairs,
- * which will be useful for drawing strings.
- *
- * The output of this routine will be an array of COLOUR_STRING
- * objects - each object will contain a colour and ONE CHARACTER
- * of text to draw.
+ * Is the given character valid within the name of a colour?
+ */
+static bool is_colour_char(char c)
+{
+    return (((c >= 'a') && (c <= 'z')) ||
+            ((c >= 'A') && (c <= 'Z')) ||
+            (c == '#') || (c == '|'));
+}
+
+
+/*
+ * The number of columns occupied by the given character, of `len` bytes.
  *
- * This needs re-emphasising:  The entries will contain one character
- * which may be displayed, even if that character might be made from
- * multiple *BYTES*.
+ * This depends upon the locale, and if we can't tell we assume one.
  */
-std::vector<COLOUR_STRING *> CColourString::parse_coloured_string(std::string input, int offset, int tab_width)
+static int character_width(const char *chr, size_t len)
 {
-    /**
-     * Vector we use while building.
-     */
-    std::vector<COLOUR_STRING *> temp;
+    if ((len == 1) && ((unsigned char)chr[0] < 0x80))
+        return 1;
 
-    /**
-     * Returned to the caller.
-     */
-    std::vector<COLOUR_STRING *> results;
+    wchar_t wc;
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
 
-    /*
-     * I know this is horrid.
-     *
-     * NOTE: We're trying to be greedy but searching from the
-     * back of the string forward.  This is definitely the simpler
-     * of the approaches I trialled.
-     */
-    pcrecpp::RE re("^(.*)\\$\\[([#a-zA-Z|]+)\\](.*)$");
+    size_t res = mbrtowc(&wc, chr, len, &state);
 
-    std::string pre;
-    std::string col;
-    std::string txt;
+    if ((res == (size_t) - 1) || (res == (size_t) - 2))
+        return 1;
 
-    while (re.FullMatch(input, &pre, &col, &txt))
-    {
-        /*
-         * Allocate a structure to hold this match.
-         */
-        COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
+    int width = wcwidth(wc);
+
+    return ((width < 0) ? 1 : width);
+}
 
-        /*
-         * Save our match away.
-         */
-        tmp->colour = new std::string(col);
-        tmp->string = new std::string(txt);
-        temp.push_back(tmp);
 
-        input = pre;
+/*
+ * Append a single character, of `len` bytes, to the spans we're building,
+ * starting a new span if the colour has changed.
+ *
+ * While `skip` is positive characters are discarded instead.
+ */
+static void append_character(std::vector<CColourSpan> &spans, size_t &used, const std::string &colour, const char *chr, size_t len, int &skip)
+{
+    if (skip > 0)
+    {
+        skip -= 1;
+        return;
     }
 
-    /*
-     * If input is non-empty then we have leading match.  Handle that
-     * as a special case.
-     */
-    if (! input.empty())
+    if ((used == 0) || (spans[used - 1].colour != colour))
     {
         /*
-         * Allocate a structure to hold this match.
+         * Reuse the storage of a previous span, if we can.
          */
-        COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-        tmp->colour = new std::string("white");
-        tmp->string = new std::string(input);
-        temp.push_back(tmp);
+        if (used == spans.size())
+            spans.push_back(CColourSpan());
+
+        spans[used].colour = colour;
+        spans[used].text.clear();
+        spans[used].width = 0;
+        used += 1;
     }
 
-    /*
-     * Remember we searched backwards?  Reverse so all makes sense.
-     */
-    std::reverse(temp.begin(), temp.end());
+    spans[used - 1].text.append(chr, len);
+    spans[used - 1].width += character_width(chr, len);
+}
 
 
-    /**
-     * At this point we're half done.
-     *
-     * We've turned this input:
-     *
-     *   $[RED]This is red $[BLUE]This is blue
-     *
-     * Into this intermediary step:
-     *
-     *  [colour:RED, text:"This is red "],
-     *  [colour:BLUE, text:"This is blue"],
-     *
-     * We now need to turn that middle-step into:
-     *
-     *  [colour:RED, text:T]
-     *  [colour:RED, text:h]
-     *  [colour:RED, text:i]
-     *  [colour:RED, text:s]
-     *  [colour:RED, text: ]
-     *  [colour:RED, text:i]
-     *  [colour:RED, text:s]
-     *  [colour:RED, text: ]
-     *  [colour:RED, text:r]
-     *  [colour:RED, text:e]
-     *  [colour:RED, text:d]
-     *  [colour:RED, text: ]
-     *  [colour:BLUE, text:T]
-     *  [colour:BLUE, text:h]
-     *  [colour:BLUE, text:i]
-     *  ..
-     *
-     * We do this because it is significantly more efficient to handle
-     * scrolling when we have a set of characters, since we just remove
-     * the ones to the left of the scroll-index.
-     */
+/*
+ * Parse a string into runs of text which share a colour.
+ *
+ * Colours are specified via `$[COLOUR]`, and persist until the next
+ * colour.  `$[#COLOUR]` is an escaped form, which is drawn literally as
+ * `$[COLOUR]` in the current colour.
+ */
+void CColourString::parse_spans(const std::string &input, int offset, int tab_width, std::vector<CColourSpan> &spans)
+{
+    size_t used = 0;
+    int skip    = offset;
 
+    std::string colour = "white";
 
-    /*
-     * Starting/Previous colour.
-     */
-    std::string prev_colour = "white";
+    size_t len = input.size();
+    size_t i   = 0;
 
-    /*
-     * Iterate over the entries.
-     */
-    for (std::vector<COLOUR_STRING *>::iterator it = temp.begin(); it != temp.end() ; ++it)
+    while (i < len)
     {
-        std::string *colour = (*it)->colour;
-        std::string *text   = (*it)->string;
+        const char byte = input[i];
 
-        /**
-         * Expand "$[#RED]", appropriately.
+        /*
+         * Is this the start of a colour?
          */
-        if ((colour->size() > 0) && (colour->at(0) == '#'))
+        if ((byte == '$') && (i + 1 < len) && (input[i + 1] == '['))
         {
-            /* Rewrite the text - i.e escape the whole damn thing. */
-            *text = "$[" + colour->substr(1) + "]" + *text;
+            size_t end = i + 2;
 
-            /* avoid using the selected colour */
-            delete(colour);
+            while ((end < len) && is_colour_char(input[end]))
+                end++;
+
+            if ((end > i + 2) && (end < len) && (input[end] == ']'))
+            {
+                std::string name = input.substr(i + 2, end - i - 2);
 
-            (*it)->colour = new std::string(prev_colour);
-            colour        = (*it)->colour;
+                if (name[0] == '#')
+                {
+                    std::string escaped = "$[" + name.substr(1) + "]";
+
+                    for (size_t j = 0; j < escaped.size(); j++)
+                        append_character(spans, used, colour, &escaped[j], 1, skip);
+                }
+                else
+                {
+                    colour = name;
+                }
+
+                i = end + 1;
+                continue;
+            }
         }
-        else
+
+        /*
+         * TAB is a special-case, and is replaced by `tab_width` spaces.
+         */
+        if (byte == '\t')
         {
-            /*
-             * Record the previous colour, to handle the case of a future
-             * string not updating itself because it is escaped.
-             */
-            prev_colour = *colour;
-        }
+            for (int j = 0; j < tab_width; j++)
+                append_character(spans, used, colour, " ", 1, skip);
 
+            i += 1;
+            continue;
+        }
 
         /*
-         * Copy the colour, and the one-character string.
+         * Lookup the size of the UTF-character, in bytes.  If the UTF-8
+         * is invalid we're gonna have to fake it.
          */
-        int max = (int)text->length();
+        size_t size = dsutil_utf8_charlen(byte);
 
-        for (int i = 0; i < max; i++)
+        if (size == 0)
         {
-            /*
-             * The "single character" we'll draw, which might
-             * actually be comprised of multiple bytes.
-             */
-            std::string chr;
-
-            /*
-             * Get the single byte at the position.
-             * We'll test this to see if it is a multi-byte chacter
-             * and if it is we'll bump it up.
-             */
-            const char byte = text->at(i);
-
-            /*
-             * TAB is a special-case.
-             */
-            if (byte == '\t')
-            {
-                /*
-                 * Width of a TAB is 8 characters by default, but
-                 * the user might have changed it.
-                 *
-                 * NOTE: We could improve things here by counting
-                 * the width of our parts, and using that to snap
-                 * to boundaries - for the moment we're just replacing
-                 * the TAB => "    ".
-                 *
-                 * TODO: Improve this :)
-                 *
-                 */
-                for (int j = 0; j < tab_width ; j++)
-                {
-                    COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-                    tmp->colour = new std::string(*colour);
-                    tmp->string = new std::string(" ");
-                    results.push_back(tmp);
-                }
+            append_character(spans, used, colour, "?", 1, skip);
+            i += 1;
+            continue;
+        }
 
-                continue;
+        if (i + size > len)
+            size = len - i;
 
-            }
+        append_character(spans, used, colour, input.data() + i, size, skip);
+        i += size;
+    }
 
-            /*
-             * Lookup the size of the UTF-character, in bytes.
-             */
-            int size = dsutil_utf8_charlen(byte);
+    spans.resize(used);
+}
 
-            /*
-             * If that failed because the UTF-8 is invalid we're
-             * gonna have to fake it.
-             */
-            if (size == 0)
-            {
-                chr = "?";
-            }
-            else
-            {
-                /*
-                 * Otherwise add each byte
-                 */
-                for (int j = 0; j < size; j++)
-                {
-                    if (i + j < max)
-                        chr += text->at(i + j);
-                }
 
-                /*
-                 * Bump past the bytes we've added
-                 */
-                i += (size - 1);
-            }
+/*
+ * Return the number of bytes at the start of the given text which fit
+ * within the given number of columns.
+ */
+size_t CColourString::fit(const std::string &text, int columns, int &width)
+{
+    size_t i = 0;
+    width    = 0;
 
-            COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-            tmp->colour = new std::string(*colour);
-            tmp->string = new std::string(chr);
-            results.push_back(tmp);
+    while (i < text.size())
+    {
+        size_t size = dsutil_utf8_charlen(text[i]);
 
-        }
-    }
+        if ((size == 0) || (i + size > text.size()))
+            size = text.size() - i;
 
+        int w = character_width(text.data() + i, size);
 
-    /*
-     * Free the array we built in the middle.
-     */
-    for (std::vector<COLOUR_STRING *>::iterator it = temp.begin(); it != temp.end() ; ++it)
-    {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
+        if (width + w > columns)
+            break;
+
+        width += w;
+        i     += size;
     }
 
+    return (i);
+}
+
 
+/*
+ * Parse a string into an array of "string + colour" pairs,
+ * which will be useful for drawing strings.
+ *
+ * The output of this routine will be an array of COLOUR_STRING
+ * objects - each object will contain a colour and ONE CHARACTER
+ * of text to draw.
+ *
+ * This needs re-emphasising:  The entries will contain one character
+ * which may be displayed, even if that character might be made from
+ * multiple *BYTES*.
+ */
+std::vector<COLOUR_STRING *> CColourString::parse_coloured_string(std::string input, int offset, int tab_width)
+{
+    /**
+     * Returned to the caller.
+     */
+    std::vector<COLOUR_STRING *> results;
 
     /*
-     * Now remove the parts that we should skip because we have
-     * scrolling in effect.
+     * Parse the input into runs of a single colour, then split each
+     * of those into characters.
      */
-    for (int i = 0; i < offset && ((int)results.size() >= 1); i++)
+    std::vector<CColourSpan> spans;
+    parse_spans(input, offset, tab_width, spans);
+
+    for (auto it = spans.begin(); it != spans.end(); ++it)
     {
-        COLOUR_STRING *x = results.at(0);
-        delete(x->string);
-        delete(x->colour);
-        free(x);
-        results.erase(results.begin(), results.begin() + 1);
+        const std::string &text = (*it).text;
+        size_t i = 0;
+
+        while (i < text.size())
+        {
+            size_t size = dsutil_utf8_charlen(text[i]);
+
+            if ((size == 0) || (i + size > text.size()))
+                size = text.size() - i;
+
+            COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
+            tmp->colour = new std::string((*it).colour);
+            tmp->string = new std::string(text.substr(i, size));
+            results.push_back(tmp);
+
+            i += size;
+        }
     }
 
     /*
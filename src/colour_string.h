@@ -63,6 +63,33 @@ typedef struct _COLOUR_STRING
 
 
 
+/**
+ * A run of text which is drawn in a single colour.
+ *
+ * This is the output of `CColourString::parse_spans`, which is used by
+ * `draw_text_lines` rather than splitting lines into single characters.
+ */
+struct CColourSpan
+{
+    /**
+     * The colour to use for this span.
+     */
+    std::string colour;
+
+    /**
+     * The text to draw for this span, with any TABs expanded.
+     */
+    std::string text;
+
+    /**
+     * The number of columns the text occupies, which might differ from
+     * the number of bytes, or characters.
+     */
+    int width;
+};
+
+
+
 class CColourString
 {
 public:
@@ -81,5 +108,24 @@ public:
      */
     static std::vector<COLOUR_STRING *> parse_coloured_string(std::string input, int offset, int tab_width);
 
+    /**
+     * Parse a string into runs of text which share a colour, in a single
+     * pass over the input.
+     *
+     * The first `offset` characters are skipped, to allow horizontal
+     * scrolling.
+     *
+     * `spans` is overwritten, rather than being appended to, so that a
+     * caller which draws many lines may reuse the storage it holds.
+     */
+    static void parse_spans(const std::string &input, int offset, int tab_width, std::vector<CColourSpan> &spans);
+
+    /**
+     * Return the number of bytes at the start of the given text which
+     * fit within the given number of columns, and set `width` to the
+     * number of columns which they occupy.
+     */
+    static size_t fit(const std::string &text, int columns, int &width);
+
 
 };
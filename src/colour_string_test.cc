@@ -193,6 +193,74 @@ void TestTabWidth(CuTest * tc)
     }
 }
 
+/**
+ * Test that colours are parsed into runs.
+ */
+void TestColourSpans(CuTest * tc)
+{
+    std::vector<CColourSpan> spans;
+
+    /*
+     * Text before the first colour is white, and colours persist.
+     */
+    CColourString::parse_spans("Lead $[RED]red$[BLUE]$[YELLOW]yellow", 0, 8, spans);
+    CuAssertIntEquals(tc, 3, spans.size());
+    CuAssertStrEquals(tc, "white", spans[0].colour.c_str());
+    CuAssertStrEquals(tc, "Lead ", spans[0].text.c_str());
+    CuAssertIntEquals(tc, 5, spans[0].width);
+    CuAssertStrEquals(tc, "RED", spans[1].colour.c_str());
+    CuAssertStrEquals(tc, "red", spans[1].text.c_str());
+    CuAssertStrEquals(tc, "YELLOW", spans[2].colour.c_str());
+    CuAssertStrEquals(tc, "yellow", spans[2].text.c_str());
+
+    /*
+     * Escaped colours are drawn literally, in the current colour, as
+     * are things which merely look like colours.
+     */
+    CColourString::parse_spans("$[RED]a$[#BLUE]b $[x y] $[]", 0, 8, spans);
+    CuAssertIntEquals(tc, 1, spans.size());
+    CuAssertStrEquals(tc, "RED", spans[0].colour.c_str());
+    CuAssertStrEquals(tc, "a$[BLUE]b $[x y] $[]", spans[0].text.c_str());
+
+    /*
+     * Scrolling skips characters, rather than bytes, and TABs are
+     * expanded first.
+     */
+    CColourString::parse_spans("\t$[GREEN]\xc3\xa9t\xc3\xa9", 9, 2, spans);
+    CuAssertIntEquals(tc, 0, spans.size());
+
+    CColourString::parse_spans("\t$[GREEN]\xc3\xa9t\xc3\xa9", 3, 2, spans);
+    CuAssertIntEquals(tc, 1, spans.size());
+    CuAssertStrEquals(tc, "t\xc3\xa9", spans[0].text.c_str());
+    CuAssertIntEquals(tc, 2, spans[0].width);
+
+    /*
+     * Invalid UTF-8 is replaced.
+     */
+    CColourString::parse_spans("a\x80" "b", 0, 8, spans);
+    CuAssertIntEquals(tc, 1, spans.size());
+    CuAssertStrEquals(tc, "a?b", spans[0].text.c_str());
+}
+
+
+/**
+ * Test fitting text into a number of columns.
+ */
+void TestColourFit(CuTest * tc)
+{
+    int width = 0;
+
+    CuAssertIntEquals(tc, 3, CColourString::fit("Steve", 3, width));
+    CuAssertIntEquals(tc, 3, width);
+
+    CuAssertIntEquals(tc, 5, CColourString::fit("Steve", 10, width));
+    CuAssertIntEquals(tc, 5, width);
+
+    CuAssertIntEquals(tc, 0, CColourString::fit("Steve", 0, width));
+    CuAssertIntEquals(tc, 0, width);
+}
+
+
 CuSuite *
 coloured_string_getsuite()
 {
@@ -203,5 +271,7 @@ coloured_string_getsuite()
     SUITE_ADD_TEST(suite, TestStringPartLength);
     SUITE_ADD_TEST(suite, TestSimpleMultiByte);
     SUITE_ADD_TEST(suite, TestTabWidth);
+    SUITE_ADD_TEST(suite, TestColourSpans);
+    SUITE_ADD_TEST(suite, TestColourFit);
     return suite;
 }
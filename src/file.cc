@@ -19,12 +19,18 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 #include <wordexp.h>
 
@@ -151,64 +157,312 @@ int CFile::size(std::string path)
  */
 std::vector < std::string > CFile::get_all_maildirs(std::string prefix)
 {
-    std::vector < std::string > result;
+    std::vector < std::string > prefixes;
+    prefixes.push_back(prefix);
 
-    dirent *de;
-    DIR *dp;
+    return (CFile::get_all_maildirs(prefixes));
+}
+
+
+/**
+ * A directory which is waiting to be walked by `CMaildirWalker`.
+ */
+struct CWalkItem
+{
+    /**
+     * The path to the directory.
+     */
+    std::string path;
+
+    /**
+     * The offset of the prefix this directory was found beneath.
+     */
+    size_t prefix;
+};
 
-    dp = opendir(prefix.c_str());
 
-    if (dp)
+/**
+ * A work-stealing parallel directory walker, which finds maildirs.
+ *
+ * Each worker has its own deque of directories to walk, pushing and
+ * popping from the back.  When a worker runs out of work it steals
+ * from the front of another worker's deque, which tends to take the
+ * largest unexplored subtree.
+ */
+class CMaildirWalker
+{
+public:
+    CMaildirWalker(size_t workers) : m_queues(workers), m_found(workers)
     {
-        if (CFile::is_maildir(prefix))
-            result.push_back(prefix);
+        m_pending = 0;
+        m_queued  = 0;
+    }
 
-        while (true)
+    /**
+     * Walk the given prefixes, returning the maildirs found.
+     */
+    std::vector<std::string> walk(std::vector<std::string> prefixes)
+    {
+        std::vector<std::pair<size_t, std::string> > found;
+
+        /*
+         * The prefixes themselves might be maildirs.
+         */
+        for (size_t i = 0; i < prefixes.size(); i++)
         {
-            de = readdir(dp);
+            if (CFile::is_maildir(prefixes[i]))
+                found.push_back(std::make_pair(i, prefixes[i]));
+
+            CWalkItem item;
+            item.path   = prefixes[i];
+            item.prefix = i;
+            push(i % m_queues.size(), item);
+        }
+
+        std::vector<std::thread> threads;
+
+        for (size_t i = 0; i < m_queues.size(); i++)
+            threads.push_back(std::thread(&CMaildirWalker::worker, this, i));
+
+        for (std::thread &t : threads)
+            t.join();
+
+        for (auto &results : m_found)
+            found.insert(found.end(), results.begin(), results.end());
+
+        /*
+         * Sort by prefix, then path, which is the order we'd
+         * have had from walking each prefix in turn.
+         */
+        std::sort(found.begin(), found.end());
 
-            if (de == NULL)
-                break;
+        std::vector<std::string> result;
+        result.reserve(found.size());
 
-            if ((strcmp(de->d_name, ".") != 0) &&
-                    (strcmp(de->d_name, "..") != 0) &&
-                    ((de->d_type == DT_UNKNOWN) || (de->d_type == DT_DIR)))
+        for (auto &entry : found)
+            result.push_back(entry.second);
+
+        return result;
+    }
+
+private:
+
+    /**
+     * A queue of work, and the lock protecting it.
+     */
+    struct CWalkQueue
+    {
+        std::mutex lock;
+        std::deque<CWalkItem> items;
+    };
+
+    /**
+     * Add an item to the given worker's queue.
+     */
+    void push(size_t id, CWalkItem &item)
+    {
+        m_pending++;
+
+        {
+            std::lock_guard<std::mutex> guard(m_queues[id].lock);
+            m_queues[id].items.push_back(item);
+        }
+
+        m_queued++;
+
+        std::lock_guard<std::mutex> guard(m_idle_lock);
+        m_idle.notify_one();
+    }
+
+    /**
+     * Take an item, from our own queue if possible, otherwise from
+     * the front of somebody else's.
+     */
+    bool pop(size_t id, CWalkItem &item)
+    {
+        size_t count = m_queues.size();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            CWalkQueue &q = m_queues[(id + i) % count];
+            std::lock_guard<std::mutex> guard(q.lock);
+
+            if (q.items.empty())
+                continue;
+
+            if (i == 0)
             {
-                std::string subdir_name = std::string(de->d_name);
-                std::string subdir_path =
-                    std::string(prefix + "/" + subdir_name);
+                item = q.items.back();
+                q.items.pop_back();
+            }
+            else
+            {
+                item = q.items.front();
+                q.items.pop_front();
+            }
+
+            m_queued--;
+            return true;
+        }
 
-                if (CFile::is_maildir(subdir_path))
-                    result.push_back(subdir_path);
-                else
+        return false;
+    }
+
+    /**
+     * Is the named child of the given directory a directory?
+     */
+    static bool is_dir_at(int dfd, const std::string &name)
+    {
+        struct stat sb;
+        return ((fstatat(dfd, name.c_str(), &sb, 0) == 0) && S_ISDIR(sb.st_mode));
+    }
+
+    /**
+     * Walk a single directory.
+     */
+    void process(size_t id, CWalkItem &item)
+    {
+        int fd = open(item.path.c_str(), O_RDONLY | O_DIRECTORY);
+
+        if (fd < 0)
+            return;
+
+        DIR *dp = fdopendir(fd);
+
+        if (dp == NULL)
+        {
+            close(fd);
+            return;
+        }
+
+        /*
+         * If this directory is itself a maildir then there is
+         * no need to look inside cur/, new/, and tmp/.
+         */
+        bool is_maildir = is_dir_at(fd, "cur") && is_dir_at(fd, "new") && is_dir_at(fd, "tmp");
+
+        dirent *de;
+
+        while ((de = readdir(dp)) != NULL)
+        {
+            if ((strcmp(de->d_name, ".") == 0) ||
+                    (strcmp(de->d_name, "..") == 0))
+                continue;
+
+            if ((de->d_type != DT_UNKNOWN) && (de->d_type != DT_DIR))
+                continue;
+
+            std::string name = de->d_name;
+
+            if (is_maildir && ((name == "cur") || (name == "new") || (name == "tmp")))
+                continue;
+
+            if ((de->d_type == DT_UNKNOWN) && !is_dir_at(fd, name))
+                continue;
+
+            CWalkItem child;
+            child.path   = item.path + "/" + name;
+            child.prefix = item.prefix;
+
+            /*
+             * Maildirs are recorded, everything else is walked.
+             */
+            if (is_dir_at(fd, name + "/cur") &&
+                    is_dir_at(fd, name + "/tmp") &&
+                    is_dir_at(fd, name + "/new"))
+                m_found[id].push_back(std::make_pair(child.prefix, child.path));
+            else
+                push(id, child);
+        }
+
+        closedir(dp);
+    }
+
+    /**
+     * The body of each worker-thread.
+     */
+    void worker(size_t id)
+    {
+        CWalkItem item;
+
+        while (true)
+        {
+            if (pop(id, item))
+            {
+                process(id, item);
+
+                /*
+                 * If this was the last outstanding item wake everybody
+                 * so that they can terminate.
+                 */
+                if (--m_pending == 0)
                 {
-                    if (subdir_name != "." && subdir_name != "..")
-                    {
-                        DIR *sdp = opendir(subdir_path.c_str());
-
-                        if (sdp)
-                        {
-                            closedir(sdp);
-                            std::vector < std::string > sub_maildirs;
-                            sub_maildirs = CFile::get_all_maildirs(subdir_path);
-
-                            for (std::string sub_maildir : sub_maildirs)
-                            {
-                                result.push_back(sub_maildir);
-                            }
-                        }
-                    }
+                    std::lock_guard<std::mutex> guard(m_idle_lock);
+                    m_idle.notify_all();
                 }
+
+                continue;
             }
-        }
 
-        closedir(dp);
-        std::sort(result.begin(), result.end());
+            std::unique_lock<std::mutex> lock(m_idle_lock);
+            m_idle.wait(lock, [this]
+            {
+                return ((m_queued > 0) || (m_pending == 0));
+            });
+
+            if (m_pending == 0)
+                return;
+        }
     }
 
-    return result;
+private:
+
+    /**
+     * The per-worker queues.
+     */
+    std::vector<CWalkQueue> m_queues;
+
+    /**
+     * The per-worker results, as (prefix, path) pairs.
+     */
+    std::vector<std::vector<std::pair<size_t, std::string> > > m_found;
+
+    /**
+     * The number of items queued, or being processed.
+     */
+    std::atomic<int> m_pending;
+
+    /**
+     * The number of items sitting in a queue.
+     */
+    std::atomic<int> m_queued;
+
+    /**
+     * Idle workers wait here for more work to appear.
+     */
+    std::mutex m_idle_lock;
+    std::condition_variable m_idle;
+};
+
+
+/*
+ * Return a list of the maildirs beneath the given prefixes, sorted
+ * by prefix and then by path.
+ */
+std::vector < std::string > CFile::get_all_maildirs(std::vector < std::string > prefixes, int threads)
+{
+    /*
+     * Walking a tree is dominated by I/O latency, rather than CPU,
+     * so we use a few more threads than we have CPUs.
+     */
+    if (threads < 1)
+        threads = std::max(4, (int)std::thread::hardware_concurrency());
+
+    CMaildirWalker walker(threads);
+    return (walker.walk(prefixes));
 }
 
+
 /*
  * Delete the given path.
  */
@@ -89,4 +89,13 @@ public:
      */
     static std::vector < std::string > get_all_maildirs(std::string prefix);
 
+    /**
+     * Return a list of the maildirs beneath all the given prefixes,
+     * sorted by prefix and then by path.
+     *
+     * The directory-trees are walked in parallel, by the given number
+     * of threads - if zero a default based on the CPU count is used.
+     */
+    static std::vector < std::string > get_all_maildirs(std::vector < std::string > prefixes, int threads = 0);
+
 };
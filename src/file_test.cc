@@ -18,6 +18,7 @@
 
 
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string.h>
@@ -428,6 +429,79 @@ void TestFileMaildir(CuTest * tc)
 }
 
 
+/**
+ * Test CFile::get_all_maildirs()
+ */
+void TestFileAllMaildirs(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.walkXXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    /*
+     * The maildirs we create, the plain directories, and the
+     * maildirs we don't expect to find because they're nested
+     * beneath another maildir.
+     */
+    std::vector<std::string> maildirs = { "/one/a", "/one/b/c", "/one/b/d/e", "/two" };
+    std::vector<std::string> plain    = { "/one", "/one/b", "/one/b/d", "/empty" };
+    std::vector<std::string> nested   = { "/one/a/.sub" };
+
+    std::vector<std::string> all;
+    all.insert(all.end(), maildirs.begin(), maildirs.end());
+    all.insert(all.end(), nested.begin(), nested.end());
+
+    for (std::string dir : all)
+    {
+        CDirectory::mkdir_p(prefix + dir + "/cur");
+        CDirectory::mkdir_p(prefix + dir + "/new");
+        CDirectory::mkdir_p(prefix + dir + "/tmp");
+    }
+
+    CDirectory::mkdir_p(prefix + "/empty");
+
+    /*
+     * Walk the two prefixes, using several threads.
+     */
+    std::vector<std::string> prefixes = { prefix + "/two", prefix + "/one" };
+    std::vector<std::string> found = CFile::get_all_maildirs(prefixes, 3);
+
+    CuAssertIntEquals(tc, 4, found.size());
+    CuAssertStrEquals(tc, std::string(prefix + "/two").c_str(), found[0].c_str());
+    CuAssertStrEquals(tc, std::string(prefix + "/one/a").c_str(), found[1].c_str());
+    CuAssertStrEquals(tc, std::string(prefix + "/one/b/c").c_str(), found[2].c_str());
+    CuAssertStrEquals(tc, std::string(prefix + "/one/b/d/e").c_str(), found[3].c_str());
+
+    /*
+     * The single-prefix version should agree.
+     */
+    found = CFile::get_all_maildirs(prefix + "/one");
+    CuAssertIntEquals(tc, 3, found.size());
+
+    /*
+     * Cleanup, deepest first.
+     */
+    std::sort(all.begin(), all.end());
+    std::reverse(all.begin(), all.end());
+
+    for (std::string dir : all)
+    {
+        rmdir(std::string(prefix + dir + "/cur").c_str());
+        rmdir(std::string(prefix + dir + "/new").c_str());
+        rmdir(std::string(prefix + dir + "/tmp").c_str());
+        rmdir(std::string(prefix + dir).c_str());
+    }
+
+    std::sort(plain.begin(), plain.end());
+    std::reverse(plain.begin(), plain.end());
+
+    for (std::string dir : plain)
+        rmdir(std::string(prefix + dir).c_str());
+
+    rmdir(prefix.c_str());
+    CuAssertTrue(tc, !CFile::exists(prefix));
+}
+
+
 /**
  * Test CFile::expand_path()
  */
@@ -474,6 +548,7 @@ CuSuite *
 file_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFileAllMaildirs);
     SUITE_ADD_TEST(suite, TestFileBasename);
     SUITE_ADD_TEST(suite, TestFileCopy);
     SUITE_ADD_TEST(suite, TestFileDirectory);
@@ -16,8 +16,12 @@
  * General Public License can be found in `/usr/share/common-licenses/GPL-2'
  */
 
+#include <algorithm>
+#include <ctype.h>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <string.h>
 
 
 #include "config.h"
@@ -26,11 +30,14 @@
 #include "global_state.h"
 #include "history.h"
 #include "imap_proxy.h"
+#include "imap_sync.h"
 #include "json/json.h"
 #include "logger.h"
 #include "lua.h"
 #include "maildir.h"
+#include "maildir_watcher.h"
 #include "message.h"
+#include "screen.h"
 #include "util.h"
 
 /*
@@ -40,6 +47,8 @@ CGlobalState::CGlobalState() : Observer(CConfig::instance())
 {
     m_messages = NULL;
     m_current_message = NULL;
+    m_maildirs_generation = 0;
+    m_messages_generation = 0;
     update_messages();
     update_maildirs();
 
@@ -223,6 +232,289 @@ CMessageList * CGlobalState::get_messages()
 }
 
 
+/*
+ * Get the messages in the currently-selected folder which match
+ * the given filter.
+ */
+CMessageList CGlobalState::limit_messages(CMessageFilter &filter)
+{
+    CMessageList result;
+
+    if (m_messages == NULL)
+        return result;
+
+    for (std::shared_ptr<CMessage> msg : *m_messages)
+    {
+        if (filter.matches(msg))
+            result.push_back(msg);
+    }
+
+    return result;
+}
+
+
+/*
+ * Search every local maildir for the given words.
+ */
+std::vector<CSearchResult> CGlobalState::search(std::string query)
+{
+    std::vector<CSearchResult> results;
+    std::vector<std::string> paths;
+    std::vector<std::string> unindexed;
+
+    for (std::shared_ptr<CMaildir> maildir : m_maildirs)
+    {
+        if (!maildir->is_maildir())
+            continue;
+
+        std::string path = maildir->path();
+        std::shared_ptr<CSearchIndex> idx = m_search[path];
+
+        if (!idx)
+        {
+            idx = std::shared_ptr<CSearchIndex>(new CSearchIndex(path));
+            m_search[path] = idx;
+        }
+
+        if (!CFile::exists(idx->index_file()))
+            unindexed.push_back(path);
+
+        paths.push_back(path);
+    }
+
+    /*
+     * Building the index of a maildir for the first time means parsing
+     * every message it contains, which may take a while, so we let the
+     * user know as we go.
+     */
+    CLua *lua = CLua::instance();
+    size_t built = 0;
+
+    for (std::string path : paths)
+    {
+        if ((built < unindexed.size()) && (unindexed[built] == path))
+        {
+            built += 1;
+            lua->on_search_index(path, built, unindexed.size());
+        }
+
+        std::shared_ptr<CSearchIndex> idx = m_search[path];
+        idx->update();
+
+        std::vector<CSearchResult> found = idx->search(query);
+        results.insert(results.end(), found.begin(), found.end());
+    }
+
+    std::stable_sort(results.begin(), results.end(),
+                     [](const CSearchResult & a, const CSearchResult & b)
+    {
+        return (a.date > b.date);
+    });
+
+    return results;
+}
+
+
+/*
+ * Add and remove flags on many messages at once.
+ */
+bool CGlobalState::apply_flags(CMessageList messages, std::string spec)
+{
+    /*
+     * Parse the specification into the flags to add, and to remove.
+     */
+    std::string add;
+    std::string remove;
+    bool adding = true;
+
+    for (char c : spec)
+    {
+        if (c == '+')
+            adding = true;
+        else if (c == '-')
+            adding = false;
+        else if (isalpha(c))
+            (adding ? add : remove) += toupper(c);
+        else
+            return false;
+    }
+
+    /*
+     * A flag can't be both added and removed.
+     */
+    for (char c : add)
+    {
+        if (remove.find(c) != std::string::npos)
+            return false;
+    }
+
+    /*
+     * The proxy only understands the seen-flag, so if there are any
+     * IMAP messages that is all we may be asked to change.
+     */
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (msg->is_imap() && ((add + remove).find_first_not_of("S") != std::string::npos))
+            return false;
+    }
+
+    /*
+     * Marking a message as seen means it is no longer new, as it does
+     * for `CMessage::mark_read`.
+     */
+    if ((add.find('S') != std::string::npos) && (add.find('N') == std::string::npos))
+        remove += 'N';
+
+    bool seen   = (add.find('S') != std::string::npos);
+    bool unseen = (remove.find('S') != std::string::npos);
+
+    /*
+     * The IDs of the IMAP messages to mark read/unread, by folder.
+     */
+    std::map<std::string, std::vector<int> > read;
+    std::map<std::string, std::vector<int> > unread;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (msg->is_imap())
+        {
+            /*
+             * Only the seen-flag is updated - in our cached flags as
+             * well as remotely.
+             */
+            if (!seen && !unseen)
+                continue;
+
+            std::shared_ptr<CMaildir> parent = msg->parent();
+            std::string flags = msg->get_flags();
+            bool was_new = msg->is_new();
+
+            flags.erase(std::remove(flags.begin(), flags.end(), seen ? 'N' : 'S'), flags.end());
+            flags += seen ? 'S' : 'N';
+            std::sort(flags.begin(), flags.end());
+            flags.erase(std::unique(flags.begin(), flags.end()), flags.end());
+            msg->set_imap_flags(flags);
+
+            if (seen)
+                read[parent->path()].push_back(msg->get_imap_id());
+            else
+                unread[parent->path()].push_back(msg->get_imap_id());
+
+            /*
+             * Keep the count of unread messages in step.
+             */
+            if (was_new != msg->is_new())
+            {
+                int c = parent->unread_messages() + (was_new ? -1 : 1);
+                parent->set_unread(c < 0 ? 0 : c);
+            }
+
+            continue;
+        }
+
+        /*
+         * For a local message we work out the final name, and rename
+         * it once, rather than once for each flag.
+         */
+        std::string cur_path = msg->path();
+        std::string flags    = msg->get_flags();
+        std::string updated  = flags;
+
+        for (char c : remove)
+            updated.erase(std::remove(updated.begin(), updated.end(), c), updated.end());
+
+        updated += add;
+        std::sort(updated.begin(), updated.end());
+        updated.erase(std::unique(updated.begin(), updated.end()), updated.end());
+
+        if (updated == flags)
+            continue;
+
+        std::string dst_path = cur_path;
+        size_t offset = dst_path.find(":2,");
+
+        if (offset != std::string::npos)
+            dst_path = dst_path.substr(0, offset);
+
+        /*
+         * Messages beneath new/ are flagged as new implicitly, and move
+         * to cur/ once they're not.
+         */
+        if ((offset = dst_path.find("/new/")) != std::string::npos)
+        {
+            if (updated.find('N') == std::string::npos)
+                dst_path.replace(offset, strlen("/new/"), "/cur/");
+
+            updated.erase(std::remove(updated.begin(), updated.end(), 'N'), updated.end());
+        }
+
+        dst_path += ":2," + updated;
+
+        if (CFile::move(cur_path, dst_path))
+            msg->path(dst_path);
+    }
+
+    /*
+     * The flags are shown in the index, which must be redrawn.
+     */
+    if (!messages.empty())
+        CScreen::instance()->damage(CScreen::DAMAGE_CONTENT);
+
+    /*
+     * Now send a single command for each IMAP folder.  We don't need to
+     * wait for the replies, since the proxy carries out our requests in
+     * order.
+     */
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+
+    for (auto it = read.begin(); it != read.end(); ++it)
+        proxy->send_command("mark_read " + CIMAPProxy::uid_set(it->second) + " " + it->first + "\n", true);
+
+    for (auto it = unread.begin(); it != unread.end(); ++it)
+        proxy->send_command("mark_unread " + CIMAPProxy::uid_set(it->second) + " " + it->first + "\n", true);
+
+    return true;
+}
+
+
+/*
+ * Delete many messages at once.
+ */
+void CGlobalState::delete_messages(CMessageList messages)
+{
+    std::map<std::string, std::vector<int> > remote;
+    std::map<std::string, std::shared_ptr<CMaildir> > folders;
+    bool local = false;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (msg->is_imap())
+        {
+            std::shared_ptr<CMaildir> parent = msg->parent();
+            remote[parent->path()].push_back(msg->get_imap_id());
+            folders[parent->path()] = parent;
+        }
+        else
+        {
+            CFile::delete_file(msg->path());
+            local = true;
+        }
+    }
+
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+
+    for (auto it = remote.begin(); it != remote.end(); ++it)
+    {
+        proxy->send_command("delete_message " + CIMAPProxy::uid_set(it->second) + " " + it->first + "\n", true);
+        folders[it->first]->bump_mtime();
+    }
+
+    update_messages(local);
+
+    CScreen::instance()->damage(CScreen::DAMAGE_CONTENT);
+}
+
+
 /*
  * Get the available maildirs.
  */
@@ -243,6 +535,13 @@ void CGlobalState::update_maildirs()
     if (!m_maildirs.empty())
         m_maildirs.clear();
 
+    CMaildirWatcher *watcher = CMaildirWatcher::instance();
+    watcher->clear();
+
+    /*
+     * Any IMAP folders we're waiting for are no longer wanted.
+     */
+    int generation = ++m_maildirs_generation;
 
     /*
      *
@@ -257,51 +556,16 @@ void CGlobalState::update_maildirs()
             (config->get_string("imap.server", "") != ""))
     {
         /*
-         * Read the output from our IMAP proxy.
+         * The folders are listed in the background, followed by the
+         * number of messages in each, so they appear as they arrive.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string json  = proxy->read_imap_output("list_folders\n");
-
-        /*
-         * Now parse the JSON into objects.
-         */
-        Json::Value root;
-        Json::Reader reader;
-        bool parsingSuccessful = reader.parse(json, root);
-
-        if (!parsingSuccessful)
-        {
-            CLua *lua = CLua::instance();
-            lua->on_error("Failed to parse JSON response to 'list_folders': " + json);
-
-            config->set("maildir.max", 0);
-            return;
-        }
-
-        Json::Value folders = root["folders"];
-
-        int count  = 0;
-
-        for (Json::ValueConstIterator it = folders.begin(); it != folders.end(); ++it)
+        proxy->send_async("list_folder_names\n", [generation](std::string json)
         {
-            /*
-             * Get the values from the JSON array.
-             */
-            Json::Value single = (*it);
-            int unread       = single["unread"].asInt();
-            int total        = single["total"].asInt();
-            std::string path = single["name"].asString();
+            CGlobalState::instance()->imap_folders(generation, json);
+        });
 
-            std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path, false));
-            m->set_total(total);
-            m->set_unread(unread);
-
-            m_maildirs.push_back(m);
-
-            count += 1;
-        }
-
-        config->set("maildir.max", count);
+        config->set("maildir.max", 0);
         return;
     }
 
@@ -319,36 +583,100 @@ void CGlobalState::update_maildirs()
 
 
     /*
-     * For each prefix add in the Maildirs.
+     * Find the maildirs beneath all the prefixes, in parallel.
+     */
+    std::vector<std::string> folders;
+    folders = CFile::get_all_maildirs(prefixes);
+
+    /*
+     * Construct the Maildir objects.
      */
-    for (auto it = prefixes.begin(); it != prefixes.end(); ++it)
+    for (std::string path : folders)
     {
-        std::string prefix = *it;
+        std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path));
 
-        /*
-         * We'll store each maildir here.
-         */
-        std::vector<std::string> folders;
-        folders = CFile::get_all_maildirs(prefix);
+        m_maildirs.push_back(m);
+    }
+
+    /*
+     * Watch the maildirs for changes, unless we've been told not to.
+     */
+    if (config->get_integer("maildir.watch", 1) == 1)
+        watcher->watch(m_maildirs);
+
+    /*
+     * Setup the size.
+     */
+    config->set("maildir.max", m_maildirs.size());
+}
+
+
+/*
+ * Replace our maildirs with the folders listed by the IMAP proxy.
+ */
+void CGlobalState::imap_folders(int generation, std::string json)
+{
+    if (generation != m_maildirs_generation)
+        return;
+
+    CConfig *config = CConfig::instance();
+
+    /*
+     * Now parse the JSON into objects.
+     */
+    Json::Value root;
+    Json::Reader reader;
+    bool parsingSuccessful = reader.parse(json, root);
+
+    if (!parsingSuccessful)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to parse JSON response to 'list_folder_names': " + json);
+        return;
+    }
+
+    Json::Value folders = root["folders"];
+    CIMAPProxy *proxy   = CIMAPProxy::instance();
+
+    for (Json::ValueConstIterator it = folders.begin(); it != folders.end(); ++it)
+    {
+        std::string path = (*it)["name"].asString();
+
+        std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path, false));
+        m_maildirs.push_back(m);
 
         /*
-         * Construct the Maildir object.
+         * Ask for the number of messages in the folder.
          */
-        for (std::string path : folders)
+        proxy->send_async("folder_status " + path + "\n", [m, generation](std::string json)
         {
-            std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path));
-
-            m_maildirs.push_back(m);
-        }
+            CGlobalState::instance()->imap_folder_status(m, generation, json);
+        });
     }
 
-    /*
-     * Setup the size.
-     */
     config->set("maildir.max", m_maildirs.size());
 }
 
 
+/*
+ * Update the number of messages in an IMAP folder.
+ */
+void CGlobalState::imap_folder_status(std::shared_ptr<CMaildir> folder, int generation, std::string json)
+{
+    if (generation != m_maildirs_generation)
+        return;
+
+    Json::Value root;
+    Json::Reader reader;
+
+    if (!reader.parse(json, root))
+        return;
+
+    folder->set_total(root["total"].asInt());
+    folder->set_unread(root["unread"].asInt());
+}
+
+
 /*
  * Update the cached list of messages.
  */
@@ -377,8 +705,24 @@ void CGlobalState::update_messages(bool force)
     if (force == true)
         old_val = -2;
 
+    /*
+     * Has a different folder been selected since last time?
+     */
+    bool changed = (!current) || (old_path != current->path());
+
     if (current)
     {
+        /*
+         * A watched maildir has its changes applied to our list
+         * as they happen, so we only need to rescan it if it is
+         * newly-selected.
+         */
+        if ((old_path == current->path()) && (old_val != -2) &&
+                current->is_watched())
+        {
+            return;
+        }
+
         if ((old_path == current->path()) &&
                 (old_val == current->last_modified()))
         {
@@ -390,23 +734,19 @@ void CGlobalState::update_messages(bool force)
             old_path = current->path();
         }
     }
-
-    /*
-     * If we have items already then free each of them.
-     */
-    if (m_messages != NULL)
-        delete(m_messages);
-
-
-    /*
-     * create a new store.
-     */
-    m_messages = new CMessageList;
+    else
+    {
+        /*
+         * Our list is about to be emptied, so whichever folder is
+         * selected next must be listed afresh.
+         */
+        old_path = "";
+    }
 
     /*
      *
      * If `imap.server`, `imap.user`, and `imap.password` are set
-     * then retrieve the list of available folders via IMAP.
+     * then retrieve the list of messages via IMAP.
      *
      */
     CConfig *config = CConfig::instance();
@@ -421,158 +761,311 @@ void CGlobalState::update_messages(bool force)
          * If we don't have a currently-selected folder then return.
          */
         if (! current)
+        {
+            m_messages_generation++;
+
+            delete(m_messages);
+            m_messages = new CMessageList;
+            m_imap_sync = NULL;
+            config->set("index.max", 0);
             return;
+        }
 
         /*
-         * Get the path of the currently selected folder.
+         * When a folder is selected we show the messages we listed
+         * last time straight away, from our cache.
          */
-        std::string folder = current->path();
+        if ((m_messages == NULL) || changed || (! m_imap_sync))
+        {
+            m_imap_sync = std::shared_ptr<CIMAPSync>(new CIMAPSync(current->path(), imap_directory(current->path())));
+            m_imap_sync->load();
 
-        /*
-         * The server name is part of the cache.
-         */
-        CConfig *config = CConfig::instance();
-        std::string imap_server = config->get_string("imap.server");
-        std::string imap_cache  = config->get_string("imap.cache");
+            delete(m_messages);
+            m_messages = new CMessageList;
+            imap_refresh(current);
+
+            int count = m_messages->size();
+            config->set("index.max", count);
 
-        if (imap_cache.empty())
-            imap_cache = "/tmp";
+            if (changed && (count > 0))
+                config->set("index.current", count - 1, false);
+        }
 
         /*
-         * Use our IMAP-proxy to get the message ID of each message
-         * in the currently selected folder, as well as the flags of
-         * the associated message.
+         * Then ask the proxy for the messages which are new, or whose
+         * flags have changed, since then.
          *
          * The retrival of the body will happen on-demand inside the
          * CMessage object.
-         *
          */
-        CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string json  = proxy->read_imap_output("get_message_ids " + folder + "\n");
-
-        int count = 0;
+        std::shared_ptr<CIMAPSync> sync = m_imap_sync;
+        bool select = changed && m_messages->empty();
 
         /*
-         * Now parse the JSON into objects.
+         * Any reply to an earlier request is no longer wanted.  This is
+         * only done once we know we're sending a new request, otherwise
+         * the reply we're waiting for would never be applied.
          */
-        Json::Value root;
-        Json::Reader reader;
-        bool parsingSuccessful = reader.parse(json, root);
+        int generation = ++m_messages_generation;
 
-        if (!parsingSuccessful)
+        CIMAPProxy *proxy = CIMAPProxy::instance();
+        proxy->send_async(sync->command(),
+                          [current, sync, generation, select](std::string json)
         {
-            CLua *lua = CLua::instance();
-            lua->on_error("Failed to parse JSON response to 'get_messages'.");
+            CGlobalState::instance()->imap_messages(current, sync, generation, select, json);
+        });
+        return;
+    }
 
-            config->set("index.max", 0);
-            return;
-        }
 
-        Json::Value messages = root["messages"];
+    /*
+     * Any IMAP messages we're waiting for are no longer wanted.
+     */
+    m_messages_generation++;
+
+    /*
+     * If we have items already then free each of them.
+     */
+    if (m_messages != NULL)
+        delete(m_messages);
+
+
+    /*
+     * create a new store.
+     */
+    m_messages = new CMessageList;
+
+    /*
+     * Get the messages from the maildir.
+     */
+    if (current)
+    {
+        logger->log("maildir", "%s", "Fetching messages.");
+        CMessageList contents = current->getMessages();
 
-        for (Json::ValueConstIterator it = messages.begin(); it != messages.end(); ++it)
+        for (std::shared_ptr<CMessage> content : contents)
         {
-            /*
-             * The array-member
-             */
-            Json::Value single = (*it);
+            m_messages->push_back(content) ;
+        }
+    }
 
-            /*
-             * The flags and ID of the message.
-             */
-            int id_val            = single["id"].asInt();
-            std::string flags_val = single["flags"].asString();
+    logger->log("maildir", "Found %d message(s).", m_messages->size());
 
-            /*
-             * Create a path to hold the IMAP message.
-             *
-             * The path will be $cache/$server/$folder/NN
-             */
-            std::string path = imap_cache;
-            path += "/";
-            path += escape_filename(imap_server);
-            path += "/";
-            path += escape_filename(folder);
+    config->set("index.max", m_messages->size());
+}
 
-            CDirectory::mkdir_p(path);
 
-            path += "/";
-            path += std::to_string(id_val);
+/*
+ * Update the messages of the current IMAP folder from the proxy.
+ */
+void CGlobalState::imap_messages(std::shared_ptr<CMaildir> current, std::shared_ptr<CIMAPSync> sync, int generation, bool select, std::string json)
+{
+    /*
+     * Ignore the reply if we've since asked again, or moved on.
+     */
+    if ((generation != m_messages_generation) || (current != m_current_maildir) ||
+            (sync != m_imap_sync))
+        return;
 
-            /*
-             * Now create the message-object, pointing to the suitable
-             * path, making sure that it is marked as non-local.
-             */
-            std::shared_ptr < CMessage > t = std::shared_ptr < CMessage >(new CMessage(path, false));
-            t->path(path);
+    int changes = sync->apply(json);
 
-            /*
-             * Split the flags into sane things.
-             */
-            std::string f;
-            std::vector<std::string> flags = split(flags_val, ',');
+    if (changes < 0)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to parse JSON response to 'sync_messages'.");
+        return;
+    }
 
-            for (auto it = flags.begin() ; it != flags.end(); ++it)
-            {
-                std::string flag = (*it);
+    sync->save();
 
-                if (flag == "\\Seen")
-                    f += "S";
+    /*
+     * If nothing has changed there is nothing more to do.
+     */
+    if ((changes == 0) && (! select))
+        return;
 
-                if (flag == "\\Unseen")
-                    f += "N";
+    /*
+     * If the UIDs were reset then the messages we have might refer to
+     * different ones now, so none of them are kept.
+     */
+    if (sync->was_reset())
+        m_messages->clear();
 
-                if (flag == "\\Answered")
-                    f += "R";
-            }
+    imap_refresh(current);
 
-            /*
-             * Empty flag == new message.
-             */
-            if (f.empty())
-                f = "N";
+    CConfig *config = CConfig::instance();
+    int count = m_messages->size();
+    config->set("index.max", count);
 
-            /*
-             * Set the flags and ID to the message.  The flags will be
-             * usable as-is.
-             *
-             * The ID means that the message-object can fetch its own
-             * body on-demand when it wants to.
-             */
-            t->parent(current);
-            t->set_imap_flags(f);
-            t->set_imap_id(id_val);
+    /*
+     * If the folder was newly-selected then the selection moves to the
+     * bottom, as it does for a local folder.
+     */
+    if (select)
+        config->set("index.current", count > 0 ? count - 1 : 0, false);
 
-            /*
-             * Add the message to our list.
-             */
-            m_messages->push_back(t);
+    /*
+     * Let Lua know the messages have changed.
+     */
+    CLua *lua = CLua::instance();
+    lua->maildir_changed(current->path());
+}
+
+
+/*
+ * Rebuild our messages from the state of the current IMAP folder.
+ */
+void CGlobalState::imap_refresh(std::shared_ptr<CMaildir> current)
+{
+    /*
+     * The messages we already have are kept, so that we don't need to
+     * build a new object for each message every time.
+     */
+    std::unordered_map<int, std::shared_ptr<CMessage>> existing;
+
+    for (std::shared_ptr<CMessage> msg : *m_messages)
+        existing[msg->get_imap_id()] = msg;
+
+    CMessageList *listed = new CMessageList;
+
+    const std::map<int, std::string> &messages = m_imap_sync->messages();
 
-            count += 1;
+    for (auto it = messages.begin(); it != messages.end(); ++it)
+    {
+        auto found = existing.find(it->first);
+
+        if (found != existing.end())
+        {
+            std::shared_ptr<CMessage> msg = found->second;
+
+            if (msg->get_flags() != it->second)
+                msg->set_imap_flags(it->second);
+
+            listed->push_back(msg);
+            continue;
         }
 
-        config->set("index.max", count);
-        return;
+        /*
+         * Create the message-object, pointing to a path to hold the
+         * body, making sure that it is marked as non-local.
+         *
+         * The flags are set before the parent, since these are the
+         * flags the server already has, and the folder hasn't changed.
+         *
+         * The ID means that the message-object can fetch its own
+         * body on-demand when it wants to.
+         */
+        std::string path = m_imap_sync->body_file(it->first);
+
+        std::shared_ptr<CMessage> msg = std::shared_ptr<CMessage>(new CMessage(path, false));
+        msg->path(path);
+        msg->set_imap_flags(it->second);
+        msg->set_imap_id(it->first);
+        msg->parent(current);
+
+        listed->push_back(msg);
     }
 
+    delete(m_messages);
+    m_messages = listed;
+}
+
+
+/*
+ * The directory in which we cache the messages of the given IMAP folder.
+ *
+ * The path will be $cache/$server/$folder, and is created if missing.
+ */
+std::string CGlobalState::imap_directory(std::string folder)
+{
+    CConfig *config = CConfig::instance();
+    std::string imap_server = config->get_string("imap.server");
+    std::string imap_cache  = config->get_string("imap.cache");
+
+    if (imap_cache.empty())
+        imap_cache = "/tmp";
+
+    std::string path = imap_cache;
+    path += "/";
+    path += escape_filename(imap_server);
+    path += "/";
+    path += escape_filename(folder);
+
+    CDirectory::mkdir_p(path);
+
+    return (path);
+}
+
+
+/*
+ * Add a message which has arrived in the given maildir.
+ */
+std::shared_ptr<CMessage> CGlobalState::message_added(std::shared_ptr<CMaildir> maildir, std::string path)
+{
+    if ((m_messages == NULL) || (maildir != m_current_maildir))
+        return NULL;
 
     /*
-     * Get the messages from the maildir.
+     * We might already know about this message, for example if we
+     * moved it ourselves.
      */
-    if (current)
+    for (std::shared_ptr<CMessage> msg : *m_messages)
     {
-        logger->log("maildir", "%s", "Fetching messages.");
-        CMessageList contents = current->getMessages();
+        if (msg->path() == path)
+            return NULL;
+    }
 
-        for (std::shared_ptr<CMessage> content : contents)
+    std::shared_ptr<CMessage> msg = std::shared_ptr<CMessage>(new CMessage(path));
+    m_messages->push_back(msg);
+
+    CConfig *config = CConfig::instance();
+    config->set("index.max", m_messages->size());
+
+    return (msg);
+}
+
+
+/*
+ * Remove the message with the given path.
+ */
+void CGlobalState::message_removed(std::string path)
+{
+    if (m_messages == NULL)
+        return;
+
+    for (auto it = m_messages->begin(); it != m_messages->end(); ++it)
+    {
+        if ((*it)->path() == path)
         {
-            m_messages->push_back(content) ;
+            if (m_current_message == (*it))
+                m_current_message = NULL;
+
+            m_messages->erase(it);
+
+            CConfig *config = CConfig::instance();
+            config->set("index.max", m_messages->size());
+            return;
         }
     }
+}
 
-    logger->log("maildir", "Found %d message(s).", m_messages->size());
 
-    config->set("index.max", m_messages->size());
+/*
+ * Update the path of a message which has been renamed.
+ */
+void CGlobalState::message_renamed(std::string old_path, std::string new_path)
+{
+    if (m_messages == NULL)
+        return;
+
+    for (std::shared_ptr<CMessage> msg : *m_messages)
+    {
+        if (msg->path() == old_path)
+        {
+            msg->path(new_path);
+            return;
+        }
+    }
 }
 
 
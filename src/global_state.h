@@ -22,11 +22,15 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "imap_sync.h"
 #include "maildir.h"
 #include "message.h"
+#include "message_filter.h"
 #include "observer.h"
+#include "search_index.h"
 #include "singleton.h"
 
 
@@ -64,6 +68,12 @@ public:
      */
     std::vector<std::shared_ptr<CMessage> > *get_messages();
 
+    /**
+     * Get the messages in the currently-selected folder which match
+     * the given filter.
+     */
+    CMessageList limit_messages(CMessageFilter &filter);
+
     /**
      * Get the currently selected message.
      */
@@ -85,6 +95,33 @@ public:
      */
     void set_maildir(std::shared_ptr<CMaildir >  folder);
 
+    /**
+     * Search every local maildir for messages containing all the words
+     * in the query, returning them newest-first.
+     *
+     * The search-index of each maildir is brought up to date first.  The
+     * Lua `on_search_index` function is called before a maildir is
+     * indexed for the first time, so that progress may be shown.
+     */
+    std::vector<CSearchResult> search(std::string query);
+
+    /**
+     * Add and remove flags on each of the given messages, as described
+     * by a specification such as "+S", "-S" or "+F-S".
+     *
+     * Messages on IMAP servers are updated with one command per folder,
+     * and local messages are renamed just once each.  Returns false if
+     * the specification is invalid, adds and removes the same flag, or
+     * changes anything other than `S` on an IMAP message.
+     */
+    bool apply_flags(CMessageList messages, std::string spec);
+
+    /**
+     * Delete each of the given messages, with one command per IMAP
+     * folder, and refresh our list of messages once afterwards.
+     */
+    void delete_messages(CMessageList messages);
+
 public:
 
     /**
@@ -98,12 +135,64 @@ public:
      */
     void update_messages(bool force = false);
 
+    /**
+     * Add the message with the given path, which has arrived in
+     * the given maildir, to our list of messages - if that maildir
+     * is currently selected.
+     *
+     * The new message is returned, or NULL if it was not added.
+     */
+    std::shared_ptr<CMessage> message_added(std::shared_ptr<CMaildir> maildir, std::string path);
+
+    /**
+     * Remove the message with the given path from our list of messages.
+     */
+    void message_removed(std::string path);
+
+    /**
+     * Update the path of a message, which has been renamed.
+     */
+    void message_renamed(std::string old_path, std::string new_path);
+
     /**
      * This method is called when a configuration key changes,
      * via our observer implementation.
      */
     void update(std::string key_name, CConfigEntry *old);
 
+private:
+
+    /**
+     * Replace our maildirs with the IMAP folders listed in the given
+     * reply from the proxy, and request the status of each.
+     */
+    void imap_folders(int generation, std::string json);
+
+    /**
+     * Update the number of messages in an IMAP folder, from the given
+     * reply from the proxy.
+     */
+    void imap_folder_status(std::shared_ptr<CMaildir> folder, int generation, std::string json);
+
+    /**
+     * Update the state of the current IMAP folder from the given reply
+     * from the proxy, and our messages with it.  If `select` is true the
+     * selection is reset too.
+     */
+    void imap_messages(std::shared_ptr<CMaildir> folder, std::shared_ptr<CIMAPSync> sync, int generation, bool select, std::string json);
+
+    /**
+     * Rebuild our messages from the state of the current IMAP folder,
+     * keeping the message-objects we already have.
+     */
+    void imap_refresh(std::shared_ptr<CMaildir> folder);
+
+    /**
+     * The directory in which we cache the messages of the given IMAP
+     * folder, which is created if missing.
+     */
+    std::string imap_directory(std::string folder);
+
 private:
 
     /**
@@ -125,4 +214,21 @@ private:
      * The currently selected message.
      */
     std::shared_ptr<CMessage> m_current_message;
+
+    /**
+     * The search-index of each maildir we've searched, keyed by path.
+     */
+    std::unordered_map<std::string, std::shared_ptr<CSearchIndex>> m_search;
+
+    /**
+     * The synchronisation state of the currently selected IMAP folder.
+     */
+    std::shared_ptr<CIMAPSync> m_imap_sync;
+
+    /**
+     * Incremented each time we list our maildirs, or messages, so that
+     * replies from the IMAP proxy to earlier requests may be ignored.
+     */
+    int m_maildirs_generation;
+    int m_messages_generation;
 };
@@ -22,10 +22,14 @@
 
 #include "config.h"
 #include "global_state.h"
+#include "imap_prefetch.h"
+#include "imap_proxy.h"
 #include "maildir_lua.h"
 #include "message_lua.h"
+#include "message_sort.h"
 #include "lua.h"
 #include "screen.h"
+#include "threader.h"
 
 
 /**
@@ -144,6 +148,78 @@ int l_CGlobalState_current_messages(lua_State * l)
 
 
 
+/**
+ * Implementation of `Global:imap_command`.
+ *
+ * The command is sent to the IMAP proxy without waiting for the reply,
+ * which is given to the optional callback from the main-loop.
+ */
+int l_CGlobalState_imap_command(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_imap_command");
+
+    std::string cmd = luaL_checkstring(l, 2);
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+
+    if (lua_isnoneornil(l, 3))
+    {
+        lua_pushinteger(l, proxy->send_async(cmd, [](std::string) {}));
+        return 1;
+    }
+
+    luaL_checktype(l, 3, LUA_TFUNCTION);
+    lua_pushvalue(l, 3);
+    int ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+    lua_pushinteger(l, proxy->send_async(cmd, [ref](std::string reply)
+    {
+        CLua::instance()->call_reference(ref, reply);
+    }));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:limit_messages`.
+ *
+ * Returns nil if the limit must be applied in Lua.
+ */
+int l_CGlobalState_limit_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_limit_messages");
+
+    std::string limit;
+
+    if (lua_isstring(l, 2))
+        limit = lua_tostring(l, 2);
+    else
+        limit = CConfig::instance()->get_string("index.limit", "all");
+
+    CMessageFilter filter(limit);
+
+    if (!filter.valid())
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    CGlobalState *global = CGlobalState::instance();
+    CMessageList msgs = global->limit_messages(filter);
+
+    lua_createtable(l, msgs.size(), 0);
+    int i = 0;
+
+    for (std::shared_ptr<CMessage> m : msgs)
+    {
+        push_cmessage(l, m);
+        lua_rawseti(l, -2, i + 1);
+        i++;
+    }
+
+    return 1;
+}
+
+
 /**
  * Return all the registered view-modes to the caller.
  */
@@ -173,6 +249,36 @@ int l_CGlobalState_modes(lua_State * l)
 
 
 
+/**
+ * Implementation of `Global:search`.
+ *
+ * Returns the paths of the matching messages, newest-first.
+ */
+int l_CGlobalState_search(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_search");
+
+    const char *query = luaL_checkstring(l, 2);
+    int max = luaL_optinteger(l, 3, 0);
+
+    CGlobalState *global = CGlobalState::instance();
+    std::vector<CSearchResult> found = global->search(query);
+
+    if ((max > 0) && (found.size() > (size_t)max))
+        found.resize(max);
+
+    lua_createtable(l, found.size(), 0);
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        lua_pushstring(l, found[i].path.c_str());
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
 /**
  * Implementation of `Global:select_messages`.
  */
@@ -186,6 +292,216 @@ int l_CGlobalState_select_message(lua_State * l)
 }
 
 
+/**
+ * Get the messages from the table at the given stack-index.
+ */
+static CMessageList check_messages(lua_State * l, int index)
+{
+    luaL_checktype(l, index, LUA_TTABLE);
+
+#if LUA_VERSION_NUM == 501
+    size_t count = lua_objlen(l, index);
+#else
+    size_t count = lua_rawlen(l, index);
+#endif
+
+    CMessageList messages;
+    messages.reserve(count);
+
+    for (size_t i = 1; i <= count; i++)
+    {
+        lua_rawgeti(l, index, i);
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    return messages;
+}
+
+
+/**
+ * Implementation of `Global:apply_flags`.
+ *
+ * Returns false if the specification of the flags is invalid.
+ */
+int l_CGlobalState_apply_flags(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_apply_flags");
+
+    CMessageList messages = check_messages(l, 2);
+    std::string spec = luaL_checkstring(l, 3);
+
+    CGlobalState *global = CGlobalState::instance();
+    bool ret = global->apply_flags(messages, spec);
+
+    lua_pushboolean(l, ret);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:delete_messages`.
+ */
+int l_CGlobalState_delete_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_delete_messages");
+
+    CMessageList messages = check_messages(l, 2);
+
+    CGlobalState *global = CGlobalState::instance();
+    global->set_message(NULL);
+    global->delete_messages(messages);
+    return 0;
+}
+
+
+/**
+ * Implementation of `Global:prefetch_messages`.
+ */
+int l_CGlobalState_prefetch_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_prefetch_messages");
+
+    CMessageList messages = check_messages(l, 2);
+
+    CIMAPPrefetch *prefetch = CIMAPPrefetch::instance();
+    prefetch->fetch(messages);
+
+    return 0;
+}
+
+
+/**
+ * Implementation of `Global:sort_messages`.
+ *
+ * Returns nil if the sorting method must be implemented in Lua.
+ */
+int l_CGlobalState_sort_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_sort_messages");
+
+    CMessageList messages = check_messages(l, 2);
+
+    std::string method;
+
+    if (lua_isstring(l, 3))
+        method = lua_tostring(l, 3);
+    else
+        method = CConfig::instance()->get_string("index.sort", "date");
+
+    if (!CMessageSort::is_native(method))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    std::vector<size_t> order = CMessageSort::sort(messages, method);
+
+    /*
+     * We return the userdata we were given, rather than pushing new ones,
+     * so that they may still be used as table-keys.
+     */
+    lua_createtable(l, order.size(), 0);
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        lua_rawgeti(l, 2, order[i] + 1);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:thread_messages`.
+ *
+ * Returns the messages in thread-order, the indentation of each message,
+ * and a table of the messages which start each thread.
+ */
+int l_CGlobalState_thread_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_thread_messages");
+
+    const char *sort = luaL_optstring(l, 3, "");
+
+    CMessageList messages = check_messages(l, 2);
+
+    /*
+     * Get the signs used to draw the threads, ignoring empty ones as
+     * `lib/threader.lua` did.
+     */
+    CConfig *config = CConfig::instance();
+    std::string output = config->get_string("threads.output", " ;`;-> ");
+    std::vector<std::string> signs;
+    size_t start = 0;
+
+    while (start <= output.size())
+    {
+        size_t end = output.find(';', start);
+
+        if (end == std::string::npos)
+            end = output.size();
+
+        if (end > start)
+            signs.push_back(output.substr(start, end - start));
+
+        start = end + 1;
+    }
+
+    signs.resize(3);
+
+    CThreader *threader = CThreader::instance();
+    threader->signs(signs[0], signs[1], signs[2]);
+
+    std::vector<std::string> indentation;
+    std::vector<bool> roots;
+    std::vector<size_t> order = threader->thread(messages, sort, indentation, roots);
+
+    /*
+     * As with `Global:sort_messages` we return the userdata we were given,
+     * as they're used as keys in the tables we return.
+     */
+    lua_createtable(l, order.size(), 0);
+    int list = lua_gettop(l);
+
+    lua_createtable(l, 0, order.size());
+    int indent = lua_gettop(l);
+
+    lua_newtable(l);
+    int root = lua_gettop(l);
+    int threads = 0;
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        lua_rawgeti(l, 2, order[i] + 1);
+        lua_pushvalue(l, -1);
+        lua_rawseti(l, list, i + 1);
+
+        lua_pushvalue(l, -1);
+        lua_pushstring(l, indentation[i].c_str());
+        lua_rawset(l, indent);
+
+        if (roots[i])
+        {
+            threads += 1;
+
+            lua_pushvalue(l, -1);
+            lua_rawseti(l, root, threads);
+
+            lua_pushinteger(l, threads);
+            lua_rawset(l, root);
+        }
+        else
+        {
+            lua_pop(l, 1);
+        }
+    }
+
+    return 3;
+}
+
+
 /**
  * Register the global `Global` object to the Lua environment,
  * and setup our public methods upon which the user may operate.
@@ -194,13 +510,21 @@ void InitGlobalState(lua_State * l)
 {
     luaL_Reg sFooRegs[] =
     {
+        {"apply_flags", l_CGlobalState_apply_flags},
         {"current_maildir", l_CGlobalState_current_maildir},
         {"current_message", l_CGlobalState_current_message},
         {"current_messages", l_CGlobalState_current_messages},
+        {"delete_messages", l_CGlobalState_delete_messages},
+        {"imap_command", l_CGlobalState_imap_command},
+        {"limit_messages", l_CGlobalState_limit_messages},
         {"maildirs", l_CGlobalState_maildirs},
         {"modes", l_CGlobalState_modes},
+        {"prefetch_messages", l_CGlobalState_prefetch_messages},
+        {"search", l_CGlobalState_search},
         {"select_maildir", l_CGlobalState_select_maildir},
         {"select_message", l_CGlobalState_select_message},
+        {"sort_messages", l_CGlobalState_sort_messages},
+        {"thread_messages", l_CGlobalState_thread_messages},
         {NULL, NULL}
     };
     luaL_newmetatable(l, "luaL_CGlobalState");
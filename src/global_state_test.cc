@@ -0,0 +1,296 @@
+/*
+ * global_state_test.cc - Test-cases for our CGlobalState class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "file.h"
+#include "global_state.h"
+#include "imap_proxy.h"
+#include "maildir.h"
+#include "message.h"
+#include "screen.h"
+#include "util.h"
+#include "CuTest.h"
+
+
+/*
+ * Read a single framed request from the given socket, waiting no more
+ * than the given number of milliseconds for it.
+ */
+static std::string read_request(int fd, int timeout)
+{
+    std::string input;
+
+    while (true)
+    {
+        size_t nl = input.find('\n');
+        int id = 0;
+        long len = 0;
+
+        if ((nl != std::string::npos) &&
+                (sscanf(input.substr(0, nl).c_str(), "%d %ld", &id, &len) == 2) &&
+                (input.size() >= nl + 1 + (size_t)len))
+            return (input.substr(nl + 1, len));
+
+        struct pollfd pfd;
+        pfd.fd     = fd;
+        pfd.events = POLLIN;
+
+        if (::poll(&pfd, 1, timeout) != 1)
+            return "";
+
+        char buf[4096];
+        ssize_t got = read(fd, buf, sizeof(buf));
+
+        if (got <= 0)
+            return "";
+
+        input.append(buf, got);
+    }
+}
+
+
+/**
+ * Test that the messages of an IMAP folder are listed by the proxy, even
+ * if we update them again - without change - before the reply arrives.
+ */
+void TestGlobalStateIMAPMessages(CuTest * tc)
+{
+    CGlobalState *global = CGlobalState::instance();
+
+    char tmpl[] = "/tmp/lumail.globalXXXXXX";
+    std::string home = mkdtemp(tmpl);
+
+    /*
+     * Our proxy must listen beneath a HOME of our own, so that we don't
+     * disturb a real one.
+     */
+    std::string old_home = getenv("HOME") ? getenv("HOME") : "";
+    setenv("HOME", home.c_str(), 1);
+    CIMAPProxy::instance()->destroy_instance();
+
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, proxy->socket_path().c_str(), sizeof(addr.sun_path) - 1);
+    CuAssertIntEquals(tc, 0, bind(server, (sockaddr*)&addr, sizeof(addr)));
+    CuAssertIntEquals(tc, 0, listen(server, 1));
+
+    CConfig *config = CConfig::instance();
+    config->set("imap.proxy", "/nonexistent/imap-proxy", false);
+    config->set("imap.cache", home, false);
+    config->set("imap.server", "imaps://imap.example.com/", false);
+    config->set("imap.username", "steve", false);
+    config->set("imap.password", "secret", false);
+
+    /*
+     * Select the folder, then update it again as changing mode does.
+     */
+    global->set_maildir(std::shared_ptr<CMaildir>(new CMaildir("INBOX", false)));
+    global->update_messages();
+
+    CuAssertIntEquals(tc, 0, global->get_messages()->size());
+
+    /*
+     * Only a single request is made.
+     */
+    int client = accept(server, NULL, NULL);
+    CuAssertTrue(tc, client >= 0);
+    CuAssertStrEquals(tc, "sync_messages 0 0 0 0 INBOX", read_request(client, 1000).c_str());
+    CuAssertStrEquals(tc, "", read_request(client, 0).c_str());
+
+    std::string reply = "{\"uidvalidity\": 3, \"reset\": 1, \"messages\": ["
+                        "{\"id\": 1, \"flags\": \"\\\\Seen\"}, {\"id\": 2, \"flags\": \"\"} ] }";
+    std::string frame = "1 " + std::to_string(reply.size()) + "\n" + reply;
+    CuAssertIntEquals(tc, frame.size(), write(client, frame.data(), frame.size()));
+
+    /*
+     * The reply is applied, and saved, from the main-loop.
+     */
+    for (int i = 0; (i < 100) && (global->get_messages()->size() == 0); i++)
+    {
+        proxy->poll();
+        usleep(10000);
+    }
+
+    CuAssertIntEquals(tc, 2, global->get_messages()->size());
+    CuAssertIntEquals(tc, 2, config->get_integer("index.max"));
+
+    std::string server_dir = home + "/" + escape_filename("imaps://imap.example.com/");
+    std::string folder_dir = server_dir + "/" + escape_filename("INBOX");
+    std::string state      = folder_dir + "/.sync";
+    CuAssertTrue(tc, CFile::exists(state));
+
+    /*
+     * Selecting the folder again shows the messages we saved at once,
+     * and only asks for what has changed since.
+     */
+    global->set_maildir(NULL);
+    global->set_maildir(std::shared_ptr<CMaildir>(new CMaildir("INBOX", false)));
+    global->update_messages();
+
+    CuAssertIntEquals(tc, 2, global->get_messages()->size());
+    CuAssertStrEquals(tc, "sync_messages 3 2 0 2 INBOX", read_request(client, 1000).c_str());
+    CuAssertStrEquals(tc, "", read_request(client, 0).c_str());
+
+    std::shared_ptr<CMessage> first = global->get_messages()->at(0);
+    CuAssertStrEquals(tc, "S", first->get_flags().c_str());
+
+    reply = "{\"uidvalidity\": 3, \"messages\": [ {\"id\": 1, \"flags\": \"\"} ] }";
+    frame = "2 " + std::to_string(reply.size()) + "\n" + reply;
+    CuAssertIntEquals(tc, frame.size(), write(client, frame.data(), frame.size()));
+
+    for (int i = 0; (i < 100) && (first->get_flags() == "S"); i++)
+    {
+        proxy->poll();
+        usleep(10000);
+    }
+
+    /*
+     * The existing message is updated, rather than replaced.
+     */
+    CuAssertIntEquals(tc, 2, global->get_messages()->size());
+    CuAssertPtrEquals(tc, first.get(), global->get_messages()->at(0).get());
+    CuAssertStrEquals(tc, "N", first->get_flags().c_str());
+
+    /*
+     * Cleanup.
+     */
+    config->set("imap.server", "", false);
+    config->set("imap.username", "", false);
+    config->set("imap.password", "", false);
+    global->set_maildir(NULL);
+
+    close(client);
+    close(server);
+    CIMAPProxy::instance()->destroy_instance();
+    setenv("HOME", old_home.c_str(), 1);
+
+    unlink(state.c_str());
+    unlink(std::string(home + "/.imap.sock").c_str());
+    rmdir(folder_dir.c_str());
+    rmdir(server_dir.c_str());
+    rmdir(home.c_str());
+}
+
+
+/**
+ * Test that changing the flags of a message means the index is drawn
+ * afresh, rather than from the lines we fetched before.
+ */
+void TestGlobalStateFlagDamage(CuTest * tc)
+{
+    CGlobalState *global = CGlobalState::instance();
+    CScreen *screen      = CScreen::instance();
+
+    char tmpl[] = "/tmp/lumail.flagsXXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+    mkdir(std::string(prefix + "/cur").c_str(), 0755);
+
+    std::string path = prefix + "/cur/1.host:2,S";
+    std::ofstream out(path);
+    out << "Subject: test\n\nBody\n";
+    out.close();
+
+    std::shared_ptr<CMessage> msg(new CMessage(path));
+
+    /*
+     * Toggling a flag, as `Message.toggle()` does.
+     */
+    uint64_t generation = screen->generation();
+    CuAssertTrue(tc, msg->add_flag('F'));
+    CuAssertTrue(tc, screen->generation() > generation);
+
+    generation = screen->generation();
+    CuAssertTrue(tc, msg->remove_flag('F'));
+    CuAssertTrue(tc, screen->generation() > generation);
+
+    /*
+     * Flagging many messages at once.
+     */
+    CMessageList messages;
+    messages.push_back(msg);
+
+    generation = screen->generation();
+    CuAssertTrue(tc, global->apply_flags(messages, "+F"));
+    CuAssertTrue(tc, screen->generation() > generation);
+    CuAssertStrEquals(tc, "FS", msg->get_flags().c_str());
+
+    /*
+     * Adding and removing the same flag is rejected, and leaves the
+     * message alone.
+     */
+    CuAssertTrue(tc, !global->apply_flags(messages, "+S-S"));
+    CuAssertStrEquals(tc, "FS", msg->get_flags().c_str());
+
+    /*
+     * The cached flags of an IMAP message.
+     */
+    std::shared_ptr<CMessage> remote(new CMessage("1", false));
+
+    generation = screen->generation();
+    remote->set_imap_flags("S");
+    CuAssertTrue(tc, screen->generation() > generation);
+
+    /*
+     * Only the seen-flag may be changed on IMAP messages.
+     */
+    messages.push_back(remote);
+    CuAssertTrue(tc, !global->apply_flags(messages, "+F"));
+    CuAssertStrEquals(tc, "FS", msg->get_flags().c_str());
+    CuAssertStrEquals(tc, "S", remote->get_flags().c_str());
+
+    /*
+     * The updated flags are sorted, as those from the server are.
+     */
+    std::shared_ptr<CMessage> answered(new CMessage("2", false));
+    answered->parent(std::shared_ptr<CMaildir>(new CMaildir("INBOX", false)));
+    answered->set_imap_flags("RS");
+
+    CMessageList replies;
+    replies.push_back(answered);
+    CuAssertTrue(tc, global->apply_flags(replies, "-S"));
+    CuAssertStrEquals(tc, "NR", answered->get_flags().c_str());
+
+    unlink(msg->path().c_str());
+    rmdir(std::string(prefix + "/cur").c_str());
+    rmdir(prefix.c_str());
+}
+
+
+CuSuite *
+global_state_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestGlobalStateIMAPMessages);
+    SUITE_ADD_TEST(suite, TestGlobalStateFlagDamage);
+    return suite;
+}
@@ -0,0 +1,361 @@
+/*
+ * imap_prefetch.cc - Fetch IMAP messages in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <errno.h>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "file.h"
+#include "imap_prefetch.h"
+#include "imap_proxy.h"
+#include "maildir.h"
+
+
+/*
+ * Constructor.
+ */
+CIMAPPrefetch::CIMAPPrefetch()
+{
+    m_stopping = false;
+    m_sock     = -1;
+    m_bytes    = 0;
+    m_budget   = 0;
+}
+
+
+/*
+ * Destructor.
+ */
+CIMAPPrefetch::~CIMAPPrefetch()
+{
+    stop();
+}
+
+
+/*
+ * Replace the queue of messages to fetch.
+ */
+void CIMAPPrefetch::fetch(CMessageList messages)
+{
+    CConfig *config = CConfig::instance();
+    int budget = config->get_integer("imap.prefetch.bytes", 16 * 1024 * 1024);
+
+    if (budget < 1)
+    {
+        stop();
+        return;
+    }
+
+    std::deque<CPrefetchItem> queue;
+    std::string folder;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (!msg->is_imap())
+            continue;
+
+        CPrefetchItem item;
+        item.path   = msg->cache_path();
+        item.folder = msg->parent()->path();
+        item.id     = msg->get_imap_id();
+        queue.push_back(item);
+
+        folder = item.folder;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_queue.swap(queue);
+        m_budget = budget;
+
+        /*
+         * We're called each time the selection moves, so the count of
+         * bytes is only reset when we move to another folder.
+         */
+        if (!folder.empty() && (folder != m_folder))
+        {
+            m_folder = folder;
+            m_bytes  = 0;
+        }
+    }
+
+    if (!m_thread.joinable())
+    {
+        m_sock_path = CIMAPProxy::instance()->socket_path();
+        m_thread    = std::thread(&CIMAPPrefetch::worker, this);
+    }
+
+    m_wake.notify_all();
+}
+
+
+/*
+ * Remove the given message from the queue, or wait for it to be fetched.
+ */
+void CIMAPPrefetch::claim(std::string path)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    for (auto it = m_queue.begin(); it != m_queue.end(); ++it)
+    {
+        if (it->path == path)
+        {
+            m_queue.erase(it);
+            break;
+        }
+    }
+
+    m_done.wait(lock, [this, &path]
+    {
+        return (m_busy.find(path) == m_busy.end());
+    });
+}
+
+
+/*
+ * Discard any queued messages, and stop our worker.
+ */
+void CIMAPPrefetch::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+        m_queue.clear();
+
+        /*
+         * Don't wait for the reply to any request in progress.
+         */
+        if (m_sock != -1)
+            shutdown(m_sock, SHUT_RDWR);
+    }
+
+    m_wake.notify_all();
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_stopping = false;
+}
+
+
+/*
+ * The number of bytes fetched from the current folder.
+ */
+size_t CIMAPPrefetch::fetched()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return (m_bytes);
+}
+
+
+/*
+ * The body of our worker-thread.
+ */
+void CIMAPPrefetch::worker()
+{
+    int sock = -1;
+
+    while (true)
+    {
+        CPrefetchItem item;
+
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [this]
+            {
+                return (m_stopping || !m_queue.empty());
+            });
+
+            if (m_stopping)
+                break;
+
+            item = m_queue.front();
+            m_queue.pop_front();
+
+            /*
+             * Once we've fetched enough from this folder we stop.
+             */
+            if (m_bytes >= m_budget)
+            {
+                m_queue.clear();
+                continue;
+            }
+
+            if (m_busy.find(item.path) != m_busy.end())
+                continue;
+
+            m_busy.insert(item.path);
+        }
+
+        std::string body;
+        bool fetched = false;
+
+        if (!CFile::exists(item.path) && request(sock, item, body))
+        {
+            /*
+             * Write to a temporary file, and rename it into place, so
+             * that the message appears complete, or not at all.
+             */
+            std::string tmp = item.path + ".part";
+            std::ofstream fs(tmp, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+            fs << body;
+            fs.close();
+
+            if (fs.good() && (rename(tmp.c_str(), item.path.c_str()) == 0))
+                fetched = true;
+            else
+                unlink(tmp.c_str());
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_busy.erase(item.path);
+
+            if (fetched)
+                m_bytes += body.size();
+        }
+
+        m_done.notify_all();
+    }
+
+    if (sock != -1)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_sock = -1;
+        close(sock);
+    }
+}
+
+
+/*
+ * Fetch the body of a single message over the given connection.
+ */
+bool CIMAPPrefetch::request(int &sock, CPrefetchItem &item, std::string &body)
+{
+    if (sock == -1)
+    {
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (sock < 0)
+            return false;
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, m_sock_path.c_str(), sizeof(addr.sun_path) - 1);
+
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            close(sock);
+            sock = -1;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        /*
+         * We might have been asked to stop while connecting.
+         */
+        if (m_stopping)
+            shutdown(sock, SHUT_RDWR);
+
+        m_sock = sock;
+    }
+
+    /*
+     * We only have one request outstanding, so its ID is always the same.
+     */
+    std::string cmd = "get_message " + std::to_string(item.id) + " " + item.folder;
+    std::string out = "1 " + std::to_string(cmd.size()) + "\n" + cmd;
+
+    bool ok = true;
+    size_t done = 0;
+
+    while (ok && (done < out.size()))
+    {
+        ssize_t wrote = send(sock, out.data() + done, out.size() - done, MSG_NOSIGNAL);
+
+        if (wrote > 0)
+            done += wrote;
+        else if ((wrote < 0) && (errno == EINTR))
+            continue;
+        else
+            ok = false;
+    }
+
+    /*
+     * Read the header of the reply, then the reply itself.
+     */
+    std::string input;
+    size_t length = std::string::npos;
+    char buf[65536];
+
+    while (ok)
+    {
+        if (length == std::string::npos)
+        {
+            size_t nl = input.find('\n');
+
+            if (nl != std::string::npos)
+            {
+                const char *space = strchr(input.c_str(), ' ');
+
+                if ((space == NULL) || (atoi(input.c_str()) != 1))
+                {
+                    ok = false;
+                    break;
+                }
+
+                length = strtoul(space + 1, NULL, 10);
+                input.erase(0, nl + 1);
+            }
+        }
+
+        if ((length != std::string::npos) && (input.size() >= length))
+            break;
+
+        ssize_t got = read(sock, buf, sizeof(buf));
+
+        if (got > 0)
+            input.append(buf, got);
+        else if ((got < 0) && (errno == EINTR))
+            continue;
+        else
+            ok = false;
+    }
+
+    if (!ok)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_sock = -1;
+        close(sock);
+        sock = -1;
+        return false;
+    }
+
+    body = input.substr(0, length);
+    return true;
+}
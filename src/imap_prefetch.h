@@ -0,0 +1,156 @@
+/*
+ * imap_prefetch.h - Fetch IMAP messages in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+#include "message.h"
+#include "singleton.h"
+
+
+/**
+ * The CIMAPPrefetch class is a singleton which fetches the bodies of
+ * IMAP messages into our cache, ahead of their being opened.
+ *
+ * A single worker-thread keeps its own connection to the IMAP proxy,
+ * and takes messages from a queue, nearest-first.  The proxy carries
+ * out one request at a time, over one connection to the server, so
+ * more workers would fetch no faster.  Each body is written to a
+ * temporary file which is then renamed into place, so a message in the
+ * cache is always complete.
+ *
+ * The number of bytes fetched from a folder is limited by
+ * `imap.prefetch.bytes`, and only starts again from zero once messages
+ * from a different folder are fetched.
+ */
+class CIMAPPrefetch : public Singleton<CIMAPPrefetch>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CIMAPPrefetch();
+
+    /**
+     * Destructor - stop our worker.
+     */
+    ~CIMAPPrefetch();
+
+    /**
+     * Replace the queue of messages to fetch with the given ones, which
+     * should be ordered most-wanted first.  This never blocks.
+     */
+    void fetch(CMessageList messages);
+
+    /**
+     * We're about to fetch the message with the given path ourselves:
+     * remove it from the queue, or wait for our worker if it is already
+     * fetching it.
+     */
+    void claim(std::string path);
+
+    /**
+     * Discard any queued messages, and stop our worker.
+     */
+    void stop();
+
+    /**
+     * The number of bytes fetched from the current folder.
+     */
+    size_t fetched();
+
+private:
+
+    /**
+     * A message to fetch.
+     */
+    struct CPrefetchItem
+    {
+        std::string path;
+        std::string folder;
+        int id;
+    };
+
+    /**
+     * The body of our worker-thread.
+     */
+    void worker();
+
+    /**
+     * Fetch the body of a single message over the given connection,
+     * opening it first if required.  On failure the connection is
+     * closed, and false returned.
+     */
+    bool request(int &sock, CPrefetchItem &item, std::string &body);
+
+private:
+
+    /**
+     * Protects everything below.
+     */
+    std::mutex m_lock;
+
+    /**
+     * Our worker waits here for work, and `claim` for our worker.
+     */
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    /**
+     * The messages waiting to be fetched.
+     */
+    std::deque<CPrefetchItem> m_queue;
+
+    /**
+     * The paths of the messages being fetched right now.
+     */
+    std::unordered_set<std::string> m_busy;
+
+    /**
+     * Our worker, and its connection to the proxy.
+     */
+    std::thread m_thread;
+    int m_sock;
+
+    /**
+     * Set when our worker should exit.
+     */
+    bool m_stopping;
+
+    /**
+     * The folder we're fetching from, the bytes fetched from it, and
+     * the number we may fetch.
+     */
+    std::string m_folder;
+    size_t m_bytes;
+    size_t m_budget;
+
+    /**
+     * The path to the socket of the IMAP proxy.
+     */
+    std::string m_sock_path;
+};
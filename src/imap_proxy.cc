@@ -17,29 +17,39 @@
  */
 
 
+#include <algorithm>
 #include <cstdlib>
+#include <errno.h>
 #include <fcntl.h>
 #include <memory>
+#include <poll.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 
 #include "config.h"
 #include "file.h"
+#include "imap_prefetch.h"
 #include "imap_proxy.h"
 #include "statuspanel.h"
+#include "util.h"
 
 
 CIMAPProxy::CIMAPProxy()
 {
-    m_child = -1;
+    m_child    = -1;
+    m_sock     = -1;
+    m_next_id  = 1;
+    m_launched = 0;
 
     /*
      * Use ~/.imap.sock as the path.
@@ -63,6 +73,17 @@ CIMAPProxy::~CIMAPProxy()
  */
 void CIMAPProxy::terminate()
 {
+    /*
+     * Stop fetching messages in the background.
+     */
+    CIMAPPrefetch::instance()->stop();
+
+    /*
+     * Ensure the proxy has carried out everything we've asked of it.
+     */
+    flush();
+    disconnect();
+
     if (m_child != -1)
     {
         kill(m_child, SIGKILL);
@@ -98,8 +119,6 @@ void CIMAPProxy::launch()
         if (CFile::exists(path))
         {
             CStatusPanel *panel = CStatusPanel::instance();
-            int i;
-
             panel->add_text("Launching IMAP proxy " + path);
 
             unlink(m_sock_path.c_str());
@@ -111,18 +130,11 @@ void CIMAPProxy::launch()
                 exit(1);
             }
 
-            for (i = 0; i < 100; i++)
-            {
-                if (access(m_sock_path.c_str(), F_OK) == 0)
-                {
-                    /*
-                     * Done waiting, successfully.
-                     */
-                    return;
-                }
-                usleep(100000);
-            }
-            panel->add_text("Timed out waiting for IMAP proxy");
+            /*
+             * We don't wait for the proxy to start listening here, that
+             * happens as we connect to it.
+             */
+            m_launched = time(NULL);
         }
         else
         {
@@ -140,51 +152,462 @@ void CIMAPProxy::launch()
  */
 std::string CIMAPProxy::read_imap_output(std::string cmd)
 {
-    int sockfd;
-    sockaddr_un addr;
-    size_t unused __attribute__((unused));
-    std::string result = "";
+    /*
+     * If we were already connected the proxy might have closed our
+     * connection since, in which case we'll try once more.
+     */
+    bool connected = (m_sock != -1);
+
+    std::string result = wait_for(send_command(cmd));
+
+    if (connected && (m_sock == -1) && (result == "Connection failed!"))
+        result = wait_for(send_command(cmd));
+
+    return (result);
+}
+
+
+/*
+ * Send a command to our IMAP proxy, without waiting for the reply.
+ */
+int CIMAPProxy::send_command(std::string cmd, bool discard)
+{
+    if (! connect_proxy(true))
+        return -1;
+
+    int id = queue(cmd);
+
+    if (discard)
+        m_discard.insert(id);
+
+    /*
+     * Write the request.  We only wait for room to do so, not for the
+     * reply, but we read any replies which arrive meanwhile so that the
+     * proxy is never blocked writing them.
+     */
+    while ((m_sock != -1) && (! m_output.empty()))
+        pump(true);
+
+    if (m_sock == -1)
+        return -1;
+
+    return (id);
+}
+
+
+/*
+ * Send a command to our IMAP proxy, without blocking, and arrange for
+ * the reply to be given to the callback.
+ */
+int CIMAPProxy::send_async(std::string cmd, CIMAPCallback callback)
+{
+    /*
+     * The request is queued before we connect, so that it will be sent
+     * once the proxy has started - or fail if it never does.
+     */
+    int id = queue(cmd);
+    m_callbacks[id] = callback;
+
+    if (connect_proxy(false))
+        pump(false);
+
+    return (id);
+}
+
+
+/*
+ * Send what we can, read what we can, and give any replies which have
+ * arrived to their callbacks.
+ */
+bool CIMAPProxy::poll()
+{
+    if (m_callbacks.empty())
+        return false;
+
+    if (connect_proxy(false))
+    {
+        while (pump(false))
+            ;
+    }
+
+    /*
+     * Collect the callbacks first, in the order the requests were made,
+     * since they might well send further requests.
+     */
+    std::vector<std::pair<CIMAPCallback, std::string> > ready;
+
+    for (auto it = m_callbacks.begin(); it != m_callbacks.end();)
+    {
+        auto reply = m_replies.find(it->first);
+
+        if (reply == m_replies.end())
+        {
+            ++it;
+            continue;
+        }
+
+        ready.push_back(std::make_pair(it->second, reply->second));
+        m_replies.erase(reply);
+        it = m_callbacks.erase(it);
+    }
+
+    for (auto &entry : ready)
+        entry.first(entry.second);
+
+    return (! ready.empty());
+}
+
+
+/*
+ * Add a request to our output.
+ */
+int CIMAPProxy::queue(std::string cmd)
+{
+    /*
+     * The length of the command delimits it, rather than a newline.
+     */
+    while ((! cmd.empty()) && (cmd[cmd.size() - 1] == '\n'))
+        cmd.erase(cmd.size() - 1);
+
+    int id = m_next_id++;
+
+    m_output += std::to_string(id) + " " + std::to_string(cmd.size()) + "\n" + cmd;
+    m_outstanding.insert(id);
+
+    return (id);
+}
+
+
+/*
+ * Wait for the reply to the given request.
+ */
+std::string CIMAPProxy::wait_for(int id)
+{
+    while (id != -1)
+    {
+        auto it = m_replies.find(id);
+
+        if (it != m_replies.end())
+        {
+            std::string result = it->second;
+            m_replies.erase(it);
+            return (result);
+        }
+
+        /*
+         * If the request isn't outstanding our connection failed.
+         */
+        if (m_outstanding.find(id) == m_outstanding.end())
+            break;
+
+        if (! pump(true))
+            break;
+    }
+
+    return ("Connection failed!");
+}
+
+
+/*
+ * Wait for the replies to every request we've sent.
+ */
+void CIMAPProxy::flush()
+{
+    while ((m_sock != -1) && (! m_outstanding.empty()))
+        pump(true);
+}
+
+
+/*
+ * The path to the socket upon which the proxy listens.
+ */
+std::string CIMAPProxy::socket_path()
+{
+    return (m_sock_path);
+}
+
+
+/*
+ * Return the given message-IDs as an IMAP UID-set.
+ */
+std::string CIMAPProxy::uid_set(std::vector<int> ids)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    std::string result;
+
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        /*
+         * Find the end of the run of consecutive IDs starting here.
+         */
+        size_t end = i;
+
+        while ((end + 1 < ids.size()) && (ids[end + 1] == ids[end] + 1))
+            end++;
+
+        if (! result.empty())
+            result += ",";
+
+        result += std::to_string(ids[i]);
+
+        if (end > i)
+            result += ":" + std::to_string(ids[end]);
+
+        i = end;
+    }
+
+    return (result);
+}
+
+
+/*
+ * Return the message-IDs in the given IMAP UID-set.
+ */
+std::vector<int> CIMAPProxy::parse_uid_set(std::string set)
+{
+    std::vector<int> ids;
+
+    for (std::string range : split(set, ','))
+    {
+        if (range.empty() || (range.find_first_not_of("0123456789:") != std::string::npos))
+            continue;
+
+        size_t colon = range.find(':');
+        int first    = atoi(range.substr(0, colon).c_str());
+        int last     = first;
+
+        if (colon != std::string::npos)
+            last = atoi(range.substr(colon + 1).c_str());
+
+        if (last < first)
+            std::swap(first, last);
+
+        for (int id = first; id <= last; id++)
+            ids.push_back(id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    return (ids);
+}
+
+
+/*
+ * Connect to the proxy, launching it if required.
+ */
+bool CIMAPProxy::connect_proxy(bool block)
+{
+    if (m_sock != -1)
+        return true;
 
     /*
      * Launch the child.
      */
     launch();
 
+    while (true)
+    {
+        int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (sockfd < 0)
+            break;
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, m_sock_path.c_str(), sizeof(addr.sun_path) - 1);
+
+        if (connect(sockfd, (sockaddr*)&addr, sizeof(addr)) == 0)
+        {
+            /*
+             * We never want to block writing, since the proxy might be
+             * blocked writing replies to us.
+             */
+            fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+            m_sock = sockfd;
+            return true;
+        }
+
+        close(sockfd);
 
-    sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-    addr.sun_family = AF_UNIX;
+        /*
+         * If the proxy is still starting we'll try again - now, or the
+         * next time we're polled.
+         */
+        if (! starting())
+        {
+            if (m_child != -1)
+                CStatusPanel::instance()->add_text("Timed out waiting for IMAP proxy");
+
+            break;
+        }
 
-    strcpy(addr.sun_path, m_sock_path.c_str());
+        if (! block)
+            return false;
 
-    if (connect(sockfd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        usleep(100000);
+    }
+
+    /*
+     * Fail any requests we were waiting to send.
+     */
+    disconnect();
+    return false;
+}
+
+
+/*
+ * Is the proxy we launched still starting up?
+ */
+bool CIMAPProxy::starting()
+{
+    if (m_child == -1)
+        return false;
+
+    /*
+     * If it exited it will never start.
+     */
+    if (waitpid(m_child, NULL, WNOHANG) == m_child)
+    {
+        m_child = -1;
+        return false;
+    }
+
+    return (time(NULL) < m_launched + 10);
+}
+
+
+/*
+ * Close our connection, failing any outstanding requests.
+ */
+void CIMAPProxy::disconnect()
+{
+    if (m_sock != -1)
     {
-        return ("Connection failed!");
+        close(m_sock);
+        m_sock = -1;
     }
 
-    unused = write(sockfd, cmd.c_str(), cmd.length());
+    /*
+     * Requests with a callback are told of the failure.
+     */
+    for (int id : m_outstanding)
+    {
+        if (m_callbacks.find(id) != m_callbacks.end())
+            m_replies[id] = "Connection failed!";
+    }
+
+    m_output.clear();
+    m_input.clear();
+    m_outstanding.clear();
+    m_discard.clear();
+}
+
+
+/*
+ * Write any pending requests, and read any replies which have arrived.
+ */
+bool CIMAPProxy::pump(bool block)
+{
+    if (m_sock == -1)
+        return false;
+
+    struct pollfd pfd;
+    pfd.fd      = m_sock;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+
+    if (! m_output.empty())
+        pfd.events |= POLLOUT;
+
+    int rc = ::poll(&pfd, 1, block ? -1 : 0);
+
+    if (rc < 0)
+    {
+        if (errno == EINTR)
+            return true;
+
+        disconnect();
+        return false;
+    }
 
-    char buf[65535];
-    int rval;
+    if (rc == 0)
+        return false;
 
-    do
+    if (pfd.revents & POLLOUT)
     {
-        bzero(buf, sizeof(buf));
+        ssize_t wrote = send(m_sock, m_output.data(), m_output.size(), MSG_NOSIGNAL);
 
-        if ((rval = read(sockfd, buf, sizeof(buf) - 1)) < 0)
+        if (wrote > 0)
+            m_output.erase(0, wrote);
+        else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
         {
-            // Failure
+            disconnect();
+            return false;
         }
-        else if (rval == 0)
+    }
+
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        char buf[65536];
+        ssize_t got = read(m_sock, buf, sizeof(buf));
+
+        if (got > 0)
         {
-            // End.
+            m_input.append(buf, got);
+
+            if (! parse_replies())
+            {
+                disconnect();
+                return false;
+            }
         }
-        else
+        else if ((got == 0) ||
+                 ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
         {
-            result += buf;
+            disconnect();
+            return false;
         }
     }
-    while (rval > 0);
 
-    close(sockfd);
-    return (result);
+    return true;
+}
+
+
+/*
+ * Parse any complete replies we've read.
+ *
+ * Each reply is a line holding the ID of the request, and the length of
+ * the reply, followed by the reply itself.
+ */
+bool CIMAPProxy::parse_replies()
+{
+    while (true)
+    {
+        size_t nl = m_input.find('\n');
+
+        if (nl == std::string::npos)
+            return true;
+
+        int id   = 0;
+        long len = -1;
+
+        if ((sscanf(m_input.substr(0, nl).c_str(), "%d %ld", &id, &len) != 2) || (len < 0))
+            return false;
+
+        if (m_input.size() < nl + 1 + (size_t)len)
+            return true;
+
+        std::string reply = m_input.substr(nl + 1, len);
+        m_input.erase(0, nl + 1 + len);
+
+        m_outstanding.erase(id);
+
+        if (m_discard.erase(id) == 0)
+            m_replies[id] = reply;
+    }
 }
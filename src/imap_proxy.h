@@ -19,13 +19,33 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "singleton.h"
 
+
+/**
+ * A function to be called with the reply to an asynchronous request.
+ */
+typedef std::function<void(std::string)> CIMAPCallback;
+
 /**
  * The CImapProxy class is a singleton which is responsible for
- * launching our (perl) IMAP-proxy.
+ * launching our (perl) IMAP-proxy, and talking to it.
+ *
+ * We keep a single connection open to the proxy, upon which each
+ * command is sent as a request with an ID, and the length of the
+ * command, and each reply is returned in the same way.  This allows
+ * many commands to be sent without waiting for the reply to each.
+ *
+ * Requests made via `send_async` never block, not even whilst the proxy
+ * is starting.  Their replies are collected by `poll`, which is called
+ * from the main-loop, and given to the callback of each request.
  *
  */
 class CIMAPProxy : public Singleton<CIMAPProxy>
@@ -49,6 +69,59 @@ public:
      */
     std::string read_imap_output(std::string cmd);
 
+    /**
+     * Send a command to our IMAP proxy, launching it first if required,
+     * without waiting for the reply.
+     *
+     * Returns the ID of the request, for use with `wait_for`, or -1 on
+     * failure.  If `discard` is true the reply will be ignored.
+     */
+    int send_command(std::string cmd, bool discard = false);
+
+    /**
+     * Send a command to our IMAP proxy, launching it first if required,
+     * without blocking.  The reply is given to the callback, from `poll`,
+     * or "Connection failed!" if the proxy couldn't be reached.
+     *
+     * Returns the ID of the request.
+     */
+    int send_async(std::string cmd, CIMAPCallback callback);
+
+    /**
+     * Send and receive whatever we can without blocking, then invoke
+     * the callbacks of any asynchronous requests which have completed.
+     *
+     * Returns true if any callbacks were invoked.
+     */
+    bool poll();
+
+    /**
+     * Wait for the reply to the given request.
+     */
+    std::string wait_for(int id);
+
+    /**
+     * Wait for the replies to every request we've sent.
+     */
+    void flush();
+
+    /**
+     * The path to the socket upon which the proxy listens.
+     */
+    std::string socket_path();
+
+    /**
+     * Return the given message-IDs as an IMAP UID-set, such as
+     * "1:5,7,9:10", suitable for sending in a single command.
+     */
+    static std::string uid_set(std::vector<int> ids);
+
+    /**
+     * Return the message-IDs in the given IMAP UID-set, in order.  Any
+     * ranges using `*` are ignored.
+     */
+    static std::vector<int> parse_uid_set(std::string set);
+
     /**
      * Launch an IMAP-proxy.
      */
@@ -59,14 +132,89 @@ public:
      */
     void terminate();
 
+private:
+
+    /**
+     * Connect to the proxy, if we're not already connected.
+     *
+     * If we've just launched the proxy, and `block` is true, we wait for
+     * it to start listening.  Otherwise we return false, and will try
+     * again next time.
+     */
+    bool connect_proxy(bool block);
+
+    /**
+     * Is the proxy we launched still starting up?
+     */
+    bool starting();
+
+    /**
+     * Add a request to our output, returning its ID.
+     */
+    int queue(std::string cmd);
+
+    /**
+     * Close our connection, failing any outstanding requests.
+     */
+    void disconnect();
+
+    /**
+     * Write any pending requests, and read any replies which have
+     * arrived.  If `block` is true we wait until one of those is
+     * possible, otherwise we return false if neither was.
+     */
+    bool pump(bool block);
+
+    /**
+     * Parse any complete replies we've read.
+     */
+    bool parse_replies();
+
 private:
     /**
      * The handle to our child-process.
      */
     pid_t m_child;
 
+    /**
+     * When we launched our child.
+     */
+    time_t m_launched;
+
     /**
      * Path to the IMAP proxy socket.
      */
     std::string m_sock_path;
+
+    /**
+     * Our connection to the proxy, or -1.
+     */
+    int m_sock;
+
+    /**
+     * The ID of the next request.
+     */
+    int m_next_id;
+
+    /**
+     * Requests we've not yet written, and replies we've not yet parsed.
+     */
+    std::string m_output;
+    std::string m_input;
+
+    /**
+     * The requests awaiting a reply, and those whose reply is ignored.
+     */
+    std::unordered_set<int> m_outstanding;
+    std::unordered_set<int> m_discard;
+
+    /**
+     * Replies which have arrived, but not been collected.
+     */
+    std::unordered_map<int, std::string> m_replies;
+
+    /**
+     * The callbacks of asynchronous requests, by ID.
+     */
+    std::map<int, CIMAPCallback> m_callbacks;
 };
@@ -0,0 +1,76 @@
+/*
+ * imap_proxy_test.cc - Test-cases for our CIMAPProxy class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "imap_proxy.h"
+#include "CuTest.h"
+
+
+/**
+ * Test the building of UID-sets.
+ */
+void TestIMAPUIDSet(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "", CIMAPProxy::uid_set({}).c_str());
+    CuAssertStrEquals(tc, "7", CIMAPProxy::uid_set({7}).c_str());
+    CuAssertStrEquals(tc, "1:3", CIMAPProxy::uid_set({1, 2, 3}).c_str());
+    CuAssertStrEquals(tc, "1:2,4,6:8", CIMAPProxy::uid_set({1, 2, 4, 6, 7, 8}).c_str());
+
+    /*
+     * The IDs are sorted, and duplicates removed.
+     */
+    CuAssertStrEquals(tc, "1:3,10", CIMAPProxy::uid_set({10, 3, 1, 2, 2}).c_str());
+}
+
+
+/**
+ * Test the parsing of UID-sets.
+ */
+void TestIMAPParseUIDSet(CuTest * tc)
+{
+    CuAssertIntEquals(tc, 0, CIMAPProxy::parse_uid_set("").size());
+
+    std::vector<int> ids = CIMAPProxy::parse_uid_set("1:2,4,8:6");
+    CuAssertIntEquals(tc, 6, ids.size());
+    CuAssertIntEquals(tc, 1, ids[0]);
+    CuAssertIntEquals(tc, 4, ids[2]);
+    CuAssertIntEquals(tc, 8, ids[5]);
+
+    /*
+     * We can parse what we build.
+     */
+    CuAssertStrEquals(tc, "1:2,4,6:8",
+                      CIMAPProxy::uid_set(CIMAPProxy::parse_uid_set("1:2,4,6:8")).c_str());
+
+    /*
+     * Open-ended ranges, and rubbish, are ignored.
+     */
+    CuAssertIntEquals(tc, 1, CIMAPProxy::parse_uid_set("3,5:*,x").size());
+}
+
+
+CuSuite *
+imap_proxy_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestIMAPUIDSet);
+    SUITE_ADD_TEST(suite, TestIMAPParseUIDSet);
+    return suite;
+}
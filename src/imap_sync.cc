@@ -0,0 +1,375 @@
+/*
+ * imap_sync.cc - The synchronisation state of an IMAP folder.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "imap_proxy.h"
+#include "imap_sync.h"
+#include "json/json.h"
+#include "util.h"
+
+
+/*
+ * The first line of our on-disk state.
+ */
+static const std::string STATE_HEADER = "lumail-imap-sync 1";
+
+
+/*
+ * Read a number from the proxy's reply, which might have been sent
+ * as a string.
+ */
+static uint64_t json_number(const Json::Value &value)
+{
+    if (value.isString())
+        return (strtoull(value.asCString(), NULL, 10));
+
+    if (value.isUInt64())
+        return (value.asUInt64());
+
+    return 0;
+}
+
+
+/*
+ * Constructor.
+ */
+CIMAPSync::CIMAPSync(std::string folder, std::string directory)
+{
+    m_folder      = folder;
+    m_directory   = directory;
+    m_uidvalidity = 0;
+    m_highest     = 0;
+    m_modseq      = 0;
+    m_dirty       = false;
+    m_reset       = false;
+}
+
+
+/*
+ * The path to our on-disk state.
+ */
+std::string CIMAPSync::state_file()
+{
+    return (m_directory + "/.sync");
+}
+
+
+/*
+ * The path to the cached body of the message with the given UID.
+ */
+std::string CIMAPSync::body_file(int uid)
+{
+    return (m_directory + "/" + std::to_string(uid));
+}
+
+
+/*
+ * Remove the cached bodies of every message.
+ *
+ * We look at the directory, rather than our list of messages, as the
+ * state might have been lost while the bodies were not.
+ */
+void CIMAPSync::remove_bodies()
+{
+    DIR *dp = opendir(m_directory.c_str());
+
+    if (dp == NULL)
+        return;
+
+    dirent *de;
+
+    while ((de = readdir(dp)) != NULL)
+    {
+        const char *name = de->d_name;
+
+        if (*name == '\0')
+            continue;
+
+        while (isdigit(*name))
+            name++;
+
+        /*
+         * A body is named by its UID, or by its UID and ".part" while
+         * it is being written.
+         */
+        if ((name != de->d_name) && ((*name == '\0') || (strcmp(name, ".part") == 0)))
+            unlink((m_directory + "/" + de->d_name).c_str());
+    }
+
+    closedir(dp);
+}
+
+
+/*
+ * Load our state from disk, if present.
+ */
+bool CIMAPSync::load()
+{
+    std::ifstream input(state_file());
+    std::string line;
+
+    if (!getline(input, line) || (line != STATE_HEADER))
+        return false;
+
+    if (!getline(input, line))
+        return false;
+
+    uint64_t uidvalidity = 0, highest = 0, modseq = 0;
+    std::istringstream counters(line);
+
+    if (!(counters >> uidvalidity >> highest >> modseq))
+        return false;
+
+    std::map<int, std::string> flags;
+
+    while (getline(input, line))
+    {
+        size_t space = line.find(' ');
+
+        if (space == std::string::npos)
+            continue;
+
+        flags[atoi(line.substr(0, space).c_str())] = line.substr(space + 1);
+    }
+
+    m_uidvalidity = uidvalidity;
+    m_highest     = highest;
+    m_modseq      = modseq;
+    m_flags.swap(flags);
+    m_dirty       = false;
+
+    return true;
+}
+
+
+/*
+ * Write our state to disk, if it has changed.
+ */
+bool CIMAPSync::save()
+{
+    if (!m_dirty)
+        return true;
+
+    std::string buf = STATE_HEADER + "\n";
+    buf += std::to_string(m_uidvalidity) + " " + std::to_string(m_highest) + " " +
+           std::to_string(m_modseq) + "\n";
+
+    for (auto it = m_flags.begin(); it != m_flags.end(); ++it)
+        buf += std::to_string(it->first) + " " + it->second + "\n";
+
+    /*
+     * Write to a temporary file, then rename into place, so that an
+     * interrupted write never leaves us with a partial state.
+     */
+    std::string file = state_file();
+    std::string tmp  = file + ".tmp";
+
+    FILE *f = fopen(tmp.c_str(), "wb");
+
+    if (f == NULL)
+        return false;
+
+    bool ok = (fwrite(buf.data(), 1, buf.size(), f) == buf.size());
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok)
+        ok = (rename(tmp.c_str(), file.c_str()) == 0);
+    else
+        unlink(tmp.c_str());
+
+    if (ok)
+        m_dirty = false;
+
+    return ok;
+}
+
+
+/*
+ * The command to send to the IMAP proxy to bring us up to date.
+ */
+std::string CIMAPSync::command()
+{
+    return ("sync_messages " + std::to_string(m_uidvalidity) + " " +
+            std::to_string(m_highest) + " " + std::to_string(m_modseq) + " " +
+            std::to_string(m_flags.size()) + " " + m_folder + "\n");
+}
+
+
+/*
+ * Update our state from the proxy's reply.
+ */
+int CIMAPSync::apply(std::string json)
+{
+    Json::Value root;
+    Json::Reader reader;
+
+    if (!reader.parse(json, root) || !root.isObject())
+        return -1;
+
+    int changes = 0;
+
+    /*
+     * If the folder has been recreated then the UIDs we know of are
+     * meaningless, and we start again.  So too are the bodies we've
+     * cached, which might now be shown for a different message.
+     */
+    uint64_t uidvalidity = json_number(root["uidvalidity"]);
+
+    m_reset = (json_number(root["reset"]) || (uidvalidity != m_uidvalidity));
+
+    if (m_reset)
+    {
+        changes  += m_flags.size();
+        m_flags.clear();
+        m_highest = 0;
+        m_modseq  = 0;
+        remove_bodies();
+    }
+
+    /*
+     * If we've been sent the UIDs which remain then forget those which
+     * have been expunged.
+     */
+    if (root.isMember("uids"))
+    {
+        std::vector<int> uids = CIMAPProxy::parse_uid_set(root["uids"].asString());
+
+        for (auto it = m_flags.begin(); it != m_flags.end();)
+        {
+            if (std::binary_search(uids.begin(), uids.end(), it->first))
+            {
+                ++it;
+            }
+            else
+            {
+                unlink(body_file(it->first).c_str());
+                it = m_flags.erase(it);
+                changes += 1;
+            }
+        }
+    }
+
+    /*
+     * Record the new messages, and the changed flags.
+     */
+    Json::Value messages = root["messages"];
+
+    for (Json::ValueConstIterator it = messages.begin(); it != messages.end(); ++it)
+    {
+        int id            = json_number((*it)["id"]);
+        std::string flags = convert_flags((*it)["flags"].asString());
+
+        if (id <= 0)
+            continue;
+
+        auto found = m_flags.find(id);
+
+        if ((found == m_flags.end()) || (found->second != flags))
+        {
+            m_flags[id] = flags;
+            changes += 1;
+        }
+
+        m_highest = std::max(m_highest, (uint64_t)id);
+    }
+
+    uint64_t highest = std::max(m_highest, json_number(root["highest"]));
+    uint64_t modseq  = json_number(root["modseq"]);
+
+    if ((changes > 0) || (uidvalidity != m_uidvalidity) ||
+            (highest != m_highest) || (modseq != m_modseq))
+        m_dirty = true;
+
+    m_uidvalidity = uidvalidity;
+    m_highest     = highest;
+    m_modseq      = modseq;
+
+    return changes;
+}
+
+
+/*
+ * Did the last reply reset the UIDs of the folder?
+ */
+bool CIMAPSync::was_reset()
+{
+    return (m_reset);
+}
+
+
+/*
+ * The cache-directory of the folder.
+ */
+std::string CIMAPSync::directory()
+{
+    return (m_directory);
+}
+
+
+/*
+ * The flags of each message, keyed by UID.
+ */
+const std::map<int, std::string> &CIMAPSync::messages()
+{
+    return (m_flags);
+}
+
+
+/*
+ * Convert a list of IMAP flags to the flags we use.
+ */
+std::string CIMAPSync::convert_flags(std::string flags)
+{
+    std::string f;
+
+    for (std::string flag : split(flags, ','))
+    {
+        if (flag == "\\Seen")
+            f += "S";
+
+        if (flag == "\\Unseen")
+            f += "N";
+
+        if (flag == "\\Answered")
+            f += "R";
+    }
+
+    /*
+     * Empty flag == new message.
+     */
+    if (f.empty())
+        f = "N";
+
+    /*
+     * Sort the flags, as CMessage does.
+     */
+    std::sort(f.begin(), f.end());
+    f.erase(std::unique(f.begin(), f.end()), f.end());
+
+    return (f);
+}
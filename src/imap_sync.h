@@ -0,0 +1,163 @@
+/*
+ * imap_sync.h - The synchronisation state of an IMAP folder.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+
+/**
+ * This class records what we know of a single remote IMAP folder, so that
+ * it may be brought up to date without listing every message again.
+ *
+ * We store the UIDVALIDITY of the folder, the highest UID we've seen, the
+ * highest MODSEQ we've seen - if the server supports CONDSTORE - and the
+ * UID and flags of each message.  This is kept in a small text file in
+ * the cache-directory of the folder.
+ *
+ * The `sync_messages` command we send to the proxy includes this state,
+ * and the proxy replies with only the messages which are new, or whose
+ * flags have changed.  If messages have been expunged the UIDs which
+ * remain are included too, as a UID-set.  If the UIDVALIDITY of the
+ * folder has changed then every message is listed afresh.
+ *
+ * The bodies of the messages are cached in the same directory, named
+ * by UID.  They are removed when their message is expunged, and all of
+ * them are removed when the UIDs are reset, since a UID may then refer
+ * to a different message.
+ */
+class CIMAPSync
+{
+public:
+
+    /**
+     * Constructor.  The directory is where we cache the messages of the
+     * given folder.
+     */
+    CIMAPSync(std::string folder, std::string directory);
+
+    /**
+     * Load our state from disk, if present.
+     */
+    bool load();
+
+    /**
+     * Write our state to disk, if it has changed since it was loaded.
+     */
+    bool save();
+
+    /**
+     * The path to our on-disk state.
+     */
+    std::string state_file();
+
+    /**
+     * The cache-directory of the folder.
+     */
+    std::string directory();
+
+    /**
+     * The path to the cached body of the message with the given UID.
+     */
+    std::string body_file(int uid);
+
+    /**
+     * The command to send to the IMAP proxy to bring us up to date.
+     */
+    std::string command();
+
+    /**
+     * Update our state from the proxy's reply to `command`.
+     *
+     * Returns the number of messages which were added, removed, or
+     * changed, or -1 if the reply could not be parsed.
+     */
+    int apply(std::string json);
+
+    /**
+     * Did the last reply we applied reset the UIDs of the folder?
+     */
+    bool was_reset();
+
+    /**
+     * The flags of each message, in the form lumail uses, keyed by UID.
+     */
+    const std::map<int, std::string> &messages();
+
+    /**
+     * Convert a comma-separated list of IMAP flags to the flags we use,
+     * such as "S" for a message which has been seen.  The result is
+     * sorted, as `CMessage::get_flags` is.
+     */
+    static std::string convert_flags(std::string flags);
+
+private:
+
+    /**
+     * The remote folder.
+     */
+    std::string m_folder;
+
+    /**
+     * The cache-directory of the folder.
+     */
+    std::string m_directory;
+
+    /**
+     * The UIDVALIDITY of the folder, when we last synchronised.
+     */
+    uint64_t m_uidvalidity;
+
+    /**
+     * The highest UID we've seen.
+     */
+    uint64_t m_highest;
+
+    /**
+     * The highest MODSEQ we've seen, or zero if the server doesn't
+     * support CONDSTORE.
+     */
+    uint64_t m_modseq;
+
+    /**
+     * The flags of each message, keyed by UID.
+     */
+    std::map<int, std::string> m_flags;
+
+    /**
+     * Has our state changed since it was loaded, or saved?
+     */
+    bool m_dirty;
+
+    /**
+     * Did the last reply reset the UIDs of the folder?
+     */
+    bool m_reset;
+
+private:
+
+    /**
+     * Remove the cached bodies of every message.
+     */
+    void remove_bodies();
+};
@@ -0,0 +1,169 @@
+/*
+ * imap_sync_test.cc - Test-cases for our CIMAPSync class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "file.h"
+#include "imap_sync.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that replies from the proxy are applied incrementally.
+ */
+void TestIMAPSyncApply(CuTest * tc)
+{
+    CIMAPSync sync("INBOX", "/tmp/lumail.sync");
+    CuAssertStrEquals(tc, "sync_messages 0 0 0 0 INBOX\n", sync.command().c_str());
+
+    /*
+     * The first reply lists every message.
+     */
+    CuAssertIntEquals(tc, 3, sync.apply("{\"uidvalidity\": 7, \"reset\": 1, \"modseq\": 40, "
+                                        "\"messages\": [ {\"id\": 1, \"flags\": \"\\\\Seen\"},"
+                                        "{\"id\": 2, \"flags\": \"\"},"
+                                        "{\"id\": \"5\", \"flags\": \"\\\\Seen,\\\\Answered\"} ] }"));
+    CuAssertIntEquals(tc, 3, sync.messages().size());
+    CuAssertStrEquals(tc, "S", sync.messages().at(1).c_str());
+    CuAssertStrEquals(tc, "N", sync.messages().at(2).c_str());
+    CuAssertStrEquals(tc, "RS", sync.messages().at(5).c_str());
+    CuAssertStrEquals(tc, "sync_messages 7 5 40 3 INBOX\n", sync.command().c_str());
+
+    /*
+     * Nothing changed.
+     */
+    CuAssertIntEquals(tc, 0, sync.apply("{\"uidvalidity\": 7, \"modseq\": 40, \"messages\": []}"));
+
+    /*
+     * A new message arrives, one is read, and one expunged.
+     */
+    CuAssertIntEquals(tc, 3, sync.apply("{\"uidvalidity\": 7, \"modseq\": 42, \"uids\": \"1:2,6\", "
+                                        "\"messages\": [ {\"id\": 2, \"flags\": \"\\\\Seen\"},"
+                                        "{\"id\": 6, \"flags\": \"\"} ] }"));
+    CuAssertIntEquals(tc, 3, sync.messages().size());
+    CuAssertStrEquals(tc, "S", sync.messages().at(2).c_str());
+    CuAssertTrue(tc, sync.messages().find(5) == sync.messages().end());
+    CuAssertStrEquals(tc, "sync_messages 7 6 42 3 INBOX\n", sync.command().c_str());
+
+    /*
+     * The folder was recreated.
+     */
+    CuAssertIntEquals(tc, 4, sync.apply("{\"uidvalidity\": 8, \"modseq\": 0, "
+                                        "\"messages\": [ {\"id\": 1, \"flags\": \"\"} ] }"));
+    CuAssertIntEquals(tc, 1, sync.messages().size());
+    CuAssertStrEquals(tc, "sync_messages 8 1 0 1 INBOX\n", sync.command().c_str());
+
+    /*
+     * Rubbish.
+     */
+    CuAssertIntEquals(tc, -1, sync.apply("Connection failed!"));
+    CuAssertIntEquals(tc, 1, sync.messages().size());
+}
+
+
+/**
+ * Test that our state survives a reload.
+ */
+void TestIMAPSyncSave(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.syncXXXXXX";
+    std::string dir = mkdtemp(tmpl);
+
+    CIMAPSync sync("Lists/lumail", dir);
+    CuAssertTrue(tc, !sync.load());
+
+    sync.apply("{\"uidvalidity\": 3, \"modseq\": 9, \"messages\": ["
+               "{\"id\": 10, \"flags\": \"\\\\Seen\"}, {\"id\": 12, \"flags\": \"\"} ] }");
+    CuAssertTrue(tc, sync.save());
+
+    CIMAPSync reloaded("Lists/lumail", dir);
+    CuAssertTrue(tc, reloaded.load());
+    CuAssertIntEquals(tc, 2, reloaded.messages().size());
+    CuAssertStrEquals(tc, "S", reloaded.messages().at(10).c_str());
+    CuAssertStrEquals(tc, "N", reloaded.messages().at(12).c_str());
+    CuAssertStrEquals(tc, "sync_messages 3 12 9 2 Lists/lumail\n", reloaded.command().c_str());
+
+    unlink(reloaded.state_file().c_str());
+    rmdir(dir.c_str());
+}
+
+
+/**
+ * Test that cached bodies are removed with their messages.
+ */
+void TestIMAPSyncBodies(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.syncXXXXXX";
+    std::string dir = mkdtemp(tmpl);
+
+    CIMAPSync sync("INBOX", dir);
+    CuAssertStrEquals(tc, std::string(dir + "/7").c_str(), sync.body_file(7).c_str());
+
+    sync.apply("{\"uidvalidity\": 3, \"reset\": 1, \"messages\": ["
+               "{\"id\": 1, \"flags\": \"\"}, {\"id\": 2, \"flags\": \"\"},"
+               "{\"id\": 3, \"flags\": \"\"} ] }");
+    CuAssertTrue(tc, sync.was_reset());
+    CuAssertTrue(tc, sync.save());
+
+    for (int uid = 1; uid <= 3; uid++)
+    {
+        std::ofstream out(sync.body_file(uid));
+        out << "Subject: " << uid << "\n\nBody\n";
+    }
+
+    std::ofstream part(sync.body_file(3) + ".part");
+    part.close();
+
+    /*
+     * An expunged message loses its body.
+     */
+    sync.apply("{\"uidvalidity\": 3, \"uids\": \"1,3\", \"messages\": []}");
+    CuAssertTrue(tc, !sync.was_reset());
+    CuAssertTrue(tc, CFile::exists(sync.body_file(1)));
+    CuAssertTrue(tc, !CFile::exists(sync.body_file(2)));
+    CuAssertTrue(tc, CFile::exists(sync.body_file(3)));
+
+    /*
+     * When the UIDs are reset the body of UID 1 might belong to another
+     * message, so every body is removed - but not our state.
+     */
+    sync.apply("{\"uidvalidity\": 4, \"messages\": [ {\"id\": 1, \"flags\": \"\"} ] }");
+    CuAssertTrue(tc, sync.was_reset());
+    CuAssertTrue(tc, !CFile::exists(sync.body_file(1)));
+    CuAssertTrue(tc, !CFile::exists(sync.body_file(3)));
+    CuAssertTrue(tc, !CFile::exists(sync.body_file(3) + ".part"));
+    CuAssertTrue(tc, CFile::exists(sync.state_file()));
+
+    unlink(sync.state_file().c_str());
+    rmdir(dir.c_str());
+}
+
+
+CuSuite *
+imap_sync_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestIMAPSyncApply);
+    SUITE_ADD_TEST(suite, TestIMAPSyncSave);
+    SUITE_ADD_TEST(suite, TestIMAPSyncBodies);
+    return suite;
+}
@@ -46,6 +46,15 @@ CLifeView::~CLifeView()
 }
 
 
+/*
+ * Our display is drawn directly, by `on_idle`, so there is nothing
+ * to do here.
+ */
+void CLifeView::draw()
+{
+}
+
+
 /*
  * Update and re-draw our display.
  */
@@ -64,4 +73,10 @@ void CLifeView::on_idle()
 
     lua->execute("life:print_matrix()");
     lua->execute("life:next_gen()");
+
+    /*
+     * Ensure the new generation is displayed.
+     */
+    CScreen *screen = CScreen::instance();
+    screen->damage(CScreen::DAMAGE_REFRESH);
 }
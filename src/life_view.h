@@ -39,6 +39,11 @@ public:
      */
     ~CLifeView();
 
+    /**
+     * Our display is drawn by `on_idle`.
+     */
+    void draw();
+
     /**
      * Update and re-draw our display.
      */
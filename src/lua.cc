@@ -181,6 +181,125 @@ void CLua::on_error(std::string msg)
     }
 }
 
+/*
+ * Report the arrival of a new message.
+ */
+void CLua::on_message_arrived(std::shared_ptr<CMessage> message, std::string folder)
+{
+    CLuaLog("on_message_arrived(" + folder + ")");
+
+    lua_getglobal(m_lua, "on_message_arrived");
+
+    if (!lua_isfunction(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return;
+    }
+
+    push_cmessage(m_lua, message);
+    lua_pushstring(m_lua, folder.c_str());
+
+    if (lua_pcall(m_lua, 2, 0, 0) != 0)
+    {
+        std::string err = lua_isstring(m_lua, -1) ? lua_tostring(m_lua, -1) : "on_message_arrived failed";
+        lua_pop(m_lua, 1);
+        on_error(err);
+    }
+}
+
+
+/*
+ * Report that the search-index of a maildir is about to be built.
+ */
+void CLua::on_search_index(std::string folder, int current, int total)
+{
+    CLuaLog("on_search_index(" + folder + ")");
+
+    lua_getglobal(m_lua, "on_search_index");
+
+    if (!lua_isfunction(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return;
+    }
+
+    lua_pushstring(m_lua, folder.c_str());
+    lua_pushinteger(m_lua, current);
+    lua_pushinteger(m_lua, total);
+
+    if (lua_pcall(m_lua, 3, 0, 0) != 0)
+    {
+        std::string err = lua_isstring(m_lua, -1) ? lua_tostring(m_lua, -1) : "on_search_index failed";
+        lua_pop(m_lua, 1);
+        on_error(err);
+    }
+}
+
+
+/*
+ * Report that the contents of the given maildir have changed.
+ */
+void CLua::maildir_changed(std::string folder)
+{
+    CLuaLog("maildir_changed(" + folder + ")");
+
+    lua_getglobal(m_lua, "Maildir");
+
+    if (!lua_istable(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return;
+    }
+
+    lua_getfield(m_lua, -1, "contents_changed");
+
+    if (!lua_isfunction(m_lua, -1))
+    {
+        lua_pop(m_lua, 2);
+        return;
+    }
+
+    lua_pushstring(m_lua, folder.c_str());
+
+    if (lua_pcall(m_lua, 1, 0, 0) != 0)
+    {
+        std::string err = lua_isstring(m_lua, -1) ? lua_tostring(m_lua, -1) : "Maildir.contents_changed failed";
+        lua_pop(m_lua, 2);
+        on_error(err);
+        return;
+    }
+
+    lua_pop(m_lua, 1);
+}
+
+
+/*
+ * Call the Lua function with the given reference, once.
+ */
+void CLua::call_reference(int ref, std::string argument)
+{
+    CLuaLog("call_reference");
+
+    lua_rawgeti(m_lua, LUA_REGISTRYINDEX, ref);
+    luaL_unref(m_lua, LUA_REGISTRYINDEX, ref);
+
+    if (!lua_isfunction(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return;
+    }
+
+    lua_pushlstring(m_lua, argument.data(), argument.size());
+
+    if (lua_pcall(m_lua, 1, 0, 0) != 0)
+    {
+        std::string err = lua_isstring(m_lua, -1) ? lua_tostring(m_lua, -1) : "IMAP callback failed";
+        lua_pop(m_lua, 1);
+        on_error(err);
+    }
+}
+
+
 /*
  * Evaluate the given string.
  *
@@ -230,21 +349,15 @@ bool CLua::function_exists(std::string function)
      */
     lua_getglobal(m_lua, function.c_str());
 
-    /*
-     * If the result was nil then it doesn't exist.
-     */
-    if (lua_isnil(m_lua, -1))
-        return false;
-
     /*
      * If the type of the global is not a function then
-     * it doesn't exist.
+     * it doesn't exist - this includes it being nil.
      */
-    if (! lua_isfunction(m_lua, -1))
-        return false;
+    bool exists = lua_isfunction(m_lua, -1);
 
+    lua_pop(m_lua, 1);
 
-    return true;
+    return (exists);
 }
 
 
@@ -565,7 +678,10 @@ std::string CLua::function2string(std::string function, std::string input)
     lua_getglobal(m_lua, function.c_str());
 
     if (lua_isnil(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
         return ("");
+    }
 
 
     if (input.empty())
@@ -602,16 +718,120 @@ std::string CLua::function2string(std::string function, std::string input)
     /*
      * Now get the table we expected.
      */
+    std::string result;
+
     if (lua_isstring(m_lua, -1))
+        result = lua_tostring(m_lua, -1);
+
+    lua_pop(m_lua, 1);
+    return (result);
+}
+
+
+/*
+ * Call a Lua function which will return a single integer.
+ *
+ * Returns -1 if the function doesn't exist, fails, or returns something
+ * other than a number.
+ */
+int CLua::function2integer(std::string function)
+{
+    CLuaLog("function2integer(" + function + ")");
+
+    lua_getglobal(m_lua, function.c_str());
+
+    if (! lua_isfunction(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return -1;
+    }
+
+    if (lua_pcall(m_lua, 0, 1, 0) != 0)
+    {
+        if (lua_isstring(m_lua, -1))
+        {
+            char *err = strdup(lua_tostring(m_lua, -1));
+            lua_pop(m_lua, 1);
+
+            on_error(err);
+            free(err);
+        }
+        else
+            lua_pop(m_lua, 1);
+
+        return -1;
+    }
+
+    int result = -1;
+
+    if (lua_isnumber(m_lua, -1))
+        result = lua_tointeger(m_lua, -1);
+
+    lua_pop(m_lua, 1);
+    return result;
+}
+
+
+/*
+ * Call a Lua function to fetch `count` lines of text, starting with the
+ * (zero-based) line `top`.
+ */
+std::vector<std::string> CLua::function2rows(std::string function, int top, int count)
+{
+    CLuaLog("function2rows(" + function + ")");
+
+    std::vector<std::string> result;
+
+    lua_getglobal(m_lua, function.c_str());
+
+    if (! lua_isfunction(m_lua, -1))
     {
-        const char *result = lua_tostring(m_lua, -1);
+        lua_pop(m_lua, 1);
         return (result);
     }
-    else
+
+    lua_pushinteger(m_lua, top);
+    lua_pushinteger(m_lua, count);
+
+    if (lua_pcall(m_lua, 2, 1, 0) != 0)
     {
-        return "";
+        if (lua_isstring(m_lua, -1))
+        {
+            char *err = strdup(lua_tostring(m_lua, -1));
+            lua_pop(m_lua, 1);
+
+            on_error(err);
+            free(err);
+        }
+        else
+            lua_pop(m_lua, 1);
+
+        return (result);
     }
 
+    /*
+     * Unlike `function2table` we walk the array-part in order, stopping
+     * at the first gap.
+     */
+    if (lua_istable(m_lua, -1))
+    {
+        for (int i = 1; i <= count; i++)
+        {
+            lua_rawgeti(m_lua, -1, i);
+
+            if (! lua_isstring(m_lua, -1))
+            {
+                lua_pop(m_lua, 1);
+                break;
+            }
+
+            result.push_back(lua_tostring(m_lua, -1));
+            lua_pop(m_lua, 1);
+        }
+    }
+
+    lua_pop(m_lua, 1);
+    return (result);
 }
 
 
@@ -115,6 +115,30 @@ public:
      */
     void on_error(std::string msg);
 
+    /**
+     * Call the user "on_message_arrived" function, if it exists, with
+     * the message which has arrived and the path of its maildir.
+     */
+    void on_message_arrived(std::shared_ptr<CMessage> message, std::string folder);
+
+    /**
+     * Call the user "on_search_index" function, if it exists, before the
+     * search-index of the given maildir is built for the first time.
+     */
+    void on_search_index(std::string folder, int current, int total);
+
+    /**
+     * Call the "Maildir.contents_changed" function, if it exists, to
+     * report that the messages in the given maildir have changed.
+     */
+    void maildir_changed(std::string folder);
+
+    /**
+     * Call the Lua function with the given reference, in the registry,
+     * with a single string argument - and then release the reference.
+     */
+    void call_reference(int ref, std::string argument);
+
     /**
      * Return the (string) contents of a variable.
      * Used for our test suite only.
@@ -131,6 +155,20 @@ public:
      */
     std::string function2string(std::string function, std::string input);
 
+    /**
+     * Call a Lua function which will return a single integer.
+     *
+     * Returns -1 if the function doesn't exist, or fails.
+     */
+    int function2integer(std::string function);
+
+    /**
+     * Call a Lua function, with the arguments `top` and `count`, which
+     * will return a table of (up to) `count` lines of text, starting
+     * with the zero-based line `top`.
+     */
+    std::vector<std::string> function2rows(std::string function, int top, int count);
+
 
     /**
      * Lookup a key-binding.
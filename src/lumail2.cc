@@ -25,17 +25,20 @@
 #include "file.h"
 #include "global_state.h"
 #include "history.h"
+#include "imap_prefetch.h"
 #include "imap_proxy.h"
 #include "input_queue.h"
 #include "logger.h"
 #include "lua.h"
 #include "maildir.h"
+#include "maildir_watcher.h"
 #include "message.h"
 #include "message_part.h"
 #include "mime.h"
 #include "screen.h"
 #include "statuspanel.h"
 #include "tests.h"
+#include "threader.h"
 #include "util.h"
 
 /*
@@ -53,10 +56,21 @@ void run_all_tests()
     CuSuiteAddSuite(suite, config_getsuite());
     CuSuiteAddSuite(suite, directory_getsuite());
     CuSuiteAddSuite(suite, file_getsuite());
+    CuSuiteAddSuite(suite, global_state_getsuite());
     CuSuiteAddSuite(suite, history_getsuite());
+    CuSuiteAddSuite(suite, imap_proxy_getsuite());
+    CuSuiteAddSuite(suite, imap_sync_getsuite());
     CuSuiteAddSuite(suite, input_queue_getsuite());
     CuSuiteAddSuite(suite, lua_getsuite());
+    CuSuiteAddSuite(suite, maildir_getsuite());
+    CuSuiteAddSuite(suite, maildir_index_getsuite());
+    CuSuiteAddSuite(suite, message_filter_getsuite());
+    CuSuiteAddSuite(suite, message_format_getsuite());
+    CuSuiteAddSuite(suite, message_sort_getsuite());
+    CuSuiteAddSuite(suite, regexp_getsuite());
+    CuSuiteAddSuite(suite, search_index_getsuite());
     CuSuiteAddSuite(suite, statuspanel_getsuite());
+    CuSuiteAddSuite(suite, threader_getsuite());
     CuSuiteAddSuite(suite, util_getsuite());
 
     CuSuiteRun(suite);
@@ -261,7 +275,10 @@ int main(int argc, char *argv[])
     config->destroy_instance();
     proxy->destroy_instance();
 
+    CIMAPPrefetch::instance()->destroy_instance();
     CHistory::instance()->destroy_instance();
+    CMaildirWatcher::instance()->destroy_instance();
+    CThreader::instance()->destroy_instance();
     CGlobalState::instance()->destroy_instance();
     CInputQueue::instance()->destroy_instance();
     CStatusPanel::instance()->destroy_instance();
@@ -36,14 +36,24 @@
 #include <gmime/gmime.h>
 
 
+#include "config.h"
 #include "directory.h"
 #include "file.h"
 #include "imap_proxy.h"
 #include "maildir.h"
+#include "maildir_index.h"
 #include "message.h"
 #include "util.h"
 
 
+/*
+ * On Mac OS X the nanosecond-resolution mtime has a different name.
+ */
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+
 /*
  * Constructor.  Create an object to encapsulate the given path.
  */
@@ -60,6 +70,18 @@ CMaildir::CMaildir(const std::string name, bool is_local)
      * Default cache-time.
      */
     m_modified = -1;
+
+    /*
+     * Nothing has been counted yet.
+     */
+    m_unread     = 0;
+    m_total      = 0;
+    m_cur_total  = 0;
+    m_cur_unread = 0;
+    m_new_total  = 0;
+    m_cur_mtime.tv_sec  = m_new_mtime.tv_sec  = -1;
+    m_cur_mtime.tv_nsec = m_new_mtime.tv_nsec = 0;
+    m_watched = false;
 }
 
 
@@ -125,6 +147,9 @@ int CMaildir::total_messages()
 
 /*
  * Update the cached total/unread message counts.
+ *
+ * The counts of `cur/` and `new/` are cached separately, such that
+ * the arrival of new mail doesn't cause us to recount `cur/`.
  */
 void CMaildir::update_cache()
 {
@@ -132,35 +157,176 @@ void CMaildir::update_cache()
         return;
 
     /*
-     * If the cached date isn't different then we need do nothing.
+     * If we're being watched our counts are kept up to date for us,
+     * once they've been calculated.
      */
-    time_t last_mod = last_modified();
+    if (m_watched && (m_cur_mtime.tv_sec != -1) && (m_new_mtime.tv_sec != -1))
+        return;
+
+    struct stat st_buf;
+    std::string cur = m_path + "/cur";
+    std::string nw  = m_path + "/new";
+
+    if (stat(cur.c_str(), &st_buf) == 0)
+    {
+        if ((st_buf.st_mtim.tv_sec != m_cur_mtime.tv_sec) ||
+                (st_buf.st_mtim.tv_nsec != m_cur_mtime.tv_nsec))
+        {
+            m_cur_mtime = st_buf.st_mtim;
+            count_messages(cur, false, m_cur_total, m_cur_unread);
+        }
+    }
+    else
+    {
+        m_cur_total = m_cur_unread = 0;
+    }
+
+    if (stat(nw.c_str(), &st_buf) == 0)
+    {
+        if ((st_buf.st_mtim.tv_sec != m_new_mtime.tv_sec) ||
+                (st_buf.st_mtim.tv_nsec != m_new_mtime.tv_nsec))
+        {
+            int unread;
+            m_new_mtime = st_buf.st_mtim;
+            count_messages(nw, true, m_new_total, unread);
+        }
+    }
+    else
+    {
+        m_new_total = 0;
+    }
+
+    m_total  = m_cur_total + m_new_total;
+    m_unread = m_cur_unread + m_new_total;
+}
 
-    if (last_mod == m_modified)
+
+/*
+ * Count the messages in the given directory.
+ *
+ * A message is unread if it lives in `new/`, or if its flags contain
+ * `N` or lack `S` - which matches `CMessage::is_new()`.  The flags are
+ * read straight from the directory entry, so nothing is allocated.
+ */
+void CMaildir::count_messages(std::string path, bool is_new, int &total, int &unread)
+{
+    total  = 0;
+    unread = 0;
+
+    DIR *dp = opendir(path.c_str());
+
+    if (dp == NULL)
         return;
 
-    /*
-     * Otherwise update the last modified time.
-     */
-    m_modified = last_mod;
+    int dfd = dirfd(dp);
+    dirent *de;
 
-    /*
-     * Get all messages, and update the total
-     */
-    CMessageList all = getMessages();
-    m_total = all.size();
+    while ((de = readdir(dp)) != NULL)
+    {
+        /*
+         * Skip dotfiles, which includes "." and "..".
+         */
+        if (de->d_name[0] == '.')
+            continue;
 
+        if (de->d_type == DT_DIR)
+            continue;
+
+        if (de->d_type == DT_UNKNOWN)
+        {
+            struct stat sb;
+
+            if ((fstatat(dfd, de->d_name, &sb, 0) < 0) || S_ISDIR(sb.st_mode))
+                continue;
+        }
+
+        total += 1;
+
+        if (is_new || is_unread(de->d_name))
+            unread += 1;
+    }
+
+    closedir(dp);
+}
 
-    /*
-      * Now update the unread count.
-      */
-    m_unread = 0;
 
-    for (std::shared_ptr < CMessage > message : all)
+/*
+ * Is the message with the given filename, in `cur/`, unread?
+ */
+bool CMaildir::is_unread(const char *name)
+{
+    const char *flags = strstr(name, ":2,");
+
+    return ((flags == NULL) ||
+            (strchr(flags + 3, 'N') != NULL) ||
+            (strchr(flags + 3, 'S') == NULL));
+}
+
+
+/*
+ * Mark this maildir as being watched.
+ */
+void CMaildir::set_watched(bool watched)
+{
+    m_watched = watched;
+}
+
+
+/*
+ * Is this maildir being watched?
+ */
+bool CMaildir::is_watched()
+{
+    return (m_watched);
+}
+
+
+/*
+ * Update our cached counts for the arrival of the named file.
+ */
+void CMaildir::message_added(std::string name, bool is_new)
+{
+    if (is_new)
+        m_new_total += 1;
+    else
     {
-        if (message->is_new())
-            m_unread++;
+        m_cur_total += 1;
+
+        if (is_unread(name.c_str()))
+            m_cur_unread += 1;
     }
+
+    m_total  = m_cur_total + m_new_total;
+    m_unread = m_cur_unread + m_new_total;
+}
+
+
+/*
+ * Update our cached counts for the removal of the named file.
+ */
+void CMaildir::message_removed(std::string name, bool is_new)
+{
+    if (is_new)
+        m_new_total = std::max(0, m_new_total - 1);
+    else
+    {
+        m_cur_total = std::max(0, m_cur_total - 1);
+
+        if (is_unread(name.c_str()))
+            m_cur_unread = std::max(0, m_cur_unread - 1);
+    }
+
+    m_total  = m_cur_total + m_new_total;
+    m_unread = m_cur_unread + m_new_total;
+}
+
+
+/*
+ * Discard our cached counts.
+ */
+void CMaildir::invalidate_counts()
+{
+    m_cur_mtime.tv_sec = m_new_mtime.tv_sec = -1;
 }
 
 /*
@@ -218,38 +384,48 @@ CMessageList CMaildir::getMessages()
     CMessageList result;
 
     /*
-     * Directories we search.
+     * Should the index be persisted?
      */
-    std::vector < std::string > dirs;
-    dirs.push_back(m_path + "/cur/");
-    dirs.push_back(m_path + "/new/");
+    CConfig *config = CConfig::instance();
+    bool persist    = (config->get_integer("maildir.index", 1) == 1);
+
+    if (! m_index)
+        m_index = std::shared_ptr<CMaildirIndex>(new CMaildirIndex(m_path));
+
+    /*
+     * The headers to store in the index may be configured.
+     */
+    std::vector<std::string> headers = config->get_array("index.headers");
+
+    if (headers.empty())
+        m_index->headers(CMaildirIndex::key_headers());
+    else
+        m_index->headers(headers);
 
     /*
-     * For each directory.
+     * Update the index from the contents of `cur/` + `new/`.
      */
-    for (std::string path : dirs)
+    std::vector<CMaildirIndexEntry *> entries = m_index->refresh(persist);
+    result.reserve(entries.size());
+
+    /*
+     * Create a message for each file, seeding it with the headers
+     * we've previously seen - if any.
+     */
+    for (CMaildirIndexEntry *entry : entries)
     {
+        std::string file = m_path + "/" + entry->name;
+        file.erase(std::unique(file.begin(), file.end(), both_slashes()), file.end());
 
-        /*
-         * Get the entries in the directory
-         */
-        std::vector<std::string> entries = CDirectory::entries(path);
+        std::shared_ptr < CMessage > t = std::shared_ptr < CMessage > (new CMessage(file));
 
-        /*
-         * For each one - if it isn't a dirrectory create a message
-         * using the path.
-         *
-         * This test is required because `CDirectory::entries` will return
-         * both the prefix, and the children "." + "..".
-         */
-        for (std::string file : entries)
-        {
-            if (! CFile::is_directory(file))
-            {
-                std::shared_ptr < CMessage > t = std::shared_ptr < CMessage > (new CMessage(std::string(file)));
-                result.push_back(t);
-            }
-        }
+        if (entry->have_headers)
+            t->set_cached_headers(entry->headers);
+
+        t->set_cached_parts(entry->parts);
+
+        t->index(m_index);
+        result.push_back(t);
     }
 
     return result;
@@ -23,9 +23,13 @@
 #pragma once
 
 
+#include <time.h>
+
 #include "message.h"
 
 
+class CMaildirIndex;
+
 
 
 /**
@@ -131,6 +135,9 @@ public:
 
     /**
       * Get all of the messages in this maildir.
+      *
+      * For local maildirs this is served from a persistent
+      * `CMaildirIndex`, unless `maildir.index` is set to zero.
       */
     CMessageList getMessages();
 
@@ -153,6 +160,37 @@ public:
     void bump_mtime();
 
 
+    /**
+     * Mark this maildir as being watched by `CMaildirWatcher`.
+     *
+     * A watched maildir trusts the deltas it is given, via
+     * `message_added` and `message_removed`, rather than testing
+     * the modification-times of `cur/` and `new/`.
+     */
+    void set_watched(bool watched);
+
+    /**
+     * Is this maildir being watched by `CMaildirWatcher`?
+     */
+    bool is_watched();
+
+    /**
+     * Update our cached counts for the arrival of the named file,
+     * in `new/` or `cur/`.
+     */
+    void message_added(std::string name, bool is_new);
+
+    /**
+     * Update our cached counts for the removal of the named file,
+     * from `new/` or `cur/`.
+     */
+    void message_removed(std::string name, bool is_new);
+
+    /**
+     * Discard our cached counts, forcing them to be recalculated.
+     */
+    void invalidate_counts();
+
     /**
      * Return the last modified time for this Maildir, which is
      * used to determine if we need to update our cache.
@@ -181,6 +219,11 @@ private:
      */
     time_t m_modified;
 
+    /**
+     * The index of our messages, created on first use.
+     */
+    std::shared_ptr<CMaildirIndex> m_index;
+
     /**
      * A cached count of the unread messages in this maildir.
      */
@@ -191,6 +234,26 @@ private:
      */
     int m_total;
 
+    /**
+     * The modification-times of `cur/` and `new/` when we last
+     * counted their contents.
+     */
+    struct timespec m_cur_mtime;
+    struct timespec m_new_mtime;
+
+    /**
+     * The cached counts of `cur/` and `new/`, which are updated
+     * independently.
+     */
+    int m_cur_total;
+    int m_cur_unread;
+    int m_new_total;
+
+    /**
+     * Are we being watched by `CMaildirWatcher`?
+     */
+    bool m_watched;
+
     /**
      * Update the cached total/unread message counts.
      *
@@ -198,6 +261,17 @@ private:
      */
     void update_cache();
 
+    /**
+     * Count the messages in the given directory, and how many of
+     * them are unread, without creating any `CMessage` objects.
+     */
+    static void count_messages(std::string path, bool is_new, int &total, int &unread);
+
+    /**
+     * Is the message with the given filename, in `cur/`, unread?
+     */
+    static bool is_unread(const char *name);
+
     /**
      * Generate a filename for saving a message into.
      */
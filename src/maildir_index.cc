@@ -0,0 +1,801 @@
+/*
+ * maildir_index.cc - Persistent index of the messages in a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+
+#include "maildir_index.h"
+
+
+/*
+ * On Mac OS X the nanosecond-resolution mtime has a different name.
+ */
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+
+/**
+ * @file maildir_index.cc
+ *
+ * The on-disk format of the index is:
+ *
+ *   "LMI4"              - Magic, 4 bytes.
+ *   int64_t x 4         - The mtime of `cur/` and `new/`, seconds + nanoseconds.
+ *   uint8_t             - The number of header-names which follow.
+ *
+ * Then for each header-name:
+ *
+ *   uint8_t             - length of the name.
+ *   name                - The bytes of the name.
+ *
+ * Then:
+ *
+ *   uint32_t            - The number of records which follow.
+ *
+ * Then for each record:
+ *
+ *   uint64_t            - inode.
+ *   int64_t             - size.
+ *   int64_t             - mtime.
+ *   uint16_t            - length of the name.
+ *   uint8_t             - length of the flags.
+ *   uint8_t             - count of headers, or 0xFF if not yet known.
+ *   uint8_t             - summary of the MIME-parts, or 0xFF if not yet known.
+ *   name, flags         - The bytes of each.
+ *
+ * Then for each header:
+ *
+ *   uint8_t             - offset of the header in the list of names.
+ *   uint32_t            - length of the value.
+ *   value               - The bytes of the value.
+ *
+ * Values are stored in host byte-order, as the index is a local cache.
+ */
+
+
+/*
+ * The magic-marker at the start of our index.
+ */
+#define INDEX_MAGIC "LMI4"
+
+/*
+ * The marker used to show we've not yet seen the headers of a message.
+ */
+#define INDEX_NO_HEADERS 0xFF
+
+/*
+ * The most header-names we'll store.
+ */
+#define INDEX_MAX_HEADERS 254
+
+
+/*
+ * Append the raw bytes of the given value to the buffer.
+ */
+template <typename T> static void append_value(std::string &buf, T value)
+{
+    buf.append((const char *)&value, sizeof(T));
+}
+
+
+/*
+ * Read a value from the buffer, if there is room.
+ */
+template <typename T> static bool read_value(const char *&p, const char *end, T &value)
+{
+    if ((size_t)(end - p) < sizeof(T))
+        return false;
+
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+
+/*
+ * Read a string of the given length from the buffer, if there is room.
+ */
+static bool read_string(const char *&p, const char *end, size_t len, std::string &value)
+{
+    if ((size_t)(end - p) < len)
+        return false;
+
+    value.assign(p, len);
+    p += len;
+    return true;
+}
+
+
+/*
+ * Return the flags from the given maildir filename.
+ */
+static std::string filename_flags(const std::string &name)
+{
+    size_t offset = name.find(":2,");
+
+    if (offset == std::string::npos)
+        return "";
+
+    return (name.substr(offset + 3));
+}
+
+
+/*
+ * Constructor.
+ */
+CMaildirIndex::CMaildirIndex(std::string maildir)
+{
+    m_maildir = maildir;
+    m_headers = key_headers();
+    m_loaded  = false;
+    m_persist = false;
+    m_dirty   = false;
+
+    m_cur_mtime.tv_sec  = m_new_mtime.tv_sec  = -1;
+    m_cur_mtime.tv_nsec = m_new_mtime.tv_nsec = 0;
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildirIndex::~CMaildirIndex()
+{
+    save();
+}
+
+
+/*
+ * The headers we store in the index.
+ *
+ * These are the ones needed to format, sort, and thread the index.
+ */
+const std::vector<std::string> &CMaildirIndex::key_headers()
+{
+    static std::vector<std::string> names =
+    {
+        "cc",
+        "date",
+        "delivery-date",
+        "from",
+        "in-reply-to",
+        "message-id",
+        "references",
+        "subject",
+        "to"
+    };
+
+    return names;
+}
+
+
+/*
+ * Set the names of the headers which are stored in the index.
+ */
+void CMaildirIndex::headers(std::vector<std::string> names)
+{
+    for (std::string &name : names)
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    names.erase(std::remove(names.begin(), names.end(), ""), names.end());
+
+    if (names.size() > INDEX_MAX_HEADERS)
+        names.resize(INDEX_MAX_HEADERS);
+
+    if (names == m_headers)
+        return;
+
+    m_headers = names;
+
+    /*
+     * The headers we have are now incomplete, or include ones we
+     * no longer want.
+     */
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        it->second.have_headers = false;
+        it->second.headers.clear();
+    }
+
+    if (!m_entries.empty())
+        m_dirty = true;
+}
+
+
+/*
+ * The names of the headers which are stored in the index.
+ */
+const std::vector<std::string> &CMaildirIndex::headers()
+{
+    return (m_headers);
+}
+
+
+/*
+ * Is the given header one we store?
+ */
+bool CMaildirIndex::is_key_header(std::string name)
+{
+    return (std::binary_search(m_headers.begin(), m_headers.end(), name));
+}
+
+
+/*
+ * The path to the on-disk index file.
+ */
+std::string CMaildirIndex::index_file()
+{
+    return (m_maildir + "/.lumail.index");
+}
+
+
+/*
+ * Load the on-disk index, if present.
+ */
+bool CMaildirIndex::load()
+{
+    m_loaded = true;
+
+    std::string file = index_file();
+    int fd = open(file.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+
+    if ((fstat(fd, &sb) < 0) || (sb.st_size < 8))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    const char *p   = (const char *)map;
+    const char *end = p + sb.st_size;
+
+    bool valid = (memcmp(p, INDEX_MAGIC, 4) == 0);
+    p += 4;
+
+    /*
+     * The modification-times of the directories when the index was
+     * written.
+     */
+    int64_t times[4] = { -1, 0, -1, 0 };
+
+    for (int i = 0; valid && (i < 4); i++)
+        valid = read_value(p, end, times[i]);
+
+    /*
+     * Read the names of the headers the index was written with.  If
+     * any we want are missing then we can't use the stored headers.
+     */
+    std::vector<std::string> names;
+    uint8_t name_count = 0;
+    bool complete = true;
+
+    if (valid)
+        valid = read_value(p, end, name_count);
+
+    for (int i = 0; valid && (i < name_count); i++)
+    {
+        uint8_t len;
+        std::string name;
+
+        valid = read_value(p, end, len) && read_string(p, end, len, name);
+        names.push_back(name);
+    }
+
+    for (const std::string &name : m_headers)
+    {
+        if (std::find(names.begin(), names.end(), name) == names.end())
+            complete = false;
+    }
+
+    uint32_t count = 0;
+
+    if (valid)
+        valid = read_value(p, end, count);
+
+    for (uint32_t i = 0; valid && (i < count); i++)
+    {
+        CMaildirIndexEntry entry;
+        uint16_t name_len;
+        uint8_t flags_len;
+        uint8_t header_count;
+
+        valid = read_value(p, end, entry.inode) &&
+                read_value(p, end, entry.size) &&
+                read_value(p, end, entry.mtime) &&
+                read_value(p, end, name_len) &&
+                read_value(p, end, flags_len) &&
+                read_value(p, end, header_count) &&
+                read_value(p, end, entry.parts) &&
+                read_string(p, end, name_len, entry.name) &&
+                read_string(p, end, flags_len, entry.flags);
+
+        if (!valid)
+            break;
+
+        entry.have_headers = (header_count != INDEX_NO_HEADERS);
+
+        for (int h = 0; entry.have_headers && (h < header_count); h++)
+        {
+            uint8_t id;
+            uint32_t len;
+            std::string value;
+
+            valid = read_value(p, end, id) &&
+                    read_value(p, end, len) &&
+                    read_string(p, end, len, value) &&
+                    (id < names.size());
+
+            if (!valid)
+                break;
+
+            if (is_key_header(names[id]))
+                entry.headers[names[id]] = value;
+        }
+
+        if (!complete)
+        {
+            entry.have_headers = false;
+            entry.headers.clear();
+            m_dirty = true;
+        }
+
+        if (valid)
+            m_entries[entry.name] = entry;
+    }
+
+    munmap(map, sb.st_size);
+
+    /*
+     * A corrupt index is discarded, and will be rebuilt.
+     */
+    if (!valid)
+    {
+        m_entries.clear();
+        m_dirty = true;
+    }
+    else
+    {
+        m_cur_mtime.tv_sec  = times[0];
+        m_cur_mtime.tv_nsec = times[1];
+        m_new_mtime.tv_sec  = times[2];
+        m_new_mtime.tv_nsec = times[3];
+    }
+
+    return valid;
+}
+
+
+/*
+ * Write the index to disk, if it has changed.
+ */
+bool CMaildirIndex::save()
+{
+    if (!m_persist || !m_dirty)
+        return true;
+
+    const std::vector<std::string> &names = m_headers;
+
+    std::string buf;
+    buf.reserve(m_entries.size() * 256);
+    buf.append(INDEX_MAGIC, 4);
+    append_value(buf, (int64_t)m_cur_mtime.tv_sec);
+    append_value(buf, (int64_t)m_cur_mtime.tv_nsec);
+    append_value(buf, (int64_t)m_new_mtime.tv_sec);
+    append_value(buf, (int64_t)m_new_mtime.tv_nsec);
+    append_value(buf, (uint8_t)names.size());
+
+    for (const std::string &name : names)
+    {
+        append_value(buf, (uint8_t)std::min(name.size(), (size_t)255));
+        buf.append(name, 0, 255);
+    }
+
+    append_value(buf, (uint32_t)m_entries.size());
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        CMaildirIndexEntry &entry = it->second;
+
+        append_value(buf, entry.inode);
+        append_value(buf, entry.size);
+        append_value(buf, entry.mtime);
+        append_value(buf, (uint16_t)entry.name.size());
+        append_value(buf, (uint8_t)entry.flags.size());
+
+        if (entry.have_headers)
+            append_value(buf, (uint8_t)entry.headers.size());
+        else
+            append_value(buf, (uint8_t)INDEX_NO_HEADERS);
+
+        append_value(buf, entry.parts);
+
+        buf += entry.name;
+        buf += entry.flags;
+
+        if (!entry.have_headers)
+            continue;
+
+        for (auto h = entry.headers.begin(); h != entry.headers.end(); ++h)
+        {
+            uint8_t id = std::lower_bound(names.begin(), names.end(), h->first) - names.begin();
+
+            append_value(buf, id);
+            append_value(buf, (uint32_t)h->second.size());
+            buf += h->second;
+        }
+    }
+
+    /*
+     * Write to a temporary file, then rename into place, so that a
+     * concurrent reader never sees a partial index.
+     */
+    std::string file = index_file();
+    std::string tmp  = file + ".tmp";
+
+    FILE *f = fopen(tmp.c_str(), "wb");
+
+    if (f == NULL)
+        return false;
+
+    bool ok = (fwrite(buf.data(), 1, buf.size(), f) == buf.size());
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok)
+        ok = (rename(tmp.c_str(), file.c_str()) == 0);
+    else
+        unlink(tmp.c_str());
+
+    if (ok)
+        m_dirty = false;
+
+    return ok;
+}
+
+
+/*
+ * Read the names + inodes of the files in the given sub-directory.
+ */
+void CMaildirIndex::list(std::string subdir, std::vector<CMaildirIndexEntry> &found)
+{
+    std::string path = m_maildir + "/" + subdir;
+
+    DIR *dp = opendir(path.c_str());
+
+    if (dp == NULL)
+        return;
+
+    int dfd = dirfd(dp);
+    dirent *de;
+
+    while ((de = readdir(dp)) != NULL)
+    {
+        /*
+         * Skip dotfiles, which includes "." and "..".
+         */
+        if (de->d_name[0] == '.')
+            continue;
+
+        if (de->d_type == DT_DIR)
+            continue;
+
+        if (de->d_type == DT_UNKNOWN)
+        {
+            struct stat sb;
+
+            if ((fstatat(dfd, de->d_name, &sb, 0) < 0) || S_ISDIR(sb.st_mode))
+                continue;
+        }
+
+        CMaildirIndexEntry entry;
+        entry.name  = subdir + "/" + de->d_name;
+        entry.inode = de->d_ino;
+        entry.have_headers = false;
+        entry.parts = CMaildirIndexEntry::PARTS_UNKNOWN;
+        found.push_back(entry);
+    }
+
+    closedir(dp);
+}
+
+
+/*
+ * Compare the directory contents against our index, and return the
+ * current entries.
+ */
+std::vector<CMaildirIndexEntry *> CMaildirIndex::refresh(bool persist)
+{
+    m_persist = persist;
+
+    if (m_persist && !m_loaded)
+        load();
+
+    /*
+     * If neither directory has changed since we last read them then
+     * our entries are current, and we needn't read them again.  The
+     * directories are tested before they're read so that a file which
+     * arrives while we're reading them is found next time.
+     */
+    struct stat cur_sb;
+    struct stat new_sb;
+
+    if (stat(std::string(m_maildir + "/cur").c_str(), &cur_sb) < 0)
+    {
+        cur_sb.st_mtim.tv_sec  = -1;
+        cur_sb.st_mtim.tv_nsec = 0;
+    }
+
+    if (stat(std::string(m_maildir + "/new").c_str(), &new_sb) < 0)
+    {
+        new_sb.st_mtim.tv_sec  = -1;
+        new_sb.st_mtim.tv_nsec = 0;
+    }
+
+    if ((cur_sb.st_mtim.tv_sec != -1) &&
+            (cur_sb.st_mtim.tv_sec == m_cur_mtime.tv_sec) &&
+            (cur_sb.st_mtim.tv_nsec == m_cur_mtime.tv_nsec) &&
+            (new_sb.st_mtim.tv_sec == m_new_mtime.tv_sec) &&
+            (new_sb.st_mtim.tv_nsec == m_new_mtime.tv_nsec))
+    {
+        std::vector<CMaildirIndexEntry *> result;
+        result.reserve(m_entries.size());
+
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+            result.push_back(&it->second);
+
+        std::sort(result.begin(), result.end(),
+                  [](const CMaildirIndexEntry * a, const CMaildirIndexEntry * b)
+        {
+            return (a->name < b->name);
+        });
+
+        save();
+
+        return result;
+    }
+
+    /*
+     * Read the directories - which is the only I/O we need to do
+     * for a maildir we've seen before.
+     */
+    std::vector<CMaildirIndexEntry> found;
+    found.reserve(m_entries.size());
+    list("cur", found);
+    list("new", found);
+
+    /*
+     * Find the files which we've not seen before, and which
+     * have vanished.
+     */
+    std::unordered_map<std::string, bool> present;
+    std::vector<CMaildirIndexEntry *> unknown;
+
+    for (CMaildirIndexEntry &entry : found)
+    {
+        present[entry.name] = true;
+
+        auto it = m_entries.find(entry.name);
+
+        if ((it == m_entries.end()) || (it->second.inode != entry.inode))
+            unknown.push_back(&entry);
+    }
+
+    std::unordered_map<uint64_t, CMaildirIndexEntry> vanished;
+
+    for (auto it = m_entries.begin(); it != m_entries.end();)
+    {
+        if (present.find(it->first) == present.end())
+        {
+            vanished[it->second.inode] = it->second;
+            it = m_entries.erase(it);
+            m_dirty = true;
+        }
+        else
+            ++it;
+    }
+
+    /*
+     * Now add the new files.  If the inode matches a vanished entry
+     * then the file was renamed and we keep the details we had.
+     */
+    for (CMaildirIndexEntry *entry : unknown)
+    {
+        auto old = vanished.find(entry->inode);
+
+        if (old != vanished.end())
+        {
+            CMaildirIndexEntry updated = old->second;
+            updated.name  = entry->name;
+            updated.flags = filename_flags(entry->name);
+            m_entries[updated.name] = updated;
+            vanished.erase(old);
+        }
+        else
+        {
+            struct stat sb;
+            std::string path = m_maildir + "/" + entry->name;
+
+            if (stat(path.c_str(), &sb) < 0)
+                continue;
+
+            entry->size         = sb.st_size;
+            entry->mtime        = sb.st_mtime;
+            entry->flags        = filename_flags(entry->name);
+            entry->have_headers = false;
+            entry->parts        = CMaildirIndexEntry::PARTS_UNKNOWN;
+            m_entries[entry->name] = *entry;
+        }
+
+        m_dirty = true;
+    }
+
+    /*
+     * Build up the result, sorted by name as the directory-listing
+     * used to be.
+     */
+    if ((cur_sb.st_mtim.tv_sec != m_cur_mtime.tv_sec) ||
+            (cur_sb.st_mtim.tv_nsec != m_cur_mtime.tv_nsec) ||
+            (new_sb.st_mtim.tv_sec != m_new_mtime.tv_sec) ||
+            (new_sb.st_mtim.tv_nsec != m_new_mtime.tv_nsec))
+    {
+        m_cur_mtime = cur_sb.st_mtim;
+        m_new_mtime = new_sb.st_mtim;
+        m_dirty     = true;
+    }
+
+    std::vector<CMaildirIndexEntry *> result;
+    result.reserve(found.size());
+
+    for (CMaildirIndexEntry &entry : found)
+    {
+        auto it = m_entries.find(entry.name);
+
+        if (it != m_entries.end())
+            result.push_back(&it->second);
+    }
+
+    std::sort(result.begin(), result.end(),
+              [](const CMaildirIndexEntry * a, const CMaildirIndexEntry * b)
+    {
+        return (a->name < b->name);
+    });
+
+    save();
+
+    return result;
+}
+
+
+/*
+ * Record the headers of the message with the given path.
+ */
+void CMaildirIndex::set_headers(std::string path, const std::unordered_map<std::string, std::string> &headers)
+{
+    CMaildirIndexEntry *found = find_entry(path);
+
+    if (found == NULL)
+        return;
+
+    CMaildirIndexEntry &entry = *found;
+    entry.headers.clear();
+
+    for (const std::string &key : m_headers)
+    {
+        auto h = headers.find(key);
+
+        if (h != headers.end())
+            entry.headers[key] = h->second;
+    }
+
+    entry.have_headers = true;
+    m_dirty = true;
+}
+
+
+/*
+ * Is the file of the given message unchanged since we recorded it?
+ */
+bool CMaildirIndex::is_current(std::string path)
+{
+    CMaildirIndexEntry *entry = find_entry(path);
+
+    if (entry == NULL)
+        return false;
+
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) < 0)
+        return false;
+
+    if ((sb.st_size == entry->size) && (sb.st_mtime == entry->mtime))
+        return true;
+
+    /*
+     * The file was rewritten in place, so what we knew of it is stale.
+     */
+    entry->size         = sb.st_size;
+    entry->mtime        = sb.st_mtime;
+    entry->have_headers = false;
+    entry->parts        = CMaildirIndexEntry::PARTS_UNKNOWN;
+    entry->headers.clear();
+    m_dirty = true;
+
+    return false;
+}
+
+
+/*
+ * Record the summary of the MIME-parts of the message with the given path.
+ */
+void CMaildirIndex::set_parts(std::string path, uint8_t parts)
+{
+    CMaildirIndexEntry *entry = find_entry(path);
+
+    if ((entry == NULL) || (entry->parts == parts))
+        return;
+
+    entry->parts = parts;
+    m_dirty = true;
+}
+
+
+/*
+ * Find the entry for the message with the given path.
+ */
+CMaildirIndexEntry *CMaildirIndex::find_entry(std::string path)
+{
+    /*
+     * The name we use is the last two components of the path,
+     * i.e. "cur/xxx" or "new/xxx".
+     */
+    size_t last = path.rfind('/');
+
+    if ((last == std::string::npos) || (last == 0))
+        return NULL;
+
+    size_t prev = path.rfind('/', last - 1);
+    std::string name = (prev == std::string::npos) ? path : path.substr(prev + 1);
+
+    auto it = m_entries.find(name);
+
+    if (it == m_entries.end())
+        return NULL;
+
+    return &it->second;
+}
@@ -0,0 +1,246 @@
+/*
+ * maildir_index.h - Persistent index of the messages in a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+
+
+/**
+ * A single entry in a maildir-index, which describes one message-file.
+ */
+struct CMaildirIndexEntry
+{
+    /**
+     * The name of the file, relative to the maildir, e.g. "cur/123.host:2,S".
+     */
+    std::string name;
+
+    /**
+     * The inode of the file, used to spot renames.
+     */
+    uint64_t inode;
+
+    /**
+     * The size of the file, in bytes.
+     */
+    int64_t size;
+
+    /**
+     * The modification-time of the file.
+     */
+    int64_t mtime;
+
+    /**
+     * The maildir-flags of the message, as found in the filename.
+     */
+    std::string flags;
+
+    /**
+     * Have the key-headers of this message been recorded?
+     */
+    bool have_headers;
+
+    /**
+     * The key-headers of the message, lower-cased name to decoded value.
+     */
+    std::unordered_map<std::string, std::string> headers;
+
+    /**
+     * A summary of the MIME-parts of the message, as a mask of the
+     * `PARTS_` values, or `PARTS_UNKNOWN` if they've not been parsed.
+     */
+    uint8_t parts;
+
+    /**
+     * The bits of `parts`.
+     */
+    static const uint8_t PARTS_ATTACHMENT = 0x01;
+    static const uint8_t PARTS_SIGNED     = 0x02;
+    static const uint8_t PARTS_UNKNOWN    = 0xFF;
+};
+
+
+
+/**
+ * This class maintains a persistent index of a single maildir.
+ *
+ * The index records the filename, inode, size, mtime, flags, and a small
+ * set of pre-parsed headers for each message.  It is stored in a compact
+ * binary file beneath the maildir, which is loaded via a single `mmap`.
+ *
+ * When the messages in the maildir are requested we test the mtimes of
+ * `cur/` and `new/`, which are recorded in the index; only if they have
+ * changed are the directories read, and the entries compared against the
+ * index, calling `stat` only for files we've not seen before.  Renames,
+ * which happen when the flags of a message change, are detected via the
+ * inode so the cached headers survive them.
+ *
+ * A message rewritten in place changes neither its name nor its
+ * directory, so its size and mtime are instead tested by `is_current`,
+ * the first time its cached headers are used.
+ *
+ * The headers of new files are not parsed here; instead `CMessage`
+ * reports them back, via `set_headers`, the first time they are parsed,
+ * and `CMessage::header` answers from the index from then on.  Whether a
+ * message has attachments, or is signed, is recorded the same way, via
+ * `set_parts`.
+ *
+ * The headers which are stored default to those needed to format, sort,
+ * and thread the index, but may be changed via `headers`.
+ *
+ */
+class CMaildirIndex
+{
+public:
+
+    /**
+     * Constructor.  The path is the top-level of the maildir.
+     */
+    CMaildirIndex(std::string maildir);
+
+    /**
+     * Destructor.  Write the index to disk, if it has changed.
+     */
+    ~CMaildirIndex();
+
+    /**
+     * Compare the contents of `cur/` + `new/` against our index, updating
+     * it, and return the entries in directory-order.
+     *
+     * If `persist` is true the index is loaded from, and will be saved
+     * to, disk.
+     */
+    std::vector<CMaildirIndexEntry *> refresh(bool persist = true);
+
+    /**
+     * Record the headers of the message with the given path.
+     *
+     * Only the key-headers are stored, the rest are ignored.
+     */
+    void set_headers(std::string path, const std::unordered_map<std::string, std::string> &headers);
+
+    /**
+     * Is the file of the message with the given path unchanged since it
+     * was recorded?  If its size or mtime differ then the headers and
+     * parts we recorded are forgotten, and false is returned.
+     */
+    bool is_current(std::string path);
+
+    /**
+     * Record the summary of the MIME-parts of the message with the given
+     * path, as a mask of the `CMaildirIndexEntry::PARTS_` values.
+     */
+    void set_parts(std::string path, uint8_t parts);
+
+    /**
+     * Write the index to disk, if it has changed since it was loaded.
+     */
+    bool save();
+
+    /**
+     * The path to the on-disk index file.
+     */
+    std::string index_file();
+
+    /**
+     * Set the names of the headers which are stored in the index.
+     *
+     * If these differ from the headers we've stored then the headers of
+     * every message will be collected again.
+     */
+    void headers(std::vector<std::string> names);
+
+    /**
+     * The names of the headers which are stored in the index.
+     */
+    const std::vector<std::string> &headers();
+
+    /**
+     * Is the given (lower-case) header one we store in the index?
+     */
+    bool is_key_header(std::string name);
+
+    /**
+     * The names of the headers which are stored by default.
+     */
+    static const std::vector<std::string> &key_headers();
+
+private:
+
+    /**
+     * Load the on-disk index, if present.
+     */
+    bool load();
+
+    /**
+     * Read the given sub-directory of our maildir, appending an entry
+     * for each file found.  Only the name and inode are populated.
+     */
+    void list(std::string subdir, std::vector<CMaildirIndexEntry> &found);
+
+    /**
+     * Find the entry for the message with the given path.
+     */
+    CMaildirIndexEntry *find_entry(std::string path);
+
+private:
+
+    /**
+     * The maildir we represent.
+     */
+    std::string m_maildir;
+
+    /**
+     * The entries, keyed by filename.
+     */
+    std::unordered_map<std::string, CMaildirIndexEntry> m_entries;
+
+    /**
+     * The names of the headers we store, sorted.
+     */
+    std::vector<std::string> m_headers;
+
+    /**
+     * Have we attempted to load the on-disk index?
+     */
+    bool m_loaded;
+
+    /**
+     * Should we write our index to disk?
+     */
+    bool m_persist;
+
+    /**
+     * Has the index changed since it was loaded?
+     */
+    bool m_dirty;
+
+    /**
+     * The modification-times of `cur/` and `new/` when we last read them.
+     */
+    struct timespec m_cur_mtime;
+    struct timespec m_new_mtime;
+};
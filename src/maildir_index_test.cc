@@ -0,0 +1,356 @@
+/*
+ * maildir_index_test.cc - Test-cases for our CMaildirIndex class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "maildir_index.h"
+#include "CuTest.h"
+
+
+/*
+ * Create a temporary maildir, returning the path to it.
+ */
+static std::string make_maildir()
+{
+    char tmpl[] = "/tmp/lumail.indexXXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    mkdir(std::string(prefix + "/cur").c_str(), 0755);
+    mkdir(std::string(prefix + "/new").c_str(), 0755);
+    mkdir(std::string(prefix + "/tmp").c_str(), 0755);
+
+    return prefix;
+}
+
+
+/*
+ * Write a message with the given subject to the given file.
+ */
+static void write_message(std::string path, std::string subject)
+{
+    std::ofstream out(path);
+    out << "From: steve@example.com\n";
+    out << "Subject: " << subject << "\n";
+    out << "\nBody\n";
+    out.close();
+}
+
+
+/*
+ * Remove the contents of our temporary maildir.
+ */
+static void remove_maildir(std::string prefix, std::vector<std::string> files)
+{
+    for (std::string file : files)
+        unlink(std::string(prefix + "/" + file).c_str());
+
+    unlink(std::string(prefix + "/.lumail.index").c_str());
+    rmdir(std::string(prefix + "/cur").c_str());
+    rmdir(std::string(prefix + "/new").c_str());
+    rmdir(std::string(prefix + "/tmp").c_str());
+    rmdir(prefix.c_str());
+}
+
+
+/**
+ * Test that new files are found, and vanished ones removed.
+ */
+void TestMaildirIndexScan(CuTest * tc)
+{
+    std::string prefix = make_maildir();
+
+    write_message(prefix + "/cur/1.host:2,S", "One");
+    write_message(prefix + "/new/2.host", "Two");
+
+    CMaildirIndex idx(prefix);
+    std::vector<CMaildirIndexEntry *> entries = idx.refresh(false);
+
+    CuAssertIntEquals(tc, 2, entries.size());
+    CuAssertStrEquals(tc, "cur/1.host:2,S", entries[0]->name.c_str());
+    CuAssertStrEquals(tc, "S", entries[0]->flags.c_str());
+    CuAssertStrEquals(tc, "new/2.host", entries[1]->name.c_str());
+    CuAssertTrue(tc, entries[1]->have_headers == false);
+
+    /*
+     * Remove a message and ensure it is gone.
+     */
+    unlink(std::string(prefix + "/new/2.host").c_str());
+    entries = idx.refresh(false);
+    CuAssertIntEquals(tc, 1, entries.size());
+
+    /*
+     * We never persisted the index.
+     */
+    CuAssertTrue(tc, access(idx.index_file().c_str(), F_OK) != 0);
+
+    std::vector<std::string> files = { "cur/1.host:2,S" };
+    remove_maildir(prefix, files);
+}
+
+
+/**
+ * Test that the directories are only read when their mtimes change.
+ */
+void TestMaildirIndexUnchanged(CuTest * tc)
+{
+    std::string prefix = make_maildir();
+    std::string cur    = prefix + "/cur";
+
+    write_message(cur + "/1.host:2,S", "One");
+
+    {
+        CMaildirIndex idx(prefix);
+        CuAssertIntEquals(tc, 1, idx.refresh(true).size());
+    }
+
+    /*
+     * Add a message, but put the mtime of `cur/` back as it was; the
+     * persisted index is used without reading the directory.
+     */
+    struct stat before;
+    stat(cur.c_str(), &before);
+
+    write_message(cur + "/2.host:2,S", "Two");
+
+    struct timespec times[2];
+    times[0] = before.st_mtim;
+    times[1] = before.st_mtim;
+    CuAssertIntEquals(tc, 0, utimensat(AT_FDCWD, cur.c_str(), times, 0));
+
+    {
+        CMaildirIndex idx(prefix);
+        CuAssertIntEquals(tc, 1, idx.refresh(true).size());
+    }
+
+    /*
+     * Once the mtime changes the new message is found.
+     */
+    times[0].tv_sec += 10;
+    times[1] = times[0];
+    CuAssertIntEquals(tc, 0, utimensat(AT_FDCWD, cur.c_str(), times, 0));
+
+    CMaildirIndex idx(prefix);
+    CuAssertIntEquals(tc, 2, idx.refresh(true).size());
+
+    std::vector<std::string> files = { "cur/1.host:2,S", "cur/2.host:2,S" };
+    remove_maildir(prefix, files);
+}
+
+
+/**
+ * Test that the index survives a reload, and a rename.
+ */
+void TestMaildirIndexPersist(CuTest * tc)
+{
+    std::string prefix = make_maildir();
+
+    write_message(prefix + "/new/1.host", "One");
+
+    /*
+     * Create the index and record the headers of our message.
+     */
+    {
+        CMaildirIndex idx(prefix);
+        std::vector<CMaildirIndexEntry *> entries = idx.refresh(true);
+        CuAssertIntEquals(tc, 1, entries.size());
+        CuAssertIntEquals(tc, CMaildirIndexEntry::PARTS_UNKNOWN, entries[0]->parts);
+
+        std::unordered_map<std::string, std::string> headers;
+        headers["subject"] = "One";
+        headers["x-mailer"] = "lumail";
+        idx.set_headers(prefix + "/new/1.host", headers);
+        idx.set_parts(prefix + "/new/1.host", CMaildirIndexEntry::PARTS_ATTACHMENT);
+    }
+
+    /*
+     * Change the flags of the message, as `CMessage::mark_read` would.
+     */
+    rename(std::string(prefix + "/new/1.host").c_str(),
+           std::string(prefix + "/cur/1.host:2,S").c_str());
+
+    CMaildirIndex idx(prefix);
+    std::vector<CMaildirIndexEntry *> entries = idx.refresh(true);
+
+    CuAssertIntEquals(tc, 1, entries.size());
+    CuAssertStrEquals(tc, "cur/1.host:2,S", entries[0]->name.c_str());
+    CuAssertStrEquals(tc, "S", entries[0]->flags.c_str());
+    CuAssertTrue(tc, entries[0]->have_headers);
+    CuAssertStrEquals(tc, "One", entries[0]->headers["subject"].c_str());
+    CuAssertIntEquals(tc, CMaildirIndexEntry::PARTS_ATTACHMENT, entries[0]->parts);
+
+    /*
+     * Headers we don't index are not stored.
+     */
+    CuAssertTrue(tc, entries[0]->headers.find("x-mailer") == entries[0]->headers.end());
+
+    std::vector<std::string> files = { "cur/1.host:2,S" };
+    remove_maildir(prefix, files);
+}
+
+
+/**
+ * Test that the headers we store may be changed.
+ */
+void TestMaildirIndexHeaders(CuTest * tc)
+{
+    std::string prefix = make_maildir();
+
+    write_message(prefix + "/cur/1.host:2,S", "One");
+
+    std::unordered_map<std::string, std::string> headers;
+    headers["subject"]  = "One";
+    headers["x-mailer"] = "lumail";
+
+    /*
+     * Store the default headers.
+     */
+    {
+        CMaildirIndex idx(prefix);
+        idx.refresh(true);
+        idx.set_headers(prefix + "/cur/1.host:2,S", headers);
+
+        CuAssertTrue(tc, idx.is_key_header("subject"));
+        CuAssertTrue(tc, !idx.is_key_header("x-mailer"));
+    }
+
+    /*
+     * Reloading with the same list keeps the headers.
+     */
+    {
+        CMaildirIndex idx(prefix);
+        std::vector<CMaildirIndexEntry *> entries = idx.refresh(true);
+        CuAssertTrue(tc, entries[0]->have_headers);
+    }
+
+    /*
+     * Adding a header means we must collect them again.
+     */
+    std::vector<std::string> names = { "Subject", "X-Mailer" };
+
+    {
+        CMaildirIndex idx(prefix);
+        idx.headers(names);
+        CuAssertTrue(tc, idx.is_key_header("x-mailer"));
+
+        std::vector<CMaildirIndexEntry *> entries = idx.refresh(true);
+        CuAssertTrue(tc, entries[0]->have_headers == false);
+
+        idx.set_headers(prefix + "/cur/1.host:2,S", headers);
+    }
+
+    CMaildirIndex idx(prefix);
+    idx.headers(names);
+
+    std::vector<CMaildirIndexEntry *> entries = idx.refresh(true);
+    CuAssertTrue(tc, entries[0]->have_headers);
+    CuAssertStrEquals(tc, "lumail", entries[0]->headers["x-mailer"].c_str());
+    CuAssertIntEquals(tc, 2, entries[0]->headers.size());
+
+    std::vector<std::string> files = { "cur/1.host:2,S" };
+    remove_maildir(prefix, files);
+}
+
+
+/**
+ * Test that a message rewritten in place has its headers collected again.
+ */
+void TestMaildirIndexRewrite(CuTest * tc)
+{
+    std::string prefix = make_maildir();
+    std::string path   = prefix + "/cur/1.host:2,S";
+
+    write_message(path, "One");
+
+    std::unordered_map<std::string, std::string> headers;
+    headers["subject"] = "One";
+
+    {
+        CMaildirIndex idx(prefix);
+        idx.refresh(true);
+        idx.set_headers(path, headers);
+    }
+
+    /*
+     * Rewrite the file, keeping its name and inode, and make sure the
+     * mtime changes even within the same second.
+     */
+    struct stat before;
+    stat(path.c_str(), &before);
+
+    write_message(path, "Rewritten subject");
+
+    struct timespec times[2];
+    times[0].tv_sec  = before.st_mtime + 10;
+    times[0].tv_nsec = 0;
+    times[1]         = times[0];
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+
+    struct stat after;
+    stat(path.c_str(), &after);
+    CuAssertIntEquals(tc, before.st_ino, after.st_ino);
+
+    /*
+     * The directory is unchanged, so the entry is still as it was, until
+     * it is tested - as `CMessage` does when it uses the cached headers.
+     */
+    {
+        CMaildirIndex idx(prefix);
+        std::vector<CMaildirIndexEntry *> entries = idx.refresh(true);
+        CuAssertIntEquals(tc, 1, entries.size());
+        CuAssertTrue(tc, entries[0]->have_headers);
+
+        CuAssertTrue(tc, !idx.is_current(path));
+        CuAssertTrue(tc, entries[0]->have_headers == false);
+        CuAssertIntEquals(tc, after.st_size, entries[0]->size);
+        CuAssertTrue(tc, idx.is_current(path));
+
+        /*
+         * Record the headers, as `CMessage` does once it parses the file.
+         */
+        headers["subject"] = "Rewritten subject";
+        idx.set_headers(path, headers);
+    }
+
+    CMaildirIndex idx(prefix);
+    std::vector<CMaildirIndexEntry *> entries = idx.refresh(true);
+    CuAssertTrue(tc, entries[0]->have_headers);
+    CuAssertStrEquals(tc, "Rewritten subject", entries[0]->headers["subject"].c_str());
+
+    std::vector<std::string> files = { "cur/1.host:2,S" };
+    remove_maildir(prefix, files);
+}
+
+
+CuSuite *
+maildir_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirIndexScan);
+    SUITE_ADD_TEST(suite, TestMaildirIndexUnchanged);
+    SUITE_ADD_TEST(suite, TestMaildirIndexPersist);
+    SUITE_ADD_TEST(suite, TestMaildirIndexHeaders);
+    SUITE_ADD_TEST(suite, TestMaildirIndexRewrite);
+    return suite;
+}
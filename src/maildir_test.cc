@@ -0,0 +1,127 @@
+/*
+ * maildir_test.cc - Test-cases for our CMaildir class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "maildir.h"
+#include "CuTest.h"
+
+
+/*
+ * Create an empty file.
+ */
+static void touch(std::string path)
+{
+    std::ofstream out(path);
+    out << "Subject: test\n\nBody\n";
+    out.close();
+}
+
+
+/**
+ * Test that the total/unread counts of a maildir are correct.
+ */
+void TestMaildirCounts(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.maildirXXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    mkdir(std::string(prefix + "/cur").c_str(), 0755);
+    mkdir(std::string(prefix + "/new").c_str(), 0755);
+    mkdir(std::string(prefix + "/tmp").c_str(), 0755);
+
+    /*
+     * The files we create, and whether they're unread.
+     */
+    std::vector<std::string> files =
+    {
+        "cur/1.host:2,S",
+        "cur/2.host:2,RS",
+        "cur/3.host:2,",
+        "cur/4.host:2,NS",
+        "cur/5.host",
+        "new/6.host",
+    };
+
+    for (std::string file : files)
+        touch(prefix + "/" + file);
+
+    /*
+     * Dotfiles, and directories, are ignored.
+     */
+    touch(prefix + "/cur/.hidden");
+    mkdir(std::string(prefix + "/cur/subdir").c_str(), 0755);
+
+    CMaildir maildir(prefix);
+    CuAssertIntEquals(tc, 6, maildir.total_messages());
+    CuAssertIntEquals(tc, 4, maildir.unread_messages());
+
+    /*
+     * Now add more new mail.
+     */
+    struct stat before;
+    stat(std::string(prefix + "/new").c_str(), &before);
+
+    touch(prefix + "/new/7.host");
+    files.push_back("new/7.host");
+
+    /*
+     * The mtime of `new/` might not visibly change within the same
+     * second, on some filesystems, so move it on ourselves.
+     */
+    struct timespec times[2];
+    times[0].tv_sec  = before.st_mtime + 10;
+    times[0].tv_nsec = 0;
+    times[1]         = times[0];
+    CuAssertIntEquals(tc, 0, utimensat(AT_FDCWD, std::string(prefix + "/new").c_str(), times, 0));
+
+    /*
+     * The same object notices the change.
+     */
+    CuAssertIntEquals(tc, 7, maildir.total_messages());
+    CuAssertIntEquals(tc, 5, maildir.unread_messages());
+
+    /*
+     * Cleanup.
+     */
+    for (std::string file : files)
+        unlink(std::string(prefix + "/" + file).c_str());
+
+    unlink(std::string(prefix + "/cur/.hidden").c_str());
+    rmdir(std::string(prefix + "/cur/subdir").c_str());
+    rmdir(std::string(prefix + "/cur").c_str());
+    rmdir(std::string(prefix + "/new").c_str());
+    rmdir(std::string(prefix + "/tmp").c_str());
+    rmdir(prefix.c_str());
+}
+
+
+CuSuite *
+maildir_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirCounts);
+    return suite;
+}
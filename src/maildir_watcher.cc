@@ -0,0 +1,348 @@
+/*
+ * maildir_watcher.cc - Watch local maildirs for changes, via inotify.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+
+#include "global_state.h"
+#include "logger.h"
+#include "lua.h"
+#include "maildir.h"
+#include "maildir_watcher.h"
+#include "message.h"
+#include "util.h"
+
+
+
+/*
+ * Constructor.
+ */
+CMaildirWatcher::CMaildirWatcher()
+{
+#ifdef __linux__
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    m_fd = -1;
+#endif
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildirWatcher::~CMaildirWatcher()
+{
+    clear();
+
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+
+/*
+ * Stop watching all maildirs.
+ */
+void CMaildirWatcher::clear()
+{
+    for (auto it = m_watches.begin(); it != m_watches.end(); ++it)
+    {
+#ifdef __linux__
+        inotify_rm_watch(m_fd, it->first);
+#endif
+        std::shared_ptr<CMaildir> maildir = it->second.maildir.lock();
+
+        if (maildir)
+            maildir->set_watched(false);
+    }
+
+    m_watches.clear();
+}
+
+
+/*
+ * Replace the set of maildirs being watched.
+ */
+void CMaildirWatcher::watch(CMaildirList maildirs)
+{
+    clear();
+
+#ifdef __linux__
+
+    if (m_fd < 0)
+        return;
+
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+    for (std::shared_ptr<CMaildir> maildir : maildirs)
+    {
+        if (maildir->is_imap())
+            continue;
+
+        std::string cur = maildir->path() + "/cur";
+        std::string nw  = maildir->path() + "/new";
+
+        int cur_wd = inotify_add_watch(m_fd, cur.c_str(), mask);
+        int new_wd = inotify_add_watch(m_fd, nw.c_str(), mask);
+
+        /*
+         * If we couldn't watch both directories, most likely because
+         * we've hit the limit of watches, then leave the maildir to
+         * be polled as before.
+         */
+        if ((cur_wd < 0) || (new_wd < 0))
+        {
+            CLogger *logger = CLogger::instance();
+            logger->log("maildir", "Failed to watch %s: %s", maildir->path().c_str(), strerror(errno));
+
+            if (cur_wd >= 0)
+                inotify_rm_watch(m_fd, cur_wd);
+
+            if (new_wd >= 0)
+                inotify_rm_watch(m_fd, new_wd);
+
+            continue;
+        }
+
+        CWatchedDir c;
+        c.maildir = maildir;
+        c.is_new  = false;
+        m_watches[cur_wd] = c;
+
+        CWatchedDir n;
+        n.maildir = maildir;
+        n.is_new  = true;
+        m_watches[new_wd] = n;
+
+        maildir->set_watched(true);
+    }
+
+#else
+    (void)maildirs;
+#endif
+}
+
+
+/*
+ * Read any pending events, and apply them.
+ */
+bool CMaildirWatcher::poll()
+{
+#ifdef __linux__
+
+    if ((m_fd < 0) || m_watches.empty())
+        return false;
+
+    CGlobalState *global = CGlobalState::instance();
+    CLua *lua            = CLua::instance();
+
+    /*
+     * A file which has been moved out of a directory, and which we're
+     * waiting to see moved into another.
+     */
+    struct moved_file
+    {
+        int wd;
+        std::string name;
+    };
+
+    std::unordered_map<uint32_t, moved_file> moved;
+    std::unordered_set<std::string> changed;
+    bool overflow = false;
+
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    /*
+     * Helpers to find the maildir for a watch-descriptor, and the
+     * path of a file beneath it.
+     */
+    auto maildir_of = [this](int wd) -> std::shared_ptr<CMaildir>
+    {
+        auto it = m_watches.find(wd);
+
+        if (it == m_watches.end())
+            return NULL;
+
+        return (it->second.maildir.lock());
+    };
+
+    auto path_of = [this](int wd, std::shared_ptr<CMaildir> maildir, const std::string & name)
+    {
+        std::string path = maildir->path() + (m_watches[wd].is_new ? "/new/" : "/cur/") + name;
+        path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
+        return (path);
+    };
+
+    auto removed = [&](int wd, const std::string & name)
+    {
+        std::shared_ptr<CMaildir> maildir = maildir_of(wd);
+
+        if (!maildir)
+            return;
+
+        maildir->message_removed(name, m_watches[wd].is_new);
+        global->message_removed(path_of(wd, maildir, name));
+        changed.insert(maildir->path());
+    };
+
+    auto added = [&](int wd, const std::string & name)
+    {
+        std::shared_ptr<CMaildir> maildir = maildir_of(wd);
+
+        if (!maildir)
+            return;
+
+        std::string path = path_of(wd, maildir, name);
+
+        maildir->message_added(name, m_watches[wd].is_new);
+        changed.insert(maildir->path());
+
+        std::shared_ptr<CMessage> msg = global->message_added(maildir, path);
+
+        if (!msg)
+            msg = std::shared_ptr<CMessage>(new CMessage(path));
+
+        lua->on_message_arrived(msg, maildir->path());
+    };
+
+    while (true)
+    {
+        ssize_t len = read(m_fd, buf, sizeof(buf));
+
+        if (len <= 0)
+            break;
+
+        for (char *ptr = buf; ptr < buf + len;)
+        {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED)
+            {
+                m_watches.erase(event->wd);
+                continue;
+            }
+
+            /*
+             * Ignore directories, and dotfiles.
+             */
+            if ((event->mask & IN_ISDIR) || (event->len == 0) || (event->name[0] == '.'))
+                continue;
+
+            std::string name = event->name;
+
+            if (event->mask & IN_MOVED_FROM)
+            {
+                moved_file m;
+                m.wd   = event->wd;
+                m.name = name;
+                moved[event->cookie] = m;
+            }
+            else if (event->mask & IN_MOVED_TO)
+            {
+                auto it = moved.find(event->cookie);
+
+                if (it == moved.end())
+                {
+                    added(event->wd, name);
+                    continue;
+                }
+
+                /*
+                 * A rename, most likely because the flags changed or
+                 * the message moved from new/ to cur/.
+                 */
+                std::shared_ptr<CMaildir> src = maildir_of(it->second.wd);
+                std::shared_ptr<CMaildir> dst = maildir_of(event->wd);
+
+                if (src && dst && (src == dst))
+                {
+                    src->message_removed(it->second.name, m_watches[it->second.wd].is_new);
+                    dst->message_added(name, m_watches[event->wd].is_new);
+                    global->message_renamed(path_of(it->second.wd, src, it->second.name),
+                                            path_of(event->wd, dst, name));
+                    changed.insert(dst->path());
+                }
+                else
+                {
+                    removed(it->second.wd, it->second.name);
+                    added(event->wd, name);
+                }
+
+                moved.erase(it);
+            }
+            else if (event->mask & IN_CREATE)
+            {
+                added(event->wd, name);
+            }
+            else if (event->mask & IN_DELETE)
+            {
+                removed(event->wd, name);
+            }
+        }
+    }
+
+    /*
+     * Files moved out of our maildirs entirely have been removed.
+     */
+    for (auto it = moved.begin(); it != moved.end(); ++it)
+        removed(it->second.wd, it->second.name);
+
+    /*
+     * If we missed events then we must fall back to a rescan.
+     */
+    if (overflow)
+    {
+        for (auto it = m_watches.begin(); it != m_watches.end(); ++it)
+        {
+            std::shared_ptr<CMaildir> maildir = it->second.maildir.lock();
+
+            if (maildir)
+            {
+                maildir->invalidate_counts();
+                changed.insert(maildir->path());
+            }
+        }
+
+        global->update_messages(true);
+    }
+
+    for (std::string folder : changed)
+        lua->maildir_changed(folder);
+
+    return (!changed.empty());
+
+#else
+    return false;
+#endif
+}
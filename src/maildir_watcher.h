@@ -0,0 +1,99 @@
+/*
+ * maildir_watcher.h - Watch local maildirs for changes, via inotify.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "maildir.h"
+#include "singleton.h"
+
+
+/**
+ * The CMaildirWatcher class is a singleton which watches the `new/` and
+ * `cur/` directories of every local maildir, via inotify.
+ *
+ * Rather than rescanning a maildir whenever its modification-time changes
+ * we receive a stream of add/rename/delete events, which are applied to
+ * the message-counts of the maildir, and to the list of messages held by
+ * `CGlobalState`, as deltas.
+ *
+ * For each message which arrives the Lua function `on_message_arrived`
+ * is invoked, if it is defined.
+ *
+ * On systems without inotify this class does nothing, and we fall back
+ * to polling modification-times as before.
+ */
+class CMaildirWatcher : public Singleton<CMaildirWatcher>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMaildirWatcher();
+
+    /**
+     * Destructor.
+     */
+    ~CMaildirWatcher();
+
+public:
+
+    /**
+     * Replace the set of maildirs being watched.
+     */
+    void watch(CMaildirList maildirs);
+
+    /**
+     * Stop watching all maildirs.
+     */
+    void clear();
+
+    /**
+     * Read any pending events, without blocking, and apply them.
+     *
+     * Returns true if anything changed.
+     */
+    bool poll();
+
+private:
+
+    /**
+     * A directory we're watching.
+     */
+    struct CWatchedDir
+    {
+        std::weak_ptr<CMaildir> maildir;
+        bool is_new;
+    };
+
+    /**
+     * Our inotify handle.
+     */
+    int m_fd;
+
+    /**
+     * The directories we're watching, keyed by watch-descriptor.
+     */
+    std::unordered_map<int, CWatchedDir> m_watches;
+};
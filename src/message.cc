@@ -21,6 +21,7 @@
 #include <cstdlib>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <string.h>
 #include <string>
@@ -41,16 +42,20 @@
 
 
 
+#include "approxidate.h"
 #include "config.h"
 #include "file.h"
 #include "global_state.h"
+#include "imap_prefetch.h"
 #include "imap_proxy.h"
 #include "json/json.h"
 #include "lua.h"
 #include "maildir.h"
+#include "maildir_index.h"
 #include "message.h"
 #include "message_part.h"
 #include "mime.h"
+#include "screen.h"
 #include "util.h"
 
 
@@ -62,6 +67,10 @@ CMessage::CMessage(const std::string name, bool is_local)
     m_path = name;
     m_time = 0;
     m_imap = !is_local;
+    m_headers_complete = false;
+    m_headers_seeded   = false;
+    m_cache_checked    = false;
+    m_parts_summary    = CMaildirIndexEntry::PARTS_UNKNOWN;
 }
 
 
@@ -83,6 +92,12 @@ std::string CMessage::path()
 void CMessage::path(std::string new_path)
 {
     m_path = new_path;
+
+    /*
+     * Any MIME-parts we've parsed read their content from our file.
+     */
+    for (auto part : m_parts)
+        part->source(new_path);
 }
 
 
@@ -91,25 +106,107 @@ void CMessage::path(std::string new_path)
  */
 std::string CMessage::header(std::string name)
 {
-    std::unordered_map < std::string, std::string > h = headers();
-
     /*
      * Lower-case the header we were given.
      */
     std::transform(name.begin(), name.end(), name.begin(), tolower);
 
+    check_cache();
+
+    /*
+     * If we've been seeded with the key-headers then we might be
+     * able to answer without parsing the message at all.
+     */
+    if (!m_headers_complete && m_headers_seeded)
+    {
+        auto it = m_headers.find(name);
+
+        if (it != m_headers.end())
+            return (it->second);
+
+        std::shared_ptr<CMaildirIndex> idx = m_index.lock();
+
+        if (idx && idx->is_key_header(name))
+            return "";
+    }
+
+    if (!m_headers_complete && !parse_headers())
+        populate_message();
+
     /*
      * Lookup the value.
      */
-    return (h[name]);
+    auto it = m_headers.find(name);
+
+    if (it != m_headers.end())
+        return (it->second);
+
+    return "";
+}
+
+
+/*
+ * Seed the header-cache with values we've already parsed.
+ */
+void CMessage::set_cached_headers(const std::unordered_map < std::string, std::string > &headers)
+{
+    if (m_headers_complete)
+        return;
+
+    m_headers        = headers;
+    m_headers_seeded = true;
+}
+
+
+/*
+ * Forget our seeded values if our file has been rewritten.
+ *
+ * This is done lazily, rather than when the index is refreshed, so that
+ * opening a large maildir doesn't `stat` every message.
+ */
+void CMessage::check_cache()
+{
+    if (m_cache_checked)
+        return;
+
+    if (!m_headers_seeded && (m_parts_summary == CMaildirIndexEntry::PARTS_UNKNOWN))
+        return;
+
+    m_cache_checked = true;
+
+    std::shared_ptr<CMaildirIndex> idx = m_index.lock();
+
+    if (!idx || idx->is_current(m_path))
+        return;
+
+    if (!m_headers_complete)
+    {
+        m_headers.clear();
+        m_headers_seeded = false;
+    }
+
+    m_parts_summary = CMaildirIndexEntry::PARTS_UNKNOWN;
+}
+
+
+/*
+ * Set the index which contains this message.
+ */
+void CMessage::index(std::shared_ptr<CMaildirIndex> owner)
+{
+    m_index = owner;
 }
 
 
 /*
  * Parse a MIME message and return an object suitable for operating
  * upon.
+ *
+ * The message refers to the file it was parsed from, rather than holding
+ * copies of the content of each part, so it keeps the file open until it
+ * is unref'd.
  */
-GMimeMessage * CMessage::parse_message()
+GMimeMessage * CMessage::parse_message(bool *replaced_file)
 {
 
     /*
@@ -167,11 +264,14 @@ GMimeMessage * CMessage::parse_message()
         return (NULL);
     }
 
+    /*
+     * The stream owns `fd`, and will close it when the message, which
+     * persists a reference to it, is freed.
+     */
     stream = g_mime_stream_fs_new(fd);
-    g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
 
     parser = g_mime_parser_new_with_stream(stream);
-    g_mime_parser_set_persist_stream(parser, FALSE);
+    g_mime_parser_set_persist_stream(parser, TRUE);
 
     message = g_mime_parser_construct_message(parser);
     g_object_unref(stream);
@@ -185,10 +285,10 @@ GMimeMessage * CMessage::parse_message()
     {
 
         /*
-         * Close the file and retry parsing it, by opening it and
-         * skipping two lines.
+         * Retry parsing the file, by opening it and skipping two lines.
+         *
+         * The previous descriptor was closed along with its stream.
          */
-        close(fd);
         fd = open(file.c_str(), O_RDONLY, 0);
 
         int newline = 2;
@@ -222,8 +322,7 @@ GMimeMessage * CMessage::parse_message()
         stream    = g_mime_stream_fs_new(fd);
 
         parser    = g_mime_parser_new_with_stream(stream);
-        g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
-        g_mime_parser_set_persist_stream(parser, FALSE);
+        g_mime_parser_set_persist_stream(parser, TRUE);
 
         message = g_mime_parser_construct_message(parser);
         g_object_unref(stream);
@@ -231,30 +330,24 @@ GMimeMessage * CMessage::parse_message()
 
     }
 
+    /*
+     * The replacement file is removed, but it remains readable via the
+     * open descriptor for as long as the message exists.
+     */
     if (replaced == true)
         CFile::delete_file(file);
 
-    /*
-     * We close this here explicitly to avoid a leak.
-     */
-    close(fd);
+    if (replaced_file != NULL)
+        *replaced_file = replaced;
+
     return (message);
 }
 
-/**
- * Populate the headers and MIME-Parts caches.
+/*
+ * Store the headers of the given message in our cache.
  */
-void CMessage::populate_message() {
-
-    GMimeMessage *msg = parse_message();
-
-    if (msg == NULL)
-    {
-        CLua *lua = CLua::instance();
-        lua->on_error("Failed to populate message :" + path());
-        return;
-    }
-
+void CMessage::store_headers(GMimeMessage *msg)
+{
     const char *name;
     const char *value;
 
@@ -315,14 +408,133 @@ void CMessage::populate_message() {
     g_mime_header_list_clear(ls);
     g_mime_header_iter_free(iter);
 
+    m_headers_complete = true;
+
+    /*
+     * Let our index know the headers, so they can be persisted.
+     */
+    std::shared_ptr<CMaildirIndex> idx = m_index.lock();
+
+    if (idx)
+        idx->set_headers(m_path, m_headers);
+}
+
+
+/*
+ * Parse only the headers of our message.
+ *
+ * We read the file until we find the blank line which terminates the
+ * header-block, and hand just that to GMime, so the body of the
+ * message is never touched.
+ */
+bool CMessage::parse_headers()
+{
+    /*
+     * If we're an IMAP-messge then we need to ensure
+     * that our file exists locally.
+     */
+    if (m_imap)
+        lazy_load();
+
+    int fd = open(m_path.c_str(), O_RDONLY, 0);
+
+    if (fd < 0)
+        return false;
+
+    /*
+     * The largest header-block we'll read.
+     */
+    const size_t max_size = 256 * 1024;
+
+    std::string block;
+    char buf[8192];
+    ssize_t len;
+    bool found = false;
+
+    while (!found && (block.size() < max_size) &&
+            ((len = read(fd, buf, sizeof(buf))) > 0))
+    {
+        /*
+         * Look for the end of the headers, allowing for the
+         * separator to span two reads.
+         */
+        size_t from = block.size() > 3 ? block.size() - 3 : 0;
+        block.append(buf, len);
+
+        size_t end = block.find("\n\n", from);
+        size_t crlf = block.find("\n\r\n", from);
+
+        if ((crlf != std::string::npos) && ((end == std::string::npos) || (crlf < end)))
+            end = crlf;
+
+        if (end != std::string::npos)
+        {
+            block.resize(end + 1);
+            found = true;
+        }
+    }
+
+    close(fd);
+
+    if (block.empty())
+        return false;
+
+    /*
+     * Terminate the header-block, and parse it.
+     */
+    block += "\n";
+
+    GMimeStream *stream = g_mime_stream_mem_new_with_buffer(block.c_str(), block.size());
+    GMimeParser *parser = g_mime_parser_new_with_stream(stream);
+    g_mime_parser_set_persist_stream(parser, FALSE);
+
+    GMimeMessage *message = g_mime_parser_construct_message(parser);
+    g_object_unref(stream);
+    g_object_unref(parser);
+
+    if (message == NULL)
+        return false;
+
+    store_headers(message);
+    g_object_unref(message);
+
+    return true;
+}
+
+
+/**
+ * Populate the headers and MIME-Parts caches.
+ */
+void CMessage::populate_message() {
+
+    bool replaced = false;
+    GMimeMessage *msg = parse_message(&replaced);
+
+    if (msg == NULL)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to populate message :" + path());
+        return;
+    }
+
+    store_headers(msg);
+
     /* Parse into MIME-Parts */
 
     GMimeObject *mime_part = g_mime_message_get_mime_part(msg);
 
     if (!mime_part)
+    {
+        g_object_unref(msg);
         return;
+    }
 
-    m_parts.push_back(part2obj(mime_part));
+    /*
+     * If the message was replaced then the file we parsed has gone,
+     * so the content of each part must be read now.
+     */
+    if (m_parts.empty())
+        m_parts.push_back(part2obj(mime_part, !replaced));
 
     g_object_unref(msg);
 }
@@ -334,9 +546,10 @@ void CMessage::populate_message() {
 std::unordered_map < std::string, std::string > CMessage::headers()
 {
     /*
-     * If we've cached these then return that copy.
+     * If we've cached these then return that copy, otherwise
+     * parse just the header-block of the message.
      */
-    if (m_headers.size() == 0)
+    if (!m_headers_complete && !parse_headers())
         populate_message();
 
     return (m_headers);
@@ -426,6 +639,11 @@ void CMessage::set_flags(std::string new_flags)
     {
         CFile::move(cur_path, dst_path);
         path(dst_path);
+
+        /*
+         * The flags are shown in the index, which must be redrawn.
+         */
+        CScreen::instance()->damage(CScreen::DAMAGE_CONTENT);
     }
 }
 
@@ -451,8 +669,13 @@ void CMessage::set_imap_flags(std::string flags)
     /*
      * Increase the modification time of the parent folder too.
      */
-    m_parent->bump_mtime();
+    if (m_parent)
+        m_parent->bump_mtime();
 
+    /*
+     * The flags are shown in the index, which must be redrawn.
+     */
+    CScreen::instance()->damage(CScreen::DAMAGE_CONTENT);
 }
 
 
@@ -573,10 +796,11 @@ void CMessage::mark_unread()
         std::string cmd = "mark_unread " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't need to wait for the reply, since the proxy carries
+         * out our requests in order.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->send_command(cmd, true);
 
         /*
          * Remove `S` flag from m_imap_flags since these are
@@ -606,6 +830,11 @@ void CMessage::mark_unread()
          */
         m_parent->bump_mtime();
 
+        /*
+         * The flags are shown in the index, which must be redrawn.
+         */
+        CScreen::instance()->damage(CScreen::DAMAGE_CONTENT);
+
         int c = m_parent->unread_messages();
         c += 1;
         m_parent->set_unread(c);
@@ -646,10 +875,11 @@ void CMessage::mark_read()
         std::string cmd = "mark_read " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't need to wait for the reply, since the proxy carries
+         * out our requests in order.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->send_command(cmd, true);
 
         /*
          * Remove `N` flag from m_imap_flags since these are
@@ -679,6 +909,11 @@ void CMessage::mark_read()
          */
         m_parent->bump_mtime();
 
+        /*
+         * The flags are shown in the index, which must be redrawn.
+         */
+        CScreen::instance()->damage(CScreen::DAMAGE_CONTENT);
+
         int c = m_parent->unread_messages();
         c -= 1;
 
@@ -734,7 +969,7 @@ void CMessage::mark_read()
 /*
  * Convert a message-part from the MIME message to a CMessagePart object.
  */
-std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
+std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part, bool lazy)
 {
     /*
      * This is used to enable/disable conversion of character
@@ -765,114 +1000,104 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
         aname = (char *) g_mime_object_get_content_type_parameter(part, "name");
 
     /*
-     * Holder for the content
+     * Should we convert the content of this part to UTF-8?
+     *
+     * We only do that if the content is:
+     *
+     *   text/plain
+     *   not UTF-8 already.
      */
-    GMimeStream *mem = g_mime_stream_mem_new();
+    std::string convert;
 
-    if (GMIME_IS_MULTIPART(part) || GMIME_IS_MESSAGE_PARTIAL(part))
-    {
-        /* NOP */
-    }
-    else if (GMIME_IS_MESSAGE_PART(part))
-    {
-
-        /*
-         * Populate `mem` with the data.
-         */
-        GMimeMessage *msg = g_mime_message_part_get_message(GMIME_MESSAGE_PART(part));
-        g_mime_object_write_to_stream(GMIME_OBJECT(msg), mem);
-
-        /*
-         * We explicitly don't free this message here, because this
-         * will be done by the caller.
-         *
-         * g_object_unref(msg);
-         *
-         *  https://github.com/lumail/lumail2/issues/292
-         *
-         */
-
-    }
-    else
-    {
-        /*
-         * Populate `mem` with the data.
-         */
-        GMimeDataWrapper *content = g_mime_part_get_content_object(GMIME_PART(part));
-        g_mime_data_wrapper_write_to_stream(content, mem);
-    }
+    if ((iconv == 1) &&
+            (g_mime_content_type_is_type(ct, "text", "plain")) &&
+            (charset != NULL) &&
+            (strcmp(charset, "utf-8") != 0) &&
+            (strcmp(charset, "UTF-8") != 0))
+        convert = charset;
 
     /*
-     * NOTE: by setting the owner to FALSE, it means unreffing the
-     * memory stream won't free the GByteArray data.
+     * For a simple part, which we're allowed to read lazily, we just
+     * record where the encoded content lives in the message-file.
      */
-    g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+    GMimeDataWrapper *content = NULL;
+    GMimeStream *source = NULL;
 
+    if (!GMIME_IS_MULTIPART(part) && !GMIME_IS_MESSAGE_PARTIAL(part) &&
+            !GMIME_IS_MESSAGE_PART(part))
+    {
+        content = g_mime_part_get_content_object(GMIME_PART(part));
 
-    /*
-     * Now we have `res` which is a byte-array of the part's content.
-     *
-     * We also have the content-type.
-     */
-    GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+        if (content != NULL)
+            source = g_mime_data_wrapper_get_stream(content);
+    }
 
-    /*
-     * The actual data from the array, and the size of that data.
-     */
-    char *adata = (char *) res->data;
-    size_t len = (res->len);
+    std::shared_ptr<CMessagePart> ret;
 
-    if (iconv == 1)
+    if (lazy && (source != NULL) && (source->bound_end > source->bound_start))
+    {
+        ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, aname ? aname : "",
+                                             m_path, source->bound_start, source->bound_end,
+                                             g_mime_data_wrapper_get_encoding(content),
+                                             convert));
+    }
+    else
     {
         /*
-         * Now we'll try to conver the text to UTF-8, but we
-         * only do that if the content is:
-         *
-         *   text/plain
-         *   not UTF-8 already.
+         * Holder for the content
          */
+        GMimeStream *mem = g_mime_stream_mem_new();
 
-        if ((g_mime_content_type_is_type(ct, "text", "plain")) &&
-                (charset != NULL) &&
-                (strcmp(charset, "utf-8") != 0) &&
-                (strcmp(charset, "UTF-8") != 0))
+        if (GMIME_IS_MULTIPART(part) || GMIME_IS_MESSAGE_PARTIAL(part))
+        {
+            /* NOP */
+        }
+        else if (GMIME_IS_MESSAGE_PART(part))
         {
-            iconv_t cv = g_mime_iconv_open("UTF-8", charset);
-            char *converted = g_mime_iconv_strndup(cv, (const char *) adata, len);
 
-            if (converted != NULL)
-            {
-                /*
-                 * If that succeeded then update our byte-array.
-                 *
-                 * This might causes problems in free.  We should check.
-                 */
-                size_t conv_len = strlen(converted);
-                adata = (char*)malloc(conv_len + 1);
-
-                memcpy(adata, converted, conv_len + 1);
-                len = (size_t)conv_len;
-                g_free(converted);
-            }
+            /*
+             * Populate `mem` with the data.
+             */
+            GMimeMessage *msg = g_mime_message_part_get_message(GMIME_MESSAGE_PART(part));
+            g_mime_object_write_to_stream(GMIME_OBJECT(msg), mem);
+
+            /*
+             * We explicitly don't free this message here, because this
+             * will be done by the caller.
+             *
+             * g_object_unref(msg);
+             *
+             *  https://github.com/lumail/lumail2/issues/292
+             *
+             */
 
         }
-    }
+        else if (content != NULL)
+        {
+            /*
+             * Populate `mem` with the data.
+             */
+            g_mime_data_wrapper_write_to_stream(content, mem);
+        }
 
-    std::shared_ptr<CMessagePart> ret;
+        /*
+         * NOTE: by setting the owner to FALSE, it means unreffing the
+         * memory stream won't free the GByteArray, which we take over.
+         */
+        g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+        GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+        g_object_unref(mem);
 
-    /*
-     * If it is an attachment we'll add it.
-     */
-    if (aname)
-    {
-        ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, aname, adata, len));
-    }
-    else
-    {
         /*
-         * Here we store it, but not as an attachment.
+         * The actual data from the array, and the size of that data.
          */
-        ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, "", adata, len));
+        size_t len  = res->len;
+        char *adata = (char *) g_byte_array_free(res, FALSE);
+
+        if (!convert.empty())
+            CMessagePart::to_utf8(convert, &adata, &len);
+
+        ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, aname ? aname : "", adata, len));
     }
 
     /* If this is a multipart part, then add its children. */
@@ -893,7 +1118,7 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
             /*
              * Create the child - set the parent.
              */
-            std::shared_ptr<CMessagePart> child = part2obj(subpart);
+            std::shared_ptr<CMessagePart> child = part2obj(subpart, lazy);
             child->set_parent(ret);
 
             /*
@@ -904,10 +1129,9 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
     }
 
     /*
-     * Unref the memory & type.
+     * Unref the type.
      */
     free(type);
-    g_object_unref(mem);
 
     return ret;
 }
@@ -960,10 +1184,11 @@ bool CMessage::unlink()
         std::string cmd = "delete_message " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't need to wait for the reply, since the proxy carries
+         * out our requests in order.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->send_command(cmd, true);
 
         /*
          * Increase the modification time of the parent folder.
@@ -1212,11 +1437,121 @@ int CMessage::get_mtime()
 }
 
 
+/*
+ * Retrieve the date of our message.
+ */
+time_t CMessage::get_date()
+{
+    /*
+     * Maildir filenames usually start with the time of delivery.
+     */
+    std::string name = path();
+    size_t slash = name.rfind('/');
+
+    if (slash != std::string::npos)
+        name = name.substr(slash + 1);
+
+    size_t digits = 0;
+
+    while ((digits < name.size()) && isdigit(name[digits]))
+        digits++;
+
+    if ((digits > 0) && (digits < name.size()) && (name[digits] == '.'))
+        return (strtoll(name.substr(0, digits).c_str(), NULL, 10));
+
+    /*
+     * Otherwise look for `Delivery-Date`, then `Date`.
+     */
+    std::string date = header("Delivery-Date");
+
+    if (date.empty())
+        date = header("Date");
+
+    struct timeval t;
+
+    if (!date.empty() && (approxidate(date.c_str(), &t) == 0))
+        return (t.tv_sec);
+
+    return 0;
+}
+
+
+/*
+ * Retrieve the informational flags of our message.
+ */
+std::string CMessage::get_message_flags()
+{
+    check_cache();
+
+    if (m_parts_summary == CMaildirIndexEntry::PARTS_UNKNOWN)
+    {
+        uint8_t summary = 0;
+
+        std::function<void(std::vector<std::shared_ptr<CMessagePart>>)> walk =
+            [&](std::vector<std::shared_ptr<CMessagePart>> parts)
+        {
+            for (std::shared_ptr<CMessagePart> part : parts)
+            {
+                if (!part->filename().empty())
+                    summary |= CMaildirIndexEntry::PARTS_ATTACHMENT;
+
+                std::string type = part->type();
+                std::transform(type.begin(), type.end(), type.begin(), tolower);
+
+                if (type == "text/x-gpg-output")
+                    summary |= CMaildirIndexEntry::PARTS_SIGNED;
+
+                walk(part->children());
+            }
+        };
+
+        walk(get_parts());
+        m_parts_summary = summary;
+
+        /*
+         * Let our index know, so we don't need to parse again.
+         */
+        std::shared_ptr<CMaildirIndex> idx = m_index.lock();
+
+        if (idx)
+            idx->set_parts(m_path, summary);
+    }
+
+    std::string flags;
+
+    if (m_parts_summary & CMaildirIndexEntry::PARTS_ATTACHMENT)
+        flags += "A";
+
+    if (m_parts_summary & CMaildirIndexEntry::PARTS_SIGNED)
+        flags += "S";
+
+    return flags;
+}
+
+
+/*
+ * Seed the summary of our MIME-parts.
+ */
+void CMessage::set_cached_parts(uint8_t parts)
+{
+    m_parts_summary = parts;
+}
+
+
 /*
  * Load our IMAP-based body, lazily.
  */
 void CMessage::lazy_load()
 {
+    if (CFile::exists(m_path))
+        return;
+
+    /*
+     * The message might be being fetched in the background, in which
+     * case we wait for that rather than fetching it twice.
+     */
+    CIMAPPrefetch::instance()->claim(m_path);
+
     if (! CFile::exists(m_path))
     {
         /*
@@ -21,12 +21,14 @@
 
 
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <gmime/gmime.h>
 
 class CMaildir;
+class CMaildirIndex;
 
 /*
  * Forward declaration of class.
@@ -77,8 +79,20 @@ public:
      */
     void path(std::string new_path);
 
+    /**
+     * Get the path of this message, without fetching the body of an
+     * IMAP message into it.
+     */
+    std::string cache_path()
+    {
+        return m_path;
+    };
+
     /**
      * Get the value of the given header.
+     *
+     * Only the header-block of the message is read to answer this,
+     * the MIME-parts are not parsed until `get_parts()` is called.
      */
     std::string header(std::string name);
 
@@ -87,6 +101,21 @@ public:
      */
     std::unordered_map < std::string, std::string > headers();
 
+    /**
+     * Seed the header-cache with values we've already parsed, for
+     * example from a `CMaildirIndex`.
+     *
+     * Only the key-headers are expected to be present, if any other
+     * header is requested the message will be parsed as normal.
+     */
+    void set_cached_headers(const std::unordered_map < std::string, std::string > &headers);
+
+    /**
+     * Set the index this message belongs to, which will be informed
+     * when we parse our headers.
+     */
+    void index(std::shared_ptr<CMaildirIndex> owner);
+
     /**
      * Retrieve the current flags for this message.
      */
@@ -98,7 +127,8 @@ public:
     void set_flags(std::string new_flags);
 
     /**
-     * Set IMAP-flags - these are set at creation time.
+     * Set IMAP-flags - these are set at creation time.  The modification
+     * time of the parent folder is bumped, if it has been set.
      */
     void set_imap_flags(std::string flags);
 
@@ -110,6 +140,14 @@ public:
         m_imap_id = n;
     };
 
+    /**
+     * Get the IMAP message ID of this message.
+     */
+    int get_imap_id()
+    {
+        return m_imap_id;
+    };
+
 
     /**
      * Add a flag to a message.
@@ -193,6 +231,32 @@ public:
      */
     int get_mtime();
 
+    /**
+     * Retrieve the date of our message.
+     *
+     * Like `Message:to_ctime` we use the time at the start of the filename,
+     * if present, otherwise the `Delivery-Date` or `Date` header.
+     */
+    time_t get_date();
+
+    /**
+     * Retrieve the informational flags of our message, which are
+     * unrelated to its maildir-flags:
+     *
+     *   A => The message has attachments.
+     *   S => The message is signed.
+     *
+     * Finding these requires the MIME-parts to be parsed, so the result
+     * is recorded in our index, if we have one.
+     */
+    std::string get_message_flags();
+
+    /**
+     * Seed the result of `get_message_flags`, as a mask of the
+     * `CMaildirIndexEntry::PARTS_` values.
+     */
+    void set_cached_parts(uint8_t parts);
+
 private:
 
     /**
@@ -203,18 +267,42 @@ private:
     /**
      * Parse a MIME message and return an object suitable for operating
      * upon.
+     *
+     * If `replaced` is non-NULL it is set to show whether the message
+     * was parsed from a file supplied by `message_replace`, which no
+     * longer exists.
      */
-    GMimeMessage * parse_message();
+    GMimeMessage * parse_message(bool *replaced = NULL);
 
     /**
      * Populate the headers and MIME-Parts caches.
      */
     void populate_message();
 
+    /**
+     * Populate the header cache, reading only the header-block of
+     * the message.  Returns false on failure.
+     */
+    bool parse_headers();
+
+    /**
+     * Store the headers of the given message in our cache.
+     */
+    void store_headers(GMimeMessage *msg);
+
     /**
      * Convert a message-part from the MIME message to a CMessagePart object.
+     *
+     * If `lazy` is true the content of simple parts isn't read, instead
+     * it is decoded from our file when it is first used.
      */
-    std::shared_ptr<CMessagePart> part2obj(GMimeObject *part);
+    std::shared_ptr<CMessagePart> part2obj(GMimeObject *part, bool lazy);
+
+    /**
+     * Forget the headers, and parts-summary, we were seeded with if our
+     * file has been rewritten since our index recorded them.
+     */
+    void check_cache();
 
 private:
 
@@ -233,11 +321,37 @@ private:
      */
     std::unordered_map < std::string, std::string > m_headers;
 
+    /**
+     * Does `m_headers` contain all the headers of the message, or
+     * just those which were seeded via `set_cached_headers`?
+     */
+    bool m_headers_complete;
+
+    /**
+     * Has `m_headers` been seeded, from our index?
+     */
+    bool m_headers_seeded;
+
+    /**
+     * Have we tested that our seeded values are current?
+     */
+    bool m_cache_checked;
+
+    /**
+     * The index which contains this message, if any.
+     */
+    std::weak_ptr<CMaildirIndex> m_index;
+
     /**
      * Cached MIME-parts to this message.
      */
     std::vector<std::shared_ptr<CMessagePart>> m_parts;
 
+    /**
+     * The summary of our MIME-parts, see `get_message_flags`.
+     */
+    uint8_t m_parts_summary;
+
     /**
      * Is this message stored in IMAP?
      */
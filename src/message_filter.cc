@@ -0,0 +1,310 @@
+/*
+ * message_filter.cc - Filter messages by the value of `index.limit`.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <ctype.h>
+#include <pcrecpp.h>
+#include <string.h>
+#include <time.h>
+
+
+#include "message_filter.h"
+
+
+
+/*
+ * Return the POSIX class-name for the given Lua character-class, or NULL.
+ */
+static const char *lua_class(char c)
+{
+    switch (tolower(c))
+    {
+    case 'a':
+        return "alpha";
+
+    case 'c':
+        return "cntrl";
+
+    case 'd':
+        return "digit";
+
+    case 'g':
+        return "graph";
+
+    case 'l':
+        return "lower";
+
+    case 'p':
+        return "punct";
+
+    case 's':
+        return "space";
+
+    case 'u':
+        return "upper";
+
+    case 'w':
+        return "alnum";
+
+    case 'x':
+        return "xdigit";
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Append the given character to a regular expression, escaping it if
+ * it is special.
+ */
+static void append_literal(std::string &regexp, char c)
+{
+    if (isascii(c) && !isalnum(c) && !isspace(c))
+        regexp += '\\';
+
+    regexp += c;
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageFilter::CMessageFilter(std::string limit)
+{
+    if (limit == "all")
+    {
+        m_predicate = [](std::shared_ptr<CMessage>)
+        {
+            return true;
+        };
+    }
+    else if (limit == "new")
+    {
+        m_predicate = [](std::shared_ptr<CMessage> msg)
+        {
+            return (msg->is_new());
+        };
+    }
+    else if (limit == "today")
+    {
+        time_t today = time(NULL) - (60 * 60 * 24);
+
+        m_predicate = [today](std::shared_ptr<CMessage> msg)
+        {
+            return (msg->get_date() > today);
+        };
+    }
+    else if (limit == "attach")
+    {
+        m_predicate = [](std::shared_ptr<CMessage> msg)
+        {
+            return (msg->get_message_flags().find('A') != std::string::npos);
+        };
+    }
+    else
+    {
+        /*
+         * If the pattern contains no special characters we can search
+         * for it literally, otherwise we translate it to a regexp.
+         */
+        std::shared_ptr<pcrecpp::RE> re;
+
+        if (limit.find_first_of("^$*+?.([%-") != std::string::npos)
+        {
+            std::string regexp;
+
+            if (!translate_pattern(limit, regexp))
+                return;
+
+            pcrecpp::RE_Options opt;
+            opt.set_dotall(true);
+
+            re = std::shared_ptr<pcrecpp::RE>(new pcrecpp::RE(regexp, opt));
+
+            if (!re->error().empty())
+                return;
+        }
+
+        auto match = [re, limit](const std::string & value)
+        {
+            if (re)
+                return (re->PartialMatch(value));
+
+            return (value.find(limit) != std::string::npos);
+        };
+
+        m_predicate = [match](std::shared_ptr<CMessage> msg)
+        {
+            return (match(msg->header("From")) ||
+                    match(msg->header("To")) ||
+                    match(msg->header("Subject")));
+        };
+    }
+}
+
+
+/*
+ * Can this limit be evaluated natively?
+ */
+bool CMessageFilter::valid()
+{
+    return (m_predicate ? true : false);
+}
+
+
+/*
+ * Does the given message match our limit?
+ */
+bool CMessageFilter::matches(std::shared_ptr<CMessage> msg)
+{
+    return (m_predicate && m_predicate(msg));
+}
+
+
+/*
+ * Translate a Lua pattern to the equivalent PCRE regular expression.
+ */
+bool CMessageFilter::translate_pattern(std::string pattern, std::string &regexp)
+{
+    regexp.clear();
+
+    /*
+     * Is the previous item a single character-class, which may be
+     * followed by a quantifier?
+     */
+    bool atom = false;
+    size_t len = pattern.size();
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = pattern[i];
+
+        if (c == '%')
+        {
+            if (++i >= len)
+                return false;
+
+            c = pattern[i];
+
+            /*
+             * We can't support balanced-matches, frontiers, or
+             * back-references.
+             */
+            if ((c == 'b') || (c == 'f') || isdigit(c))
+                return false;
+
+            const char *cls = lua_class(c);
+
+            if (cls != NULL)
+            {
+                regexp += std::string("[[:") + (isupper(c) ? "^" : "") + cls + ":]]";
+            }
+            else
+            {
+                append_literal(regexp, c);
+            }
+
+            atom = true;
+        }
+        else if (c == '[')
+        {
+            regexp += '[';
+            i++;
+
+            if ((i < len) && (pattern[i] == '^'))
+            {
+                regexp += '^';
+                i++;
+            }
+
+            /*
+             * A leading `]` is literal.
+             */
+            bool first = true;
+
+            while ((i < len) && ((pattern[i] != ']') || first))
+            {
+                char s = pattern[i];
+                first = false;
+
+                if (s == '%')
+                {
+                    if (++i >= len)
+                        return false;
+
+                    s = pattern[i];
+                    const char *cls = lua_class(s);
+
+                    if (cls != NULL)
+                        regexp += std::string("[:") + (isupper(s) ? "^" : "") + cls + ":]";
+                    else
+                        append_literal(regexp, s);
+                }
+                else if ((s == '-') && (i + 1 < len) && (pattern[i + 1] != ']'))
+                {
+                    regexp += '-';
+                }
+                else
+                {
+                    append_literal(regexp, s);
+                }
+
+                i++;
+            }
+
+            if (i >= len)
+                return false;
+
+            regexp += ']';
+            atom = true;
+        }
+        else if ((c == '^') && (i == 0))
+        {
+            regexp += '^';
+            atom = false;
+        }
+        else if ((c == '$') && (i == len - 1))
+        {
+            regexp += "\\z";
+            atom = false;
+        }
+        else if ((c == '*' || c == '+' || c == '?' || c == '-') && atom)
+        {
+            regexp += (c == '-') ? "*?" : std::string(1, c);
+            atom = false;
+        }
+        else if (c == '.')
+        {
+            regexp += '.';
+            atom = true;
+        }
+        else if ((c == '(') || (c == ')'))
+        {
+            regexp += c;
+            atom = false;
+        }
+        else
+        {
+            append_literal(regexp, c);
+            atom = true;
+        }
+    }
+
+    return true;
+}
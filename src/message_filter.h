@@ -0,0 +1,79 @@
+/*
+ * message_filter.h - Filter messages by the value of `index.limit`.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "message.h"
+
+
+/**
+ * A compiled form of the `index.limit` value.
+ *
+ * The limit is parsed once, into a predicate, which is then evaluated
+ * against each message without calling into Lua:
+ *
+ *   all    -> Every message.
+ *   new    -> Messages which are unread.
+ *   today  -> Messages which arrived in the past 24 hours.
+ *   attach -> Messages which have at least one named MIME-part.
+ *
+ * Anything else is a Lua pattern, which is translated to a regular
+ * expression and matched against the `From`, `To`, and `Subject` headers.
+ * A pattern which cannot be translated, such as one using `%b` or `%f`,
+ * leaves the filter invalid, and the caller must fall back to Lua.
+ */
+class CMessageFilter
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMessageFilter(std::string limit);
+
+    /**
+     * Can this limit be evaluated natively?
+     */
+    bool valid();
+
+    /**
+     * Does the given message match our limit?
+     */
+    bool matches(std::shared_ptr<CMessage> msg);
+
+    /**
+     * Translate a Lua pattern to the equivalent PCRE regular expression.
+     *
+     * Returns false if the pattern uses features we cannot translate.
+     */
+    static bool translate_pattern(std::string pattern, std::string &regexp);
+
+private:
+
+    /**
+     * The predicate we compiled the limit to, which is empty if the
+     * limit is invalid.
+     */
+    std::function<bool(std::shared_ptr<CMessage>)> m_predicate;
+};
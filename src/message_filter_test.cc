@@ -0,0 +1,80 @@
+/*
+ * message_filter_test.cc - Test-cases for our CMessageFilter class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "message_filter.h"
+#include "CuTest.h"
+
+
+/**
+ * Test the translation of Lua patterns to regular expressions.
+ */
+void TestMessageFilterPatterns(CuTest * tc)
+{
+    std::string out;
+
+    CuAssertTrue(tc, CMessageFilter::translate_pattern("^Re: %d+$", out));
+    CuAssertStrEquals(tc, "^Re\\: [[:digit:]]+\\z", out.c_str());
+
+    CuAssertTrue(tc, CMessageFilter::translate_pattern("a.-b", out));
+    CuAssertStrEquals(tc, "a.*?b", out.c_str());
+
+    CuAssertTrue(tc, CMessageFilter::translate_pattern("[%a_-]%S", out));
+    CuAssertStrEquals(tc, "[[:alpha:]\\_\\-][[:^space:]]", out.c_str());
+
+    CuAssertTrue(tc, CMessageFilter::translate_pattern("%.(x|y){1}", out));
+    CuAssertStrEquals(tc, "\\.(x\\|y)\\{1\\}", out.c_str());
+
+    /*
+     * A leading quantifier is literal.
+     */
+    CuAssertTrue(tc, CMessageFilter::translate_pattern("*-", out));
+    CuAssertStrEquals(tc, "\\**?", out.c_str());
+
+    /*
+     * Things we cannot translate.
+     */
+    CuAssertTrue(tc, !CMessageFilter::translate_pattern("%b()", out));
+    CuAssertTrue(tc, !CMessageFilter::translate_pattern("%f[%w]", out));
+    CuAssertTrue(tc, !CMessageFilter::translate_pattern("[abc", out));
+    CuAssertTrue(tc, !CMessageFilter::translate_pattern("100%", out));
+}
+
+
+/**
+ * Test which limits are valid.
+ */
+void TestMessageFilterValid(CuTest * tc)
+{
+    CuAssertTrue(tc, CMessageFilter("all").valid());
+    CuAssertTrue(tc, CMessageFilter("new").valid());
+    CuAssertTrue(tc, CMessageFilter("steve").valid());
+    CuAssertTrue(tc, !CMessageFilter("%bxy").valid());
+}
+
+
+CuSuite *
+message_filter_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageFilterPatterns);
+    SUITE_ADD_TEST(suite, TestMessageFilterValid);
+    return suite;
+}
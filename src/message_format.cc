@@ -0,0 +1,396 @@
+/*
+ * message_format.cc - Format messages for display in index-mode.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "message_format.h"
+#include "util.h"
+
+
+/*
+ * Constructor.
+ */
+CMessageFormat::CMessageFormat(std::string format)
+{
+    m_source    = format;
+    m_uses_name = false;
+
+    size_t pos = 0;
+
+    while (pos < format.size())
+    {
+        /*
+         * Find the next reference, which must have balanced braces.
+         */
+        size_t start = format.find("${", pos);
+        size_t end   = std::string::npos;
+
+        if (start != std::string::npos)
+        {
+            int depth = 0;
+
+            for (size_t i = start + 1; i < format.size(); i++)
+            {
+                if (format[i] == '{')
+                    depth++;
+                else if (format[i] == '}')
+                    depth--;
+
+                if (depth == 0)
+                {
+                    end = i;
+                    break;
+                }
+            }
+        }
+
+        if (end == std::string::npos)
+            start = format.size();
+
+        if (start > pos)
+        {
+            CFormatOp literal;
+            literal.field    = LITERAL;
+            literal.text     = format.substr(pos, start - pos);
+            literal.width    = -1;
+            literal.pad_left = true;
+            literal.padding  = ' ';
+            m_ops.push_back(literal);
+        }
+
+        if (end == std::string::npos)
+            break;
+
+        CFormatOp op = parse_field(format.substr(start + 2, end - start - 2));
+
+        if (op.field == NAME)
+            m_uses_name = true;
+
+        m_ops.push_back(op);
+        pos = end + 1;
+    }
+}
+
+
+/*
+ * The template we were compiled from.
+ */
+std::string CMessageFormat::source()
+{
+    return (m_source);
+}
+
+
+/*
+ * Parse a single `${...}` reference, without the braces.
+ */
+CMessageFormat::CFormatOp CMessageFormat::parse_field(std::string key)
+{
+    static const struct
+    {
+        const char *name;
+        FormatField field;
+    } fields[] =
+    {
+        {"date", DATE},
+        {"email", EMAIL},
+        {"flags", FLAGS},
+        {"id", ID},
+        {"indent", INDENT},
+        {"message_flags", MESSAGE_FLAGS},
+        {"name", NAME},
+        {"number", NUMBER},
+        {"recipient", RECIPIENT},
+        {"recipient_email", RECIPIENT_EMAIL},
+        {"recipient_name", RECIPIENT_NAME},
+        {"sender", SENDER},
+        {"sender_email", SENDER_EMAIL},
+        {"sender_name", SENDER_NAME},
+        {"subject", SUBJECT},
+    };
+
+    CFormatOp op;
+    op.field    = UNKNOWN;
+    op.text     = "${" + key + "}";
+    op.width    = -1;
+    op.pad_left = true;
+    op.padding  = ' ';
+
+    std::string name = key;
+    std::string len;
+
+    /*
+     * "name|NN" pads on the right, "NN|name" on the left.  If both
+     * match the former wins, as it does in `string.interp`.
+     */
+    size_t bar = key.rfind('|');
+
+    if ((bar != std::string::npos) && (bar + 1 < key.size()) &&
+            (key.find_first_not_of("0123456789", bar + 1) == std::string::npos))
+    {
+        name = key.substr(0, bar);
+        len  = key.substr(bar + 1);
+        op.pad_left = false;
+    }
+    else
+    {
+        bar = key.find('|');
+
+        if ((bar != std::string::npos) && (bar > 0) &&
+                (key.find_first_not_of("0123456789") == bar))
+        {
+            len  = key.substr(0, bar);
+            name = key.substr(bar + 1);
+        }
+    }
+
+    if (!len.empty())
+    {
+        op.width = atoi(len.c_str());
+
+        if (len[0] == '0')
+            op.padding = '0';
+    }
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        if (name == fields[i].name)
+            op.field = fields[i].field;
+    }
+
+    return (op);
+}
+
+
+/*
+ * Split an address into the email-address and the name, as
+ * `Message:format` used to.
+ */
+void CMessageFormat::split_address(std::string address, std::string &email, std::string &name)
+{
+    size_t open  = address.find('<');
+    size_t close = address.rfind('>');
+
+    if ((open != std::string::npos) && (close != std::string::npos) && (close > open))
+    {
+        email = address.substr(open + 1, close - open - 1);
+        name  = address.substr(0, open) + address.substr(close + 1);
+    }
+    else
+    {
+        email = address;
+        name  = address;
+    }
+
+    if (name.empty())
+        name = address;
+}
+
+
+/*
+ * Format the given message.
+ */
+std::string CMessageFormat::expand(std::shared_ptr<CMessage> msg, std::string indent, std::string number)
+{
+    std::string result;
+
+    /*
+     * The addresses are only split if they're used.
+     */
+    bool have_sender = false;
+    std::string sender, sender_email, sender_name, name;
+
+    bool have_recipient = false;
+    std::string recipient, recipient_email, recipient_name;
+
+    for (const CFormatOp &op : m_ops)
+    {
+        if (op.field == LITERAL)
+        {
+            result += op.text;
+            continue;
+        }
+
+        if (!have_sender && (op.field == SENDER || op.field == SENDER_EMAIL ||
+                             op.field == SENDER_NAME || op.field == EMAIL ||
+                             op.field == NAME))
+        {
+            sender = msg->header("From");
+            split_address(sender, sender_email, sender_name);
+            name = sender_name;
+
+            /*
+             * The user might have a filter-function to cleanup
+             * the name of the sender.
+             */
+            if (m_uses_name)
+            {
+                CLua *lua = CLua::instance();
+
+                if (lua->function_exists("on_clean_name"))
+                    name = lua->function2string("on_clean_name", name);
+            }
+
+            have_sender = true;
+        }
+
+        if (!have_recipient && (op.field == RECIPIENT || op.field == RECIPIENT_EMAIL ||
+                                op.field == RECIPIENT_NAME))
+        {
+            recipient = msg->header("To");
+            split_address(recipient, recipient_email, recipient_name);
+            have_recipient = true;
+        }
+
+        std::string value;
+        bool found = true;
+
+        switch (op.field)
+        {
+        case DATE:
+            value = msg->header("Date");
+            break;
+
+        case EMAIL:
+        case SENDER_EMAIL:
+            value = sender_email;
+            break;
+
+        case FLAGS:
+            value = msg->get_flags();
+            break;
+
+        case ID:
+            value = msg->header("Message-ID");
+            break;
+
+        case INDENT:
+            value = indent;
+            break;
+
+        case MESSAGE_FLAGS:
+            value = msg->get_message_flags();
+            break;
+
+        case NAME:
+            value = name;
+            break;
+
+        case NUMBER:
+            value = number;
+            found = !number.empty();
+            break;
+
+        case RECIPIENT:
+            value = recipient;
+            break;
+
+        case RECIPIENT_EMAIL:
+            value = recipient_email;
+            break;
+
+        case RECIPIENT_NAME:
+            value = recipient_name;
+            break;
+
+        case SENDER:
+            value = sender;
+            break;
+
+        case SENDER_NAME:
+            value = sender_name;
+            break;
+
+        case SUBJECT:
+            value = msg->header("Subject");
+            break;
+
+        default:
+            found = false;
+            break;
+        }
+
+        if (!found)
+            value = op.text;
+
+        if (op.width >= 0)
+            value = pad(value, op.width, op.pad_left, op.padding);
+
+        result += value;
+    }
+
+    /*
+     * If the message is unread then show it in the "unread" colour
+     */
+    if (msg->is_new())
+        result = "$[UNREAD]" + result;
+
+    return (result);
+}
+
+
+/*
+ * Return the compiled form of the given template.
+ */
+std::shared_ptr<CMessageFormat> CMessageFormat::compile(std::string format)
+{
+    static std::shared_ptr<CMessageFormat> cached;
+
+    if (!cached || (cached->source() != format))
+        cached = std::shared_ptr<CMessageFormat>(new CMessageFormat(format));
+
+    return (cached);
+}
+
+
+/*
+ * Pad, or truncate, the given value to the given number of characters.
+ */
+std::string CMessageFormat::pad(std::string value, size_t width, bool left, char padding)
+{
+    size_t chars = 0;
+
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (dsutil_utf8_charlen(value[i]) < 1)
+            continue;
+
+        /*
+         * Truncate before the first character which won't fit.
+         */
+        if (chars == width)
+            return (value.substr(0, i));
+
+        chars++;
+    }
+
+    if (chars < width)
+    {
+        std::string fill(width - chars, padding);
+
+        if (left)
+            value = fill + value;
+        else
+            value += fill;
+    }
+
+    return (value);
+}
@@ -0,0 +1,159 @@
+/*
+ * message_format.h - Format messages for display in index-mode.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "message.h"
+
+
+/**
+ * A compiled form of the `index.format` template.
+ *
+ * The template is parsed once, into a list of literal strings and field
+ * references, which is then expanded against each message without
+ * calling into Lua.  The syntax is that of `string.interp`:
+ *
+ *   ${name}     -> The value of the field.
+ *   ${10|name}  -> The value, truncated or left-padded to ten characters.
+ *   ${name|10}  -> The value, truncated or right-padded to ten characters.
+ *   ${04|name}  -> The value, left-padded with zeros.
+ *
+ * A reference to a field which doesn't exist is left as-is.
+ */
+class CMessageFormat
+{
+public:
+
+    /**
+     * Constructor.  Compile the given template.
+     */
+    CMessageFormat(std::string format);
+
+    /**
+     * The template we were compiled from.
+     */
+    std::string source();
+
+    /**
+     * Format the given message.
+     *
+     * `indent` is the thread-indentation of the message, and `number`
+     * its position in the index, or empty if not known.
+     */
+    std::string expand(std::shared_ptr<CMessage> msg, std::string indent, std::string number);
+
+    /**
+     * Return the compiled form of the given template, which is cached
+     * until the template changes.
+     */
+    static std::shared_ptr<CMessageFormat> compile(std::string format);
+
+    /**
+     * Pad, or truncate, the given value to the given number of
+     * characters - not bytes.
+     */
+    static std::string pad(std::string value, size_t width, bool left, char padding);
+
+private:
+
+    /**
+     * The fields which may be referenced.
+     */
+    enum FormatField
+    {
+        LITERAL,
+        UNKNOWN,
+        DATE,
+        EMAIL,
+        FLAGS,
+        ID,
+        INDENT,
+        MESSAGE_FLAGS,
+        NAME,
+        NUMBER,
+        RECIPIENT,
+        RECIPIENT_EMAIL,
+        RECIPIENT_NAME,
+        SENDER,
+        SENDER_EMAIL,
+        SENDER_NAME,
+        SUBJECT
+    };
+
+    /**
+     * A single piece of the template.
+     */
+    struct CFormatOp
+    {
+        /**
+         * The field to expand, or LITERAL.
+         */
+        FormatField field;
+
+        /**
+         * The literal text, or the original reference, which is used if
+         * the field has no value.
+         */
+        std::string text;
+
+        /**
+         * The width to pad or truncate to, or -1.
+         */
+        int width;
+
+        /**
+         * Is the value padded on the left, and with which character?
+         */
+        bool pad_left;
+        char padding;
+    };
+
+    /**
+     * Parse a single `${...}` reference, without the braces.
+     */
+    static CFormatOp parse_field(std::string key);
+
+    /**
+     * Split an address into the email-address and the name.
+     */
+    static void split_address(std::string address, std::string &email, std::string &name);
+
+private:
+
+    /**
+     * The template we were compiled from.
+     */
+    std::string m_source;
+
+    /**
+     * The compiled template.
+     */
+    std::vector<CFormatOp> m_ops;
+
+    /**
+     * Does the template refer to the name of the sender, which requires
+     * the `on_clean_name` hook to be called?
+     */
+    bool m_uses_name;
+};
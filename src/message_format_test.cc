@@ -0,0 +1,109 @@
+/*
+ * message_format_test.cc - Test-cases for our CMessageFormat class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "maildir_index.h"
+#include "message.h"
+#include "message_format.h"
+#include "test_support.h"
+#include "CuTest.h"
+
+
+/**
+ * Test the padding and truncation of values.
+ */
+void TestMessageFormatPad(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "  abc", CMessageFormat::pad("abc", 5, true, ' ').c_str());
+    CuAssertStrEquals(tc, "abc  ", CMessageFormat::pad("abc", 5, false, ' ').c_str());
+    CuAssertStrEquals(tc, "007", CMessageFormat::pad("7", 3, true, '0').c_str());
+    CuAssertStrEquals(tc, "abc", CMessageFormat::pad("abcdef", 3, true, ' ').c_str());
+    CuAssertStrEquals(tc, "", CMessageFormat::pad("abc", 0, true, ' ').c_str());
+
+    /*
+     * Widths are in characters, not bytes.
+     */
+    CuAssertStrEquals(tc, "h\xc3\xa9", CMessageFormat::pad("h\xc3\xa9llo", 2, true, ' ').c_str());
+    CuAssertStrEquals(tc, " h\xc3\xa9", CMessageFormat::pad("h\xc3\xa9", 3, true, ' ').c_str());
+}
+
+
+/**
+ * Test the expansion of a template.
+ */
+void TestMessageFormatExpand(CuTest * tc)
+{
+    std::unordered_map<std::string, std::string> headers =
+    {
+        {"from", "Steve <steve@example.com>"},
+        {"to", "bob@example.com"},
+        {"subject", "Hello"},
+        {"message-id", "<1@example.com>"}
+    };
+
+    std::shared_ptr<CMessage> msg = make_message("/tmp/lumail.format/cur/1.host:2,S", headers);
+    msg->set_cached_parts(CMaildirIndexEntry::PARTS_ATTACHMENT);
+
+    /*
+     * The default template.
+     */
+    CMessageFormat def("[${4|flags}] ${2|message_flags} - ${20|sender} - ${indent}${subject}");
+    CuAssertStrEquals(tc, "[   S]  A - Steve <steve@example - -> Hello",
+                      def.expand(msg, "-> ", "1").c_str());
+
+    /*
+     * The parts of the addresses.
+     */
+    CMessageFormat addr("${sender_name|8}/${sender_email}/${recipient_name}/${recipient_email}");
+    CuAssertStrEquals(tc, "Steve   /steve@example.com/bob@example.com/bob@example.com",
+                      addr.expand(msg, "", "").c_str());
+
+    /*
+     * Unknown fields are left alone, as is the number if not given.
+     */
+    CMessageFormat unknown("${03|number} ${missing} ${5|missing} $x {y}");
+    CuAssertStrEquals(tc, "007 ${missing} ${5|m $x {y}", unknown.expand(msg, "", "7").c_str());
+    CuAssertStrEquals(tc, "${0 ${missing} ${5|m $x {y}", unknown.expand(msg, "", "").c_str());
+
+    /*
+     * New messages are coloured.
+     */
+    headers["from"] = "steve@example.com";
+    msg = make_message("/tmp/lumail.format/new/2.host", headers);
+    CMessageFormat flags("${flags}:${email}");
+    CuAssertStrEquals(tc, "$[UNREAD]N:steve@example.com", flags.expand(msg, "", "").c_str());
+
+    /*
+     * The compiled template is reused until it changes.
+     */
+    std::shared_ptr<CMessageFormat> a = CMessageFormat::compile("${subject}");
+    CuAssertPtrEquals(tc, a.get(), CMessageFormat::compile("${subject}").get());
+    CuAssertTrue(tc, a.get() != CMessageFormat::compile("${flags}").get());
+}
+
+
+CuSuite *
+message_format_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageFormatPad);
+    SUITE_ADD_TEST(suite, TestMessageFormatExpand);
+    return suite;
+}
@@ -33,12 +33,15 @@
 #include <vector>
 
 #include "approxidate.h"
+#include "config.h"
 #include "file.h"
 #include "global_state.h"
 #include "lua.h"
 #include "message.h"
+#include "message_format.h"
 #include "message_part.h"
 #include "message_part_lua.h"
+#include "screen.h"
 
 
 /**
@@ -385,6 +388,38 @@ int l_CMessage_ctime(lua_State * l)
 }
 
 
+/**
+ * Implementation of CMessage:format_line
+ *
+ * Format the message for index-mode, according to `index.format`.
+ */
+int l_CMessage_format_line(lua_State * l)
+{
+    CLuaLog("l_CMessage_format_line");
+
+    std::shared_ptr<CMessage> msg = l_CheckCMessage(l, 1);
+    const char *indent = luaL_optstring(l, 2, "");
+
+    /*
+     * The number is optional.
+     */
+    std::string number;
+
+    if (lua_isnumber(l, 3))
+        number = std::to_string(lua_tointeger(l, 3));
+    else if (lua_isstring(l, 3))
+        number = lua_tostring(l, 3);
+
+    CConfig *config = CConfig::instance();
+    std::string format = config->get_string("index.format", "[${4|flags}] ${2|message_flags} - ${20|sender} - ${indent}${subject}");
+
+    std::shared_ptr<CMessageFormat> tmpl = CMessageFormat::compile(format);
+    lua_pushstring(l, tmpl->expand(msg, indent, number).c_str());
+
+    return 1;
+}
+
+
 /**
  * Implementation of CMessage:flags
  */
@@ -477,6 +512,7 @@ int l_CMessage_unlink(lua_State * l)
     global->set_message(NULL);
     global->update_messages();
 
+    CScreen::instance()->damage();
     return 0;
 }
 
@@ -493,6 +529,7 @@ void InitMessage(lua_State * l)
         {"add_attachments", l_CMessage_add_attachments},
         {"ctime", l_CMessage_ctime},
         {"flags", l_CMessage_flags},
+        {"format_line", l_CMessage_format_line},
         {"generate_message_id", l_CMessage_generate_message_id},
         {"header", l_CMessage_header},
         {"headers", l_CMessage_headers},
@@ -18,12 +18,22 @@
 
 
 #include <algorithm>
+#include <fcntl.h>
 #include <string>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 #include <stdlib.h>
 
 #include "message_part.h"
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 
 
 /*
@@ -37,12 +47,22 @@ CMessagePart::CMessagePart(std::string type, std::string filename,
     m_filename       = filename;
     m_content        = NULL;
     m_content_length = 0;
+    m_lazy           = false;
+    m_loaded         = true;
+    m_size_known     = true;
+    m_start          = 0;
+    m_end            = 0;
+    m_encoding       = GMIME_CONTENT_ENCODING_DEFAULT;
 
     if ((content_length > 0) && (content != NULL))
     {
         m_content = content;
         m_content_length = content_length;
     }
+    else if (content != NULL)
+    {
+        free(content);
+    }
 
     /*
      * To allow users to make use of the MIME type more easily
@@ -52,6 +72,31 @@ CMessagePart::CMessagePart(std::string type, std::string filename,
 
 }
 
+
+/*
+ * Constructor for a part whose content is decoded lazily.
+ */
+CMessagePart::CMessagePart(std::string type, std::string filename, std::string source,
+                           int64_t start, int64_t end, GMimeContentEncoding encoding,
+                           std::string charset)
+{
+    m_parent         = nullptr;
+    m_type           = type;
+    m_filename       = filename;
+    m_content        = NULL;
+    m_content_length = 0;
+    m_lazy           = true;
+    m_loaded         = false;
+    m_size_known     = false;
+    m_source         = source;
+    m_start          = start;
+    m_end            = end;
+    m_encoding       = encoding;
+    m_charset        = charset;
+
+    std::transform(m_type.begin(), m_type.end(), m_type.begin(), ::tolower);
+}
+
 /*
  * Destructor.
  */
@@ -100,6 +145,9 @@ bool CMessagePart::is_attachment()
  */
 void * CMessagePart::content()
 {
+    if (!m_loaded)
+        load();
+
     return (m_content);
 }
 
@@ -108,10 +156,298 @@ void * CMessagePart::content()
  */
 size_t CMessagePart::content_size()
 {
+    if (m_loaded || m_size_known)
+        return (m_content_length);
+
+    /*
+     * Converting the character set changes the length, so we must
+     * decode the content properly.  That only happens for text/plain
+     * parts, which are small.
+     */
+    if (!m_charset.empty())
+    {
+        load();
+        return (m_content_length);
+    }
+
+    /*
+     * Otherwise decode into a null-stream, which just counts.
+     */
+    GMimeDataWrapper *wrapper = source_wrapper();
+
+    if (wrapper != NULL)
+    {
+        GMimeStream *null = g_mime_stream_null_new();
+        ssize_t len = g_mime_data_wrapper_write_to_stream(wrapper, null);
+
+        m_content_length = (len > 0) ? len : 0;
+
+        g_object_unref(null);
+        g_object_unref(wrapper);
+    }
+
+    m_size_known = true;
     return (m_content_length);
 }
 
 
+/*
+ * Write all of the given buffer to the descriptor.
+ */
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = write(fd, data, len);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        data += written;
+        len  -= written;
+    }
+
+    return true;
+}
+
+
+/*
+ * Copy the given range of one file to another, without decoding it.
+ */
+static bool copy_range(int in, int out, off_t start, off_t end)
+{
+    off_t offset = start;
+
+#ifdef __linux__
+
+    /*
+     * Let the kernel copy the data, if it can.
+     */
+    while (offset < end)
+    {
+        ssize_t copied = sendfile(out, in, &offset, end - offset);
+
+        if (copied <= 0)
+            break;
+    }
+
+    if (offset >= end)
+        return true;
+
+#endif
+
+    char buf[64 * 1024];
+
+    while (offset < end)
+    {
+        size_t want = std::min((off_t) sizeof(buf), end - offset);
+        ssize_t got = pread(in, buf, want, offset);
+
+        if (got < 0 && errno == EINTR)
+            continue;
+
+        if (got <= 0)
+            return false;
+
+        if (!write_all(out, buf, got))
+            return false;
+
+        offset += got;
+    }
+
+    return true;
+}
+
+
+/*
+ * Write the decoded content to the given file.
+ */
+bool CMessagePart::save(std::string path)
+{
+    /*
+     * Text which needs converting is small, so we just load it.
+     */
+    if (!m_loaded && !m_charset.empty())
+        load();
+
+    int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (out < 0)
+        return false;
+
+    bool ok = false;
+
+    if (m_loaded)
+    {
+        ok = write_all(out, (const char *)m_content, m_content_length);
+    }
+    else if ((m_encoding == GMIME_CONTENT_ENCODING_DEFAULT) ||
+             (m_encoding == GMIME_CONTENT_ENCODING_7BIT) ||
+             (m_encoding == GMIME_CONTENT_ENCODING_8BIT) ||
+             (m_encoding == GMIME_CONTENT_ENCODING_BINARY))
+    {
+        /*
+         * The content isn't encoded, so it can be copied as-is.
+         */
+        int in = open(m_source.c_str(), O_RDONLY);
+
+        if (in >= 0)
+        {
+            ok = copy_range(in, out, m_start, m_end);
+            close(in);
+        }
+    }
+    else
+    {
+        /*
+         * Decode as we write - GMime streams the data through its
+         * filters with a fixed-size buffer.
+         */
+        GMimeDataWrapper *wrapper = source_wrapper();
+
+        if (wrapper != NULL)
+        {
+            GMimeStream *stream = g_mime_stream_fs_new(out);
+            g_mime_stream_fs_set_owner((GMimeStreamFs *) stream, FALSE);
+
+            ok = (g_mime_data_wrapper_write_to_stream(wrapper, stream) >= 0) &&
+                 (g_mime_stream_flush(stream) == 0);
+
+            g_object_unref(stream);
+            g_object_unref(wrapper);
+        }
+    }
+
+    if (close(out) != 0)
+        ok = false;
+
+    return ok;
+}
+
+
+/*
+ * Update the path of the message-file we read our content from.
+ */
+void CMessagePart::source(std::string path)
+{
+    if (m_lazy)
+        m_source = path;
+
+    for (auto child : m_children)
+        child->source(path);
+}
+
+
+/*
+ * Open a data-wrapper which decodes our content from the message-file.
+ */
+GMimeDataWrapper *CMessagePart::source_wrapper()
+{
+    if (m_end <= m_start)
+        return NULL;
+
+    int fd = open(m_source.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    /*
+     * The stream owns the descriptor, and will close it.
+     */
+    GMimeStream *stream = g_mime_stream_mmap_new_with_bounds(fd, PROT_READ, MAP_PRIVATE, m_start, m_end);
+
+    if (stream == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    GMimeDataWrapper *wrapper = g_mime_data_wrapper_new_with_stream(stream, m_encoding);
+    g_object_unref(stream);
+
+    return (wrapper);
+}
+
+
+/*
+ * Decode our content from the message-file.
+ */
+bool CMessagePart::load()
+{
+    m_loaded     = true;
+    m_size_known = true;
+
+    GMimeDataWrapper *wrapper = source_wrapper();
+
+    if (wrapper == NULL)
+        return false;
+
+    GMimeStream *mem = g_mime_stream_mem_new();
+    g_mime_data_wrapper_write_to_stream(wrapper, mem);
+    g_object_unref(wrapper);
+
+    /*
+     * NOTE: by setting the owner to FALSE, it means unreffing the
+     * memory stream won't free the GByteArray, which we take over.
+     */
+    g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+    GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+    g_object_unref(mem);
+
+    size_t len = res->len;
+    char *data = (char *) g_byte_array_free(res, FALSE);
+
+    if (!m_charset.empty())
+        to_utf8(m_charset, &data, &len);
+
+    if (len == 0)
+    {
+        free(data);
+        data = NULL;
+    }
+
+    m_content        = data;
+    m_content_length = len;
+
+    return true;
+}
+
+
+/*
+ * Convert the given data to UTF-8.
+ */
+void CMessagePart::to_utf8(std::string charset, char **data, size_t *len)
+{
+    iconv_t cv = g_mime_iconv_open("UTF-8", charset.c_str());
+
+    if (cv == (iconv_t) - 1)
+        return;
+
+    char *converted = g_mime_iconv_strndup(cv, (const char *) * data, *len);
+    g_mime_iconv_close(cv);
+
+    if (converted == NULL)
+        return;
+
+    /*
+     * If that succeeded then replace the data we were given.
+     */
+    size_t conv_len = strlen(converted);
+    char *result = (char *)malloc(conv_len + 1);
+    memcpy(result, converted, conv_len + 1);
+    g_free(converted);
+
+    free(*data);
+    *data = result;
+    *len  = conv_len;
+}
+
+
 /*
  * Get the children of this part, if any.
  */
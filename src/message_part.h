@@ -19,13 +19,20 @@
 
 #pragma once
 
+#include <gmime/gmime.h>
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
 
 /**
  * This is the C++ object which represents a MIME-part from a message.
+ *
+ * A part either owns its content outright, or it records where the
+ * content lives in the message-file - a byte-range and the transfer
+ * encoding - and decodes it the first time `content()` is called.  This
+ * means large attachments are never read unless they're viewed or saved.
  */
 class CMessagePart
 {
@@ -33,10 +40,21 @@ class CMessagePart
 public:
 
     /**
-     * Constructor.
+     * Constructor.  The part takes ownership of the malloc'd content.
      */
     CMessagePart(std::string type, std::string filename, void *content, size_t content_length);
 
+    /**
+     * Constructor for a part whose content is decoded lazily from the
+     * given range of the message-file.
+     *
+     * If `charset` is non-empty the decoded content is converted from that
+     * character set to UTF-8.
+     */
+    CMessagePart(std::string type, std::string filename, std::string source,
+                 int64_t start, int64_t end, GMimeContentEncoding encoding,
+                 std::string charset);
+
     /**
      * Destructor
      */
@@ -58,15 +76,38 @@ public:
     bool is_attachment();
 
     /**
-     * Get the content.
+     * Get the content, decoding it from the message-file if required.
      */
     void *content();
 
     /**
      * Get the length of the content.
+     *
+     * For a lazy part this doesn't keep the decoded content in memory.
      */
     size_t content_size();
 
+    /**
+     * Write the decoded content to the given file, returning true on
+     * success.
+     *
+     * Content which hasn't already been loaded is decoded as it is
+     * written, rather than being held in memory.
+     */
+    bool save(std::string path);
+
+    /**
+     * Update the path of the message-file this part, and its children,
+     * read their content from.  Used when the flags of a message change.
+     */
+    void source(std::string path);
+
+    /**
+     * Convert the given malloc'd data from the named character set to
+     * UTF-8, replacing it on success.
+     */
+    static void to_utf8(std::string charset, char **data, size_t *len);
+
     /**
      * Get the children of this part, if any.
      */
@@ -88,6 +129,18 @@ public:
     std::shared_ptr<CMessagePart> get_parent();
 
 
+private:
+
+    /**
+     * Open a data-wrapper which decodes our content from the message-file.
+     */
+    GMimeDataWrapper *source_wrapper();
+
+    /**
+     * Decode our content from the message-file.
+     */
+    bool load();
+
 private:
 
     /**
@@ -111,6 +164,42 @@ private:
      */
     size_t m_content_length;
 
+    /**
+     * Is our content read lazily from the message-file?
+     */
+    bool m_lazy;
+
+    /**
+     * Has our content been decoded, if we're lazy?
+     */
+    bool m_loaded;
+
+    /**
+     * Is `m_content_length` correct, even if the content isn't loaded?
+     */
+    bool m_size_known;
+
+    /**
+     * The message-file our lazy content is read from.
+     */
+    std::string m_source;
+
+    /**
+     * The byte-range of our encoded content within `m_source`.
+     */
+    int64_t m_start;
+    int64_t m_end;
+
+    /**
+     * The transfer-encoding of our content.
+     */
+    GMimeContentEncoding m_encoding;
+
+    /**
+     * The character set to convert from, if any.
+     */
+    std::string m_charset;
+
     /**
      * Children of this part.
      */
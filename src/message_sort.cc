@@ -0,0 +1,114 @@
+/*
+ * message_sort.cc - Sort messages, natively.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <stdint.h>
+#include <utility>
+
+
+#include "message_sort.h"
+
+
+
+/*
+ * Sort the offsets by the given keys.
+ *
+ * The sort is stable, so messages with equal keys keep their order.
+ */
+template <typename T>
+static std::vector<size_t> sort_by_key(std::vector<std::pair<T, size_t>> &keys)
+{
+    std::stable_sort(keys.begin(), keys.end(),
+                     [](const std::pair<T, size_t> &a, const std::pair<T, size_t> &b)
+    {
+        return (a.first < b.first);
+    });
+
+    std::vector<size_t> order;
+    order.reserve(keys.size());
+
+    for (auto it = keys.begin(); it != keys.end(); ++it)
+        order.push_back(it->second);
+
+    return order;
+}
+
+
+/*
+ * Can we sort by the given method?
+ */
+bool CMessageSort::is_native(std::string method)
+{
+    return ((method == "date") || (method == "file") ||
+            (method == "from") || (method == "none") ||
+            (method == "subject"));
+}
+
+
+/*
+ * Sort the given messages, returning their offsets in sorted order.
+ */
+std::vector<size_t> CMessageSort::sort(CMessageList &messages, std::string method)
+{
+    size_t count = messages.size();
+
+    /*
+     * Numeric keys.
+     */
+    if ((method == "date") || (method == "file"))
+    {
+        std::vector<std::pair<int64_t, size_t>> keys;
+        keys.reserve(count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            int64_t key = (method == "date") ? messages[i]->get_date() : messages[i]->get_mtime();
+            keys.push_back(std::make_pair(key, i));
+        }
+
+        return (sort_by_key(keys));
+    }
+
+    /*
+     * Header keys.
+     */
+    if ((method == "from") || (method == "subject"))
+    {
+        std::string name = (method == "from") ? "From" : "Subject";
+
+        std::vector<std::pair<std::string, size_t>> keys;
+        keys.reserve(count);
+
+        for (size_t i = 0; i < count; i++)
+            keys.push_back(std::make_pair(messages[i]->header(name), i));
+
+        return (sort_by_key(keys));
+    }
+
+    /*
+     * Otherwise leave the messages as they were.
+     */
+    std::vector<size_t> order;
+    order.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+        order.push_back(i);
+
+    return order;
+}
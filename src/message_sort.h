@@ -0,0 +1,57 @@
+/*
+ * message_sort.h - Sort messages, natively.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+#include "message.h"
+
+
+/**
+ *
+ * Sort messages by one of the built-in methods, without calling a Lua
+ * comparison function for each pair of messages.
+ *
+ * A single key is extracted from each message, up front, and the vector
+ * of (key, offset) pairs is sorted.  Each of these members is static, and
+ * they are wrapped to Lua via `Global:sort_messages`.
+ *
+ */
+class CMessageSort
+{
+
+public:
+
+    /**
+     * Can we sort by the given method?
+     *
+     * The built-in methods are `date`, `file`, `from`, `none` and `subject`.
+     */
+    static bool is_native(std::string method);
+
+    /**
+     * Sort the given messages, returning their offsets in sorted order.
+     *
+     * If the method isn't one we support the messages are left unsorted.
+     */
+    static std::vector<size_t> sort(CMessageList &messages, std::string method);
+};
@@ -0,0 +1,86 @@
+/*
+ * message_sort_test.cc - Test-cases for our CMessageSort class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "message.h"
+#include "message_sort.h"
+#include "test_support.h"
+#include "CuTest.h"
+
+
+/**
+ * Test the methods we sort by.
+ */
+void TestMessageSortMethods(CuTest * tc)
+{
+    CuAssertTrue(tc, CMessageSort::is_native("date"));
+    CuAssertTrue(tc, CMessageSort::is_native("subject"));
+    CuAssertTrue(tc, !CMessageSort::is_native("threads"));
+    CuAssertTrue(tc, !CMessageSort::is_native("local"));
+}
+
+
+/**
+ * Test sorting by date, and by header.
+ */
+void TestMessageSortKeys(CuTest * tc)
+{
+    CMessageList messages;
+    messages.push_back(make_message("/tmp/lumail.sort/cur/300.host", {{"from", "bob"}, {"subject", "Beta"}}));
+    messages.push_back(make_message("/tmp/lumail.sort/cur/100.host", {{"from", "steve"}, {"subject", "Gamma"}}));
+    messages.push_back(make_message("/tmp/lumail.sort/cur/200.host", {{"from", "alice"}, {"subject", "Alpha"}}));
+    messages.push_back(make_message("/tmp/lumail.sort/cur/no-date", {{"from", "alice"}, {"subject", "Delta"}}));
+
+    std::vector<size_t> order = CMessageSort::sort(messages, "date");
+    CuAssertIntEquals(tc, 4, order.size());
+    CuAssertIntEquals(tc, 3, order[0]);
+    CuAssertIntEquals(tc, 1, order[1]);
+    CuAssertIntEquals(tc, 2, order[2]);
+    CuAssertIntEquals(tc, 0, order[3]);
+
+    order = CMessageSort::sort(messages, "subject");
+    CuAssertIntEquals(tc, 2, order[0]);
+    CuAssertIntEquals(tc, 0, order[1]);
+    CuAssertIntEquals(tc, 3, order[2]);
+    CuAssertIntEquals(tc, 1, order[3]);
+
+    /*
+     * Equal keys keep their order.
+     */
+    order = CMessageSort::sort(messages, "from");
+    CuAssertIntEquals(tc, 2, order[0]);
+    CuAssertIntEquals(tc, 3, order[1]);
+    CuAssertIntEquals(tc, 0, order[2]);
+    CuAssertIntEquals(tc, 1, order[3]);
+
+    order = CMessageSort::sort(messages, "none");
+    CuAssertIntEquals(tc, 0, order[0]);
+    CuAssertIntEquals(tc, 3, order[3]);
+}
+
+
+CuSuite *
+message_sort_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageSortMethods);
+    SUITE_ADD_TEST(suite, TestMessageSortKeys);
+    return suite;
+}
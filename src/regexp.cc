@@ -0,0 +1,191 @@
+/*
+ * regexp.cc - A compiled, and cached, regular expression.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <list>
+#include <unordered_map>
+
+#include "regexp.h"
+
+
+/*
+ * Constructor.
+ */
+CRegexp::CRegexp(std::string pattern)
+{
+    m_pattern  = pattern;
+    m_re       = NULL;
+    m_extra    = NULL;
+    m_captures = 0;
+
+    const char *err = NULL;
+    int offset = 0;
+
+    m_re = pcre_compile(pattern.c_str(), PCRE_CASELESS, &err, &offset, NULL);
+
+    if (m_re == NULL)
+    {
+        m_error = std::string(err ? err : "unknown error") +
+                  " at offset " + std::to_string(offset);
+        return;
+    }
+
+    pcre_fullinfo(m_re, NULL, PCRE_INFO_CAPTURECOUNT, &m_captures);
+
+    /*
+     * Study the pattern, JIT-compiling it where possible.  A failure
+     * here isn't fatal, it just means we'll match more slowly.
+     */
+#ifdef PCRE_STUDY_JIT_COMPILE
+    m_extra = pcre_study(m_re, PCRE_STUDY_JIT_COMPILE, &err);
+#else
+    m_extra = pcre_study(m_re, 0, &err);
+#endif
+}
+
+
+/*
+ * Destructor.
+ */
+CRegexp::~CRegexp()
+{
+    if (m_extra)
+    {
+#ifdef PCRE_STUDY_JIT_COMPILE
+        pcre_free_study(m_extra);
+#else
+        pcre_free(m_extra);
+#endif
+    }
+
+    if (m_re)
+        pcre_free(m_re);
+}
+
+
+/*
+ * Did the pattern compile?
+ */
+bool CRegexp::valid()
+{
+    return (m_re != NULL);
+}
+
+
+/*
+ * The error, if the pattern failed to compile.
+ */
+std::string CRegexp::error()
+{
+    return m_error;
+}
+
+
+/*
+ * The pattern we were constructed with.
+ */
+std::string CRegexp::pattern()
+{
+    return m_pattern;
+}
+
+
+/*
+ * The number of capture-groups in the pattern.
+ */
+int CRegexp::captures()
+{
+    return m_captures;
+}
+
+
+/*
+ * Match against the given string, starting at the given offset.
+ */
+bool CRegexp::exec(const char *subject, size_t length, size_t offset, std::vector<int> &offsets)
+{
+    if (m_re == NULL || offset > length)
+        return false;
+
+    /*
+     * PCRE needs a third of the vector as workspace.
+     */
+    offsets.resize((m_captures + 1) * 3);
+
+    int rc = pcre_exec(m_re, m_extra, subject, length,
+                       offset, 0, &offsets[0], offsets.size());
+
+    if (rc < 0)
+        return false;
+
+    /*
+     * Groups after the last one to match are left untouched by PCRE.
+     */
+    offsets.resize((m_captures + 1) * 2);
+
+    for (size_t i = rc * 2; i < offsets.size(); i++)
+        offsets[i] = -1;
+
+    return true;
+}
+
+
+/*
+ * Match against the given string, starting at the given offset.
+ */
+bool CRegexp::exec(const std::string &subject, size_t offset, std::vector<int> &offsets)
+{
+    return exec(subject.c_str(), subject.size(), offset, offsets);
+}
+
+
+/*
+ * Return the compiled form of the given pattern, from the cache if
+ * possible.
+ */
+std::shared_ptr<CRegexp> CRegexp::compile(std::string pattern)
+{
+    /*
+     * The cached patterns, most recently used first, and their
+     * position in that list.
+     */
+    typedef std::list<std::shared_ptr<CRegexp>> lru_t;
+    static lru_t lru;
+    static std::unordered_map<std::string, lru_t::iterator> cache;
+
+    auto it = cache.find(pattern);
+
+    if (it != cache.end())
+    {
+        lru.splice(lru.begin(), lru, it->second);
+        return lru.front();
+    }
+
+    std::shared_ptr<CRegexp> re = std::shared_ptr<CRegexp>(new CRegexp(pattern));
+
+    lru.push_front(re);
+    cache[pattern] = lru.begin();
+
+    if (lru.size() > CACHE_SIZE)
+    {
+        cache.erase(lru.back()->pattern());
+        lru.pop_back();
+    }
+
+    return re;
+}
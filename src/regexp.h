@@ -0,0 +1,119 @@
+/*
+ * regexp.h - A compiled, and cached, regular expression.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <pcre.h>
+#include <string>
+#include <vector>
+
+
+
+/**
+ * A case-insensitive PCRE regular expression.
+ *
+ * The pattern is compiled once, and studied - using the JIT compiler
+ * if the installed PCRE library supports it - after which it may be
+ * matched any number of times.
+ *
+ * Objects are generally obtained via `CRegexp::compile`, which keeps the
+ * most recently used patterns in a cache, so that code which matches the
+ * same handful of patterns against each message doesn't recompile them
+ * every time.
+ */
+class CRegexp
+{
+public:
+
+    /**
+     * Constructor.  Compile the given pattern.
+     */
+    CRegexp(std::string pattern);
+
+    /**
+     * Destructor.
+     */
+    ~CRegexp();
+
+    /**
+     * Did the pattern compile?
+     */
+    bool valid();
+
+    /**
+     * The error, if the pattern failed to compile.
+     */
+    std::string error();
+
+    /**
+     * The pattern we were constructed with.
+     */
+    std::string pattern();
+
+    /**
+     * The number of capture-groups in the pattern.
+     */
+    int captures();
+
+    /**
+     * Match against the given string, starting at the given offset.
+     *
+     * On success `offsets` holds the start and end of the match, followed
+     * by those of each capture-group, with -1 for groups which didn't
+     * participate.
+     */
+    bool exec(const char *subject, size_t length, size_t offset, std::vector<int> &offsets);
+    bool exec(const std::string &subject, size_t offset, std::vector<int> &offsets);
+
+    /**
+     * Return the compiled form of the given pattern, from the cache if
+     * possible.
+     */
+    static std::shared_ptr<CRegexp> compile(std::string pattern);
+
+    /**
+     * The number of patterns we cache.
+     */
+    static const size_t CACHE_SIZE = 256;
+
+private:
+
+    /**
+     * The pattern we match.
+     */
+    std::string m_pattern;
+
+    /**
+     * The compiled pattern, and the result of studying it.
+     */
+    pcre *m_re;
+    pcre_extra *m_extra;
+
+    /**
+     * The number of capture-groups.
+     */
+    int m_captures;
+
+    /**
+     * The error from compiling the pattern, if any.
+     */
+    std::string m_error;
+};
@@ -17,11 +17,11 @@
  */
 
 
-#include <pcrecpp.h>
+#include <new>
 #include <vector>
-#include <iostream>
 
 #include "lua.h"
+#include "regexp.h"
 
 
 /**
@@ -39,7 +39,107 @@
  * end<br/>
  *</code>
  *
+ * Patterns are compiled once, and cached, but code which matches the
+ * same pattern repeatedly may also compile it explicitly:
+ *
+ *<code>
+ * local re = Regexp.compile( "^Re: (.*)$" )<br/>
+ * local s, e, subject = re:find( "Re: Lumail" )<br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * Push a compiled regular expression onto the Lua stack.
+ */
+void push_cregexp(lua_State * l, std::shared_ptr<CRegexp> re)
+{
+    CLuaLog("push_cregexp");
+
+    void *ud = lua_newuserdata(l, sizeof(std::shared_ptr<CRegexp>));
+
+    if (!ud)
+    {
+        /* Error - couldn't allocate the memory */
+        return;
+    }
+
+    /*
+     * Construct the shared pointer in the memory we've just allocated,
+     * as with `push_cmessage`.
+     */
+    std::shared_ptr<CRegexp> *udata = new(ud) std::shared_ptr<CRegexp>();
+    *udata = re;
+
+    luaL_getmetatable(l, "luaL_CRegexp");
+    lua_setmetatable(l, -2);
+}
+
+
+/**
+ * Test that the object is a std::shared_ptr<CRegexp>.
+ */
+std::shared_ptr<CRegexp> l_CheckCRegexp(lua_State * l, int n)
+{
+    CLuaLog("l_CheckCRegexp");
+
+    void *ud = luaL_checkudata(l, n, "luaL_CRegexp");
+
+    if (ud)
+    {
+        std::shared_ptr<CRegexp> *ud_re = static_cast<std::shared_ptr<CRegexp> *>(ud);
+        return *ud_re;
+    }
+    else
+        return NULL;
+}
+
+
+/**
+ * Push the capture-groups of a match, or the whole match if the
+ * pattern has none, returning the number of values pushed.
+ *
+ * Groups which didn't participate in the match are returned as
+ * empty strings.
+ */
+static int push_captures(lua_State * l, const char *input, std::shared_ptr<CRegexp> re, const std::vector<int> &offsets, bool whole)
+{
+    int n = re->captures();
+
+    if (n == 0 && whole)
+    {
+        lua_pushlstring(l, input + offsets[0], offsets[1] - offsets[0]);
+        return 1;
+    }
+
+    for (int i = 1; i <= n; i++)
+    {
+        int s = offsets[i * 2];
+        int e = offsets[i * 2 + 1];
+
+        if (s < 0)
+            lua_pushstring(l, "");
+        else
+            lua_pushlstring(l, input + s, e - s);
+    }
+
+    return n;
+}
+
+
+/**
+ * Return the offset from which to look for the next match, after the
+ * given one - skipping a character after an empty match.
  */
+static size_t next_offset(const std::vector<int> &offsets)
+{
+    if (offsets[1] == offsets[0])
+        return offsets[1] + 1;
+    else
+        return offsets[1];
+}
+
 
 /**
  * Implementation of Regexp:match().
@@ -49,107 +149,180 @@
  * If the regexp contains no captures then `true` will be returned on
  * a successful match, otherwise `false`.
  *
- * If the regexp contains captures (up to ten) then they will be returned
- * as a table.
+ * If the regexp contains captures then they will be returned as a table,
+ * containing the captures of every match in turn.
+ *
+ * This may also be called upon a compiled regexp, as `re:match(string)`.
  */
 int l_CRegexp_match(lua_State * l)
 {
     CLuaLog("l_CRegexp_match");
 
-    const char *pattern = lua_tostring(l, 2);
-    const char *input   = lua_tostring(l, 3);
+    std::shared_ptr<CRegexp> re;
+    const char *input = NULL;
+    size_t len = 0;
 
-    pcrecpp::RE_Options opt;
-    opt.set_caseless(true);
-    pcrecpp::RE re(pattern, opt);
+    if (lua_type(l, 1) == LUA_TUSERDATA)
+    {
+        re = l_CheckCRegexp(l, 1);
+        input = luaL_checklstring(l, 2, &len);
+    }
+    else
+    {
+        re = CRegexp::compile(luaL_checkstring(l, 2));
+        input = luaL_checklstring(l, 3, &len);
+    }
 
-    int n = re.NumberOfCapturingGroups();
+    std::vector<int> offsets;
 
-    if (n == 0)
+    if (re->captures() == 0)
     {
-        if (re.PartialMatch(input))
-            lua_pushboolean(l , 1);
-        else
-            lua_pushboolean(l , 0);
-
+        lua_pushboolean(l, re->exec(input, len, 0, offsets));
         return 1;
     }
 
-    std::string matches[10];
-    const pcrecpp::Arg *args[10];
+    lua_newtable(l);
+
+    int i = 1;
+    size_t offset = 0;
+
+    while (re->exec(input, len, offset, offsets))
+    {
+        int n = push_captures(l, input, re, offsets, false);
+
+        for (int t = n; t > 0; t--)
+            lua_rawseti(l, -1 - t, i + t - 1);
 
-    int z = 0;
-    pcrecpp::Arg arg0 = &matches[z];
-    args[z++] = &arg0;
+        i += n;
+        offset = next_offset(offsets);
+    }
 
-    pcrecpp::Arg arg1 = &matches[z];
-    args[z++] = &arg1;
+    return 1;
+}
 
-    pcrecpp::Arg arg2 = &matches[z];
-    args[z++] = &arg2;
 
-    pcrecpp::Arg arg3 = &matches[z];
-    args[z++] = &arg3;
+/**
+ * Implementation of Regexp.compile().
+ *
+ * Returns a compiled regular expression, or `nil` and an error-message
+ * if the pattern is invalid.
+ */
+int l_CRegexp_compile(lua_State * l)
+{
+    CLuaLog("l_CRegexp_compile");
 
-    pcrecpp::Arg arg4 = &matches[z];
-    args[z++] = &arg4;
+    const char *pattern = luaL_checkstring(l, 1);
 
-    pcrecpp::Arg arg5 = &matches[z];
-    args[z++] = &arg5;
+    std::shared_ptr<CRegexp> re = CRegexp::compile(pattern);
 
-    pcrecpp::Arg arg6 = &matches[z];
-    args[z++] = &arg6;
+    if (!re->valid())
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, re->error().c_str());
+        return 2;
+    }
 
-    pcrecpp::Arg arg7 = &matches[z];
-    args[z++] = &arg7;
+    push_cregexp(l, re);
+    return 1;
+}
 
-    pcrecpp::Arg arg8 = &matches[z];
-    args[z++] = &arg8;
 
-    pcrecpp::Arg arg9 = &matches[z];
-    args[z++] = &arg9;
+/**
+ * Implementation of re:find().
+ *
+ * Like `string.find`, returns the start and end of the first match,
+ * after the optional starting-position, followed by any captures.
+ */
+int l_CRegexp_find(lua_State * l)
+{
+    CLuaLog("l_CRegexp_find");
 
-    pcrecpp::StringPiece in(input);
+    std::shared_ptr<CRegexp> re = l_CheckCRegexp(l, 1);
+    size_t len = 0;
+    const char *input = luaL_checklstring(l, 2, &len);
+    int init = luaL_optinteger(l, 3, 1);
 
-    int consumed;
+    if (init < 1)
+        init = 1;
 
-    std::vector<std::string> r;
+    std::vector<int> offsets;
 
-    do
+    if (!re->exec(input, len, init - 1, offsets))
     {
-        if (re.DoMatch(in, re.UNANCHORED, &consumed, args, n))
-        {
-            in.remove_prefix(consumed);
-
-            for (int t = 0; t < n && t < 10; t++)
-            {
-                r.push_back(matches[t]);
-            }
-        }
-        else
-            break;
+        lua_pushnil(l);
+        return 1;
     }
-    while (true);
 
-    lua_newtable(l);
+    lua_pushinteger(l, offsets[0] + 1);
+    lua_pushinteger(l, offsets[1]);
 
-    int i = 1;
+    return 2 + push_captures(l, input, re, offsets, false);
+}
 
-    for (auto it = r.begin(); it != r.end(); ++it)
-    {
-        std::string value = (*it);
 
-        lua_pushinteger(l, i);
-        lua_pushstring(l, value.c_str());
+/**
+ * The iterator returned by re:gmatch(), which keeps the regexp, the
+ * string, and the current offset in its upvalues.
+ */
+static int l_CRegexp_gmatch_next(lua_State * l)
+{
+    std::shared_ptr<CRegexp> re = l_CheckCRegexp(l, lua_upvalueindex(1));
+    size_t len = 0;
+    const char *input = lua_tolstring(l, lua_upvalueindex(2), &len);
+    size_t offset = lua_tointeger(l, lua_upvalueindex(3));
 
-        lua_settable(l, -3);
+    std::vector<int> offsets;
 
-        i += 1;
-    }
+    if (!re->exec(input, len, offset, offsets))
+        return 0;
+
+    lua_pushinteger(l, next_offset(offsets));
+    lua_replace(l, lua_upvalueindex(3));
+
+    return push_captures(l, input, re, offsets, true);
+}
+
+
+/**
+ * Implementation of re:gmatch().
+ *
+ * Like `string.gmatch`, returns an iterator over each match, which
+ * returns its captures, or the whole match if there are none.
+ */
+int l_CRegexp_gmatch(lua_State * l)
+{
+    CLuaLog("l_CRegexp_gmatch");
+
+    l_CheckCRegexp(l, 1);
+    luaL_checkstring(l, 2);
+
+    lua_settop(l, 2);
+    lua_pushinteger(l, 0);
+    lua_pushcclosure(l, l_CRegexp_gmatch_next, 3);
 
     return 1;
 }
 
+
+/**
+ * Destructor.
+ */
+int l_CRegexp_destructor(lua_State * l)
+{
+    CLuaLog("l_CRegexp_destructor");
+
+    void *ud = luaL_checkudata(l, 1, "luaL_CRegexp");
+
+    if (ud)
+    {
+        std::shared_ptr<CRegexp> *ud_re = static_cast<std::shared_ptr<CRegexp> *>(ud);
+        ud_re->~shared_ptr<CRegexp>();
+    }
+
+    return 0;
+}
+
+
 /**
  * Export the `Regexp` class to Lua.
  *
@@ -159,6 +332,10 @@ void InitRegexp(lua_State * l)
 {
     luaL_Reg sFooRegs[] =
     {
+        {"__gc", l_CRegexp_destructor},
+        {"compile", l_CRegexp_compile},
+        {"find", l_CRegexp_find},
+        {"gmatch", l_CRegexp_gmatch},
         {"match", l_CRegexp_match},
         {NULL,       NULL}
     };
@@ -0,0 +1,107 @@
+/*
+ * regexp_test.cc - Test-cases for our CRegexp class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "regexp.h"
+#include "CuTest.h"
+
+
+/**
+ * Test matching, and the offsets of capture-groups.
+ */
+void TestRegexpMatch(CuTest * tc)
+{
+    std::vector<int> offsets;
+
+    CRegexp re("^Re: (\\w+)( again)?");
+    CuAssertTrue(tc, re.valid());
+    CuAssertIntEquals(tc, 2, re.captures());
+
+    CuAssertTrue(tc, re.exec("RE: Lumail", 0, offsets));
+    CuAssertIntEquals(tc, 6, offsets.size());
+    CuAssertIntEquals(tc, 0, offsets[0]);
+    CuAssertIntEquals(tc, 10, offsets[1]);
+    CuAssertIntEquals(tc, 4, offsets[2]);
+    CuAssertIntEquals(tc, 10, offsets[3]);
+    CuAssertIntEquals(tc, -1, offsets[4]);
+    CuAssertIntEquals(tc, -1, offsets[5]);
+
+    CuAssertTrue(tc, !re.exec("Fwd: Lumail", 0, offsets));
+
+    /*
+     * Matching from an offset.
+     */
+    CRegexp word("[a-z]+");
+    CuAssertTrue(tc, word.exec("steve kemp", 5, offsets));
+    CuAssertIntEquals(tc, 6, offsets[0]);
+    CuAssertIntEquals(tc, 10, offsets[1]);
+    CuAssertTrue(tc, !word.exec("steve kemp", 11, offsets));
+
+    /*
+     * An invalid pattern.
+     */
+    CRegexp bad("(unclosed");
+    CuAssertTrue(tc, !bad.valid());
+    CuAssertTrue(tc, bad.error().size() > 0);
+    CuAssertTrue(tc, !bad.exec("unclosed", 0, offsets));
+}
+
+
+/**
+ * Test that compiled patterns are cached.
+ */
+void TestRegexpCache(CuTest * tc)
+{
+    std::shared_ptr<CRegexp> a = CRegexp::compile("steve");
+    std::shared_ptr<CRegexp> b = CRegexp::compile("steve");
+    CuAssertPtrEquals(tc, a.get(), b.get());
+
+    /*
+     * Once enough other patterns have been compiled the first is
+     * evicted, and compiled afresh.
+     */
+    for (size_t i = 0; i < CRegexp::CACHE_SIZE; i++)
+        CRegexp::compile("pattern" + std::to_string(i));
+
+    std::shared_ptr<CRegexp> c = CRegexp::compile("steve");
+    CuAssertTrue(tc, a.get() != c.get());
+    CuAssertStrEquals(tc, "steve", c->pattern().c_str());
+
+    /*
+     * But a recently used pattern is kept.
+     */
+    for (size_t i = 0; i < CRegexp::CACHE_SIZE - 1; i++)
+    {
+        CRegexp::compile("other" + std::to_string(i));
+        CRegexp::compile("steve");
+    }
+
+    CuAssertPtrEquals(tc, c.get(), CRegexp::compile("steve").get());
+}
+
+
+CuSuite *
+regexp_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestRegexpMatch);
+    SUITE_ADD_TEST(suite, TestRegexpCache);
+    return suite;
+}
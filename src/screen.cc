@@ -28,12 +28,14 @@
 #include "config.h"
 #include "colour_string.h"
 #include "history.h"
+#include "imap_proxy.h"
 #include "index_view.h"
 #include "input_queue.h"
 #include "keybinding_view.h"
 #include "lua.h"
 #include "lua_view.h"
 #include "maildir_view.h"
+#include "maildir_watcher.h"
 #include "message_view.h"
 #include "screen.h"
 
@@ -93,6 +95,24 @@ std::vector<std::string> CScreen::view_modes()
  */
 void CScreen::update(std::string key_name, CConfigEntry *old)
 {
+    /*
+     * Moving the selection only requires the display to be refreshed,
+     * anything else might change what is displayed, or how.
+     */
+    std::string suffix = ".current";
+
+    if ((key_name.size() > suffix.size()) &&
+            (key_name.compare(key_name.size() - suffix.size(), suffix.size(), suffix) == 0))
+        damage(DAMAGE_REFRESH);
+    else
+        damage(DAMAGE_LAYOUT);
+
+    /*
+     * If a colour has changed then forget those we've looked up.
+     */
+    if (key_name.compare(0, 7, "colour.") == 0)
+        m_colour_cache.clear();
+
     /*
      * If our timeout value has changed then update
      * our loop.
@@ -166,12 +186,6 @@ void CScreen::run_main_loop()
     while ((m_running) && (ch = input->get_input()))
     {
 
-        /*
-         * Clear the screen.
-         */
-        clear(false);
-
-
         /*
          * Get the current global mode.
          */
@@ -184,6 +198,13 @@ void CScreen::run_main_loop()
          */
         CViewMode *view = m_views[mode];
 
+        /*
+         * Deliver the replies to any IMAP requests which have completed,
+         * which might have changed our folders or messages.
+         */
+        if (CIMAPProxy::instance()->poll())
+            damage(DAMAGE_CONTENT);
+
         /*
          * If the key fetching timed out then call our idle functions.
          */
@@ -197,11 +218,20 @@ void CScreen::run_main_loop()
                 /*
                  * If so we assume that there will be a prefix-match.
                  */
+                damage(DAMAGE_REFRESH);
                 on_keypress(total);
                 total = "";
             }
             else
             {
+                /*
+                 * Apply any changes to our maildirs.
+                 */
+                CMaildirWatcher *watcher = CMaildirWatcher::instance();
+
+                if (watcher->poll())
+                    damage(DAMAGE_CONTENT);
+
                 /*
                  * Call the Lua on_idle() function.
                  */
@@ -216,6 +246,18 @@ void CScreen::run_main_loop()
         }
         else
         {
+            /*
+             * Whatever the key does the display is refreshed, and if
+             * the terminal was resized it must be redrawn entirely.
+             *
+             * If the key's action changes what is displayed that is
+             * reported as it happens: configuration changes via our
+             * observer, and changes to messages - their flags, or their
+             * deletion - by `CMessage` and `CGlobalState` themselves, so
+             * it doesn't matter whether they're made from Lua or not.
+             */
+            damage(ch == KEY_RESIZE ? DAMAGE_LAYOUT : DAMAGE_REFRESH);
+
             /*
              * Convert the key-press to a key-name, which means that
              * "down" will be "KEY_DOWN", for example.
@@ -255,26 +297,81 @@ void CScreen::run_main_loop()
             view = m_views[new_mode];
 
         /*
-         * Update the view.
+         * Update the view, unless nothing has changed.
          */
-        if (view)
-            view->draw();
+        if (m_damaged)
+            paint(view);
+    }
+}
 
-        /*
-         * Update our panel
-         */
-        CStatusPanel *instance = CStatusPanel::instance();
 
-        if (! instance->hidden())
-            instance->draw();
+/*
+ * Draw the given view, and our panel.
+ */
+void CScreen::paint(CViewMode *view)
+{
+    m_drawing = true;
 
-        /*
-         * Update our panel.
-         */
-        update_panels();
-        doupdate();
-        refresh();
-    }
+    /*
+     * Clear the screen, if we're drawing from scratch.
+     */
+    if (m_repaint)
+        clear(false);
+
+    /*
+     * Update the view.
+     */
+    if (view)
+        view->draw();
+
+    /*
+     * Update our panel
+     */
+    CStatusPanel *instance = CStatusPanel::instance();
+
+    if (! instance->hidden())
+        instance->draw();
+
+    /*
+     * Refresh, via curses.
+     */
+    update_panels();
+    doupdate();
+    refresh();
+
+    m_drawing = false;
+    m_damaged = false;
+    m_repaint = false;
+}
+
+
+/*
+ * Note that the display must be redrawn.
+ */
+void CScreen::damage(damageType what)
+{
+    /*
+     * Changes made while drawing are drawn already.
+     */
+    if (m_drawing)
+        return;
+
+    m_damaged = true;
+
+    if (what != DAMAGE_REFRESH)
+        m_generation += 1;
+
+    if (what == DAMAGE_LAYOUT)
+        m_repaint = true;
+}
+
+
+/*
+ * The counter which is increased when the text of the view might change.
+ */
+uint64_t CScreen::generation()
+{
+    return (m_generation);
 }
 
 
@@ -496,6 +593,11 @@ void CScreen::setup()
     init_pair(8, COLOR_BLACK, COLOR_WHITE);
     m_colours[ "black" ] = 8;
 
+    /*
+     * Forget anything we looked up before the colours existed.
+     */
+    m_colour_cache.clear();
+
     CStatusPanel *panel = CStatusPanel::instance();
     panel->init(6);
 }
@@ -547,6 +649,11 @@ void CScreen::clear(bool refresh_screen)
         mvprintw(i, 0, "%s", blank.c_str());
     }
 
+    /*
+     * Every row is now blank.
+     */
+    m_painted.assign(height + 1, "");
+
     if (refresh_screen)
     {
         update_panels();
@@ -562,9 +669,9 @@ void CScreen::clear(bool refresh_screen)
 void CScreen::redraw()
 {
     /*
-     * Clear the screen.
+     * Everything is redrawn from scratch.
      */
-    clear(false);
+    damage(DAMAGE_LAYOUT);
 
 
     /*
@@ -575,27 +682,9 @@ void CScreen::redraw()
 
 
     /*
-     * Get the virtual view class, and if set draw with it.
+     * Get the virtual view class, and draw with it.
      */
-    CViewMode *view = m_views[mode];
-
-    if (view)
-        view->draw();
-
-    /*
-     * Update our panel
-     */
-    CStatusPanel *instance = CStatusPanel::instance();
-
-    if (! instance->hidden())
-        instance->draw();
-
-    /*
-     * Refresh, via curses.
-     */
-    update_panels();
-    doupdate();
-    refresh();
+    paint(m_views[mode]);
 }
 
 /*
@@ -756,6 +845,7 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
         {
             delwin(childwin);
             ::clear();
+            m_painted.clear();
             /*
              * Get our timeout period, and set it.
              */
@@ -831,6 +921,7 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
 
     delwin(childwin);
     ::clear();
+    m_painted.clear();
 
     return (choices.at(matches.at(selected)));
 }
@@ -1071,6 +1162,11 @@ std::string CScreen::get_line(std::string prompt, std::string input)
      */
     history->add(buffer);
 
+    /*
+     * The prompt was drawn over the view.
+     */
+    m_painted.clear();
+
     return (buffer);
 }
 
@@ -1167,6 +1263,11 @@ std::string CScreen::prompt_chars(std::string prompt, std::string valid)
             {
                 std::string result = "x";
                 result[0] = c;
+
+                /*
+                 * The prompt was drawn over the view.
+                 */
+                m_painted.clear();
                 return (result);
             }
         }
@@ -1262,6 +1363,11 @@ std::string CScreen::get_char(std::string prompt)
         {
             std::string out;
             out = lookup_key(c);
+
+            /*
+             * The prompt was drawn over the view.
+             */
+            m_painted.clear();
             return (out);
         }
     }
@@ -1314,7 +1420,27 @@ bool CScreen::on_keypress(std::string key)
 }
 
 
-int CScreen::get_colour(std::string name)
+/*
+ * Get the colour-pair, and attributes, for the given name.
+ */
+int CScreen::get_colour(const std::string &name)
+{
+    auto it = m_colour_cache.find(name);
+
+    if (it != m_colour_cache.end())
+        return (it->second);
+
+    int result = parse_colour(name);
+    m_colour_cache[name] = result;
+
+    return (result);
+}
+
+
+/*
+ * Parse the given name into a colour-pair and attributes.
+ */
+int CScreen::parse_colour(std::string name)
 {
     std::transform(name.begin(), name.end(), name.begin(), ::tolower);
 
@@ -1390,6 +1516,88 @@ int CScreen::get_colour(std::string name)
 
 
 
+/*
+ * Work out which lines `draw_text_lines` will display.
+ */
+void CScreen::visible_lines(int selected, int max, bool simple, int &top, int &count)
+{
+    /*
+     * Get the height of the screen, taking off the panel, if visible.
+     */
+    int height = CScreen::height();
+
+    CStatusPanel *panel = CStatusPanel::instance();
+
+    if (panel->hidden() == false)
+        height -= panel->height();
+
+    /*
+     * Add an extra line.
+     */
+    height += 1;
+
+    /*
+     * We draw rows 0 to height, inclusive.
+     */
+    count = height + 1;
+
+    /*
+     * In simple-mode the selected line is the first one drawn.
+     */
+    if (simple)
+    {
+        top = selected;
+        return;
+    }
+
+    /*
+     * Otherwise the highlighted bar moves "nicely": it sits at the
+     * top of the screen until it reaches the middle, then stays there
+     * as the lines scroll, until the end of the list is visible.
+     */
+    int middle = (height) / 2;
+    vectorPosition topBottomOrMiddle = NONE;
+
+    /*
+     * default to TOP if our list is shorter then the screen height
+     */
+    if (selected < middle || max <= height)
+    {
+        topBottomOrMiddle = TOP;
+
+        /*
+         * if height is uneven we have to switch to the BOTTOM case on row earlier
+         */
+    }
+    else if ((max - selected <= middle) || (height % 2 == 1 && max - selected <= middle + 1))
+        topBottomOrMiddle = BOTTOM;
+    else
+        topBottomOrMiddle = MIDDLE;
+
+
+    if (topBottomOrMiddle == TOP)
+    {
+        /*
+         * we start at the top of the list
+         */
+        top = 0;
+    }
+    else if (topBottomOrMiddle == BOTTOM)
+    {
+        /*
+         * when we reached the end of the list the last row drawn is
+         * count-1, that this is given can easily be shown
+         * row:=height-2 -> count-height+row+1 = count-height+height-2+1 = count-1
+         */
+        top = max - height + 1;
+    }
+    else
+    {
+        top = selected - middle;
+    }
+}
+
+
 /*
  * Draw an array of lines to the screen, highlighting the current line.
  *
@@ -1398,14 +1606,13 @@ int CScreen::get_colour(std::string name)
  * If `simple` is set to true then we display the lines in a  simplified
  * fashion - with no selection, and no smooth-scrolling.
  *
+ * `first` is the offset of the first of the given lines, which allows
+ * a view to supply only those lines which are visible.
+ *
  */
-void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple)
+void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple, int first)
 {
-    /*
-     * Get the dimensions of the screen.
-     */
     CScreen *screen = CScreen::instance();
-    int height      = CScreen::height();
     int width       = CScreen::width();
 
     /*
@@ -1415,17 +1622,16 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
     int wrap = config->get_integer("line.wrap", 0);
 
     /*
-     * Take off the panel, if visible.
+     * Find the lines we'll draw.
      */
-    CStatusPanel *panel = CStatusPanel::instance();
-
-    if (panel->hidden() == false)
-        height -= panel->height();
+    int top   = 0;
+    int count = 0;
+    visible_lines(selected, max, simple, top, count);
 
     /*
-     * Add an extra line.
+     * The number of lines we've been given.
      */
-    height += 1;
+    int size = lines.size();
 
     /*
      * If we're in simple-mode we can just draw the lines directly
@@ -1435,18 +1641,19 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
     if (simple)
     {
         /*
-         * The number of lines to draw.
+         * Every row is drawn, but lines might wrap onto the next, so
+         * we don't remember what was drawn where.
          */
-        int size = lines.size();
+        m_painted.clear();
 
         /*
          * The width of each line drawn.
          */
         int result __attribute__((unused));
 
-        int off = 0;
+        int off = top - first;
 
-        for (int i = 0; i <= height; i++)
+        for (int i = 0; i < count; i++)
         {
             std::string buf = "";
 
@@ -1454,8 +1661,8 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
              * If we're still in the array of lines to draw
              * then pick the right one.
              */
-            if ((off + selected) < size)
-                buf = lines.at(off + selected);
+            if ((off >= 0) && (off < size))
+                buf = lines.at(off);
 
             /*
              * Last two parameters are:
@@ -1490,71 +1697,29 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
      *
      * We'll draw a highlighted bar, and that'll move "nicely".
      */
-    int middle = (height) / 2;
-    int rowToHighlight = 0;
-    vectorPosition topBottomOrMiddle = NONE;
+    int rowToHighlight = selected - top;
 
-    /*
-     * default to TOP if our list is shorter then the screen height
-     */
-    if (selected < middle || max <= height)
-    {
-        topBottomOrMiddle = TOP;
-        rowToHighlight = selected;
-
-        /*
-         * if height is uneven we have to switch to the BOTTOM case on row earlier
-         */
-    }
-    else if ((max - selected <= middle) || (height % 2 == 1 && max - selected <= middle + 1))
-    {
-        topBottomOrMiddle = BOTTOM;
-        rowToHighlight =  height - max + selected - 1 ;
-    }
-    else
-    {
-        topBottomOrMiddle = MIDDLE;
-        rowToHighlight = middle;
-    }
-
-
-    for (int row = 0; row <= height; row++)
+    for (int row = 0; row < count; row++)
     {
         /*
          * The current object.
          */
-        int mailIndex = max;
-        int size      = lines.size();
+        int mailIndex = top + row;
 
+        std::string buf;
 
-        if (topBottomOrMiddle == TOP)
-        {
-            /*
-             * we start at the top of the list so just use row
-             */
-            mailIndex = row;
-        }
-        else if (topBottomOrMiddle == BOTTOM)
-        {
-            /*
-             * when we reached the end of the list mailIndex can maximally be
-             * count-1, that this is given can easily be shown
-             * row:=height-2 -> count-height+row+1 = count-height+height-2+1 = count-1
-             */
-            mailIndex = max - height + row + 1;
-        }
-        else if (topBottomOrMiddle == MIDDLE)
-        {
-            mailIndex = row + selected - middle;
-        }
-
+        if ((mailIndex < max) && (mailIndex >= first) && (mailIndex - first < size))
+            buf = lines.at(mailIndex - first);
 
-        std::string buf;
+        /*
+         * Skip the row if it is unchanged since we last drew it.
+         */
+        std::string painted;
 
-        if ((mailIndex < max) && (mailIndex < size))
-            buf = lines.at(mailIndex);
+        if (! buf.empty())
+            painted = ((row == rowToHighlight) ? "*" : " ") + buf;
 
-        if (buf.empty())
+        if ((row < (int)m_painted.size()) && (m_painted[row] == painted))
             continue;
 
         if (row == rowToHighlight)
@@ -1562,12 +1727,6 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
         else
             wattrset(stdscr, A_NORMAL);
 
-        /*
-         * Last two parameters are:
-         *
-         *  enable scroll: true
-         *  enable wrap: false
-         */
         int result __attribute__((unused));
 
         /*
@@ -1575,8 +1734,15 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
          *
          *  enable scroll: true
          *  enable wrap: false
+         *
+         * An empty line blanks the row.
          */
         result = draw_single_line(row, 0, buf, stdscr, true, false);
+
+        if (row >= (int)m_painted.size())
+            m_painted.resize(row + 1);
+
+        m_painted[row] = painted;
     }
 
     /*
@@ -1597,7 +1763,7 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
  *
  *  * The handling of horizontal scrolling via `global.horizontal`.
  *
- * The return value is the number of characters drawn.
+ * The return value is the number of columns drawn.
  */
 int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW * screen, bool enable_scroll, bool enable_wrap)
 {
@@ -1612,7 +1778,7 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
     int x, y;
 
     /*
-     * Count of characters we drew.
+     * Count of the columns we drew.
      */
     int count = 0;
 
@@ -1649,18 +1815,22 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
         horiz = 0;
 
     /*
-     * Split the string into segments in ONE CHARACTER pieces.
-     *
-     * These single characters may well consist of multiple bytes, but
-     * that is not important.
+     * Split the string into runs of a single colour.
+     */
+    CColourString::parse_spans(buf, horiz, tab_width, m_spans);
+
+    /*
+     * The width of the window, so we can stop at the end of the row.
      */
-    std::vector<COLOUR_STRING *> parts = CColourString::parse_coloured_string(buf, horiz, tab_width);
+    int cols = getmaxx(screen);
 
     /*
-     * Draw each piece of the string.
+     * Draw each run of the string.
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
+    for (auto it = m_spans.begin(); it != m_spans.end() ; ++it)
     {
+        const CColourSpan &span = (*it);
+
         /*
          * If we've drawn more characters than the width
          * of the screen then we should stop - unless we've got
@@ -1669,23 +1839,28 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
         getyx(screen, y, x);
 
         if ((y != row) && ! enable_wrap)
-            continue;
+            break;
 
-        /*
-         * Get the text/colour.
-         */
-        COLOUR_STRING *i = (*it);
-        std::string *colour = i->colour;
-        std::string *text   = i->string;
+        size_t bytes = span.text.size();
+        int width    = span.width;
+
+        if ((! enable_wrap) && (x + width > cols))
+            bytes = CColourString::fit(span.text, cols - x, width);
 
         /*
          * Set the colour + draw the component.
          */
         wattrset(screen, def_col);
-        wattron(screen, get_colour(*colour));
-        waddstr(screen, (char *)(*text).c_str());
+        wattron(screen, get_colour(span.colour));
+        waddnstr(screen, span.text.c_str(), bytes);
+
+        count += width;
 
-        count += 1;
+        /*
+         * Stop if the rest of the run didn't fit.
+         */
+        if (bytes < span.text.size())
+            break;
     }
 
 
@@ -1696,43 +1871,16 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
      */
 
     /*
-     * Get the X,Y coordings.
+     * If we're still upon the row draw enough spaces to reach the end.
      */
     getyx(screen, y, x);
-    bool moved = true;
 
-    /*
-     * Until the row has changed we draw " ", ensuring that
-     * we fill the line.
-     */
-    while ((y == row) && (moved == true))
+    if ((y == row) && (x < cols))
     {
-        /*
-         * Keep a copy of x,y
-         */
-        int x_orig = x;
-        int y_orig = y;
-
+        std::string padding(cols - x, ' ');
+        waddnstr(screen, padding.c_str(), padding.size());
 
-        /*
-         * Draw " ", until we wrap and the row changes to the next one.
-         */
-        waddstr(screen, (char *)" ");
-        getyx(screen, y, x);
-
-        count += 1;
-
-        /*
-         * At this point X/Y should have changed because we draw " ".
-         *
-         * If neither has changed it is because the cursor didn't move
-         * because the draw didn't happen (??) - perhaps the target
-         * is invisible?
-         *
-         * Break out if that is the case
-         */
-        if ((x == x_orig) && (y == y_orig))
-            moved = false;
+        count += padding.size();
     }
 
 
@@ -1741,17 +1889,6 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
      */
     wattrset(screen, get_colour("white|normal"));
 
-    /*
-     * Finally free the tokenized string-bits.
-     */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
-    {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
-    }
-
     return (count);
 }
 
@@ -1763,17 +1900,20 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
     CConfig *config = CConfig::instance();
     int tab_width   = config->get_integer("global.tab", 8);
 
+    /*
+     * We don't know which rows this will cover.
+     */
+    m_painted.clear();
+
     /*
      * Default colour/attributes for this line.
      */
     int def_col = getattrs(stdscr);
 
     /*
-     * Parse the string.  We don't need it in chunks,
-     * but we do need it in coloured fashion.
+     * Parse the string into runs of a single colour.
      */
-    std::vector<COLOUR_STRING *> parts;
-    parts = CColourString::parse_coloured_string(str, 0, tab_width);
+    CColourString::parse_spans(str, 0, tab_width, m_spans);
 
     /*
      * Move to the starting offset.
@@ -1783,21 +1923,14 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
     /*
      * Draw the part(s).
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
+    for (auto it = m_spans.begin(); it != m_spans.end() ; ++it)
     {
-        /*
-         * Get the text/colour.
-         */
-        COLOUR_STRING *i = (*it);
-        std::string *colour = i->colour;
-        std::string *text   = i->string;
-
         /*
          * Set the colour + draw the component.
          */
         wattrset(stdscr, def_col);
-        wattron(stdscr, get_colour(*colour));
-        waddstr(stdscr, (char *)(*text).c_str());
+        wattron(stdscr, get_colour((*it).colour));
+        waddnstr(stdscr, (*it).text.c_str(), (*it).text.size());
     }
 
     /*
@@ -1805,17 +1938,6 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
      */
     wattrset(stdscr, get_colour("white|normal"));
 
-    /*
-     * Free the parts.
-     */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
-    {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
-    }
-
     if (update)
     {
         update_panels();
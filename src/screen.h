@@ -25,10 +25,12 @@
 
 #include <cursesw.h>
 #include <panel.h>
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "colour_string.h"
 #include "singleton.h"
 #include "observer.h"
 
@@ -164,6 +166,43 @@ public:
      */
     void redraw();
 
+    /**
+     * The ways in which the display might have been damaged.
+     */
+    enum damageType
+    {
+        /*
+         * The text of the view is unchanged, but it must be redrawn -
+         * for example because the selection has moved.
+         */
+        DAMAGE_REFRESH,
+
+        /*
+         * The text of the view might have changed - for example because
+         * a message has been flagged, or new mail has arrived.
+         */
+        DAMAGE_CONTENT,
+
+        /*
+         * Everything must be redrawn from scratch.
+         */
+        DAMAGE_LAYOUT
+    };
+
+    /**
+     * Note that the display must be redrawn, the next time around the
+     * event-loop.  If nothing has been damaged then idle-ticks draw
+     * nothing at all.
+     */
+    void damage(damageType what = DAMAGE_CONTENT);
+
+    /**
+     * A counter which is increased each time the text of the view might
+     * have changed, which views may use to decide whether lines they
+     * fetched previously are still valid.
+     */
+    uint64_t generation();
+
     /**
      * Delay for the given period.
      */
@@ -220,15 +259,28 @@ public:
      *
      * If `simple` is set to true then we display the lines in a  simplified
      * fashion - with no selection, and no smooth-scrolling.
+     *
+     * `first` is the offset of the first of the given lines, so a view
+     * may supply only those lines which are visible.
+     */
+    void draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple = false, int first = 0);
+
+    /**
+     * Find the lines which `draw_text_lines` will display, given the
+     * selected line and the total number of lines.
+     *
+     * On return `top` is the offset of the first line, and `count` the
+     * number of lines which might be drawn.
      */
-    void draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple = false);
+    void visible_lines(int selected, int max, bool simple, int &top, int &count);
 
     /**
      * Draw a single text line, paying attention to our colour strings.
      *
-     * **NOTE**: This function is grossly inefficient, although functional.
+     * The line is parsed into runs of a single colour, each of which is
+     * drawn with one call to curses.
      *
-     * The return value is the number of characters drawn.
+     * The return value is the number of columns drawn.
      */
     int draw_single_line(int row, int col_offset, std::string text, WINDOW * screen, bool enable_scroll, bool enable_wrap);
 
@@ -241,9 +293,17 @@ public:
 private:
 
     /**
-     * Get the colour-pair for the given name.
+     * Get the colour-pair, and attributes, for the given name.
+     *
+     * Names are parsed once, and the result cached.
      */
-    int get_colour(std::string name);
+    int get_colour(const std::string &name);
+
+    /**
+     * Parse the given name, such as "red|bold", into a colour-pair and
+     * attributes.
+     */
+    int parse_colour(std::string name);
 
     /**
      * Convert ^I -> TAB, etc.
@@ -252,11 +312,49 @@ private:
 
 private:
 
+    /**
+     * Draw the given view, and our panel, if anything has been damaged.
+     */
+    void paint(CViewMode *view);
+
     /**
      * Are we (still) in the event-loop?
      */
     bool m_running = true;
 
+    /**
+     * Does the display need to be redrawn, and does it need to be
+     * cleared first?
+     */
+    bool m_damaged = true;
+    bool m_repaint = true;
+
+    /**
+     * Are we currently drawing?  Changes we make ourselves, such as
+     * updating `$mode.max`, don't damage the display.
+     */
+    bool m_drawing = false;
+
+    /**
+     * Increased each time the text of the view might have changed.
+     */
+    uint64_t m_generation = 0;
+
+    /**
+     * The text last drawn upon each row by `draw_text_lines`, prefixed
+     * by "*" if it was highlighted, or empty if the row is blank.
+     *
+     * Rows whose text hasn't changed aren't drawn again.  This is
+     * forgotten whenever something else draws upon the screen.
+     */
+    std::vector<std::string> m_painted;
+
+    /**
+     * The coloured runs of the line being drawn, which are kept to
+     * avoid allocating fresh storage for each line.
+     */
+    std::vector<CColourSpan> m_spans;
+
     /**
      * This map contains a mapping between a given mode-name and the
      * virtual class which implements its display.
@@ -274,12 +372,20 @@ private:
      */
     std::unordered_map < std::string, int >m_colours;
 
+    /**
+     * The names which have been parsed by `get_colour`, and the result.
+     *
+     * This is flushed when any `colour.*` setting changes, since
+     * "unread" refers to `colour.unread`.
+     */
+    std::unordered_map < std::string, int >m_colour_cache;
+
 private:
 
     /**
      * The segment of the screen the highlighted row is within.
      *
-     * Used by `draw_text_lines`.
+     * Used by `visible_lines`.
      */
     enum vectorPosition
     {
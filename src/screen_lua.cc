@@ -56,6 +56,24 @@ int l_CScreen_clear(lua_State * l)
 }
 
 
+/**
+ * Implementation of Screen:damage().
+ *
+ * Views whose text is held in Lua may call this when it changes, so
+ * that it is fetched afresh.
+ */
+int l_CScreen_damage(lua_State * l)
+{
+    CLuaLog("l_CScreen_damage");
+
+    (void)l;
+
+    CScreen *foo = CScreen::instance();
+    foo->damage(CScreen::DAMAGE_CONTENT);
+    return 0;
+}
+
+
 /**
  * Implementation of Screen:draw().
  */
@@ -275,6 +293,7 @@ void InitScreen(lua_State * l)
     luaL_Reg sFooRegs[] =
     {
         {"clear", l_CScreen_clear},
+        {"damage", l_CScreen_damage},
         {"draw", l_CScreen_draw},
         {"execute",  l_CScreen_execute},
         {"exit",  l_CScreen_exit},
@@ -0,0 +1,911 @@
+/*
+ * search_index.cc - A full-text search index of a single maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <cstdio>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <iterator>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+
+#include "message.h"
+#include "message_part.h"
+#include "search_index.h"
+
+
+/**
+ * @file search_index.cc
+ *
+ * The on-disk format of the index is:
+ *
+ *   "LMF1"              - Magic, 4 bytes.
+ *   uint32_t            - The number of messages.
+ *   uint32_t            - The number of words.
+ *   uint32_t            - Unused.
+ *   int64_t x 4         - The mtime of `cur/` and `new/`, seconds + nanoseconds.
+ *   uint64_t            - The size of the word-strings.
+ *   uint64_t            - The number of message-IDs in all posting-lists.
+ *
+ * Then for each word, sorted:
+ *
+ *   uint64_t            - The offset of the word in the word-strings.
+ *   uint64_t            - The offset of the posting-list.
+ *   uint32_t            - The length of the word.
+ *   uint32_t            - The number of messages in the posting-list.
+ *
+ * Then the word-strings, padded to a multiple of four bytes, followed by
+ * the posting-lists, each a sorted array of uint32_t message-IDs.
+ *
+ * Finally for each message:
+ *
+ *   uint64_t            - inode.
+ *   int64_t             - date.
+ *   uint8_t             - 1 if the message is present, 0 if deleted.
+ *   uint16_t            - length of the name.
+ *   name                - The bytes of the name, relative to the maildir.
+ *
+ * Values are stored in host byte-order, as the index is a local cache.
+ */
+
+
+/*
+ * On Mac OS X the nanosecond-resolution mtime has a different name.
+ */
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+
+/*
+ * The magic-marker at the start of our index.
+ */
+#define SEARCH_MAGIC "LMF1"
+
+/*
+ * The size of the fixed header.
+ */
+#define SEARCH_HEADER_SIZE 64
+
+/*
+ * The shortest, and longest, words we index.
+ */
+#define SEARCH_MIN_WORD 2
+#define SEARCH_MAX_WORD 40
+
+/*
+ * The most text we'll index from the body of each message.
+ */
+#define SEARCH_MAX_BODY (256 * 1024)
+
+
+/*
+ * Append the raw bytes of the given value to the buffer.
+ */
+template <typename T> static void append_value(std::string &buf, T value)
+{
+    buf.append((const char *)&value, sizeof(T));
+}
+
+
+/*
+ * Read a value from the buffer, if there is room.
+ */
+template <typename T> static bool read_value(const char *&p, const char *end, T &value)
+{
+    if ((size_t)(end - p) < sizeof(T))
+        return false;
+
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+
+/*
+ * Return the unique part of a maildir filename, which doesn't change
+ * when the message is moved from `new/` to `cur/`, or its flags change.
+ */
+static std::string unique_name(const std::string &name)
+{
+    size_t slash = name.find('/');
+    size_t start = (slash == std::string::npos) ? 0 : slash + 1;
+    size_t colon = name.find(':', start);
+
+    return (name.substr(start, (colon == std::string::npos) ? std::string::npos : colon - start));
+}
+
+
+/*
+ * Remove HTML tags from the given text, crudely.
+ */
+static std::string strip_tags(const char *text, size_t len)
+{
+    std::string result;
+    result.reserve(len);
+    bool in_tag = false;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (text[i] == '<')
+        {
+            in_tag = true;
+        }
+        else if (text[i] == '>')
+        {
+            in_tag = false;
+            result += ' ';
+        }
+        else if (!in_tag)
+        {
+            result += text[i];
+        }
+    }
+
+    return result;
+}
+
+
+/*
+ * Constructor.
+ */
+CSearchIndex::CSearchIndex(std::string maildir)
+{
+    m_maildir    = maildir;
+    m_map        = NULL;
+    m_map_size   = 0;
+    m_terms      = NULL;
+    m_term_count = 0;
+    m_strings    = NULL;
+    m_postings   = NULL;
+    m_dead       = 0;
+    m_loaded     = false;
+    m_dirty      = false;
+
+    m_cur_mtime.tv_sec  = m_new_mtime.tv_sec  = -1;
+    m_cur_mtime.tv_nsec = m_new_mtime.tv_nsec = 0;
+}
+
+
+/*
+ * Destructor.
+ */
+CSearchIndex::~CSearchIndex()
+{
+    save();
+    unmap();
+}
+
+
+/*
+ * The path to the on-disk index file.
+ */
+std::string CSearchIndex::index_file()
+{
+    return (m_maildir + "/.lumail.fts");
+}
+
+
+/*
+ * Split the given text into lower-cased words.
+ *
+ * Words are runs of ASCII letters and digits, along with any non-ASCII
+ * bytes, so UTF-8 text is indexed - albeit without case-folding.
+ */
+void CSearchIndex::tokenize(const std::string &text, std::vector<std::string> &words)
+{
+    std::string word;
+    size_t len = text.size();
+
+    for (size_t i = 0; i <= len; i++)
+    {
+        unsigned char c = (i < len) ? text[i] : ' ';
+
+        if ((c >= 0x80) || isalnum(c))
+        {
+            word += (char)tolower(c);
+            continue;
+        }
+
+        if ((word.size() >= SEARCH_MIN_WORD) && (word.size() <= SEARCH_MAX_WORD))
+            words.push_back(word);
+
+        word.clear();
+    }
+}
+
+
+/*
+ * Release the on-disk index.
+ */
+void CSearchIndex::unmap()
+{
+    if (m_map != NULL)
+        munmap(m_map, m_map_size);
+
+    m_map        = NULL;
+    m_map_size   = 0;
+    m_terms      = NULL;
+    m_term_count = 0;
+    m_strings    = NULL;
+    m_postings   = NULL;
+}
+
+
+/*
+ * Load the on-disk index, if present.
+ */
+bool CSearchIndex::load()
+{
+    m_loaded = true;
+
+    std::string file = index_file();
+    int fd = open(file.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+
+    if ((fstat(fd, &sb) < 0) || (sb.st_size < SEARCH_HEADER_SIZE))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    const char *p   = (const char *)map;
+    const char *end = p + sb.st_size;
+
+    bool valid = (memcmp(p, SEARCH_MAGIC, 4) == 0);
+    p += 4;
+
+    uint32_t doc_count = 0, term_count = 0, unused = 0;
+    int64_t times[4] = { -1, 0, -1, 0 };
+    uint64_t strings_size = 0, postings_count = 0;
+
+    valid = valid &&
+            read_value(p, end, doc_count) &&
+            read_value(p, end, term_count) &&
+            read_value(p, end, unused) &&
+            read_value(p, end, times[0]) && read_value(p, end, times[1]) &&
+            read_value(p, end, times[2]) && read_value(p, end, times[3]) &&
+            read_value(p, end, strings_size) &&
+            read_value(p, end, postings_count);
+
+    /*
+     * Ensure the sections fit within the file.
+     */
+    uint64_t padded  = (strings_size + 3) & ~((uint64_t)3);
+    uint64_t size    = sb.st_size;
+    uint64_t terms   = SEARCH_HEADER_SIZE;
+    uint64_t strings = terms + (uint64_t)term_count * sizeof(CSearchTerm);
+    uint64_t lists   = strings + padded;
+    uint64_t docs    = lists + postings_count * sizeof(uint32_t);
+
+    valid = valid && (strings <= size) && (lists <= size) && (docs <= size);
+
+    const char *base = (const char *)map;
+    const CSearchTerm *table = (const CSearchTerm *)(base + terms);
+
+    for (uint32_t i = 0; valid && (i < term_count); i++)
+    {
+        valid = (table[i].string_offset + table[i].string_length <= strings_size) &&
+                (table[i].postings_offset + table[i].postings_count <= postings_count);
+    }
+
+    /*
+     * Read the messages.
+     */
+    std::vector<CSearchDoc> found;
+    p = base + docs;
+
+    for (uint32_t i = 0; valid && (i < doc_count); i++)
+    {
+        CSearchDoc doc;
+        uint8_t live;
+        uint16_t len;
+
+        valid = read_value(p, end, doc.inode) &&
+                read_value(p, end, doc.date) &&
+                read_value(p, end, live) &&
+                read_value(p, end, len) &&
+                ((size_t)(end - p) >= len);
+
+        if (!valid)
+            break;
+
+        doc.name.assign(p, len);
+        doc.live = (live != 0);
+        p += len;
+
+        found.push_back(doc);
+    }
+
+    /*
+     * A corrupt index is discarded, and will be rebuilt.
+     */
+    if (!valid)
+    {
+        munmap(map, sb.st_size);
+        return false;
+    }
+
+    m_map        = map;
+    m_map_size   = sb.st_size;
+    m_terms      = table;
+    m_term_count = term_count;
+    m_strings    = base + strings;
+    m_postings   = (const uint32_t *)(base + lists);
+
+    m_docs = found;
+    m_inodes.clear();
+    m_dead = 0;
+
+    for (uint32_t i = 0; i < m_docs.size(); i++)
+    {
+        if (m_docs[i].live)
+            m_inodes[m_docs[i].inode] = i;
+        else
+            m_dead++;
+    }
+
+    m_cur_mtime.tv_sec  = times[0];
+    m_cur_mtime.tv_nsec = times[1];
+    m_new_mtime.tv_sec  = times[2];
+    m_new_mtime.tv_nsec = times[3];
+
+    return true;
+}
+
+
+/*
+ * Write the index to disk, if it has changed.
+ *
+ * The words on disk, and those indexed since, are merged.  If more
+ * than half the messages have been deleted they are dropped, and the
+ * remainder renumbered.
+ */
+bool CSearchIndex::save()
+{
+    if (!m_dirty)
+        return true;
+
+    bool compact = (m_dead * 2 > m_docs.size());
+
+    std::vector<uint32_t> remap(m_docs.size());
+    std::vector<CSearchDoc> docs;
+    docs.reserve(m_docs.size());
+
+    for (size_t i = 0; i < m_docs.size(); i++)
+    {
+        remap[i] = (uint32_t) - 1;
+
+        if (compact && !m_docs[i].live)
+            continue;
+
+        remap[i] = docs.size();
+        docs.push_back(m_docs[i]);
+    }
+
+    std::string table;
+    std::string strings;
+    std::string lists;
+    uint32_t term_count = 0;
+
+    /*
+     * Append a word, and its posting-list, dropping deleted messages.
+     */
+    auto emit = [&](const std::string & word, const uint32_t *ids, size_t n1,
+                    const std::vector<uint32_t> *more)
+    {
+        size_t start = lists.size() / sizeof(uint32_t);
+        size_t count = 0;
+
+        for (size_t i = 0; i < n1; i++)
+        {
+            if ((ids[i] < remap.size()) && (remap[ids[i]] != (uint32_t) - 1))
+            {
+                append_value(lists, remap[ids[i]]);
+                count++;
+            }
+        }
+
+        for (size_t i = 0; more && (i < more->size()); i++)
+        {
+            uint32_t id = (*more)[i];
+
+            if (remap[id] != (uint32_t) - 1)
+            {
+                append_value(lists, remap[id]);
+                count++;
+            }
+        }
+
+        if (count == 0)
+            return;
+
+        CSearchTerm t;
+        t.string_offset   = strings.size();
+        t.postings_offset = start;
+        t.string_length   = word.size();
+        t.postings_count  = count;
+
+        table.append((const char *)&t, sizeof(t));
+        strings += word;
+        term_count++;
+    };
+
+    uint32_t i = 0;
+    auto it = m_pending.begin();
+
+    while ((i < m_term_count) || (it != m_pending.end()))
+    {
+        int cmp;
+
+        if (i >= m_term_count)
+            cmp = 1;
+        else if (it == m_pending.end())
+            cmp = -1;
+        else
+            cmp = term(i).compare(it->first);
+
+        if (cmp < 0)
+        {
+            emit(term(i), m_postings + m_terms[i].postings_offset, m_terms[i].postings_count, NULL);
+            i++;
+        }
+        else if (cmp > 0)
+        {
+            emit(it->first, NULL, 0, &it->second);
+            ++it;
+        }
+        else
+        {
+            emit(it->first, m_postings + m_terms[i].postings_offset, m_terms[i].postings_count, &it->second);
+            i++;
+            ++it;
+        }
+    }
+
+    while (strings.size() % 4)
+        strings += '\0';
+
+    std::string buf;
+    buf.reserve(SEARCH_HEADER_SIZE + table.size() + strings.size() + lists.size());
+    buf.append(SEARCH_MAGIC, 4);
+    append_value(buf, (uint32_t)docs.size());
+    append_value(buf, term_count);
+    append_value(buf, (uint32_t)0);
+    append_value(buf, (int64_t)m_cur_mtime.tv_sec);
+    append_value(buf, (int64_t)m_cur_mtime.tv_nsec);
+    append_value(buf, (int64_t)m_new_mtime.tv_sec);
+    append_value(buf, (int64_t)m_new_mtime.tv_nsec);
+    append_value(buf, (uint64_t)strings.size());
+    append_value(buf, (uint64_t)(lists.size() / sizeof(uint32_t)));
+
+    buf += table;
+    buf += strings;
+    buf += lists;
+
+    for (const CSearchDoc &doc : docs)
+    {
+        append_value(buf, doc.inode);
+        append_value(buf, doc.date);
+        append_value(buf, (uint8_t)(doc.live ? 1 : 0));
+        append_value(buf, (uint16_t)doc.name.size());
+        buf += doc.name;
+    }
+
+    /*
+     * Write to a temporary file, then rename into place, so that a
+     * concurrent reader never sees a partial index.
+     */
+    std::string file = index_file();
+    std::string tmp  = file + ".tmp";
+
+    FILE *f = fopen(tmp.c_str(), "wb");
+
+    if (f == NULL)
+        return false;
+
+    bool ok = (fwrite(buf.data(), 1, buf.size(), f) == buf.size());
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok)
+        ok = (rename(tmp.c_str(), file.c_str()) == 0);
+    else
+        unlink(tmp.c_str());
+
+    if (!ok)
+        return false;
+
+    /*
+     * Now search the file we've written.
+     */
+    m_dirty = false;
+    m_pending.clear();
+    unmap();
+
+    if (!load())
+    {
+        m_docs.clear();
+        m_inodes.clear();
+        m_dead = 0;
+    }
+
+    return true;
+}
+
+
+/*
+ * Return the given word from the on-disk index.
+ */
+std::string CSearchIndex::term(uint32_t offset)
+{
+    const CSearchTerm &t = m_terms[offset];
+    return (std::string(m_strings + t.string_offset, t.string_length));
+}
+
+
+/*
+ * Read the names + inodes of the files in the given sub-directory.
+ */
+void CSearchIndex::list(std::string subdir, std::vector<CSearchDoc> &found)
+{
+    std::string path = m_maildir + "/" + subdir;
+
+    DIR *dp = opendir(path.c_str());
+
+    if (dp == NULL)
+        return;
+
+    int dfd = dirfd(dp);
+    dirent *de;
+
+    while ((de = readdir(dp)) != NULL)
+    {
+        /*
+         * Skip dotfiles, which includes "." and "..".
+         */
+        if (de->d_name[0] == '.')
+            continue;
+
+        if (de->d_type == DT_DIR)
+            continue;
+
+        if (de->d_type == DT_UNKNOWN)
+        {
+            struct stat sb;
+
+            if ((fstatat(dfd, de->d_name, &sb, 0) < 0) || S_ISDIR(sb.st_mode))
+                continue;
+        }
+
+        CSearchDoc doc;
+        doc.name  = subdir + "/" + de->d_name;
+        doc.inode = de->d_ino;
+        doc.date  = 0;
+        doc.live  = true;
+        found.push_back(doc);
+    }
+
+    closedir(dp);
+}
+
+
+/*
+ * Parse the given message, and add its words to the index.
+ */
+void CSearchIndex::index_message(uint32_t doc)
+{
+    CMessage msg(m_maildir + "/" + m_docs[doc].name);
+
+    m_docs[doc].date = msg.get_date();
+
+    std::string text = msg.header("From") + " " + msg.header("To") + " " +
+                       msg.header("Cc") + " " + msg.header("Subject") + " ";
+
+    /*
+     * Collect the text parts.  HTML is only used if there is no
+     * plain-text alternative.
+     */
+    std::string plain;
+    std::string html;
+
+    std::function<void(std::vector<std::shared_ptr<CMessagePart>>)> walk =
+        [&](std::vector<std::shared_ptr<CMessagePart>> parts)
+    {
+        for (std::shared_ptr<CMessagePart> part : parts)
+        {
+            std::string type = part->type();
+            std::transform(type.begin(), type.end(), type.begin(), tolower);
+
+            bool is_plain = (type.compare(0, 10, "text/plain") == 0);
+            bool is_html  = (type.compare(0, 9, "text/html") == 0);
+
+            if ((is_plain || is_html) && part->filename().empty())
+            {
+                std::string &out = is_plain ? plain : html;
+                size_t room = (out.size() < SEARCH_MAX_BODY) ? (SEARCH_MAX_BODY - out.size()) : 0;
+                size_t len  = std::min(part->content_size(), room);
+
+                if (len > 0)
+                {
+                    const char *content = (const char *)part->content();
+
+                    if (content != NULL)
+                    {
+                        out.append(content, len);
+                        out += ' ';
+                    }
+                }
+            }
+
+            walk(part->children());
+        }
+    };
+
+    walk(msg.get_parts());
+
+    if (!plain.empty())
+        text += plain;
+    else if (!html.empty())
+        text += strip_tags(html.data(), html.size());
+
+    std::vector<std::string> words;
+    tokenize(text, words);
+
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    for (const std::string &word : words)
+        m_pending[word].push_back(doc);
+}
+
+
+/*
+ * Bring the index up to date with the contents of the maildir.
+ */
+bool CSearchIndex::update()
+{
+    if (!m_loaded)
+        load();
+
+    std::string cur = m_maildir + "/cur";
+    std::string nw  = m_maildir + "/new";
+
+    struct stat cur_sb;
+    struct stat new_sb;
+
+    if (stat(cur.c_str(), &cur_sb) < 0)
+        return false;
+
+    if (stat(nw.c_str(), &new_sb) < 0)
+    {
+        new_sb.st_mtim.tv_sec  = -1;
+        new_sb.st_mtim.tv_nsec = 0;
+    }
+
+    /*
+     * If neither directory has changed there is nothing to do.
+     */
+    if ((cur_sb.st_mtim.tv_sec == m_cur_mtime.tv_sec) &&
+            (cur_sb.st_mtim.tv_nsec == m_cur_mtime.tv_nsec) &&
+            (new_sb.st_mtim.tv_sec == m_new_mtime.tv_sec) &&
+            (new_sb.st_mtim.tv_nsec == m_new_mtime.tv_nsec))
+        return false;
+
+    std::vector<CSearchDoc> found;
+    found.reserve(m_docs.size());
+    list("cur", found);
+    list("new", found);
+
+    std::vector<bool> seen(m_docs.size(), false);
+    std::vector<uint32_t> added;
+    size_t removed = 0;
+
+    for (CSearchDoc &doc : found)
+    {
+        auto it = m_inodes.find(doc.inode);
+
+        /*
+         * A file we've indexed - which might have been renamed.  As the
+         * inode of a deleted file may be reused we test the name too.
+         *
+         * The inode of a hard-linked file might refer to a message we've
+         * just added, which `seen` doesn't cover.
+         */
+        if ((it != m_inodes.end()) && (it->second < seen.size()) &&
+                m_docs[it->second].live && !seen[it->second] &&
+                (unique_name(m_docs[it->second].name) == unique_name(doc.name)))
+        {
+            seen[it->second] = true;
+            m_docs[it->second].name = doc.name;
+            continue;
+        }
+
+        uint32_t id = m_docs.size();
+        m_docs.push_back(doc);
+        m_inodes[doc.inode] = id;
+        added.push_back(id);
+    }
+
+    for (size_t i = 0; i < seen.size(); i++)
+    {
+        if (m_docs[i].live && !seen[i])
+        {
+            m_docs[i].live = false;
+            m_dead++;
+            removed++;
+        }
+    }
+
+    for (uint32_t id : added)
+        index_message(id);
+
+    m_cur_mtime = cur_sb.st_mtim;
+    m_new_mtime = new_sb.st_mtim;
+    m_dirty     = true;
+
+    save();
+
+    return ((added.size() + removed) > 0);
+}
+
+
+/*
+ * Append the messages which contain the given word, or prefix.
+ */
+void CSearchIndex::lookup(const std::string &word, bool prefix, std::vector<uint32_t> &docs)
+{
+    /*
+     * Binary-search the words on disk.
+     */
+    uint32_t lo = 0, hi = m_term_count;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (term(mid).compare(word) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (uint32_t i = lo; i < m_term_count; i++)
+    {
+        std::string t = term(i);
+
+        if (prefix ? (t.compare(0, word.size(), word) != 0) : (t != word))
+            break;
+
+        const uint32_t *ids = m_postings + m_terms[i].postings_offset;
+        docs.insert(docs.end(), ids, ids + m_terms[i].postings_count);
+    }
+
+    /*
+     * Then the words of messages indexed since.
+     */
+    for (auto it = m_pending.lower_bound(word); it != m_pending.end(); ++it)
+    {
+        if (prefix ? (it->first.compare(0, word.size(), word) != 0) : (it->first != word))
+            break;
+
+        docs.insert(docs.end(), it->second.begin(), it->second.end());
+    }
+}
+
+
+/*
+ * Find the messages which contain every word in the query.
+ */
+std::vector<CSearchResult> CSearchIndex::search(std::string query)
+{
+    std::vector<CSearchResult> results;
+
+    if (!m_loaded)
+        load();
+
+    /*
+     * Split the query into words, noting any prefixes.
+     */
+    std::vector<std::pair<std::string, bool>> words;
+    size_t start = 0;
+
+    while (start < query.size())
+    {
+        size_t end = query.find_first_of(" \t", start);
+
+        if (end == std::string::npos)
+            end = query.size();
+
+        std::string piece = query.substr(start, end - start);
+        bool prefix = (!piece.empty() && (piece.back() == '*'));
+
+        std::vector<std::string> found;
+        tokenize(piece, found);
+
+        for (size_t i = 0; i < found.size(); i++)
+            words.push_back(std::make_pair(found[i], prefix && (i == found.size() - 1)));
+
+        start = end + 1;
+    }
+
+    if (words.empty())
+        return results;
+
+    /*
+     * Intersect the messages containing each word.
+     */
+    std::vector<uint32_t> matches;
+
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        std::vector<uint32_t> docs;
+        lookup(words[i].first, words[i].second, docs);
+
+        if (words[i].second)
+        {
+            std::sort(docs.begin(), docs.end());
+            docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+        }
+
+        if (i == 0)
+        {
+            matches.swap(docs);
+        }
+        else
+        {
+            std::vector<uint32_t> both;
+            std::set_intersection(matches.begin(), matches.end(),
+                                  docs.begin(), docs.end(),
+                                  std::back_inserter(both));
+            matches.swap(both);
+        }
+
+        if (matches.empty())
+            return results;
+    }
+
+    for (uint32_t id : matches)
+    {
+        if ((id >= m_docs.size()) || !m_docs[id].live)
+            continue;
+
+        CSearchResult r;
+        r.path = m_maildir + "/" + m_docs[id].name;
+        r.date = m_docs[id].date;
+        results.push_back(r);
+    }
+
+    return results;
+}
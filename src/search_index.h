@@ -0,0 +1,218 @@
+/*
+ * search_index.h - A full-text search index of a single maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+
+
+/**
+ * A single message found by a search.
+ */
+struct CSearchResult
+{
+    /**
+     * The path to the message.
+     */
+    std::string path;
+
+    /**
+     * The date of the message, as returned by `CMessage::get_date`.
+     */
+    int64_t date;
+};
+
+
+
+/**
+ * This class maintains an inverted index of the messages in a single
+ * maildir, mapping each word found in their headers and text parts to
+ * the messages which contain it.
+ *
+ * The index is stored beneath the maildir, next to `.lumail.index`, and
+ * is searched via `mmap` - the sorted table of words is binary-searched,
+ * and the list of messages for each word read in place.
+ *
+ * When `update` is called the modification-times of `cur/` and `new/`
+ * are tested; only if they've changed are the directories read, to find
+ * new files, which are parsed and indexed, and removed ones, which are
+ * marked as deleted.  As with `CMaildirIndex` renames are spotted via the
+ * inode, so changing the flags of a message doesn't re-index it.
+ *
+ */
+class CSearchIndex
+{
+public:
+
+    /**
+     * Constructor.  The path is the top-level of the maildir.
+     */
+    CSearchIndex(std::string maildir);
+
+    /**
+     * Destructor.  Write the index to disk, if it has changed.
+     */
+    ~CSearchIndex();
+
+    /**
+     * Bring the index up to date with the contents of the maildir.
+     *
+     * Returns true if anything changed.
+     */
+    bool update();
+
+    /**
+     * Find the messages which contain every word in the query.
+     *
+     * A word ending in `*` matches any word with that prefix.  The
+     * results are in no particular order.
+     */
+    std::vector<CSearchResult> search(std::string query);
+
+    /**
+     * Write the index to disk, if it has changed.
+     */
+    bool save();
+
+    /**
+     * The path to the on-disk index file.
+     */
+    std::string index_file();
+
+    /**
+     * Split the given text into lower-cased words, appending them to
+     * `words`.
+     */
+    static void tokenize(const std::string &text, std::vector<std::string> &words);
+
+private:
+
+    /**
+     * A message in the index.
+     */
+    struct CSearchDoc
+    {
+        std::string name;
+        uint64_t inode;
+        int64_t date;
+        bool live;
+    };
+
+    /**
+     * A word in the on-disk index.
+     */
+    struct CSearchTerm
+    {
+        uint64_t string_offset;
+        uint64_t postings_offset;
+        uint32_t string_length;
+        uint32_t postings_count;
+    };
+
+    /**
+     * Load the on-disk index, if present.
+     */
+    bool load();
+
+    /**
+     * Release the on-disk index.
+     */
+    void unmap();
+
+    /**
+     * Read the names + inodes of the files in the given sub-directory.
+     */
+    void list(std::string subdir, std::vector<CSearchDoc> &found);
+
+    /**
+     * Parse the given message, and add its words to the index.
+     */
+    void index_message(uint32_t doc);
+
+    /**
+     * Append the messages which contain the given word, or any word
+     * with that prefix, to `docs`.
+     */
+    void lookup(const std::string &word, bool prefix, std::vector<uint32_t> &docs);
+
+    /**
+     * Return the given word from the on-disk index.
+     */
+    std::string term(uint32_t offset);
+
+private:
+
+    /**
+     * The maildir we represent.
+     */
+    std::string m_maildir;
+
+    /**
+     * The messages we've indexed, the offset is used as an ID.
+     */
+    std::vector<CSearchDoc> m_docs;
+
+    /**
+     * The ID of each message, keyed by inode.
+     */
+    std::unordered_map<uint64_t, uint32_t> m_inodes;
+
+    /**
+     * The words of messages indexed since the index was loaded.
+     */
+    std::map<std::string, std::vector<uint32_t>> m_pending;
+
+    /**
+     * The on-disk index, and the sections within it.
+     */
+    void *m_map;
+    size_t m_map_size;
+    const CSearchTerm *m_terms;
+    uint32_t m_term_count;
+    const char *m_strings;
+    const uint32_t *m_postings;
+
+    /**
+     * The modification-times of `cur/` and `new/` when we last updated.
+     */
+    struct timespec m_cur_mtime;
+    struct timespec m_new_mtime;
+
+    /**
+     * The number of deleted messages.
+     */
+    uint32_t m_dead;
+
+    /**
+     * Have we attempted to load the on-disk index?
+     */
+    bool m_loaded;
+
+    /**
+     * Has the index changed since it was loaded?
+     */
+    bool m_dirty;
+};
@@ -0,0 +1,182 @@
+/*
+ * search_index_test.cc - Test-cases for our CSearchIndex class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "search_index.h"
+#include "CuTest.h"
+
+
+/*
+ * Write a message with the given sender and subject to the given file.
+ */
+static void write_message(std::string path, std::string from, std::string subject)
+{
+    std::ofstream out(path);
+    out << "From: " << from << "\n";
+    out << "Subject: " << subject << "\n";
+    out << "\nBody\n";
+    out.close();
+}
+
+
+/*
+ * Sleep long enough that the modification-time of a directory changes.
+ */
+static void tick()
+{
+    usleep(20 * 1000);
+}
+
+
+/**
+ * Test that text is split into words.
+ */
+void TestSearchIndexTokenize(CuTest * tc)
+{
+    std::vector<std::string> words;
+    CSearchIndex::tokenize("Hello, World!  It's a TEST-case; 2016.", words);
+
+    CuAssertIntEquals(tc, 6, words.size());
+    CuAssertStrEquals(tc, "hello", words[0].c_str());
+    CuAssertStrEquals(tc, "world", words[1].c_str());
+    CuAssertStrEquals(tc, "it", words[2].c_str());
+    CuAssertStrEquals(tc, "test", words[3].c_str());
+    CuAssertStrEquals(tc, "case", words[4].c_str());
+    CuAssertStrEquals(tc, "2016", words[5].c_str());
+}
+
+
+/**
+ * Test that messages are indexed, renamed, and removed.
+ */
+void TestSearchIndexUpdate(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.searchXXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    mkdir(std::string(prefix + "/cur").c_str(), 0755);
+    mkdir(std::string(prefix + "/new").c_str(), 0755);
+
+    write_message(prefix + "/cur/100.host:2,S", "steve@example.com", "Lumail rocks");
+    write_message(prefix + "/new/200.host", "bob@example.com", "Lumail threading");
+
+    {
+        CSearchIndex idx(prefix);
+        CuAssertTrue(tc, idx.update());
+        CuAssertTrue(tc, !idx.update());
+
+        std::vector<CSearchResult> found = idx.search("lumail");
+        CuAssertIntEquals(tc, 2, found.size());
+
+        found = idx.search("LUMAIL steve");
+        CuAssertIntEquals(tc, 1, found.size());
+        CuAssertStrEquals(tc, std::string(prefix + "/cur/100.host:2,S").c_str(), found[0].path.c_str());
+        CuAssertIntEquals(tc, 100, found[0].date);
+
+        found = idx.search("thread*");
+        CuAssertIntEquals(tc, 1, found.size());
+        CuAssertIntEquals(tc, 200, found[0].date);
+
+        found = idx.search("missing");
+        CuAssertIntEquals(tc, 0, found.size());
+    }
+
+    /*
+     * Rename one message, delete the other, and add a new one.
+     */
+    tick();
+    rename(std::string(prefix + "/new/200.host").c_str(),
+           std::string(prefix + "/cur/200.host:2,S").c_str());
+    unlink(std::string(prefix + "/cur/100.host:2,S").c_str());
+    write_message(prefix + "/new/300.host", "steve@example.com", "Lumail again");
+
+    CSearchIndex idx(prefix);
+    CuAssertTrue(tc, idx.update());
+
+    std::vector<CSearchResult> found = idx.search("lumail");
+    CuAssertIntEquals(tc, 2, found.size());
+
+    found = idx.search("threading");
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertStrEquals(tc, std::string(prefix + "/cur/200.host:2,S").c_str(), found[0].path.c_str());
+
+    found = idx.search("steve");
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertIntEquals(tc, 300, found[0].date);
+
+    unlink(std::string(prefix + "/cur/200.host:2,S").c_str());
+    unlink(std::string(prefix + "/new/300.host").c_str());
+    unlink(idx.index_file().c_str());
+    rmdir(std::string(prefix + "/cur").c_str());
+    rmdir(std::string(prefix + "/new").c_str());
+    rmdir(prefix.c_str());
+}
+
+
+/**
+ * Test that a message with several hard-links is indexed under each name.
+ */
+void TestSearchIndexHardLinks(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.searchXXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    mkdir(std::string(prefix + "/cur").c_str(), 0755);
+    mkdir(std::string(prefix + "/new").c_str(), 0755);
+
+    std::string original = prefix + "/cur/100.host:2,S";
+    write_message(original, "steve@example.com", "Lumail links");
+
+    CSearchIndex idx(prefix);
+    CuAssertTrue(tc, idx.update());
+
+    /*
+     * Two more links to the same inode, neither of which is a rename.
+     */
+    tick();
+    CuAssertIntEquals(tc, 0, link(original.c_str(), std::string(prefix + "/cur/200.host:2,S").c_str()));
+    CuAssertIntEquals(tc, 0, link(original.c_str(), std::string(prefix + "/new/300.host").c_str()));
+
+    CuAssertTrue(tc, idx.update());
+    CuAssertIntEquals(tc, 3, idx.search("links").size());
+
+    unlink(original.c_str());
+    unlink(std::string(prefix + "/cur/200.host:2,S").c_str());
+    unlink(std::string(prefix + "/new/300.host").c_str());
+    unlink(idx.index_file().c_str());
+    rmdir(std::string(prefix + "/cur").c_str());
+    rmdir(std::string(prefix + "/new").c_str());
+    rmdir(prefix.c_str());
+}
+
+
+CuSuite *
+search_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestSearchIndexTokenize);
+    SUITE_ADD_TEST(suite, TestSearchIndexUpdate);
+    SUITE_ADD_TEST(suite, TestSearchIndexHardLinks);
+    return suite;
+}
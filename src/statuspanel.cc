@@ -98,6 +98,11 @@ void CStatusPanel::init(int rows)
     show_panel(g_status_bar);
     m_hidden = false;
     draw();
+
+    /*
+     * The space left for the view has changed.
+     */
+    CScreen::instance()->damage(CScreen::DAMAGE_LAYOUT);
 }
 
 
@@ -122,6 +127,8 @@ void CStatusPanel::hide()
 {
     cleanup();
     m_hidden = true;
+
+    CScreen::instance()->damage(CScreen::DAMAGE_LAYOUT);
 }
 
 /**
@@ -229,6 +236,8 @@ void CStatusPanel::set_title(std::string new_title)
 {
     title = new_title ;
     draw();
+
+    CScreen::instance()->damage(CScreen::DAMAGE_REFRESH);
 }
 
 std::string CStatusPanel::get_title()
@@ -243,6 +252,8 @@ void CStatusPanel::reset()
 {
     m_text.clear();
     draw();
+
+    CScreen::instance()->damage(CScreen::DAMAGE_REFRESH);
 }
 
 /**
@@ -252,6 +263,8 @@ void CStatusPanel::add_text(std::string line)
 {
     m_text.push_back(line);
     draw();
+
+    CScreen::instance()->damage(CScreen::DAMAGE_REFRESH);
 }
 
 /**
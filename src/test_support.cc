@@ -0,0 +1,41 @@
+/*
+ * test_support.cc - Helpers shared by our test-suites.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "maildir_index.h"
+#include "test_support.h"
+
+
+/*
+ * Create a message with the given path and headers, without touching
+ * the disk.
+ */
+std::shared_ptr<CMessage> make_message(std::string path,
+                                       std::unordered_map<std::string, std::string> headers)
+{
+    for (const std::string &name : CMaildirIndex::key_headers())
+    {
+        if (headers.find(name) == headers.end())
+            headers[name] = "";
+    }
+
+    std::shared_ptr<CMessage> msg(new CMessage(path));
+    msg->set_cached_headers(headers);
+
+    return msg;
+}
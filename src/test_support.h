@@ -0,0 +1,37 @@
+/*
+ * test_support.h - Helpers shared by our test-suites.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "message.h"
+
+
+/**
+ * Create a message with the given path and headers, without touching
+ * the disk.
+ *
+ * Any of the key-headers of `CMaildirIndex` which aren't given are left
+ * empty, so looking them up never parses the - missing - file.
+ */
+std::shared_ptr<CMessage> make_message(std::string path,
+                                       std::unordered_map<std::string, std::string> headers);
@@ -33,9 +33,18 @@ CuSuite *directory_getsuite();
 /* defined in file_test.cc */
 CuSuite *file_getsuite();
 
+/* defined in global_state_test.cc */
+CuSuite *global_state_getsuite();
+
 /* defined in history_test.cc */
 CuSuite *history_getsuite();
 
+/* defined in imap_proxy_test.cc */
+CuSuite *imap_proxy_getsuite();
+
+/* defined in imap_sync_test.cc */
+CuSuite *imap_sync_getsuite();
+
 /* defined in input_queue_test.cc */
 CuSuite *input_queue_getsuite();
 
@@ -45,8 +54,32 @@ CuSuite *lua_getsuite();
 /* defined in logfile_test.cc */
 CuSuite *logfile_getsuite();
 
+/* defined in maildir_test.cc */
+CuSuite *maildir_getsuite();
+
+/* defined in maildir_index_test.cc */
+CuSuite *maildir_index_getsuite();
+
+/* defined in message_filter_test.cc */
+CuSuite *message_filter_getsuite();
+
+/* defined in message_format_test.cc */
+CuSuite *message_format_getsuite();
+
+/* defined in message_sort_test.cc */
+CuSuite *message_sort_getsuite();
+
+/* defined in regexp_test.cc */
+CuSuite *regexp_getsuite();
+
+/* defined in search_index_test.cc */
+CuSuite *search_index_getsuite();
+
 /* defined in statuspanel_test.cc */
 CuSuite *statuspanel_getsuite();
 
+/* defined in threader_test.cc */
+CuSuite *threader_getsuite();
+
 /* defined in util_test.cc */
 CuSuite *util_getsuite();
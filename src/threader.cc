@@ -0,0 +1,738 @@
+/*
+ * threader.cc - Thread messages, via the JWZ algorithm.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <unordered_set>
+
+
+#include "threader.h"
+
+
+
+/*
+ * Return the message-ids found in the given header, i.e. the text between
+ * each pair of angle-brackets.
+ */
+static std::vector<std::string> message_ids(const std::string &value)
+{
+    std::vector<std::string> ids;
+    size_t start = 0;
+
+    while ((start = value.find('<', start)) != std::string::npos)
+    {
+        size_t end = value.find('>', start + 1);
+
+        if (end == std::string::npos)
+            break;
+
+        if (end > start + 1)
+            ids.push_back(value.substr(start + 1, end - start - 1));
+
+        start = end + 1;
+    }
+
+    return ids;
+}
+
+
+/*
+ * Does `str` contain "R[eE]:" or "R[eE][N]:" at the given offset?  If so
+ * return the length of the match, otherwise zero.
+ */
+static size_t reply_prefix(const std::string &str, size_t i)
+{
+    if ((str[i] != 'R') || (i + 2 >= str.size()))
+        return 0;
+
+    if ((str[i + 1] != 'e') && (str[i + 1] != 'E'))
+        return 0;
+
+    if (str[i + 2] == ':')
+        return 3;
+
+    if ((str[i + 2] == '[') && (i + 4 < str.size()) && isdigit(str[i + 3]) &&
+            (str[i + 4] == ']') && (i + 5 < str.size()) && (str[i + 5] == ':'))
+        return 6;
+
+    return 0;
+}
+
+
+/*
+ * Does `str` contain "F[wW][dD]:" at the given offset?
+ */
+static size_t forward_prefix(const std::string &str, size_t i)
+{
+    if ((str[i] != 'F') || (i + 3 >= str.size()))
+        return 0;
+
+    if (((str[i + 1] == 'w') || (str[i + 1] == 'W')) &&
+            ((str[i + 2] == 'd') || (str[i + 2] == 'D')) &&
+            (str[i + 3] == ':'))
+        return 4;
+
+    return 0;
+}
+
+
+/*
+ * Constructor.
+ */
+CThreader::CThreader()
+{
+    m_indent = " ";
+    m_root   = "`";
+    m_sign   = "-> ";
+}
+
+
+/*
+ * Destructor.
+ */
+CThreader::~CThreader()
+{
+    clear();
+}
+
+
+/*
+ * Forget all the messages we've threaded.
+ */
+void CThreader::clear()
+{
+    m_messages.clear();
+    m_known.clear();
+    m_ids.clear();
+    m_parent.clear();
+    m_message.clear();
+    m_dates.clear();
+    m_mtimes.clear();
+    m_offset.clear();
+}
+
+
+/*
+ * Set the strings used to draw the indentation of threads.
+ */
+void CThreader::signs(std::string indent, std::string root, std::string sign)
+{
+    m_indent = indent;
+    m_root   = root;
+    m_sign   = sign;
+}
+
+
+/*
+ * Remove any "Re:" or "Fwd:" prefixes from the given subject.
+ *
+ * As with the Lua implementation these are removed wherever they appear,
+ * along with a single following space.
+ */
+std::string CThreader::normalize_subject(std::string subject)
+{
+    std::string result;
+    result.reserve(subject.size());
+
+    for (size_t i = 0; i < subject.size();)
+    {
+        size_t len = reply_prefix(subject, i);
+
+        if (len == 0)
+            len = forward_prefix(subject, i);
+
+        if (len == 0)
+        {
+            result += subject[i];
+            i++;
+            continue;
+        }
+
+        i += len;
+
+        if ((i < subject.size()) && isspace(subject[i]))
+            i++;
+    }
+
+    return result;
+}
+
+
+/*
+ * Is the given subject that of a reply?
+ */
+bool CThreader::is_reply(const std::string &subject)
+{
+    for (size_t i = 0; i < subject.size(); i++)
+    {
+        if (reply_prefix(subject, i) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Create a new container.
+ */
+uint32_t CThreader::new_container()
+{
+    m_parent.push_back(-1);
+    m_message.push_back(-1);
+    return (m_parent.size() - 1);
+}
+
+
+/*
+ * Return the container for the given message-id, creating it if required.
+ */
+uint32_t CThreader::container(const std::string &id)
+{
+    auto it = m_ids.find(id);
+
+    if (it != m_ids.end())
+        return (it->second);
+
+    uint32_t c = new_container();
+    m_ids[id] = c;
+    return c;
+}
+
+
+/*
+ * Is `ancestor` the given container, or one of its parents?
+ */
+bool CThreader::is_ancestor(uint32_t ancestor, uint32_t c)
+{
+    int32_t cur = c;
+
+    while (cur >= 0)
+    {
+        if ((uint32_t)cur == ancestor)
+            return true;
+
+        cur = m_parent[cur];
+    }
+
+    return false;
+}
+
+
+/*
+ * Link the given message into our containers - the first step of the
+ * algorithm.
+ */
+void CThreader::link(size_t msg)
+{
+    std::shared_ptr<CMessage> message = m_messages[msg];
+
+    std::vector<std::string> ids = message_ids(message->header("Message-ID"));
+
+    /*
+     * A message without an id can't be threaded, so it is a root.
+     */
+    if (ids.empty())
+    {
+        m_message[new_container()] = msg;
+        return;
+    }
+
+    uint32_t par = container(ids[0]);
+
+    /*
+     * If we've seen this id before then give the message a container of
+     * its own, rather than losing it.
+     */
+    if (m_message[par] >= 0)
+        par = new_container();
+
+    m_message[par] = msg;
+
+    /*
+     * The references are those in the `References` header, and the last
+     * id from `In-Reply-To` if that isn't already present.
+     */
+    std::vector<std::string> refs = message_ids(message->header("References"));
+    std::vector<std::string> reply_to = message_ids(message->header("In-Reply-To"));
+
+    if (!reply_to.empty() && (refs.empty() || (refs.back() != reply_to.back())))
+        refs.push_back(reply_to.back());
+
+    int32_t prev = -1;
+
+    for (const std::string &ref : refs)
+    {
+        uint32_t cur = container(ref);
+
+        /*
+         * Don't link if they're already linked, or we'd create a loop.
+         */
+        if ((prev >= 0) && (m_parent[cur] < 0) && !is_ancestor(cur, prev))
+            m_parent[cur] = prev;
+
+        prev = cur;
+    }
+
+    if ((prev >= 0) && !is_ancestor(par, prev))
+        m_parent[par] = prev;
+}
+
+
+/*
+ * Move a node to be the last child of another.
+ */
+void CThreader::add_child(std::vector<CThreadNode> &nodes, uint32_t parent, uint32_t child)
+{
+    int32_t old = nodes[child].parent;
+
+    if (old >= 0)
+    {
+        std::vector<uint32_t> &kids = nodes[old].children;
+        kids.erase(std::remove(kids.begin(), kids.end(), child), kids.end());
+    }
+
+    nodes[child].parent = parent;
+    nodes[parent].children.push_back(child);
+}
+
+
+/*
+ * Move all the children of one node to another.
+ */
+void CThreader::transfer_children(std::vector<CThreadNode> &nodes, uint32_t from, uint32_t to)
+{
+    for (uint32_t child : nodes[from].children)
+    {
+        nodes[child].parent = to;
+        nodes[to].children.push_back(child);
+    }
+
+    nodes[from].children.clear();
+}
+
+
+/*
+ * Remove empty containers from beneath the given node - the fourth step
+ * of the algorithm.
+ */
+void CThreader::prune(std::vector<CThreadNode> &nodes, uint32_t node, bool root, std::vector<uint32_t> &out)
+{
+    std::vector<uint32_t> kids;
+
+    for (uint32_t child : nodes[node].children)
+        prune(nodes, child, false, kids);
+
+    for (uint32_t child : kids)
+        nodes[child].parent = node;
+
+    nodes[node].children = kids;
+
+    if (nodes[node].message >= 0)
+    {
+        out.push_back(node);
+        return;
+    }
+
+    /*
+     * An empty container is dropped, and its children promoted, unless
+     * that would promote several children to the root-set.
+     */
+    if (!root || (kids.size() == 1))
+    {
+        for (uint32_t child : kids)
+            nodes[child].parent = -1;
+
+        out.insert(out.end(), kids.begin(), kids.end());
+        return;
+    }
+
+    if (!kids.empty())
+        out.push_back(node);
+}
+
+
+/*
+ * The subject of the given node, or its first child.
+ */
+std::string CThreader::subject(std::vector<CThreadNode> &nodes, uint32_t node)
+{
+    while ((nodes[node].message < 0) && !nodes[node].children.empty())
+        node = nodes[node].children[0];
+
+    if (nodes[node].message < 0)
+        return "";
+
+    return (m_messages[nodes[node].message]->header("Subject"));
+}
+
+
+/*
+ * The value used to sort the given message.
+ */
+int64_t CThreader::sort_key(size_t msg, const std::string &sort)
+{
+    std::vector<int64_t> &keys = (sort == "file") ? m_mtimes : m_dates;
+
+    if (keys.size() < m_messages.size())
+        keys.resize(m_messages.size(), -1);
+
+    if (keys[msg] >= 0)
+        return (keys[msg]);
+
+    std::shared_ptr<CMessage> message = m_messages[msg];
+    int64_t key = 0;
+
+    if (sort == "file")
+    {
+        key = message->get_mtime();
+    }
+    else
+    {
+        key = message->get_date();
+    }
+
+    keys[msg] = key;
+    return key;
+}
+
+
+/*
+ * The largest sort-key beneath the given node.
+ */
+int64_t CThreader::max_key(std::vector<CThreadNode> &nodes, uint32_t node, const std::string &sort)
+{
+    int64_t max = INT64_MIN;
+
+    if (nodes[node].message >= 0)
+        max = sort_key(nodes[node].message, sort);
+
+    for (uint32_t child : nodes[node].children)
+        max = std::max(max, max_key(nodes, child, sort));
+
+    return max;
+}
+
+
+/*
+ * Sort the children of the given node, recursively.
+ */
+void CThreader::sort_children(std::vector<CThreadNode> &nodes, uint32_t node, const std::string &sort)
+{
+    std::vector<uint32_t> &kids = nodes[node].children;
+
+    for (uint32_t child : kids)
+        sort_children(nodes, child, sort);
+
+    std::vector<std::pair<int64_t, uint32_t>> keyed;
+    keyed.reserve(kids.size());
+
+    for (uint32_t child : kids)
+    {
+        uint32_t first = child;
+
+        while ((nodes[first].message < 0) && !nodes[first].children.empty())
+            first = nodes[first].children[0];
+
+        int64_t key = (nodes[first].message >= 0) ? sort_key(nodes[first].message, sort) : 0;
+        keyed.push_back(std::make_pair(key, child));
+    }
+
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](const std::pair<int64_t, uint32_t> &a, const std::pair<int64_t, uint32_t> &b)
+    {
+        return (a.first < b.first);
+    });
+
+    for (size_t i = 0; i < kids.size(); i++)
+        kids[i] = keyed[i].second;
+}
+
+
+/*
+ * Append the messages beneath the given node to our result.
+ */
+void CThreader::walk(std::vector<CThreadNode> &nodes, uint32_t node, std::string prefix,
+                     std::vector<size_t> &result, std::vector<std::string> &indentation)
+{
+    if (nodes[node].message >= 0)
+    {
+        result.push_back(m_offset[nodes[node].message]);
+        indentation.push_back(prefix);
+
+        if (prefix.empty())
+            prefix = m_root + m_sign;
+
+        prefix = m_indent + prefix;
+    }
+    else
+    {
+        prefix = m_sign;
+    }
+
+    for (uint32_t child : nodes[node].children)
+        walk(nodes, child, prefix, result, indentation);
+}
+
+
+/*
+ * Thread the given messages.
+ */
+std::vector<size_t> CThreader::thread(CMessageList messages, std::string sort,
+                                      std::vector<std::string> &indentation,
+                                      std::vector<bool> &roots)
+{
+    /*
+     * If we've linked any message which isn't present then we must
+     * start again, otherwise we only need to link the new ones.
+     */
+    size_t known = 0;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (m_known.find(msg.get()) != m_known.end())
+            known++;
+    }
+
+    if (known != m_messages.size())
+        clear();
+
+    m_offset.assign(m_messages.size(), 0);
+
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        std::shared_ptr<CMessage> msg = messages[i];
+        auto it = m_known.find(msg.get());
+
+        if (it != m_known.end())
+        {
+            m_offset[it->second] = i;
+            continue;
+        }
+
+        size_t id = m_messages.size();
+        m_messages.push_back(msg);
+        m_known[msg.get()] = id;
+        m_offset.push_back(i);
+
+        link(id);
+    }
+
+    /*
+     * Build the tree of containers, from our links.
+     */
+    size_t count = m_parent.size();
+    std::vector<CThreadNode> nodes(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        nodes[i].message = m_message[i];
+        nodes[i].parent  = m_parent[i];
+
+        if (m_parent[i] >= 0)
+            nodes[m_parent[i]].children.push_back(i);
+    }
+
+    /*
+     * Find the root-set, and prune empty containers.
+     */
+    std::vector<uint32_t> root_set;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (m_parent[i] < 0)
+            prune(nodes, i, true, root_set);
+    }
+
+    /*
+     * Group the root-set by subject.
+     */
+    std::unordered_map<std::string, uint32_t> subjects;
+    std::vector<std::string> root_subject(root_set.size());
+
+    for (size_t i = 0; i < root_set.size(); i++)
+    {
+        uint32_t root = root_set[i];
+        root_subject[i] = normalize_subject(subject(nodes, root));
+
+        if (root_subject[i].empty())
+            continue;
+
+        auto it = subjects.find(root_subject[i]);
+
+        if ((it == subjects.end()) ||
+                ((nodes[it->second].message >= 0) && (nodes[root].message < 0)))
+            subjects[root_subject[i]] = root;
+    }
+
+    for (size_t i = 0; i < root_set.size(); i++)
+    {
+        uint32_t root = root_set[i];
+
+        if (root_subject[i].empty())
+            continue;
+
+        uint32_t target = subjects[root_subject[i]];
+
+        if (target == root)
+            continue;
+
+        bool root_empty   = (nodes[root].message < 0);
+        bool target_empty = (nodes[target].message < 0);
+
+        if (root_empty && target_empty)
+        {
+            transfer_children(nodes, root, target);
+        }
+        else if (target_empty)
+        {
+            add_child(nodes, target, root);
+        }
+        else if (root_empty)
+        {
+            add_child(nodes, root, target);
+            subjects[root_subject[i]] = root;
+        }
+        else
+        {
+            bool root_reply   = is_reply(subject(nodes, root));
+            bool target_reply = is_reply(subject(nodes, target));
+
+            if (root_reply && !target_reply)
+            {
+                add_child(nodes, target, root);
+            }
+            else if (!root_reply && target_reply)
+            {
+                add_child(nodes, root, target);
+                subjects[root_subject[i]] = root;
+            }
+            else
+            {
+                CThreadNode parent;
+                parent.message = -1;
+                parent.parent  = -1;
+                nodes.push_back(parent);
+
+                uint32_t p = nodes.size() - 1;
+                add_child(nodes, p, root);
+                add_child(nodes, p, target);
+                subjects[root_subject[i]] = p;
+            }
+        }
+    }
+
+    /*
+     * Unlike the original algorithm we replace an empty root with its
+     * oldest child, if that is not a reply, to get deterministic results.
+     */
+    for (auto it = subjects.begin(); it != subjects.end(); ++it)
+    {
+        uint32_t r = it->second;
+
+        if ((nodes[r].message >= 0) || nodes[r].children.empty())
+            continue;
+
+        uint32_t oldest = nodes[r].children[0];
+        int64_t oldest_key = INT64_MAX;
+
+        for (uint32_t child : nodes[r].children)
+        {
+            if (nodes[child].message < 0)
+                continue;
+
+            int64_t key = sort_key(nodes[child].message, "date");
+
+            if (key < oldest_key)
+            {
+                oldest     = child;
+                oldest_key = key;
+            }
+        }
+
+        if ((nodes[oldest].message < 0) || is_reply(subject(nodes, oldest)))
+            continue;
+
+        std::vector<uint32_t> &kids = nodes[r].children;
+        kids.erase(std::remove(kids.begin(), kids.end(), oldest), kids.end());
+        nodes[oldest].parent = -1;
+
+        transfer_children(nodes, r, oldest);
+        it->second = oldest;
+    }
+
+    /*
+     * The threads are those without a subject, and those we grouped by
+     * subject, in the order in which they were found.
+     */
+    std::vector<uint32_t> threads;
+    std::unordered_set<std::string> seen;
+
+    for (size_t i = 0; i < root_set.size(); i++)
+    {
+        if (root_subject[i].empty())
+            threads.push_back(root_set[i]);
+        else if (seen.insert(root_subject[i]).second)
+            threads.push_back(subjects[root_subject[i]]);
+    }
+
+    /*
+     * Sort the threads, if we should.
+     */
+    if ((sort == "date") || (sort == "file"))
+    {
+        std::vector<std::pair<int64_t, uint32_t>> keyed;
+
+        for (uint32_t t : threads)
+        {
+            sort_children(nodes, t, sort);
+            keyed.push_back(std::make_pair(max_key(nodes, t, sort), t));
+        }
+
+        std::stable_sort(keyed.begin(), keyed.end(),
+                         [](const std::pair<int64_t, uint32_t> &a, const std::pair<int64_t, uint32_t> &b)
+        {
+            return (a.first < b.first);
+        });
+
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i] = keyed[i].second;
+    }
+
+    /*
+     * Finally flatten the threads.
+     */
+    std::vector<size_t> result;
+    result.reserve(messages.size());
+    indentation.clear();
+    indentation.reserve(messages.size());
+    roots.clear();
+    roots.reserve(messages.size());
+
+    for (uint32_t t : threads)
+    {
+        size_t before = result.size();
+        walk(nodes, t, "", result, indentation);
+
+        for (size_t i = before; i < result.size(); i++)
+            roots.push_back(i == before);
+    }
+
+    return result;
+}
@@ -0,0 +1,215 @@
+/*
+ * threader.h - Thread messages, via the JWZ algorithm.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+#include "singleton.h"
+
+
+/**
+ * The CThreader class is a singleton which threads a list of messages,
+ * using the algorithm described by Jamie Zawinski, with the same change
+ * to the fifth step as `lib/threader.lua`.
+ *
+ * See https://www.jwz.org/doc/threading.html for details.
+ *
+ * Message-IDs are interned, and the links between messages are held in
+ * flat arrays of container-indexes.  These links are kept between calls,
+ * so if the list of messages we're given contains everything we threaded
+ * last time then only the new messages are linked.
+ */
+class CThreader : public Singleton<CThreader>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CThreader();
+
+    /**
+     * Destructor.
+     */
+    ~CThreader();
+
+public:
+
+    /**
+     * Thread the given messages.
+     *
+     * Returns the offsets of the messages, in thread-order.  For each
+     * entry in the result `indentation` holds the prefix to draw, and
+     * `roots` is true if the message starts a thread.
+     *
+     * `sort` may be "date" or "file", to sort each thread, and the threads
+     * themselves, by date or modification-time.  Otherwise the threads are
+     * left in the order in which they were found.
+     */
+    std::vector<size_t> thread(CMessageList messages, std::string sort,
+                               std::vector<std::string> &indentation,
+                               std::vector<bool> &roots);
+
+    /**
+     * Forget all the messages we've threaded.
+     */
+    void clear();
+
+    /**
+     * Set the strings used to draw the indentation of threads.
+     */
+    void signs(std::string indent, std::string root, std::string sign);
+
+    /**
+     * Remove any "Re:" or "Fwd:" prefixes from the given subject.
+     */
+    static std::string normalize_subject(std::string subject);
+
+    /**
+     * Is the given subject that of a reply?
+     */
+    static bool is_reply(const std::string &subject);
+
+private:
+
+    /**
+     * A node in the tree of threads we build for each call.
+     */
+    struct CThreadNode
+    {
+        int32_t message;
+        int32_t parent;
+        std::vector<uint32_t> children;
+    };
+
+    /**
+     * Return the container for the given message-id, creating it if
+     * required.
+     */
+    uint32_t container(const std::string &id);
+
+    /**
+     * Create a new container.
+     */
+    uint32_t new_container();
+
+    /**
+     * Is `ancestor` the given container, or one of its parents?
+     */
+    bool is_ancestor(uint32_t ancestor, uint32_t c);
+
+    /**
+     * Link the given message into our containers.
+     */
+    void link(size_t msg);
+
+    /**
+     * Remove empty containers from beneath the given node, appending
+     * the nodes which should replace it to `out`.
+     */
+    void prune(std::vector<CThreadNode> &nodes, uint32_t node, bool root, std::vector<uint32_t> &out);
+
+    /**
+     * Move a node to be the last child of another.
+     */
+    void add_child(std::vector<CThreadNode> &nodes, uint32_t parent, uint32_t child);
+
+    /**
+     * Move all the children of one node to another.
+     */
+    void transfer_children(std::vector<CThreadNode> &nodes, uint32_t from, uint32_t to);
+
+    /**
+     * The subject of the given node, or its first child.
+     */
+    std::string subject(std::vector<CThreadNode> &nodes, uint32_t node);
+
+    /**
+     * The value used to sort the given message.
+     */
+    int64_t sort_key(size_t msg, const std::string &sort);
+
+    /**
+     * The largest sort-key beneath the given node.
+     */
+    int64_t max_key(std::vector<CThreadNode> &nodes, uint32_t node, const std::string &sort);
+
+    /**
+     * Sort the children of the given node, recursively.
+     */
+    void sort_children(std::vector<CThreadNode> &nodes, uint32_t node, const std::string &sort);
+
+    /**
+     * Append the messages beneath the given node to our result.
+     */
+    void walk(std::vector<CThreadNode> &nodes, uint32_t node, std::string prefix,
+              std::vector<size_t> &result, std::vector<std::string> &indentation);
+
+private:
+
+    /**
+     * The messages we've linked.
+     */
+    CMessageList m_messages;
+
+    /**
+     * The offset of each message within `m_messages`.
+     */
+    std::unordered_map<CMessage *, size_t> m_known;
+
+    /**
+     * Interned message-ids, mapped to their container.
+     */
+    std::unordered_map<std::string, uint32_t> m_ids;
+
+    /**
+     * The parent of each container, or -1.
+     */
+    std::vector<int32_t> m_parent;
+
+    /**
+     * The message in each container, as an offset in `m_messages`, or -1.
+     */
+    std::vector<int32_t> m_message;
+
+    /**
+     * Cached dates, and modification-times, per message, or -1.
+     */
+    std::vector<int64_t> m_dates;
+    std::vector<int64_t> m_mtimes;
+
+    /**
+     * The offset of each of our messages in the list we were given.
+     */
+    std::vector<size_t> m_offset;
+
+    /**
+     * The strings used to draw indentation.
+     */
+    std::string m_indent;
+    std::string m_root;
+    std::string m_sign;
+};
@@ -0,0 +1,139 @@
+/*
+ * threader_test.cc - Test-cases for our CThreader class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "message.h"
+#include "test_support.h"
+#include "threader.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that subjects are normalized.
+ */
+void TestThreaderSubjects(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "Hello", CThreader::normalize_subject("Re: Hello").c_str());
+    CuAssertStrEquals(tc, "Hello", CThreader::normalize_subject("RE: Fwd: Hello").c_str());
+    CuAssertStrEquals(tc, "Hello", CThreader::normalize_subject("Re[2]: Hello").c_str());
+    CuAssertStrEquals(tc, "Rest", CThreader::normalize_subject("Rest").c_str());
+
+    CuAssertTrue(tc, CThreader::is_reply("Re: Hello"));
+    CuAssertTrue(tc, CThreader::is_reply("Fwd: Re[3]: Hello"));
+    CuAssertTrue(tc, !CThreader::is_reply("Fwd: Hello"));
+}
+
+
+/**
+ * Test that replies are threaded beneath their parents.
+ */
+void TestThreaderReferences(CuTest * tc)
+{
+    CMessageList messages;
+    messages.push_back(make_message("/tmp/lumail.threader/cur/3.host", {{"message-id", "<c>"}, {"subject", "Re: One"}, {"references", "<a> <b>"}}));
+    messages.push_back(make_message("/tmp/lumail.threader/cur/1.host", {{"message-id", "<a>"}, {"subject", "One"}}));
+    messages.push_back(make_message("/tmp/lumail.threader/cur/4.host", {{"message-id", "<d>"}, {"subject", "Two"}}));
+    messages.push_back(make_message("/tmp/lumail.threader/cur/2.host", {{"message-id", "<b>"}, {"subject", "Re: One"}, {"references", "<a>"}}));
+
+    CThreader threader;
+    std::vector<std::string> indentation;
+    std::vector<bool> roots;
+
+    std::vector<size_t> order = threader.thread(messages, "date", indentation, roots);
+
+    CuAssertIntEquals(tc, 4, order.size());
+    CuAssertIntEquals(tc, 1, order[0]);
+    CuAssertIntEquals(tc, 3, order[1]);
+    CuAssertIntEquals(tc, 0, order[2]);
+    CuAssertIntEquals(tc, 2, order[3]);
+
+    CuAssertStrEquals(tc, "", indentation[0].c_str());
+    CuAssertStrEquals(tc, " `-> ", indentation[1].c_str());
+    CuAssertStrEquals(tc, "  `-> ", indentation[2].c_str());
+    CuAssertStrEquals(tc, "", indentation[3].c_str());
+
+    CuAssertTrue(tc, roots[0]);
+    CuAssertTrue(tc, !roots[1]);
+    CuAssertTrue(tc, !roots[2]);
+    CuAssertTrue(tc, roots[3]);
+
+    /*
+     * A new reply, to the second thread, is linked incrementally and
+     * moves that thread to the end.
+     */
+    messages.push_back(make_message("/tmp/lumail.threader/cur/5.host", {{"message-id", "<e>"}, {"subject", "Re: Two"}, {"references", "<d>"}}));
+    messages.push_back(make_message("/tmp/lumail.threader/cur/0.host", {{"subject", "No id"}}));
+
+    order = threader.thread(messages, "date", indentation, roots);
+
+    CuAssertIntEquals(tc, 6, order.size());
+    CuAssertIntEquals(tc, 5, order[0]);
+    CuAssertIntEquals(tc, 1, order[1]);
+    CuAssertIntEquals(tc, 2, order[4]);
+    CuAssertIntEquals(tc, 4, order[5]);
+    CuAssertStrEquals(tc, " `-> ", indentation[5].c_str());
+
+    /*
+     * Removing a message means we start again.
+     */
+    messages.erase(messages.begin() + 3);
+
+    order = threader.thread(messages, "", indentation, roots);
+
+    CuAssertIntEquals(tc, 5, order.size());
+    CuAssertIntEquals(tc, 1, order[0]);
+    CuAssertIntEquals(tc, 0, order[1]);
+    CuAssertStrEquals(tc, " `-> ", indentation[1].c_str());
+}
+
+
+/**
+ * Test that messages without references are grouped by subject.
+ */
+void TestThreaderSubjectGrouping(CuTest * tc)
+{
+    CMessageList messages;
+    messages.push_back(make_message("/tmp/lumail.threader/cur/1.host", {{"message-id", "<a>"}, {"subject", "Hello"}}));
+    messages.push_back(make_message("/tmp/lumail.threader/cur/2.host", {{"message-id", "<b>"}, {"subject", "Other"}}));
+    messages.push_back(make_message("/tmp/lumail.threader/cur/3.host", {{"message-id", "<c>"}, {"subject", "Re: Hello"}}));
+
+    CThreader threader;
+    std::vector<std::string> indentation;
+    std::vector<bool> roots;
+
+    std::vector<size_t> order = threader.thread(messages, "", indentation, roots);
+
+    CuAssertIntEquals(tc, 3, order.size());
+    CuAssertIntEquals(tc, 0, order[0]);
+    CuAssertIntEquals(tc, 2, order[1]);
+    CuAssertIntEquals(tc, 1, order[2]);
+    CuAssertStrEquals(tc, " `-> ", indentation[1].c_str());
+}
+
+
+CuSuite *
+threader_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestThreaderSubjects);
+    SUITE_ADD_TEST(suite, TestThreaderReferences);
+    SUITE_ADD_TEST(suite, TestThreaderSubjectGrouping);
+    return suite;
+}
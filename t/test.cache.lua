@@ -28,6 +28,8 @@ function TestCache:test_functions ()
   luaunit.assertIsFunction(Cache.get)
   luaunit.assertIsFunction(Cache.set)
   luaunit.assertIsFunction(Cache.empty)
+  luaunit.assertIsFunction(Cache.limit)
+  luaunit.assertIsFunction(Cache.stats)
 end
 
 
@@ -124,6 +126,86 @@ function TestCache:test_cache_empty ()
   os.remove(tmp)
 end
 
+--
+-- Values set after loading should be appended, and older text-based
+-- caches should still be read.
+--
+function TestCache:test_append_import ()
+
+  --
+  -- Create a temporary file-name, holding a text-based cache.
+  --
+  local tmp = os.tmpname()
+  local file = assert(io.open(tmp, "w"))
+  file:write(os.time() .. " old text\n")
+  file:close()
+
+  --
+  -- Load it, and save it in the new format.
+  --
+  local c = Cache.new()
+  c:load(tmp)
+  luaunit.assertEquals(c:get "old", "text")
+  c:save(tmp)
+
+  --
+  -- Reload, update a value, add another, and save again.
+  --
+  c = Cache.new()
+  c:load(tmp)
+  luaunit.assertEquals(c:get "old", "text")
+  c:set("old", "updated")
+  c:set("new", "value")
+  c:save(tmp)
+
+  --
+  -- A fresh object should see both.
+  --
+  local n = Cache.new()
+  n:load(tmp)
+  luaunit.assertEquals(n:get "old", "updated")
+  luaunit.assertEquals(n:get "new", "value")
+
+  --
+  -- All done
+  --
+  os.remove(tmp)
+end
+
+
+--
+-- A limited cache should evict values, and count that.
+--
+function TestCache:test_limit ()
+
+  local c = Cache.new(1024)
+  luaunit.assertEquals(c:limit(), 1024)
+
+  for i = 1, 100 do
+    c:set("key" .. i, string.rep("x", 100))
+  end
+
+  local stats = c:stats()
+  luaunit.assertTrue(stats['bytes'] <= 1024)
+  luaunit.assertTrue(stats['evictions'] > 0)
+
+  --
+  -- The newest value should remain, the oldest is gone.
+  --
+  luaunit.assertEquals(c:get "key100", string.rep("x", 100))
+  luaunit.assertEquals(c:get "key1", nil)
+
+  stats = c:stats()
+  luaunit.assertEquals(stats['hits'], 1)
+  luaunit.assertEquals(stats['misses'], 1)
+
+  --
+  -- Removing the limit should be possible.
+  --
+  luaunit.assertEquals(c:limit(0), 0)
+end
+
+
 --
 -- Run the tests
 --